@@ -0,0 +1,28 @@
+#include "arena.h"
+
+#include "ast.h"
+
+namespace NKaleidoscope::NAst {
+
+// TNodeDeleter
+void TNodeDeleter::operator()(const TNode* node) const {
+    if (Owning) {
+        delete node;
+    }
+}
+
+// TArena
+TArena::TArena(std::size_t initialSize)
+    : Resource_{initialSize}
+    , NodeCount_{0}
+{}
+
+std::pmr::memory_resource* TArena::GetResource() {
+    return &Resource_;
+}
+
+std::size_t TArena::GetNodeCount() const {
+    return NodeCount_;
+}
+
+} // namespace NKaleidoscope::NAst
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+
+#include "noncopyable.h"
+
+namespace NKaleidoscope::NAst {
+
+class TNode;
+
+// deletes heap nodes and does nothing for nodes owned by an arena
+struct TNodeDeleter {
+    bool Owning = true;
+
+    TNodeDeleter() = default;
+    explicit TNodeDeleter(bool owning) : Owning{owning} {}
+
+    // lets std::unique_ptr<T> be converted to TNodePtr
+    template <class T>
+    TNodeDeleter(std::default_delete<T>) {}
+
+    void operator()(const TNode* node) const;
+};
+
+template <class T>
+using TNodePtr = std::unique_ptr<T, TNodeDeleter>;
+
+// Bump-pointer memory for the nodes of a parse. The nodes are never destroyed
+// one by one: all memory is released at once by the arena's destructor, so
+// arena nodes should only reference other arena nodes or no heap memory at all.
+class TArena : private TNonCopyable {
+public:
+    explicit TArena(std::size_t initialSize = DEFAULT_INITIAL_SIZE);
+
+    template <class T, class... TArgs>
+    TNodePtr<T> Make(TArgs&&... args) {
+        void* memory = Resource_.allocate(sizeof(T), alignof(T));
+        ++NodeCount_;
+        return TNodePtr<T>{new (memory) T(std::forward<TArgs>(args)...), TNodeDeleter{/* owning = */ false}};
+    }
+
+    // for containers inside the nodes
+    std::pmr::memory_resource* GetResource();
+
+    std::size_t GetNodeCount() const;
+
+    static constexpr std::size_t DEFAULT_INITIAL_SIZE = 1 << 16;
+
+private:
+    std::pmr::monotonic_buffer_resource Resource_;
+    std::size_t NodeCount_;
+};
+
+// allocates a node in the arena, or on the heap if there is no arena
+template <class T, class... TArgs>
+TNodePtr<T> MakeNode(TArena* arena, TArgs&&... args) {
+    if (arena) {
+        return arena->Make<T>(std::forward<TArgs>(args)...);
+    }
+    return TNodePtr<T>{new T(std::forward<TArgs>(args)...)};
+}
+
+// memory for containers inside the nodes
+inline std::pmr::memory_resource* GetResource(TArena* arena) {
+    return arena ? arena->GetResource() : std::pmr::get_default_resource();
+}
+
+} // namespace NKaleidoscope::NAst
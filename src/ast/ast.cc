@@ -1,10 +1,14 @@
 #include "ast.h"
 
+#include <stdexcept>
+#include <utility>
+
 namespace NKaleidoscope::NAst {
 
 // TNumberExpr
 TNumberExpr::TNumberExpr(double value)
-    : Value_{value}
+    : TExpr{KIND}
+    , Value_{value}
 {}
 
 double TNumberExpr::GetValue() const {
@@ -12,17 +16,25 @@ double TNumberExpr::GetValue() const {
 }
 
 // TVariableExpr
-TVariableExpr::TVariableExpr(TSourceRange name)
-    : Name_{name}
+TVariableExpr::TVariableExpr(TSourceRange name, TSymbolId symbol)
+    : TExpr{KIND}
+    , Name_{name}
+    , Symbol_{symbol}
 {}
 
 const TSourceRange& TVariableExpr::GetName() const {
     return Name_;
 }
 
+TSymbolId TVariableExpr::GetSymbol() const {
+    return Symbol_;
+}
+
 // TBinaryExpr
-TBinaryExpr::TBinaryExpr(EOp op, std::unique_ptr<TExpr> lhs, std::unique_ptr<TExpr> rhs)
-    : Op_{op}
+TBinaryExpr::TBinaryExpr(EOp op, TNodePtr<TExpr> lhs, TNodePtr<TExpr> rhs, char userOp)
+    : TExpr{KIND}
+    , Op_{op}
+    , UserOp_{userOp}
     , Lhs_{std::move(lhs)}
     , Rhs_{std::move(rhs)}
 {}
@@ -31,6 +43,10 @@ TBinaryExpr::EOp TBinaryExpr::GetOp() const {
     return Op_;
 }
 
+char TBinaryExpr::GetUserOp() const {
+    return UserOp_;
+}
+
 const TExpr& TBinaryExpr::GetLhs() const {
     return *Lhs_;
 }
@@ -40,10 +56,11 @@ const TExpr& TBinaryExpr::GetRhs() const {
 }
 
 // TIfExpr
-TIfExpr::TIfExpr(std::unique_ptr<TExpr> condExpr,
-                 std::unique_ptr<TExpr> thenExpr,
-                 std::unique_ptr<TExpr> elseExpr)
-    : Cond_{std::move(condExpr)}
+TIfExpr::TIfExpr(TNodePtr<TExpr> condExpr,
+                 TNodePtr<TExpr> thenExpr,
+                 TNodePtr<TExpr> elseExpr)
+    : TExpr{KIND}
+    , Cond_{std::move(condExpr)}
     , Then_{std::move(thenExpr)}
     , Else_{std::move(elseExpr)}
 {}
@@ -61,36 +78,81 @@ const TExpr& TIfExpr::GetElse() const {
 }
 
 // TCallExpr
-TCallExpr::TCallExpr(TSourceRange callee, std::vector<std::unique_ptr<TExpr>> args)
-    : Callee_{callee}
+TCallExpr::TCallExpr(TSourceRange callee, std::pmr::vector<TNodePtr<TExpr>> args,
+                     TSymbolId calleeSymbol)
+    : TExpr{KIND}
+    , Callee_{callee}
+    , CalleeSymbol_{calleeSymbol}
     , Args_{std::move(args)}
 {}
 
+TCallExpr::TCallExpr(TSourceRange callee, std::vector<std::unique_ptr<TExpr>> args)
+    : TExpr{KIND}
+    , Callee_{callee}
+    , CalleeSymbol_{INVALID_SYMBOL}
+{
+    Args_.reserve(args.size());
+    for (auto& arg : args) {
+        Args_.emplace_back(std::move(arg));
+    }
+}
+
 const TSourceRange& TCallExpr::GetCallee() const {
     return Callee_;
 }
 
-const std::vector<std::unique_ptr<TExpr>>& TCallExpr::GetArgs() const {
+TSymbolId TCallExpr::GetCalleeSymbol() const {
+    return CalleeSymbol_;
+}
+
+const std::pmr::vector<TNodePtr<TExpr>>& TCallExpr::GetArgs() const {
     return Args_;
 }
 
 // TPrototype
-TPrototype::TPrototype(TSourceRange name, std::vector<TSourceRange> args)
-    : Name_{name}
+TPrototype::TPrototype(TSourceRange name, std::pmr::vector<TSourceRange> args, TSymbolId symbol,
+                       std::pmr::vector<TSymbolId> argSymbols)
+    : TNode{KIND}
+    , Name_{name}
+    , Symbol_{symbol}
     , Args_{std::move(args)}
+    , ArgSymbols_{std::move(argSymbols), Args_.get_allocator()}
+{
+    if (ArgSymbols_.empty()) {
+        ArgSymbols_.resize(Args_.size(), INVALID_SYMBOL);
+    } else if (ArgSymbols_.size() != Args_.size()) {
+        throw std::runtime_error("Expected an id for every argument of a prototype");
+    }
+}
+
+TPrototype::TPrototype(TSourceRange name, const std::vector<TSourceRange>& args)
+    : TNode{KIND}
+    , Name_{name}
+    , Symbol_{INVALID_SYMBOL}
+    , Args_{args.begin(), args.end()}
+    , ArgSymbols_(args.size(), INVALID_SYMBOL)
 {}
 
 const TSourceRange& TPrototype::GetName() const {
     return Name_;
 }
 
-const std::vector<TSourceRange>& TPrototype::GetArgs() const {
+TSymbolId TPrototype::GetSymbol() const {
+    return Symbol_;
+}
+
+const std::pmr::vector<TSourceRange>& TPrototype::GetArgs() const {
     return Args_;
 }
 
+const std::pmr::vector<TSymbolId>& TPrototype::GetArgSymbols() const {
+    return ArgSymbols_;
+}
+
 // TFunction
-TFunction::TFunction(std::unique_ptr<TPrototype> prototype, std::unique_ptr<TExpr> body)
-    : Prototype_{std::move(prototype)}
+TFunction::TFunction(TNodePtr<TPrototype> prototype, TNodePtr<TExpr> body)
+    : TNode{KIND}
+    , Prototype_{std::move(prototype)}
     , Body_{std::move(body)}
 {}
 
@@ -102,4 +164,45 @@ const TExpr& TFunction::GetBody() const {
     return *Body_;
 }
 
+std::size_t GetChildCount(const TNode& node) {
+    switch (node.GetKind()) {
+    case ENodeKind::Binary:
+        return 2;
+    case ENodeKind::If:
+        return 3;
+    case ENodeKind::Call:
+        return static_cast<const TCallExpr&>(node).GetArgs().size();
+    case ENodeKind::Function:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+const TNode& GetChild(const TNode& node, std::size_t index) {
+    switch (node.GetKind()) {
+    case ENodeKind::Binary: {
+        const auto& binaryExpr = static_cast<const TBinaryExpr&>(node);
+        return index == 0 ? binaryExpr.GetLhs() : binaryExpr.GetRhs();
+    }
+    case ENodeKind::If: {
+        const auto& ifExpr = static_cast<const TIfExpr&>(node);
+        return index == 0 ? ifExpr.GetCond() : index == 1 ? ifExpr.GetThen() : ifExpr.GetElse();
+    }
+    case ENodeKind::Call:
+        return *static_cast<const TCallExpr&>(node).GetArgs()[index];
+    case ENodeKind::Function: {
+        const auto& function = static_cast<const TFunction&>(node);
+        return index == 0 ? static_cast<const TNode&>(function.GetPrototype()) : function.GetBody();
+    }
+    default:
+        throw std::out_of_range("The node has no children");
+    }
+}
+
+TNode& GetChild(TNode& node, std::size_t index) {
+    // a node owns its children, so they are as mutable as the node itself
+    return const_cast<TNode&>(GetChild(std::as_const(node), index));
+}
+
 } // namespace NKaleidoscope::NAst
@@ -1,12 +1,28 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <memory_resource>
+#include <type_traits>
 #include <vector>
 
+#include "arena.h"
 #include "source.h"
+#include "symbol.h"
 
 namespace NKaleidoscope::NAst {
 
+// kinds of all nodes
+enum struct ENodeKind : std::uint8_t {
+    Number,
+    Variable,
+    Binary,
+    If,
+    Call,
+    Prototype,
+    Function,
+};
+
 // forward declarations for visitor pattern
 class TNumberExpr;
 class TVariableExpr;
@@ -16,6 +32,11 @@ class TCallExpr;
 class TPrototype;
 class TFunction;
 
+// rewrite the nodes in place, see simplify.h, bind_symbols.h and shift_ranges.h
+class TSimplifier;
+class TSymbolBinder;
+class TSourceRangeShifter;
+
 class IVisitor {
 public:
     virtual ~IVisitor() = default;
@@ -28,19 +49,30 @@ public:
     virtual void Visit(const TFunction&) = 0;
 };
 
-// base class for all nodes
+// base class for all nodes, the kind tag allows the static dispatch of Visit
 class TNode {
 public:
+    explicit TNode(ENodeKind kind) : Kind_{kind} {}
     virtual ~TNode() = default;
     virtual void Accept(IVisitor& v) const = 0;
+
+    ENodeKind GetKind() const { return Kind_; }
+
+private:
+    ENodeKind Kind_;
 };
 
 // base class for all expression nodes
-class TExpr : public TNode {};
+class TExpr : public TNode {
+public:
+    using TNode::TNode;
+};
 
 // numeric literals like "1.0"
 class TNumberExpr : public TExpr {
 public:
+    static constexpr ENodeKind KIND = ENodeKind::Number;
+
     TNumberExpr(double value);
     double GetValue() const;
 
@@ -53,45 +85,63 @@ private:
 // referencing a variable like "a"
 class TVariableExpr : public TExpr {
 public:
-    TVariableExpr(TSourceRange name);
+    static constexpr ENodeKind KIND = ENodeKind::Variable;
+
+    TVariableExpr(TSourceRange name, TSymbolId symbol = INVALID_SYMBOL);
     const TSourceRange& GetName() const;
+    TSymbolId GetSymbol() const;
 
     void Accept(IVisitor& v) const override { v.Visit(*this); }
 
 private:
+    friend class TSymbolBinder;
+    friend class TSourceRangeShifter;
+
     TSourceRange Name_;
+    TSymbolId Symbol_;
 };
 
 // a binary operator
 class TBinaryExpr : public TExpr {
 public:
-    enum struct EOp {
+    enum struct EOp : std::uint8_t {
         Less,
         Plus,
         Minus,
         Multiply,
+        // a call of the function "binary<c>" defined by the user
+        User,
     };
 
 public:
-    TBinaryExpr(EOp op, std::unique_ptr<TExpr> lhs, std::unique_ptr<TExpr> rhs);
+    static constexpr ENodeKind KIND = ENodeKind::Binary;
+
+    // the user operator's character is given only for EOp::User
+    TBinaryExpr(EOp op, TNodePtr<TExpr> lhs, TNodePtr<TExpr> rhs, char userOp = 0);
     EOp GetOp() const;
+    char GetUserOp() const;
     const TExpr& GetLhs() const;
     const TExpr& GetRhs() const;
 
     void Accept(IVisitor& v) const override { v.Visit(*this); }
 
 private:
+    friend class TSimplifier;
+
     EOp Op_;
-    std::unique_ptr<TExpr> Lhs_;
-    std::unique_ptr<TExpr> Rhs_;
+    char UserOp_;
+    TNodePtr<TExpr> Lhs_;
+    TNodePtr<TExpr> Rhs_;
 };
 
 // if-then-else expression
 class TIfExpr : public TExpr {
 public:
-    TIfExpr(std::unique_ptr<TExpr> condExpr,
-            std::unique_ptr<TExpr> thenExpr,
-            std::unique_ptr<TExpr> elseExpr);
+    static constexpr ENodeKind KIND = ENodeKind::If;
+
+    TIfExpr(TNodePtr<TExpr> condExpr,
+            TNodePtr<TExpr> thenExpr,
+            TNodePtr<TExpr> elseExpr);
     const TExpr& GetCond() const;
     const TExpr& GetThen() const;
     const TExpr& GetElse() const;
@@ -99,51 +149,131 @@ public:
     void Accept(IVisitor& v) const override { v.Visit(*this); }
 
 private:
-    std::unique_ptr<TExpr> Cond_;
-    std::unique_ptr<TExpr> Then_;
-    std::unique_ptr<TExpr> Else_;
+    friend class TSimplifier;
+
+    TNodePtr<TExpr> Cond_;
+    TNodePtr<TExpr> Then_;
+    TNodePtr<TExpr> Else_;
 };
 
 // function call
 class TCallExpr : public TExpr {
 public:
+    static constexpr ENodeKind KIND = ENodeKind::Call;
+
+    TCallExpr(TSourceRange callee, std::pmr::vector<TNodePtr<TExpr>> args,
+              TSymbolId calleeSymbol = INVALID_SYMBOL);
     TCallExpr(TSourceRange callee, std::vector<std::unique_ptr<TExpr>> args);
     const TSourceRange& GetCallee() const;
-    const std::vector<std::unique_ptr<TExpr>>& GetArgs() const;
+    TSymbolId GetCalleeSymbol() const;
+    const std::pmr::vector<TNodePtr<TExpr>>& GetArgs() const;
 
     void Accept(IVisitor& v) const override { v.Visit(*this); }
 
 private:
+    friend class TSimplifier;
+    friend class TSymbolBinder;
+    friend class TSourceRangeShifter;
+
     TSourceRange Callee_;
-    std::vector<std::unique_ptr<TExpr>> Args_;
+    TSymbolId CalleeSymbol_;
+    std::pmr::vector<TNodePtr<TExpr>> Args_;
 };
 
 // "prototype" of a function (declaration)
 class TPrototype : public TNode {
 public:
-    TPrototype(TSourceRange name, std::vector<TSourceRange> args);
+    static constexpr ENodeKind KIND = ENodeKind::Prototype;
+
+    // without argSymbols the ids of the args are INVALID_SYMBOL
+    TPrototype(TSourceRange name, std::pmr::vector<TSourceRange> args,
+               TSymbolId symbol = INVALID_SYMBOL, std::pmr::vector<TSymbolId> argSymbols = {});
+    TPrototype(TSourceRange name, const std::vector<TSourceRange>& args);
     const TSourceRange& GetName() const;
-    const std::vector<TSourceRange>& GetArgs() const;
+    TSymbolId GetSymbol() const;
+    const std::pmr::vector<TSourceRange>& GetArgs() const;
+    const std::pmr::vector<TSymbolId>& GetArgSymbols() const;
 
     void Accept(IVisitor& v) const override { v.Visit(*this); }
 
 private:
+    friend class TSymbolBinder;
+    friend class TSourceRangeShifter;
+
     TSourceRange Name_;
-    std::vector<TSourceRange> Args_;
+    TSymbolId Symbol_;
+    std::pmr::vector<TSourceRange> Args_;
+    std::pmr::vector<TSymbolId> ArgSymbols_;
 };
 
 // a function definition (at the same time it is a prototype)
 class TFunction : public TNode {
 public:
-    TFunction(std::unique_ptr<TPrototype> prototype, std::unique_ptr<TExpr> body);
+    static constexpr ENodeKind KIND = ENodeKind::Function;
+
+    TFunction(TNodePtr<TPrototype> prototype, TNodePtr<TExpr> body);
     const TPrototype& GetPrototype() const;
     const TExpr& GetBody() const;
 
     void Accept(IVisitor& v) const override { v.Visit(*this); }
 
 private:
-    std::unique_ptr<TPrototype> Prototype_;
-    std::unique_ptr<TExpr> Body_;
+    friend class TSimplifier;
+
+    TNodePtr<TPrototype> Prototype_;
+    TNodePtr<TExpr> Body_;
 };
 
+constexpr bool IsExprKind(ENodeKind kind) {
+    return kind != ENodeKind::Prototype && kind != ENodeKind::Function;
+}
+
+// a cheap dynamic_cast by the kind tag, returns nullptr if the node isn't a T
+template <class T, class TBase>
+    requires std::is_base_of_v<TNode, T> && std::is_base_of_v<TNode, std::remove_const_t<TBase>>
+auto* NodeCast(TBase* node) {
+    using TResult = std::conditional_t<std::is_const_v<TBase>, const T, T>;
+    bool matches;
+    if constexpr (std::is_same_v<T, TNode>) {
+        matches = true;
+    } else if constexpr (std::is_same_v<T, TExpr>) {
+        matches = node && IsExprKind(node->GetKind());
+    } else {
+        matches = node && node->GetKind() == T::KIND;
+    }
+    return matches ? static_cast<TResult*>(node) : nullptr;
+}
+
+// Calls `visitor` with the node cast to its concrete class. Unlike Accept, the
+// call is resolved at compile time, so a generic lambda or an overloaded
+// functor is inlined into the traversal.
+template <class TVisitor>
+decltype(auto) Visit(const TNode& node, TVisitor&& visitor) {
+    switch (node.GetKind()) {
+    case ENodeKind::Number:
+        return visitor(static_cast<const TNumberExpr&>(node));
+    case ENodeKind::Variable:
+        return visitor(static_cast<const TVariableExpr&>(node));
+    case ENodeKind::Binary:
+        return visitor(static_cast<const TBinaryExpr&>(node));
+    case ENodeKind::If:
+        return visitor(static_cast<const TIfExpr&>(node));
+    case ENodeKind::Call:
+        return visitor(static_cast<const TCallExpr&>(node));
+    case ENodeKind::Prototype:
+        return visitor(static_cast<const TPrototype&>(node));
+    case ENodeKind::Function:
+        return visitor(static_cast<const TFunction&>(node));
+    }
+    __builtin_unreachable();
+}
+
+// The children of a node in the evaluation order: the operands, the branches,
+// the args, the prototype and the body. Walks over deep trees use these with
+// an explicit stack instead of recursion.
+std::size_t GetChildCount(const TNode& node);
+const TNode& GetChild(const TNode& node, std::size_t index);
+// for the passes that rewrite a tree in place, see bind_symbols.h and shift_ranges.h
+TNode& GetChild(TNode& node, std::size_t index);
+
 } // namespace NKaleidoscope::NAst
@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+#include "ast.h"
+
+#include <type_traits>
+
+using namespace NKaleidoscope;
+using namespace NKaleidoscope::NAst;
+
+namespace {
+
+// a chain of "1 + (1 + (...))" or a balanced tree of the given depth
+TNodePtr<TExpr> MakeTree(TArena& arena, int depth, bool balanced) {
+    if (depth == 0) {
+        return arena.Make<TNumberExpr>(1.0);
+    }
+    auto lhs = balanced ? MakeTree(arena, depth - 1, balanced) : arena.Make<TNumberExpr>(1.0);
+    auto rhs = MakeTree(arena, depth - 1, balanced);
+    return arena.Make<TBinaryExpr>(TBinaryExpr::EOp::Plus, std::move(lhs), std::move(rhs));
+}
+
+class TSumVisitor : public IVisitor {
+public:
+    void Visit(const TNumberExpr& numberExpr) override { Sum_ += numberExpr.GetValue(); }
+    void Visit(const TVariableExpr&) override {}
+    void Visit(const TBinaryExpr& binaryExpr) override {
+        binaryExpr.GetLhs().Accept(*this);
+        binaryExpr.GetRhs().Accept(*this);
+    }
+    void Visit(const TIfExpr&) override {}
+    void Visit(const TCallExpr&) override {}
+    void Visit(const TPrototype&) override {}
+    void Visit(const TFunction&) override {}
+
+    double GetSum() const { return Sum_; }
+
+private:
+    double Sum_ = 0;
+};
+
+double StaticSum(const TNode& node) {
+    return Visit(node, [](const auto& concrete) -> double {
+        using T = std::decay_t<decltype(concrete)>;
+        if constexpr (std::is_same_v<T, TNumberExpr>) {
+            return concrete.GetValue();
+        } else if constexpr (std::is_same_v<T, TBinaryExpr>) {
+            return StaticSum(concrete.GetLhs()) + StaticSum(concrete.GetRhs());
+        } else {
+            return 0;
+        }
+    });
+}
+
+void SetItems(benchmark::State& state, const TNode& tree) {
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(StaticSum(tree) * 2 - 1));
+}
+
+void BM_VirtualVisit(benchmark::State& state) {
+    TArena arena;
+    const auto tree = MakeTree(arena, state.range(0), state.range(1));
+    for (auto _ : state) {
+        TSumVisitor visitor;
+        tree->Accept(visitor);
+        benchmark::DoNotOptimize(visitor.GetSum());
+    }
+    SetItems(state, *tree);
+}
+BENCHMARK(BM_VirtualVisit)->ArgNames({"depth", "balanced"})->Args({10000, 0})->Args({18, 1});
+
+void BM_StaticVisit(benchmark::State& state) {
+    TArena arena;
+    const auto tree = MakeTree(arena, state.range(0), state.range(1));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(StaticSum(*tree));
+    }
+    SetItems(state, *tree);
+}
+BENCHMARK(BM_StaticVisit)->ArgNames({"depth", "balanced"})->Args({10000, 0})->Args({18, 1});
+
+} // namespace
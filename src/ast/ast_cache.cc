@@ -0,0 +1,352 @@
+#include "ast_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <unistd.h>
+
+namespace NKaleidoscope::NAst {
+
+namespace {
+
+constexpr std::size_t SECTION_ALIGNMENT = 8;
+
+std::uint64_t AlignUp(std::uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+bool IsExpr(ENodeKind kind) {
+    using enum ENodeKind;
+    return kind == Number || kind == Variable || kind == Binary || kind == If || kind == Call;
+}
+
+// lays out the sections one after another
+class TSectionWriter {
+public:
+    TSectionWriter()
+        : Size_{AlignUp(sizeof(TAstCacheHeader))}
+    {}
+
+    template <class T>
+    TAstCacheSection Add(std::span<const T> items) {
+        const TAstCacheSection section{.Offset = Size_, .Count = items.size()};
+        Size_ = AlignUp(Size_ + items.size_bytes());
+        Data_.push_back(std::as_bytes(items));
+        return section;
+    }
+
+    void Write(std::ostream& output, const TAstCacheHeader& header) const {
+        static constexpr char PADDING[SECTION_ALIGNMENT] = {};
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::uint64_t offset = sizeof(header);
+        for (const auto& data : Data_) {
+            output.write(PADDING, AlignUp(offset) - offset);
+            output.write(reinterpret_cast<const char*>(data.data()), data.size());
+            offset = AlignUp(offset) + data.size();
+        }
+        output.write(PADDING, AlignUp(offset) - offset);
+    }
+
+private:
+    std::uint64_t Size_;
+    std::vector<std::span<const std::byte>> Data_;
+};
+
+} // namespace
+
+std::uint64_t HashSource(std::string_view buffer) {
+    // multiply-xorshift over 8-byte words in four independent lanes, it only
+    // has to detect changes of the source
+    constexpr std::uint64_t MULTIPLIER = 0xff51afd7ed558ccdULL;
+    constexpr std::size_t LANES = 4;
+    const auto mix = [](std::uint64_t hash, std::uint64_t word) {
+        hash = (hash ^ word) * MULTIPLIER;
+        return hash ^ (hash >> 32);
+    };
+
+    std::uint64_t lanes[LANES] = {0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL};
+    std::size_t offset = 0;
+    for (; offset + LANES * sizeof(std::uint64_t) <= buffer.size(); offset += LANES * sizeof(std::uint64_t)) {
+        for (std::size_t lane = 0; lane < LANES; ++lane) {
+            std::uint64_t word;
+            std::memcpy(&word, buffer.data() + offset + lane * sizeof(word), sizeof(word));
+            lanes[lane] = mix(lanes[lane], word);
+        }
+    }
+
+    std::uint64_t hash = buffer.size();
+    for (std::uint64_t lane : lanes) {
+        hash = mix(hash, lane);
+    }
+    for (; offset < buffer.size(); ++offset) {
+        hash = mix(hash, static_cast<unsigned char>(buffer[offset]));
+    }
+    return hash;
+}
+
+void WriteAstCache(const TFlatAst& ast, const TSource& source, const std::string& fileName) {
+    if (ast.Source_ && ast.Source_ != &source) {
+        throw std::runtime_error("AST cache should be written for the source of the AST");
+    }
+
+    // intern the names
+    std::unordered_map<std::string_view, std::uint32_t> stringIds;
+    std::vector<TFlatName> strings;
+    std::string stringData;
+    std::vector<TFlatName> names;
+    names.reserve(ast.Names_.size());
+    for (const TFlatName& name : ast.Names_) {
+        const std::string_view str = ast.MakeRange(name).AsStringView();
+        auto [iter, inserted] = stringIds.emplace(str, strings.size());
+        if (inserted) {
+            strings.push_back(TFlatName{
+                .Offset = static_cast<std::uint32_t>(stringData.size()),
+                .Length = static_cast<std::uint32_t>(str.size()),
+                .Symbol = 0,
+            });
+            stringData += str;
+        }
+        names.push_back(TFlatName{.Offset = name.Offset, .Length = name.Length, .Symbol = iter->second});
+    }
+
+    TSectionWriter writer;
+    const std::string_view buffer = source.GetBuffer();
+    const TAstCacheHeader header{
+        .Magic = AST_CACHE_MAGIC,
+        .Version = AST_CACHE_VERSION,
+        .SourceHash = HashSource(buffer),
+        .SourceSize = buffer.size(),
+        .Nodes = writer.Add(std::span<const TFlatNode>{ast.Nodes_}),
+        .Values = writer.Add(std::span<const double>{ast.Values_}),
+        .Names = writer.Add(std::span<const TFlatName>{names}),
+        .Children = writer.Add(std::span<const TNodeIndex>{ast.Children_}),
+        .Tops = writer.Add(std::span<const TNodeIndex>{ast.Tops_}),
+        .Strings = writer.Add(std::span<const TFlatName>{strings}),
+        .StringData = writer.Add(std::span<const char>{stringData}),
+    };
+
+    // a concurrent reader sees either the old file or the complete new one
+    const std::string tmpFileName = fileName + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream output{tmpFileName, std::ios::binary | std::ios::trunc};
+        writer.Write(output, header);
+        output.close();
+        if (!output) {
+            std::filesystem::remove(tmpFileName);
+            throw std::runtime_error("Can't write AST cache \"" + fileName + "\"");
+        }
+    }
+    try {
+        std::filesystem::rename(tmpFileName, fileName);
+    } catch (...) {
+        std::error_code error;
+        std::filesystem::remove(tmpFileName, error);
+        throw;
+    }
+}
+
+// TAstCache
+TAstCache::TAstCache(std::string fileName)
+    : File_{TSource::FromFile(std::move(fileName))}
+{
+    const std::string_view buffer = File_.GetBuffer();
+    const bool isAligned = reinterpret_cast<std::uintptr_t>(buffer.data()) % SECTION_ALIGNMENT == 0;
+    if (!isAligned || buffer.size() < sizeof(TAstCacheHeader)) {
+        ThrowMalformed();
+    }
+
+    Header_ = reinterpret_cast<const TAstCacheHeader*>(buffer.data());
+    if (Header_->Magic != AST_CACHE_MAGIC || Header_->Version != AST_CACHE_VERSION) {
+        ThrowMalformed();
+    }
+
+    Nodes_ = GetSection<TFlatNode>(Header_->Nodes);
+    Values_ = GetSection<double>(Header_->Values);
+    Names_ = GetSection<TFlatName>(Header_->Names);
+    Children_ = GetSection<TNodeIndex>(Header_->Children);
+    Tops_ = GetSection<TNodeIndex>(Header_->Tops);
+    Strings_ = GetSection<TFlatName>(Header_->Strings);
+    const auto stringData = GetSection<char>(Header_->StringData);
+    StringData_ = std::string_view{stringData.data(), stringData.size()};
+
+    Validate();
+}
+
+bool TAstCache::Matches(const TSource& source) const {
+    const std::string_view buffer = source.GetBuffer();
+    return Header_->SourceSize == buffer.size() && Header_->SourceHash == HashSource(buffer);
+}
+
+void TAstCache::BindSymbols(TSymbolTable& symbols) {
+    Symbols_.clear();
+    Symbols_.reserve(Strings_.size());
+    for (std::uint32_t string = 0; string < Strings_.size(); ++string) {
+        Symbols_.push_back(symbols.Intern(GetString(string)));
+    }
+}
+
+std::span<const TNodeIndex> TAstCache::GetTops() const {
+    return Tops_;
+}
+
+std::size_t TAstCache::GetNodeCount() const {
+    return Nodes_.size();
+}
+
+ENodeKind TAstCache::GetKind(TNodeIndex index) const {
+    return Nodes_[index].Kind;
+}
+
+double TAstCache::GetValue(TNodeIndex index) const {
+    return Values_[Nodes_[index].A];
+}
+
+std::string_view TAstCache::GetName(TNodeIndex index) const {
+    return GetString(Names_[Nodes_[index].A].Symbol);
+}
+
+TSymbolId TAstCache::GetSymbol(TNodeIndex index) const {
+    return Symbols_.empty() ? INVALID_SYMBOL : Symbols_[Names_[Nodes_[index].A].Symbol];
+}
+
+TBinaryExpr::EOp TAstCache::GetOp(TNodeIndex index) const {
+    return Nodes_[index].Op;
+}
+
+char TAstCache::GetUserOp(TNodeIndex index) const {
+    return static_cast<char>(Nodes_[index].C);
+}
+
+TNodeIndex TAstCache::GetLhs(TNodeIndex index) const {
+    return Nodes_[index].A;
+}
+
+TNodeIndex TAstCache::GetRhs(TNodeIndex index) const {
+    return Nodes_[index].B;
+}
+
+TNodeIndex TAstCache::GetCond(TNodeIndex index) const {
+    return Nodes_[index].A;
+}
+
+TNodeIndex TAstCache::GetThen(TNodeIndex index) const {
+    return Nodes_[index].B;
+}
+
+TNodeIndex TAstCache::GetElse(TNodeIndex index) const {
+    return Nodes_[index].C;
+}
+
+std::span<const TNodeIndex> TAstCache::GetArgs(TNodeIndex index) const {
+    const TFlatNode& node = Nodes_[index];
+    return Children_.subspan(node.B, node.C);
+}
+
+std::size_t TAstCache::GetArgNameCount(TNodeIndex index) const {
+    return Nodes_[index].C;
+}
+
+std::string_view TAstCache::GetArgName(TNodeIndex index, std::size_t argIndex) const {
+    return GetString(Names_[Nodes_[index].B + argIndex].Symbol);
+}
+
+TSymbolId TAstCache::GetArgSymbol(TNodeIndex index, std::size_t argIndex) const {
+    return Symbols_.empty() ? INVALID_SYMBOL : Symbols_[Names_[Nodes_[index].B + argIndex].Symbol];
+}
+
+TNodeIndex TAstCache::GetPrototype(TNodeIndex index) const {
+    return Nodes_[index].A;
+}
+
+TNodeIndex TAstCache::GetBody(TNodeIndex index) const {
+    return Nodes_[index].B;
+}
+
+template <class T>
+std::span<const T> TAstCache::GetSection(const TAstCacheSection& section) const {
+    const std::string_view buffer = File_.GetBuffer();
+    if (section.Offset % SECTION_ALIGNMENT != 0
+        || section.Offset > buffer.size()
+        || section.Count > (buffer.size() - section.Offset) / sizeof(T))
+    {
+        ThrowMalformed();
+    }
+    return {reinterpret_cast<const T*>(buffer.data() + section.Offset), section.Count};
+}
+
+void TAstCache::Validate() const {
+    // every reference should be in range and the children should precede
+    // their parents, so a walk can't go out of the mapping or loop
+    for (TNodeIndex index = 0; index < Nodes_.size(); ++index) {
+        const TFlatNode& node = Nodes_[index];
+        const auto isExpr = [&](TNodeIndex child) {
+            return child < index && IsExpr(Nodes_[child].Kind);
+        };
+
+        bool isValid = false;
+        using enum ENodeKind;
+        switch (node.Kind) {
+        case Number:
+            isValid = node.A < Values_.size();
+            break;
+        case Variable:
+            isValid = node.A < Names_.size();
+            break;
+        case Binary:
+            isValid = node.Op <= TBinaryExpr::EOp::User
+                && (node.Op == TBinaryExpr::EOp::User) == (node.C != 0)
+                && node.C <= std::numeric_limits<unsigned char>::max()
+                && isExpr(node.A) && isExpr(node.B);
+            break;
+        case If:
+            isValid = isExpr(node.A) && isExpr(node.B) && isExpr(node.C);
+            break;
+        case Call:
+            isValid = node.A < Names_.size() && node.B <= Children_.size() && node.C <= Children_.size() - node.B;
+            for (std::size_t i = 0; isValid && i < node.C; ++i) {
+                isValid = isExpr(Children_[node.B + i]);
+            }
+            break;
+        case Prototype:
+            isValid = node.A < Names_.size() && node.B <= Names_.size() && node.C <= Names_.size() - node.B;
+            break;
+        case Function:
+            isValid = node.A < index && Nodes_[node.A].Kind == Prototype && isExpr(node.B);
+            break;
+        }
+        if (!isValid || node.Reserved != 0) {
+            ThrowMalformed();
+        }
+    }
+
+    for (const TFlatName& name : Names_) {
+        if (name.Symbol >= Strings_.size()) {
+            ThrowMalformed();
+        }
+    }
+    for (const TFlatName& string : Strings_) {
+        if (string.Offset > StringData_.size() || string.Length > StringData_.size() - string.Offset) {
+            ThrowMalformed();
+        }
+    }
+    for (TNodeIndex top : Tops_) {
+        if (top >= Nodes_.size()) {
+            ThrowMalformed();
+        }
+    }
+}
+
+std::string_view TAstCache::GetString(std::uint32_t string) const {
+    const TFlatName& range = Strings_[string];
+    return StringData_.substr(range.Offset, range.Length);
+}
+
+void TAstCache::ThrowMalformed() const {
+    throw std::runtime_error("Malformed AST cache \"" + *File_.GetFileName() + "\"");
+}
+
+} // namespace NKaleidoscope::NAst
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "flat_ast.h"
+#include "noncopyable.h"
+#include "source.h"
+#include "symbol.h"
+
+namespace NKaleidoscope::NAst {
+
+// A flat AST saved to a file, all sections are arrays at 8-aligned offsets
+// from the start of the file:
+//   header | nodes | values | names | children | tops | strings | string data
+// The names are TFlatName whose Symbol is the index of the interned string,
+// every string is a TFlatName range of the string data with Symbol = 0.
+struct TAstCacheSection {
+    std::uint64_t Offset;
+    std::uint64_t Count;
+};
+
+struct TAstCacheHeader {
+    std::uint32_t Magic;
+    std::uint32_t Version;
+    std::uint64_t SourceHash;
+    std::uint64_t SourceSize;
+    TAstCacheSection Nodes;
+    TAstCacheSection Values;
+    TAstCacheSection Names;
+    TAstCacheSection Children;
+    TAstCacheSection Tops;
+    TAstCacheSection Strings;
+    TAstCacheSection StringData;
+};
+
+constexpr std::uint32_t AST_CACHE_MAGIC = 0x5453414b; // "KAST"
+constexpr std::uint32_t AST_CACHE_VERSION = 3;
+
+// hash of the source buffer stored in the cache header
+std::uint64_t HashSource(std::string_view buffer);
+
+// Writes the flat AST of the source. The nodes should be in post-order (the
+// children precede their parents) as built by Flatten and ParseChunkFlat.
+// The file is replaced atomically.
+void WriteAstCache(const TFlatAst& ast, const TSource& source, const std::string& fileName);
+
+// Maps a cache file and reads the AST right from the mapping; the accessors are
+// the same as the ones of TFlatAst, except that names are interned strings.
+// The whole file is validated when it is opened, so a corrupted cache throws
+// instead of being walked.
+class TAstCache : private TNonCopyable {
+public:
+    explicit TAstCache(std::string fileName);
+
+    // checks that the cache was written for exactly this source
+    bool Matches(const TSource& source) const;
+
+    // interns all strings of the cache, after that GetSymbol returns their ids
+    void BindSymbols(TSymbolTable& symbols);
+
+    std::span<const TNodeIndex> GetTops() const;
+    std::size_t GetNodeCount() const;
+    ENodeKind GetKind(TNodeIndex index) const;
+
+    // Number
+    double GetValue(TNodeIndex index) const;
+
+    // Variable, Call, Prototype
+    std::string_view GetName(TNodeIndex index) const;
+    TSymbolId GetSymbol(TNodeIndex index) const;
+
+    // Binary
+    TBinaryExpr::EOp GetOp(TNodeIndex index) const;
+    char GetUserOp(TNodeIndex index) const;
+    TNodeIndex GetLhs(TNodeIndex index) const;
+    TNodeIndex GetRhs(TNodeIndex index) const;
+
+    // If
+    TNodeIndex GetCond(TNodeIndex index) const;
+    TNodeIndex GetThen(TNodeIndex index) const;
+    TNodeIndex GetElse(TNodeIndex index) const;
+
+    // Call
+    std::span<const TNodeIndex> GetArgs(TNodeIndex index) const;
+
+    // Prototype
+    std::size_t GetArgNameCount(TNodeIndex index) const;
+    std::string_view GetArgName(TNodeIndex index, std::size_t argIndex) const;
+    TSymbolId GetArgSymbol(TNodeIndex index, std::size_t argIndex) const;
+
+    // Function
+    TNodeIndex GetPrototype(TNodeIndex index) const;
+    TNodeIndex GetBody(TNodeIndex index) const;
+
+private:
+    template <class T>
+    std::span<const T> GetSection(const TAstCacheSection& section) const;
+
+    void Validate() const;
+    std::string_view GetString(std::uint32_t string) const;
+    [[noreturn]] void ThrowMalformed() const;
+
+private:
+    TSource File_;
+    const TAstCacheHeader* Header_;
+    std::span<const TFlatNode> Nodes_;
+    std::span<const double> Values_;
+    std::span<const TFlatName> Names_;
+    std::span<const TNodeIndex> Children_;
+    std::span<const TNodeIndex> Tops_;
+    std::span<const TFlatName> Strings_;
+    std::string_view StringData_;
+    std::vector<TSymbolId> Symbols_;
+};
+
+} // namespace NKaleidoscope::NAst
@@ -0,0 +1,49 @@
+#include "bind_symbols.h"
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace NKaleidoscope::NAst {
+
+TSymbolBinder::TSymbolBinder(TSymbolTable& symbols)
+    : Symbols_{symbols}
+{}
+
+void TSymbolBinder::Bind(TNode& root) {
+    // a post-order walk with an explicit stack: a callee is interned after its
+    // args, a prototype before the body
+    std::vector<std::pair<TNode*, std::size_t>> frames = {{&root, 0}};
+    while (!frames.empty()) {
+        auto& [node, visited] = frames.back();
+        if (visited < GetChildCount(*node)) {
+            frames.emplace_back(&GetChild(*node, visited++), 0);
+            continue;
+        }
+
+        Visit(*node, [this](const auto& concrete) {
+            using T = std::decay_t<decltype(concrete)>;
+            auto& mutableNode = const_cast<T&>(concrete);
+            if constexpr (std::is_same_v<T, TVariableExpr>) {
+                mutableNode.Symbol_ = Symbols_.Intern(mutableNode.Name_.AsStringView());
+            } else if constexpr (std::is_same_v<T, TPrototype>) {
+                mutableNode.Symbol_ = Symbols_.Intern(mutableNode.Name_.AsStringView());
+                for (std::size_t i = 0; i < mutableNode.Args_.size(); ++i) {
+                    mutableNode.ArgSymbols_[i] = Symbols_.Intern(mutableNode.Args_[i].AsStringView());
+                }
+            } else if constexpr (std::is_same_v<T, TCallExpr>) {
+                mutableNode.CalleeSymbol_ = Symbols_.Intern(mutableNode.Callee_.AsStringView());
+            }
+        });
+        frames.pop_back();
+    }
+}
+
+void BindSymbols(std::span<TNodePtr<TNode>> nodes, TSymbolTable& symbols) {
+    TSymbolBinder binder{symbols};
+    for (auto& node : nodes) {
+        binder.Bind(*node);
+    }
+}
+
+} // namespace NKaleidoscope::NAst
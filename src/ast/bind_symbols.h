@@ -0,0 +1,25 @@
+#pragma once
+
+#include <span>
+
+#include "ast.h"
+#include "symbol.h"
+
+namespace NKaleidoscope::NAst {
+
+// Interns the names of an AST that was parsed without a symbol table. The
+// names are interned in the order the parser interns them, so the ids are the
+// same as if the table had been given to the parser.
+class TSymbolBinder {
+public:
+    explicit TSymbolBinder(TSymbolTable& symbols);
+
+    void Bind(TNode& node);
+
+private:
+    TSymbolTable& Symbols_;
+};
+
+void BindSymbols(std::span<TNodePtr<TNode>> nodes, TSymbolTable& symbols);
+
+} // namespace NKaleidoscope::NAst
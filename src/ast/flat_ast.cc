@@ -0,0 +1,247 @@
+#include "flat_ast.h"
+
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace NKaleidoscope::NAst {
+
+namespace {
+
+// converts a pointer tree in post-order with an explicit stack
+class TFlattener {
+public:
+    TFlattener(TFlatAst& ast)
+        : Ast_{ast}
+    {}
+
+    TNodeIndex Add(const TNode& root) {
+        // a frame is revisited after each of its children, whose indices are on top of Indices_
+        std::vector<std::pair<const TNode*, std::size_t>> frames = {{&root, 0}};
+        Indices_.clear();
+        while (!frames.empty()) {
+            auto& [node, visited] = frames.back();
+            if (visited < GetChildCount(*node)) {
+                const TNode* child = &GetChild(*node, visited++);
+                frames.emplace_back(child, 0);
+                continue;
+            }
+
+            const std::span<const TNodeIndex> children{Indices_.data() + Indices_.size() - visited, visited};
+            const TNodeIndex index = AddNode(*node, children);
+            Indices_.resize(Indices_.size() - visited);
+            Indices_.push_back(index);
+            frames.pop_back();
+        }
+        return Indices_.back();
+    }
+
+private:
+    TNodeIndex AddNode(const TNode& node, std::span<const TNodeIndex> children) {
+        return Visit(node, [&](const auto& concrete) -> TNodeIndex {
+            using T = std::decay_t<decltype(concrete)>;
+            if constexpr (std::is_same_v<T, TNumberExpr>) {
+                return Ast_.AddNumber(concrete.GetValue());
+            } else if constexpr (std::is_same_v<T, TVariableExpr>) {
+                return Ast_.AddVariable(concrete.GetName(), concrete.GetSymbol());
+            } else if constexpr (std::is_same_v<T, TBinaryExpr>) {
+                return Ast_.AddBinary(concrete.GetOp(), children[0], children[1], concrete.GetUserOp());
+            } else if constexpr (std::is_same_v<T, TIfExpr>) {
+                return Ast_.AddIf(children[0], children[1], children[2]);
+            } else if constexpr (std::is_same_v<T, TCallExpr>) {
+                return Ast_.AddCall(concrete.GetCallee(), children, concrete.GetCalleeSymbol());
+            } else if constexpr (std::is_same_v<T, TPrototype>) {
+                return Ast_.AddPrototype(concrete.GetName(), concrete.GetArgs(), concrete.GetSymbol(),
+                                         concrete.GetArgSymbols());
+            } else {
+                return Ast_.AddFunction(children[0], children[1]);
+            }
+        });
+    }
+
+private:
+    TFlatAst& Ast_;
+    std::vector<TNodeIndex> Indices_;
+};
+
+std::uint32_t ToIndex(std::size_t size) {
+    if (size > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("Flat AST is too large");
+    }
+    return static_cast<std::uint32_t>(size);
+}
+
+} // namespace
+
+// TFlatAst
+TFlatAst::TFlatAst()
+    : Source_{nullptr}
+{}
+
+TNodeIndex TFlatAst::AddNumber(double value) {
+    Values_.push_back(value);
+    return AddNode(TFlatNode{.Kind = ENodeKind::Number, .A = ToIndex(Values_.size() - 1)});
+}
+
+TNodeIndex TFlatAst::AddVariable(TSourceRange name, TSymbolId symbol) {
+    return AddNode(TFlatNode{.Kind = ENodeKind::Variable, .A = AddName(name, symbol)});
+}
+
+TNodeIndex TFlatAst::AddBinary(TBinaryExpr::EOp op, TNodeIndex lhs, TNodeIndex rhs, char userOp) {
+    return AddNode(TFlatNode{
+        .Kind = ENodeKind::Binary,
+        .Op = op,
+        .A = lhs,
+        .B = rhs,
+        .C = static_cast<unsigned char>(userOp),
+    });
+}
+
+TNodeIndex TFlatAst::AddIf(TNodeIndex cond, TNodeIndex then, TNodeIndex els) {
+    return AddNode(TFlatNode{.Kind = ENodeKind::If, .A = cond, .B = then, .C = els});
+}
+
+TNodeIndex TFlatAst::AddCall(TSourceRange callee, std::span<const TNodeIndex> args, TSymbolId calleeSymbol) {
+    const std::uint32_t name = AddName(callee, calleeSymbol);
+    const std::uint32_t first = ToIndex(Children_.size());
+    Children_.insert(Children_.end(), args.begin(), args.end());
+    return AddNode(TFlatNode{.Kind = ENodeKind::Call, .A = name, .B = first, .C = ToIndex(args.size())});
+}
+
+TNodeIndex TFlatAst::AddPrototype(TSourceRange name, std::span<const TSourceRange> args, TSymbolId symbol,
+                                  std::span<const TSymbolId> argSymbols)
+{
+    const std::uint32_t nameIndex = AddName(name, symbol);
+    const std::uint32_t first = ToIndex(Names_.size());
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        AddName(args[i], i < argSymbols.size() ? argSymbols[i] : INVALID_SYMBOL);
+    }
+    return AddNode(TFlatNode{.Kind = ENodeKind::Prototype, .A = nameIndex, .B = first, .C = ToIndex(args.size())});
+}
+
+TNodeIndex TFlatAst::AddFunction(TNodeIndex prototype, TNodeIndex body) {
+    return AddNode(TFlatNode{.Kind = ENodeKind::Function, .A = prototype, .B = body});
+}
+
+TNodeIndex TFlatAst::Add(const TNode& node) {
+    TFlattener flattener{*this};
+    return flattener.Add(node);
+}
+
+void TFlatAst::AddTop(TNodeIndex index) {
+    Tops_.push_back(index);
+}
+
+const std::vector<TNodeIndex>& TFlatAst::GetTops() const {
+    return Tops_;
+}
+
+const TSource* TFlatAst::GetSource() const {
+    return Source_;
+}
+
+std::size_t TFlatAst::GetNodeCount() const {
+    return Nodes_.size();
+}
+
+const TFlatNode& TFlatAst::GetNode(TNodeIndex index) const {
+    return Nodes_[index];
+}
+
+ENodeKind TFlatAst::GetKind(TNodeIndex index) const {
+    return Nodes_[index].Kind;
+}
+
+double TFlatAst::GetValue(TNodeIndex index) const {
+    return Values_[Nodes_[index].A];
+}
+
+TSourceRange TFlatAst::GetName(TNodeIndex index) const {
+    return MakeRange(Names_[Nodes_[index].A]);
+}
+
+TSymbolId TFlatAst::GetSymbol(TNodeIndex index) const {
+    return Names_[Nodes_[index].A].Symbol;
+}
+
+TBinaryExpr::EOp TFlatAst::GetOp(TNodeIndex index) const {
+    return Nodes_[index].Op;
+}
+
+char TFlatAst::GetUserOp(TNodeIndex index) const {
+    return static_cast<char>(Nodes_[index].C);
+}
+
+TNodeIndex TFlatAst::GetLhs(TNodeIndex index) const {
+    return Nodes_[index].A;
+}
+
+TNodeIndex TFlatAst::GetRhs(TNodeIndex index) const {
+    return Nodes_[index].B;
+}
+
+TNodeIndex TFlatAst::GetCond(TNodeIndex index) const {
+    return Nodes_[index].A;
+}
+
+TNodeIndex TFlatAst::GetThen(TNodeIndex index) const {
+    return Nodes_[index].B;
+}
+
+TNodeIndex TFlatAst::GetElse(TNodeIndex index) const {
+    return Nodes_[index].C;
+}
+
+std::span<const TNodeIndex> TFlatAst::GetArgs(TNodeIndex index) const {
+    const TFlatNode& node = Nodes_[index];
+    return std::span<const TNodeIndex>{Children_}.subspan(node.B, node.C);
+}
+
+std::size_t TFlatAst::GetArgNameCount(TNodeIndex index) const {
+    return Nodes_[index].C;
+}
+
+TSourceRange TFlatAst::GetArgName(TNodeIndex index, std::size_t argIndex) const {
+    return MakeRange(Names_[Nodes_[index].B + argIndex]);
+}
+
+TSymbolId TFlatAst::GetArgSymbol(TNodeIndex index, std::size_t argIndex) const {
+    return Names_[Nodes_[index].B + argIndex].Symbol;
+}
+
+TNodeIndex TFlatAst::GetPrototype(TNodeIndex index) const {
+    return Nodes_[index].A;
+}
+
+TNodeIndex TFlatAst::GetBody(TNodeIndex index) const {
+    return Nodes_[index].B;
+}
+
+TNodeIndex TFlatAst::AddNode(TFlatNode node) {
+    Nodes_.push_back(node);
+    return ToIndex(Nodes_.size() - 1);
+}
+
+std::uint32_t TFlatAst::AddName(TSourceRange name, TSymbolId symbol) {
+    if (Source_ && Source_ != name.Source) {
+        throw std::runtime_error("All names of a flat AST should come from the same source");
+    }
+    Source_ = name.Source;
+    Names_.push_back(TFlatName{.Offset = ToIndex(name.Offset), .Length = ToIndex(name.Length), .Symbol = symbol});
+    return ToIndex(Names_.size() - 1);
+}
+
+TSourceRange TFlatAst::MakeRange(const TFlatName& name) const {
+    return TSourceRange{.Source = Source_, .Offset = name.Offset, .Length = name.Length};
+}
+
+TFlatAst Flatten(std::span<const TNodePtr<TNode>> nodes) {
+    TFlatAst ast;
+    for (const auto& node : nodes) {
+        ast.AddTop(ast.Add(*node));
+    }
+    return ast;
+}
+
+} // namespace NKaleidoscope::NAst
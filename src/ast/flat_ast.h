@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+
+namespace NKaleidoscope::NAst {
+
+// index of a node in TFlatAst
+using TNodeIndex = std::uint32_t;
+
+// a node of the flat AST, the meaning of the fields depends on the kind:
+//   Number:    A = index of the value
+//   Variable:  A = index of the name
+//   Binary:    Op, A = lhs, B = rhs, C = user operator's character
+//   If:        A = cond, B = then, C = else
+//   Call:      A = index of the callee name, [B, B + C) = indices of the args in the children
+//   Prototype: A = index of the name, [B, B + C) = indices of the arg names
+//   Function:  A = prototype, B = body
+struct TFlatNode {
+    ENodeKind Kind;
+    TBinaryExpr::EOp Op;
+    // the padding is explicit, so the nodes are written to the AST cache without garbage bytes
+    std::uint16_t Reserved = 0;
+    std::uint32_t A;
+    std::uint32_t B;
+    std::uint32_t C;
+};
+
+static_assert(sizeof(TFlatNode) == 16);
+
+// name as a range of the AST's source and its interned id
+struct TFlatName {
+    std::uint32_t Offset;
+    std::uint32_t Length;
+    TSymbolId Symbol;
+};
+
+// AST stored in a few contiguous arrays, children are referenced by indices;
+// all names should come from the same source
+class TFlatAst {
+public:
+    TFlatAst();
+
+    TNodeIndex AddNumber(double value);
+    TNodeIndex AddVariable(TSourceRange name, TSymbolId symbol = INVALID_SYMBOL);
+    TNodeIndex AddBinary(TBinaryExpr::EOp op, TNodeIndex lhs, TNodeIndex rhs, char userOp = 0);
+    TNodeIndex AddIf(TNodeIndex cond, TNodeIndex then, TNodeIndex els);
+    TNodeIndex AddCall(TSourceRange callee, std::span<const TNodeIndex> args,
+                       TSymbolId calleeSymbol = INVALID_SYMBOL);
+    // without argSymbols the ids of the args are INVALID_SYMBOL
+    TNodeIndex AddPrototype(TSourceRange name, std::span<const TSourceRange> args,
+                            TSymbolId symbol = INVALID_SYMBOL, std::span<const TSymbolId> argSymbols = {});
+    TNodeIndex AddFunction(TNodeIndex prototype, TNodeIndex body);
+
+    // converts a pointer tree, returns the index of its root
+    TNodeIndex Add(const TNode& node);
+
+    // top-level items in the source order
+    void AddTop(TNodeIndex index);
+    const std::vector<TNodeIndex>& GetTops() const;
+
+    const TSource* GetSource() const;
+    std::size_t GetNodeCount() const;
+    const TFlatNode& GetNode(TNodeIndex index) const;
+    ENodeKind GetKind(TNodeIndex index) const;
+
+    // Number
+    double GetValue(TNodeIndex index) const;
+
+    // Variable, Call, Prototype
+    TSourceRange GetName(TNodeIndex index) const;
+    TSymbolId GetSymbol(TNodeIndex index) const;
+
+    // Binary
+    TBinaryExpr::EOp GetOp(TNodeIndex index) const;
+    char GetUserOp(TNodeIndex index) const;
+    TNodeIndex GetLhs(TNodeIndex index) const;
+    TNodeIndex GetRhs(TNodeIndex index) const;
+
+    // If
+    TNodeIndex GetCond(TNodeIndex index) const;
+    TNodeIndex GetThen(TNodeIndex index) const;
+    TNodeIndex GetElse(TNodeIndex index) const;
+
+    // Call
+    std::span<const TNodeIndex> GetArgs(TNodeIndex index) const;
+
+    // Prototype
+    std::size_t GetArgNameCount(TNodeIndex index) const;
+    TSourceRange GetArgName(TNodeIndex index, std::size_t argIndex) const;
+    TSymbolId GetArgSymbol(TNodeIndex index, std::size_t argIndex) const;
+
+    // Function
+    TNodeIndex GetPrototype(TNodeIndex index) const;
+    TNodeIndex GetBody(TNodeIndex index) const;
+
+private:
+    friend void WriteAstCache(const TFlatAst& ast, const TSource& source, const std::string& fileName);
+
+    TNodeIndex AddNode(TFlatNode node);
+    std::uint32_t AddName(TSourceRange name, TSymbolId symbol = INVALID_SYMBOL);
+    TSourceRange MakeRange(const TFlatName& name) const;
+
+private:
+    const TSource* Source_;
+    std::vector<TFlatNode> Nodes_;
+    std::vector<double> Values_;
+    std::vector<TFlatName> Names_;
+    std::vector<TNodeIndex> Children_;
+    std::vector<TNodeIndex> Tops_;
+};
+
+TFlatAst Flatten(std::span<const TNodePtr<TNode>> nodes);
+
+} // namespace NKaleidoscope::NAst
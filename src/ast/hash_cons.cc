@@ -0,0 +1,113 @@
+#include "hash_cons.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace NKaleidoscope::NAst {
+
+namespace {
+
+std::size_t Combine(std::size_t hash, std::uint64_t value) {
+    // the 64-bit golden ratio mixing of boost::hash_combine
+    return hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+}
+
+TNodePtr<TExpr> Share(const TExpr* node) {
+    return TNodePtr<TExpr>{const_cast<TExpr*>(node), TNodeDeleter{/* owning = */ false}};
+}
+
+} // namespace
+
+bool THashConsTable::TKey::operator==(const TKey& other) const {
+    return Kind == other.Kind
+        && Op == other.Op
+        && Symbol == other.Symbol
+        && Value == other.Value
+        && std::equal(std::begin(Children), std::end(Children), std::begin(other.Children))
+        && std::equal(Args.begin(), Args.end(), other.Args.begin(), other.Args.end(),
+                      [](const auto& lhs, const auto& rhs) { return lhs.get() == rhs.get(); });
+}
+
+std::size_t THashConsTable::THash::operator()(const TKey& key) const {
+    std::size_t hash = static_cast<std::size_t>(key.Kind);
+    hash = Combine(hash, static_cast<std::uint64_t>(key.Op));
+    hash = Combine(hash, key.Symbol);
+    hash = Combine(hash, key.Value);
+    for (const TExpr* child : key.Children) {
+        hash = Combine(hash, reinterpret_cast<std::uintptr_t>(child));
+    }
+    for (const auto& arg : key.Args) {
+        hash = Combine(hash, reinterpret_cast<std::uintptr_t>(arg.get()));
+    }
+    return hash;
+}
+
+THashConsTable::THashConsTable(TArena& arena)
+    : Arena_{arena}
+    , SharedCount_{0}
+{}
+
+TNodePtr<TExpr> THashConsTable::FindOrMake(const TKey& key, auto&& make) {
+    if (auto iter = Nodes_.find(key); iter != Nodes_.end()) {
+        ++SharedCount_;
+        return Share(iter->second);
+    }
+    TNodePtr<TExpr> node = make();
+    Nodes_.emplace(key, node.get());
+    return node;
+}
+
+TNodePtr<TExpr> THashConsTable::MakeNumber(double value) {
+    const TKey key{.Kind = ENodeKind::Number, .Value = std::bit_cast<std::uint64_t>(value)};
+    return FindOrMake(key, [&] { return Arena_.Make<TNumberExpr>(value); });
+}
+
+TNodePtr<TExpr> THashConsTable::MakeVariable(TSourceRange name, TSymbolId symbol) {
+    if (symbol == INVALID_SYMBOL) {
+        return Arena_.Make<TVariableExpr>(name, symbol);
+    }
+    const TKey key{.Kind = ENodeKind::Variable, .Symbol = symbol};
+    return FindOrMake(key, [&] { return Arena_.Make<TVariableExpr>(name, symbol); });
+}
+
+TNodePtr<TExpr> THashConsTable::MakeBinary(TBinaryExpr::EOp op, TNodePtr<TExpr> lhs, TNodePtr<TExpr> rhs, char userOp) {
+    const TKey key{
+        .Kind = ENodeKind::Binary,
+        .Op = op,
+        .Value = static_cast<unsigned char>(userOp),
+        .Children = {lhs.get(), rhs.get()},
+    };
+    return FindOrMake(key, [&] { return Arena_.Make<TBinaryExpr>(op, std::move(lhs), std::move(rhs), userOp); });
+}
+
+TNodePtr<TExpr> THashConsTable::MakeIf(TNodePtr<TExpr> condExpr, TNodePtr<TExpr> thenExpr, TNodePtr<TExpr> elseExpr) {
+    const TKey key{.Kind = ENodeKind::If, .Children = {condExpr.get(), thenExpr.get(), elseExpr.get()}};
+    return FindOrMake(key, [&] {
+        return Arena_.Make<TIfExpr>(std::move(condExpr), std::move(thenExpr), std::move(elseExpr));
+    });
+}
+
+TNodePtr<TExpr> THashConsTable::MakeCall(TSourceRange callee, std::pmr::vector<TNodePtr<TExpr>> args,
+                                         TSymbolId calleeSymbol)
+{
+    if (calleeSymbol == INVALID_SYMBOL) {
+        return Arena_.Make<TCallExpr>(callee, std::move(args), calleeSymbol);
+    }
+    TKey key{.Kind = ENodeKind::Call, .Symbol = calleeSymbol, .Args = args};
+    if (auto iter = Nodes_.find(key); iter != Nodes_.end()) {
+        ++SharedCount_;
+        return Share(iter->second);
+    }
+
+    // the stored key should reference the arguments of the node itself
+    auto node = Arena_.Make<TCallExpr>(callee, std::move(args), calleeSymbol);
+    key.Args = node->GetArgs();
+    Nodes_.emplace(key, node.get());
+    return node;
+}
+
+std::size_t THashConsTable::GetSharedCount() const {
+    return SharedCount_;
+}
+
+} // namespace NKaleidoscope::NAst
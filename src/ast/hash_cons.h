@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+
+#include "arena.h"
+#include "ast.h"
+
+namespace NKaleidoscope::NAst {
+
+// Builds expressions in an arena and returns the existing node instead of a
+// structurally identical new one, so repeated subexpressions turn the AST into
+// a DAG. Nodes are keyed on the kind, the operator, the identity of the
+// children and the literal value or the symbol; names without a symbol are
+// never shared. A shared node keeps the source location of its first occurrence.
+class THashConsTable : private TNonCopyable {
+public:
+    explicit THashConsTable(TArena& arena);
+
+    TNodePtr<TExpr> MakeNumber(double value);
+    TNodePtr<TExpr> MakeVariable(TSourceRange name, TSymbolId symbol);
+    TNodePtr<TExpr> MakeBinary(TBinaryExpr::EOp op, TNodePtr<TExpr> lhs, TNodePtr<TExpr> rhs, char userOp = 0);
+    TNodePtr<TExpr> MakeIf(TNodePtr<TExpr> condExpr, TNodePtr<TExpr> thenExpr, TNodePtr<TExpr> elseExpr);
+    TNodePtr<TExpr> MakeCall(TSourceRange callee, std::pmr::vector<TNodePtr<TExpr>> args, TSymbolId calleeSymbol);
+
+    // number of requested nodes that were not allocated
+    std::size_t GetSharedCount() const;
+
+private:
+    struct TKey {
+        ENodeKind Kind;
+        TBinaryExpr::EOp Op = {};
+        TSymbolId Symbol = INVALID_SYMBOL;
+        std::uint64_t Value = 0;
+        const TExpr* Children[3] = {};
+        std::span<const TNodePtr<TExpr>> Args;
+
+        bool operator==(const TKey& other) const;
+    };
+
+    struct THash {
+        std::size_t operator()(const TKey& key) const;
+    };
+
+    // returns the shared node for the key or the one built by `make`
+    TNodePtr<TExpr> FindOrMake(const TKey& key, auto&& make);
+
+private:
+    TArena& Arena_;
+    std::unordered_map<TKey, const TExpr*, THash> Nodes_;
+    std::size_t SharedCount_;
+};
+
+} // namespace NKaleidoscope::NAst
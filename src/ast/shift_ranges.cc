@@ -0,0 +1,46 @@
+#include "shift_ranges.h"
+
+#include <type_traits>
+#include <vector>
+
+namespace NKaleidoscope::NAst {
+
+TSourceRangeShifter::TSourceRangeShifter(std::ptrdiff_t delta)
+    : Delta_{delta}
+{}
+
+void TSourceRangeShifter::Shift(TNode& root) {
+    const auto shift = [this](TSourceRange& range) {
+        range.Offset += Delta_;
+    };
+
+    std::vector<TNode*> stack = {&root};
+    while (!stack.empty()) {
+        TNode* node = stack.back();
+        stack.pop_back();
+        for (std::size_t i = 0; i < GetChildCount(*node); ++i) {
+            stack.push_back(&GetChild(*node, i));
+        }
+
+        Visit(*node, [&shift](const auto& concrete) {
+            using T = std::decay_t<decltype(concrete)>;
+            auto& mutableNode = const_cast<T&>(concrete);
+            if constexpr (std::is_same_v<T, TVariableExpr>) {
+                shift(mutableNode.Name_);
+            } else if constexpr (std::is_same_v<T, TCallExpr>) {
+                shift(mutableNode.Callee_);
+            } else if constexpr (std::is_same_v<T, TPrototype>) {
+                shift(mutableNode.Name_);
+                for (TSourceRange& arg : mutableNode.Args_) {
+                    shift(arg);
+                }
+            }
+        });
+    }
+}
+
+void ShiftSourceRanges(TNode& node, std::ptrdiff_t delta) {
+    TSourceRangeShifter{delta}.Shift(node);
+}
+
+} // namespace NKaleidoscope::NAst
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ast.h"
+
+namespace NKaleidoscope::NAst {
+
+// Moves the source ranges of an AST by `delta` bytes, so the nodes stay valid
+// after an edit of their source before them (see TSource::Edit). Shared
+// nodes of a hash-consed AST should be shifted only once.
+class TSourceRangeShifter {
+public:
+    explicit TSourceRangeShifter(std::ptrdiff_t delta);
+
+    void Shift(TNode& node);
+
+private:
+    std::ptrdiff_t Delta_;
+};
+
+void ShiftSourceRanges(TNode& node, std::ptrdiff_t delta);
+
+} // namespace NKaleidoscope::NAst
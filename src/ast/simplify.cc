@@ -0,0 +1,231 @@
+#include "simplify.h"
+
+#include <cmath>
+#include <vector>
+
+namespace NKaleidoscope::NAst {
+
+namespace {
+
+const TNumberExpr* AsNumber(const TNodePtr<TExpr>& expr) {
+    return NodeCast<TNumberExpr>(expr.get());
+}
+
+// the same semantics as the generated code
+double Fold(TBinaryExpr::EOp op, double lhs, double rhs) {
+    using enum TBinaryExpr::EOp;
+    switch (op) {
+    case Less:
+        // fcmp ult: less than or unordered
+        return !(lhs >= rhs) ? 1.0 : 0.0;
+    case Plus:
+        return lhs + rhs;
+    case Minus:
+        return lhs - rhs;
+    case Multiply:
+        return lhs * rhs;
+    case User:
+        break;
+    }
+    __builtin_unreachable();
+}
+
+bool IsOne(const TNumberExpr* number) {
+    return number && number->GetValue() == 1.0;
+}
+
+bool IsZero(const TNumberExpr* number, bool negative) {
+    return number && number->GetValue() == 0.0 && std::signbit(number->GetValue()) == negative;
+}
+
+// arena nodes may be shared, so they are referenced instead of moved
+TNodePtr<TExpr> Take(TNodePtr<TExpr>& expr) {
+    if (expr.get_deleter().Owning) {
+        return std::move(expr);
+    }
+    return TNodePtr<TExpr>{expr.get(), TNodeDeleter{/* owning = */ false}};
+}
+
+} // namespace
+
+TSimplifier::TSimplifier(TArena* arena)
+    : Arena_{arena}
+    , EliminatedCount_{0}
+{}
+
+void TSimplifier::Simplify(TNodePtr<TNode>& node) {
+    if (auto* function = NodeCast<TFunction>(node.get())) {
+        Simplify(function->Body_);
+    } else if (auto* expr = NodeCast<TExpr>(node.get())) {
+        const TNodeDeleter deleter = node.get_deleter();
+        node.release();
+        TNodePtr<TExpr> exprPtr{expr, deleter};
+        Simplify(exprPtr);
+        node = std::move(exprPtr);
+    }
+}
+
+void TSimplifier::Simplify(TNodePtr<TExpr>& root) {
+    // a post-order walk with an explicit stack, a frame is revisited after
+    // each of its children and rewrites its slot after the last one
+    struct TFrame {
+        TNodePtr<TExpr>* Expr;
+        std::size_t Stage = 0;
+        // set for a shared node
+        const TExpr* Original = nullptr;
+    };
+
+    std::vector<TFrame> frames = {TFrame{.Expr = &root}};
+    while (!frames.empty()) {
+        TFrame& frame = frames.back();
+        TNodePtr<TExpr>& expr = *frame.Expr;
+
+        // a shared node is simplified once, the next references get its result
+        if (frame.Stage == 0 && Arena_ && !expr.get_deleter().Owning) {
+            if (auto iter = Simplified_.find(expr.get()); iter != Simplified_.end()) {
+                expr = TNodePtr<TExpr>{iter->second, TNodeDeleter{/* owning = */ false}};
+                frames.pop_back();
+                continue;
+            }
+            frame.Original = expr.get();
+        }
+
+        TNodePtr<TExpr>* child = nullptr;
+        if (auto* binaryExpr = NodeCast<TBinaryExpr>(expr.get())) {
+            if (frame.Stage < 2) {
+                child = frame.Stage == 0 ? &binaryExpr->Lhs_ : &binaryExpr->Rhs_;
+            } else {
+                SimplifyBinary(expr, *binaryExpr);
+            }
+        } else if (auto* ifExpr = NodeCast<TIfExpr>(expr.get())) {
+            child = SimplifyIf(expr, *ifExpr, frame.Stage);
+        } else if (auto* callExpr = NodeCast<TCallExpr>(expr.get())) {
+            if (frame.Stage < callExpr->Args_.size()) {
+                child = &callExpr->Args_[frame.Stage];
+            }
+        }
+
+        if (child) {
+            ++frame.Stage;
+            frames.push_back(TFrame{.Expr = child});
+            continue;
+        }
+        if (frame.Original) {
+            Simplified_.emplace(frame.Original, expr.get());
+        }
+        frames.pop_back();
+    }
+}
+
+std::size_t TSimplifier::GetEliminatedCount() const {
+    return EliminatedCount_;
+}
+
+void TSimplifier::SimplifyBinary(TNodePtr<TExpr>& expr, TBinaryExpr& binaryExpr) {
+    // a user operator is a call
+    if (binaryExpr.Op_ == TBinaryExpr::EOp::User) {
+        return;
+    }
+
+    const TNumberExpr* lhs = AsNumber(binaryExpr.Lhs_);
+    const TNumberExpr* rhs = AsNumber(binaryExpr.Rhs_);
+    if (lhs && rhs) {
+        const double value = Fold(binaryExpr.Op_, lhs->GetValue(), rhs->GetValue());
+        expr = MakeNode<TNumberExpr>(Arena_, value);
+        EliminatedCount_ += 2;
+        return;
+    }
+
+    using enum TBinaryExpr::EOp;
+    switch (binaryExpr.Op_) {
+    case Multiply:
+        if (IsOne(rhs)) {
+            ReplaceBy(expr, binaryExpr.Lhs_);
+        } else if (IsOne(lhs)) {
+            ReplaceBy(expr, binaryExpr.Rhs_);
+        }
+        break;
+    case Plus:
+        // x + 0 is +0 for x = -0, only -0 is the identity
+        if (IsZero(rhs, /* negative = */ true)) {
+            ReplaceBy(expr, binaryExpr.Lhs_);
+        } else if (IsZero(lhs, /* negative = */ true)) {
+            ReplaceBy(expr, binaryExpr.Rhs_);
+        }
+        break;
+    case Minus:
+        if (IsZero(rhs, /* negative = */ false)) {
+            ReplaceBy(expr, binaryExpr.Lhs_);
+        }
+        break;
+    case Less:
+    case User:
+        break;
+    }
+}
+
+TNodePtr<TExpr>* TSimplifier::SimplifyIf(TNodePtr<TExpr>& expr, TIfExpr& ifExpr, std::size_t stage) {
+    if (stage == 0) {
+        return &ifExpr.Cond_;
+    }
+
+    if (const TNumberExpr* cond = AsNumber(ifExpr.Cond_)) {
+        // fcmp one: ordered and not equal to zero
+        const double value = cond->GetValue();
+        const bool isTrue = !std::isnan(value) && value != 0.0;
+        TNodePtr<TExpr>& taken = isTrue ? ifExpr.Then_ : ifExpr.Else_;
+        const TNodePtr<TExpr>& dropped = isTrue ? ifExpr.Else_ : ifExpr.Then_;
+
+        if (stage == 1) {
+            // the dropped branch is not simplified at all
+            EliminatedCount_ += 2 + CountDropped(*dropped);
+            return &taken;
+        }
+        TNodePtr<TExpr> branch = Take(taken);
+        expr = std::move(branch);
+        return nullptr;
+    }
+
+    switch (stage) {
+    case 1:
+        return &ifExpr.Then_;
+    case 2:
+        return &ifExpr.Else_;
+    default:
+        return nullptr;
+    }
+}
+
+std::size_t TSimplifier::CountDropped(const TExpr& root) {
+    std::size_t count = 0;
+    std::vector<const TExpr*> stack = {&root};
+    while (!stack.empty()) {
+        const TExpr* expr = stack.back();
+        stack.pop_back();
+        // a hash-consed node is counted once, and not at all if a simplified part of the AST references it
+        if (Arena_ && (Simplified_.contains(expr) || !Dropped_.insert(expr).second)) {
+            continue;
+        }
+        ++count;
+        for (std::size_t i = 0; i < GetChildCount(*expr); ++i) {
+            stack.push_back(static_cast<const TExpr*>(&GetChild(*expr, i)));
+        }
+    }
+    return count;
+}
+
+void TSimplifier::ReplaceBy(TNodePtr<TExpr>& expr, TNodePtr<TExpr>& child) {
+    TNodePtr<TExpr> kept = Take(child);
+    expr = std::move(kept);
+    EliminatedCount_ += 2;
+}
+
+std::size_t Simplify(std::span<TNodePtr<TNode>> nodes, TArena* arena) {
+    TSimplifier simplifier{arena};
+    for (auto& node : nodes) {
+        simplifier.Simplify(node);
+    }
+    return simplifier.GetEliminatedCount();
+}
+
+} // namespace NKaleidoscope::NAst
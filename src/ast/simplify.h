@@ -0,0 +1,55 @@
+#pragma once
+
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "arena.h"
+#include "ast.h"
+
+namespace NKaleidoscope::NAst {
+
+// Rewrites expressions in place: folds binary operators over numbers, replaces
+// an if with a constant condition by the taken branch and applies the identities
+// that hold for every IEEE double (x*1, x+(-0), x-0), so the simplified AST
+// computes bit-identical values. Every node is visited at most once, with an
+// explicit stack instead of recursion.
+class TSimplifier {
+public:
+    // new nodes are allocated in the arena if it is given; a hash-consed AST
+    // should be simplified with its arena, so that every shared node is
+    // simplified only once
+    explicit TSimplifier(TArena* arena = nullptr);
+
+    void Simplify(TNodePtr<TNode>& node);
+    void Simplify(TNodePtr<TExpr>& expr);
+
+    // the number of nodes removed from the AST minus the number of new ones;
+    // for a hash-consed AST it is an upper bound, since a removed reference
+    // to a shared node is counted even if the node is referenced later on
+    std::size_t GetEliminatedCount() const;
+
+private:
+    // called after the children have been simplified
+    void SimplifyBinary(TNodePtr<TExpr>& expr, TBinaryExpr& binaryExpr);
+
+    // returns the next child to simplify at the stage, or nullptr when the if is done
+    TNodePtr<TExpr>* SimplifyIf(TNodePtr<TExpr>& expr, TIfExpr& ifExpr, std::size_t stage);
+
+    // the nodes of a branch that is dropped without being simplified
+    std::size_t CountDropped(const TExpr& root);
+
+    // replaces the binary expression by its child
+    void ReplaceBy(TNodePtr<TExpr>& expr, TNodePtr<TExpr>& child);
+
+private:
+    TArena* Arena_;
+    std::unordered_map<const TExpr*, TExpr*> Simplified_;
+    std::unordered_set<const TExpr*> Dropped_;
+    std::size_t EliminatedCount_;
+};
+
+// simplifies top-level items, returns the number of eliminated nodes
+std::size_t Simplify(std::span<TNodePtr<TNode>> nodes, TArena* arena = nullptr);
+
+} // namespace NKaleidoscope::NAst
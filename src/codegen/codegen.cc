@@ -1,7 +1,12 @@
 #include "codegen.h"
 
 #include <map>
+#include <span>
 #include <stack>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <llvm/Pass.h>
 
@@ -39,192 +44,642 @@ llvm::legacy::FunctionPassManager ConstructFunctionPassManager(llvm::Module& mod
     return manager;
 }
 
+std::string_view AsName(const TSourceRange& name) { return name.AsStringView(); }
+std::string_view AsName(std::string_view name) { return name; }
+
+// uniform access to the expressions of the pointer tree, the kind of a node
+// is checked before it is cast
+struct TTreeExprs {
+    using TRef = const NAst::TExpr*;
+
+    // the nodes shared by a hash-consed tree are emitted once per function
+    static constexpr bool MEMOIZED = true;
+
+    template <class T>
+    static const T& As(TRef expr) { return static_cast<const T&>(*expr); }
+
+    NAst::ENodeKind GetKind(TRef expr) const { return expr->GetKind(); }
+    double GetValue(TRef expr) const { return As<NAst::TNumberExpr>(expr).GetValue(); }
+
+    // Variable and Call
+    std::string_view GetName(TRef expr) const {
+        if (expr->GetKind() == NAst::ENodeKind::Variable) {
+            return As<NAst::TVariableExpr>(expr).GetName().AsStringView();
+        }
+        return As<NAst::TCallExpr>(expr).GetCallee().AsStringView();
+    }
+    TSymbolId GetSymbol(TRef expr) const {
+        if (expr->GetKind() == NAst::ENodeKind::Variable) {
+            return As<NAst::TVariableExpr>(expr).GetSymbol();
+        }
+        return As<NAst::TCallExpr>(expr).GetCalleeSymbol();
+    }
+
+    NAst::TBinaryExpr::EOp GetOp(TRef expr) const { return As<NAst::TBinaryExpr>(expr).GetOp(); }
+    char GetUserOp(TRef expr) const { return As<NAst::TBinaryExpr>(expr).GetUserOp(); }
+    TRef GetLhs(TRef expr) const { return &As<NAst::TBinaryExpr>(expr).GetLhs(); }
+    TRef GetRhs(TRef expr) const { return &As<NAst::TBinaryExpr>(expr).GetRhs(); }
+
+    TRef GetCond(TRef expr) const { return &As<NAst::TIfExpr>(expr).GetCond(); }
+    TRef GetThen(TRef expr) const { return &As<NAst::TIfExpr>(expr).GetThen(); }
+    TRef GetElse(TRef expr) const { return &As<NAst::TIfExpr>(expr).GetElse(); }
+
+    std::size_t GetArgCount(TRef expr) const { return As<NAst::TCallExpr>(expr).GetArgs().size(); }
+    TRef GetArg(TRef expr, std::size_t i) const { return As<NAst::TCallExpr>(expr).GetArgs()[i].get(); }
+};
+
+// the same for a flat AST in memory or in a cache file
+template <class TAst>
+struct TFlatExprs {
+    using TRef = NAst::TNodeIndex;
+
+    static constexpr bool MEMOIZED = false;
+
+    const TAst& Ast;
+
+    NAst::ENodeKind GetKind(TRef index) const { return Ast.GetKind(index); }
+    double GetValue(TRef index) const { return Ast.GetValue(index); }
+
+    std::string_view GetName(TRef index) const { return AsName(Ast.GetName(index)); }
+    TSymbolId GetSymbol(TRef index) const { return Ast.GetSymbol(index); }
+
+    NAst::TBinaryExpr::EOp GetOp(TRef index) const { return Ast.GetOp(index); }
+    char GetUserOp(TRef index) const { return Ast.GetUserOp(index); }
+    TRef GetLhs(TRef index) const { return Ast.GetLhs(index); }
+    TRef GetRhs(TRef index) const { return Ast.GetRhs(index); }
+
+    TRef GetCond(TRef index) const { return Ast.GetCond(index); }
+    TRef GetThen(TRef index) const { return Ast.GetThen(index); }
+    TRef GetElse(TRef index) const { return Ast.GetElse(index); }
+
+    std::size_t GetArgCount(TRef index) const { return Ast.GetArgs(index).size(); }
+    TRef GetArg(TRef index, std::size_t i) const { return Ast.GetArgs(index)[i]; }
+};
+
 } // namespace
 
 // TCodegenVisitor::TImpl
 class TCodegenVisitor::TImpl {
 public:
-    TImpl(TCodegenVisitor& visitor, EOptimizationLevel optimizationLevel)
-        : Visitor_{visitor}
-        , Builder_{Context_}
-        , Module_{"cool_module", Context_}
-        , FunctionPassManager_{ConstructFunctionPassManager(Module_, optimizationLevel)}
+    TImpl(EOptimizationLevel optimizationLevel, const TSymbolTable* symbols)
+        : Symbols_{symbols}
+        , OptimizationLevel_{optimizationLevel}
+        , EmittedCall_{false}
+        , WrapTopLevelExprs_{false}
     {
+        ResetModule();
     }
 
-    void Visit(const NAst::TNumberExpr& numberExpr) {
-        const llvm::APFloat val{numberExpr.GetValue()};
-        Value_ = llvm::ConstantFP::get(Context_, val);
+    // a top-level item, the expressions may be wrapped into functions
+    void EmitTop(const NAst::TNode& node) {
+        if (WrapTopLevelExprs_ && NAst::IsExprKind(node.GetKind())) {
+            EmitTopLevelExpr([&] {
+                Emit(node);
+                return Value_;
+            });
+        } else {
+            Emit(node);
+        }
     }
 
-    void Visit(const NAst::TVariableExpr& variableExpr) {
-        const std::string_view name = variableExpr.GetName().AsStringView();
-        auto iter = NamedValues_.find(name);
-        if (iter == NamedValues_.end()) {
-            throw std::runtime_error("Expected known named value, found \"" + std::string{name} + "\"");
+    template <class TAst>
+    void GenerateTop(const TAst& ast, NAst::TNodeIndex index) {
+        if (WrapTopLevelExprs_ && NAst::IsExprKind(ast.GetKind(index))) {
+            EmitTopLevelExpr([&] { return GenerateValue(ast, index); });
+        } else {
+            Generate(ast, index);
         }
-        Value_ = iter->second;
     }
 
-    void Visit(const NAst::TBinaryExpr& binaryExpr) {
-        binaryExpr.GetLhs().Accept(Visitor_);
-        llvm::Value* lhsValue = Value_;
+    // the children are visited with the static dispatch
+    void Emit(const NAst::TNode& node) {
+        NAst::Visit(node, [this](const auto& concrete) { Visit(concrete); });
+    }
 
-        binaryExpr.GetRhs().Accept(Visitor_);
-        llvm::Value* rhsValue = Value_;
+    void Visit(const NAst::TExpr& expr) {
+        Value_ = EmitExpr(TTreeExprs{}, &expr);
+    }
 
-        using enum NAst::TBinaryExpr::EOp;
-        switch (binaryExpr.GetOp()) {
-            case Less:
-                Value_ = Builder_.CreateFCmpULT(lhsValue, rhsValue, "cmptmp");
-                Value_ = Builder_.CreateUIToFP(Value_, llvm::Type::getDoubleTy(Context_));
+    void Visit(const NAst::TPrototype& prototype) {
+        std::vector<std::string_view> argNames;
+        for (const auto& arg : prototype.GetArgs()) {
+            argNames.push_back(arg.AsStringView());
+        }
+        Function_ = EmitPrototype(prototype.GetName().AsStringView(), prototype.GetSymbol(), argNames,
+                                  prototype.GetArgSymbols());
+    }
+
+    void Visit(const NAst::TFunction& function) {
+        const NAst::TPrototype& prototype = function.GetPrototype();
+        EmitFunction(
+            prototype.GetName().AsStringView(),
+            prototype.GetSymbol(),
+            [&] { Emit(prototype); },
+            [&] {
+                Emit(function.GetBody());
+                return Value_;
+            });
+    }
+
+    // TAst is a flat AST in memory or in a cache file
+    template <class TAst>
+    void Generate(const TAst& ast, NAst::TNodeIndex index) {
+        using enum NAst::ENodeKind;
+        switch (ast.GetKind(index)) {
+        case Number:
+        case Variable:
+        case Binary:
+        case If:
+        case Call:
+            Value_ = EmitExpr(TFlatExprs<TAst>{ast}, index);
+            break;
+        case Prototype: {
+            std::vector<std::string_view> argNames;
+            std::vector<TSymbolId> argSymbols;
+            for (std::size_t i = 0; i < ast.GetArgNameCount(index); ++i) {
+                argNames.push_back(AsName(ast.GetArgName(index, i)));
+                argSymbols.push_back(ast.GetArgSymbol(index, i));
+            }
+            Function_ = EmitPrototype(AsName(ast.GetName(index)), ast.GetSymbol(index), argNames, argSymbols);
+            break;
+        }
+        case Function: {
+            const NAst::TNodeIndex prototype = ast.GetPrototype(index);
+            EmitFunction(
+                AsName(ast.GetName(prototype)),
+                ast.GetSymbol(prototype),
+                [&] { Generate(ast, prototype); },
+                [&] { return GenerateValue(ast, ast.GetBody(index)); });
+            break;
+        }
+        }
+    }
+
+    const llvm::Value* GetValue() const { return Value_; }
+    const llvm::Function* GetFunction() const { return Function_; }
+
+    llvm::Module& GetModule() { return *Module_; }
+
+    void WrapTopLevelExprs() { WrapTopLevelExprs_ = true; }
+
+    TGeneratedModule ReleaseModule() {
+        TGeneratedModule module{
+            .Context = std::move(Context_),
+            .Module = std::move(Module_),
+            .TopLevelFunctions = std::move(TopLevelFunctions_),
+        };
+        TopLevelFunctions_.clear();
+        ResetModule();
+        return module;
+    }
+
+private:
+    void ResetModule() {
+        FunctionPassManager_.reset();
+        Builder_.reset();
+        Context_ = std::make_unique<llvm::LLVMContext>();
+        Builder_ = std::make_unique<llvm::IRBuilder<>>(*Context_);
+        Module_ = std::make_unique<llvm::Module>("cool_module", *Context_);
+        // the manager can't be moved, so the returned one is constructed in place
+        FunctionPassManager_.reset(new llvm::legacy::FunctionPassManager{
+            ConstructFunctionPassManager(*Module_, OptimizationLevel_)});
+        Functions_.clear();
+        FunctionArgs_.clear();
+        Value_ = nullptr;
+        Function_ = nullptr;
+    }
+
+    // emits "double __anon_expr<N>()" that returns the value
+    void EmitTopLevelExpr(auto&& emitValue) {
+        const std::string name = "__anon_expr" + std::to_string(TopLevelExprCount_++);
+        EmitFunction(
+            name,
+            INVALID_SYMBOL,
+            [&] { Function_ = EmitPrototype(name, INVALID_SYMBOL, /* argNames = */ {}, /* argSymbols = */ {}); },
+            emitValue);
+        TopLevelFunctions_.push_back(name);
+    }
+
+    template <class TAst>
+    llvm::Value* GenerateValue(const TAst& ast, NAst::TNodeIndex index) {
+        Generate(ast, index);
+        return Value_;
+    }
+
+    // An expression of any AST is emitted in post-order with an explicit stack,
+    // so the native stack doesn't grow with the nesting depth. A frame is
+    // revisited after each of its children, whose values are on the value stack.
+    //
+    // A node shared by a hash-consed AST is emitted once per function, the next
+    // occurrences reuse its value. Subtrees with calls are emitted every time,
+    // since the callee may have side effects.
+    template <class TExprs>
+    llvm::Value* EmitExpr(const TExprs& exprs, typename TExprs::TRef root) {
+        using TRef = typename TExprs::TRef;
+        struct TFrame {
+            TRef Expr;
+            std::size_t Stage = 0;
+            // EmittedCall_ of the enclosing memoized node
+            bool EmittedCall = false;
+            // the memo size before a branch of an if
+            std::size_t MemoSize = 0;
+            llvm::Function* Callee = nullptr;
+            TIfBlocks Blocks = {};
+        };
+
+        std::vector<TFrame> frames = {TFrame{.Expr = root}};
+        std::vector<llvm::Value*> values;
+        const auto popValue = [&values] {
+            llvm::Value* value = values.back();
+            values.pop_back();
+            return value;
+        };
+        const auto popMemo = [this](std::size_t memoSize) {
+            while (MemoLog_.size() > memoSize) {
+                Memo_.erase(MemoLog_.back());
+                MemoLog_.pop_back();
+            }
+        };
+        // returns false if the value of the memoized node is already known
+        const auto beginMemoized = [&](TFrame& frame) {
+            if constexpr (TExprs::MEMOIZED) {
+                if (auto iter = Memo_.find(frame.Expr); iter != Memo_.end()) {
+                    values.push_back(iter->second);
+                    frames.pop_back();
+                    return false;
+                }
+                frame.EmittedCall = std::exchange(EmittedCall_, false);
+            }
+            return true;
+        };
+        const auto endMemoized = [&](llvm::Value* value) {
+            const TFrame& frame = frames.back();
+            if constexpr (TExprs::MEMOIZED) {
+                if (!EmittedCall_) {
+                    Memo_.emplace(frame.Expr, value);
+                    MemoLog_.push_back(frame.Expr);
+                }
+                EmittedCall_ = EmittedCall_ || frame.EmittedCall;
+            }
+            frames.pop_back();
+            values.push_back(value);
+        };
+        const auto finish = [&](llvm::Value* value) {
+            frames.pop_back();
+            values.push_back(value);
+        };
+
+        while (!frames.empty()) {
+            TFrame& frame = frames.back();
+            const TRef expr = frame.Expr;
+            using enum NAst::ENodeKind;
+            switch (exprs.GetKind(expr)) {
+            case Number:
+                finish(EmitNumber(exprs.GetValue(expr)));
                 break;
-            case Plus:
-                Value_ = Builder_.CreateFAdd(lhsValue, rhsValue, "addtmp");
+            case Variable:
+                finish(EmitVariable(exprs.GetName(expr), exprs.GetSymbol(expr)));
                 break;
-            case Minus:
-                Value_ = Builder_.CreateFSub(lhsValue, rhsValue, "subtmp");
+            case Binary:
+                if (frame.Stage == 0) {
+                    if (beginMemoized(frame)) {
+                        frame.Stage = 1;
+                        frames.push_back(TFrame{.Expr = exprs.GetLhs(expr)});
+                    }
+                } else if (frame.Stage == 1) {
+                    frame.Stage = 2;
+                    frames.push_back(TFrame{.Expr = exprs.GetRhs(expr)});
+                } else {
+                    llvm::Value* rhsValue = popValue();
+                    llvm::Value* lhsValue = popValue();
+                    endMemoized(EmitBinary(exprs.GetOp(expr), exprs.GetUserOp(expr), lhsValue, rhsValue));
+                }
                 break;
-            case Multiply:
-                Value_ = Builder_.CreateFMul(lhsValue, rhsValue, "multmp");
+            case If:
+                // values of a branch don't dominate the other branch and the merge block
+                if (frame.Stage == 0) {
+                    if (beginMemoized(frame)) {
+                        frame.Stage = 1;
+                        frames.push_back(TFrame{.Expr = exprs.GetCond(expr)});
+                    }
+                } else if (frame.Stage == 1) {
+                    frame.Blocks = BeginIf(popValue());
+                    frame.MemoSize = MemoLog_.size();
+                    frame.Stage = 2;
+                    frames.push_back(TFrame{.Expr = exprs.GetThen(expr)});
+                } else if (frame.Stage == 2) {
+                    popMemo(frame.MemoSize);
+                    BeginElse(frame.Blocks);
+                    frame.Stage = 3;
+                    frames.push_back(TFrame{.Expr = exprs.GetElse(expr)});
+                } else {
+                    popMemo(frame.MemoSize);
+                    llvm::Value* elseValue = popValue();
+                    llvm::Value* thenValue = popValue();
+                    endMemoized(EndIf(frame.Blocks, thenValue, elseValue));
+                }
                 break;
+            case Call: {
+                const std::size_t argCount = exprs.GetArgCount(expr);
+                if (frame.Stage == 0) {
+                    frame.Callee = LookupCallee(exprs.GetName(expr), exprs.GetSymbol(expr), argCount);
+                }
+                if (frame.Stage < argCount) {
+                    frames.push_back(TFrame{.Expr = exprs.GetArg(expr, frame.Stage++)});
+                    break;
+                }
+
+                // build call
+                const llvm::ArrayRef<llvm::Value*> argsValues{values.data() + values.size() - argCount, argCount};
+                llvm::Value* value = Builder_->CreateCall(frame.Callee, argsValues, "calltmp");
+                values.resize(values.size() - argCount);
+                EmittedCall_ = true;
+                finish(value);
+                break;
+            }
+            case Prototype:
+            case Function:
+                throw std::runtime_error("Expected an expression");
+            }
+        }
+        return values.back();
+    }
+
+    // IR emitters shared by the tree and the flat AST
+    llvm::Value* EmitNumber(double value) {
+        const llvm::APFloat val{value};
+        return llvm::ConstantFP::get(*Context_, val);
+    }
+
+    llvm::Value* EmitVariable(std::string_view name, TSymbolId symbol) {
+        llvm::Value* value = nullptr;
+        if (Symbols_) {
+            symbol = Resolve(name, symbol);
+            if (symbol < LocalValues_.size()) {
+                value = LocalValues_[symbol];
+            }
+        } else if (auto iter = NamedValues_.find(name); iter != NamedValues_.end()) {
+            value = iter->second;
+        }
+
+        if (!value) {
+            throw std::runtime_error("Expected known named value, found \"" + std::string{name} + "\"");
+        }
+        return value;
+    }
+
+    llvm::Value* EmitBinary(NAst::TBinaryExpr::EOp op, char userOp, llvm::Value* lhsValue, llvm::Value* rhsValue) {
+        using enum NAst::TBinaryExpr::EOp;
+        switch (op) {
+            case Less: {
+                llvm::Value* value = Builder_->CreateFCmpULT(lhsValue, rhsValue, "cmptmp");
+                return Builder_->CreateUIToFP(value, llvm::Type::getDoubleTy(*Context_));
+            }
+            case Plus:
+                return Builder_->CreateFAdd(lhsValue, rhsValue, "addtmp");
+            case Minus:
+                return Builder_->CreateFSub(lhsValue, rhsValue, "subtmp");
+            case Multiply:
+                return Builder_->CreateFMul(lhsValue, rhsValue, "multmp");
+            case User: {
+                const std::string calleeName = std::string{"binary"} + userOp;
+                llvm::Function* calleeFunction = LookupCallee(calleeName, INVALID_SYMBOL, 2);
+                EmittedCall_ = true;
+                return Builder_->CreateCall(calleeFunction, {lhsValue, rhsValue}, "binop");
+            }
         }
+        __builtin_unreachable();
     }
 
-    void Visit(const NAst::TIfExpr& ifExpr) {
-        ifExpr.GetCond().Accept(Visitor_);
-        llvm::Value* condValue = Value_;
+    // the blocks of an if being emitted
+    struct TIfBlocks {
+        llvm::BasicBlock* Then;
+        llvm::BasicBlock* Else;
+        llvm::BasicBlock* Merge;
+    };
 
+    // emits the branch on the condition and starts the 'then' block
+    TIfBlocks BeginIf(llvm::Value* condValue) {
         // convert condition to a bool by comparing non-equal to 0.0
-        condValue = Builder_.CreateFCmpONE(condValue,
-                                           llvm::ConstantFP::get(Context_, llvm::APFloat{0.0}),
+        condValue = Builder_->CreateFCmpONE(condValue,
+                                           llvm::ConstantFP::get(*Context_, llvm::APFloat{0.0}),
                                            "ifcond");
 
         // create blocks for then/else cases
-        llvm::Function* func = Builder_.GetInsertBlock()->getParent();
-        llvm::BasicBlock* thenBlock = llvm::BasicBlock::Create(Context_, "then", func);
-        llvm::BasicBlock* elseBlock = llvm::BasicBlock::Create(Context_, "else");
-        llvm::BasicBlock* mergeBlock = llvm::BasicBlock::Create(Context_, "ifcont");
+        llvm::Function* func = Builder_->GetInsertBlock()->getParent();
+        TIfBlocks blocks{
+            .Then = llvm::BasicBlock::Create(*Context_, "then", func),
+            .Else = llvm::BasicBlock::Create(*Context_, "else"),
+            .Merge = llvm::BasicBlock::Create(*Context_, "ifcont"),
+        };
 
-        Builder_.CreateCondBr(condValue, thenBlock, elseBlock);
+        Builder_->CreateCondBr(condValue, blocks.Then, blocks.Else);
 
         // emit 'then' block
-        Builder_.SetInsertPoint(thenBlock);
-        ifExpr.GetThen().Accept(Visitor_);
-        llvm::Value* thenValue = Value_;
-        Builder_.CreateBr(mergeBlock); // unconditional branch
-        thenBlock = Builder_.GetInsertBlock();
-
-        // emit 'else' block
-        func->getBasicBlockList().push_back(elseBlock);
-        Builder_.SetInsertPoint(elseBlock);
-        ifExpr.GetElse().Accept(Visitor_);
-        llvm::Value* elseValue = Value_;
-        Builder_.CreateBr(mergeBlock); // unconditional branch
-        elseBlock = Builder_.GetInsertBlock();
+        Builder_->SetInsertPoint(blocks.Then);
+        return blocks;
+    }
 
-        // emit merge block
-        func->getBasicBlockList().push_back(mergeBlock);
-        Builder_.SetInsertPoint(mergeBlock);
-        llvm::PHINode* phiNode = Builder_.CreatePHI(llvm::Type::getDoubleTy(Context_), 2, "iftmp");
-        phiNode->addIncoming(thenValue, thenBlock);
-        phiNode->addIncoming(elseValue, elseBlock);
+    // ends the 'then' block and starts the 'else' one
+    void BeginElse(TIfBlocks& blocks) {
+        Builder_->CreateBr(blocks.Merge); // unconditional branch
+        blocks.Then = Builder_->GetInsertBlock();
+
+        llvm::Function* func = blocks.Then->getParent();
+        func->getBasicBlockList().push_back(blocks.Else);
+        Builder_->SetInsertPoint(blocks.Else);
+    }
+
+    // ends the 'else' block and merges the values of the branches
+    llvm::Value* EndIf(TIfBlocks& blocks, llvm::Value* thenValue, llvm::Value* elseValue) {
+        Builder_->CreateBr(blocks.Merge); // unconditional branch
+        blocks.Else = Builder_->GetInsertBlock();
 
-        Value_ = phiNode;
+        // emit merge block
+        llvm::Function* func = blocks.Else->getParent();
+        func->getBasicBlockList().push_back(blocks.Merge);
+        Builder_->SetInsertPoint(blocks.Merge);
+        llvm::PHINode* phiNode = Builder_->CreatePHI(llvm::Type::getDoubleTy(*Context_), 2, "iftmp");
+        phiNode->addIncoming(thenValue, blocks.Then);
+        phiNode->addIncoming(elseValue, blocks.Else);
+
+        return phiNode;
     }
 
-    void Visit(const NAst::TCallExpr& callExpr) {
-        // lookup callee function in the module
-        const std::string_view calleeName = callExpr.GetCallee().AsStringView();
-        llvm::Function* calleeFunction = Module_.getFunction(calleeName);
+    llvm::Function* LookupCallee(std::string_view calleeName, TSymbolId symbol, std::size_t argCount) {
+        llvm::Function* calleeFunction = LookupFunction(calleeName, symbol);
         if (!calleeFunction) {
             throw std::runtime_error("Unknown function \"" + std::string{calleeName} + "\"");
         }
 
         // check arguments count
-        const auto& args = callExpr.GetArgs();
-        if (calleeFunction->arg_size() != args.size()) {
+        if (calleeFunction->arg_size() != argCount) {
             throw std::runtime_error("Incorrect number of arguments");
         }
-
-        // build call
-        std::vector<llvm::Value*> argsValues;
-        for (const auto& arg : args) {
-            arg->Accept(Visitor_);
-            argsValues.emplace_back(Value_);
-        }
-        Value_ = Builder_.CreateCall(calleeFunction, argsValues, "calltmp");
+        return calleeFunction;
     }
 
-    void Visit(const NAst::TPrototype& prototype) {
-        const std::string_view name = prototype.GetName().AsStringView();
-        const auto& prototypeArgs = prototype.GetArgs();
-
-        std::vector<llvm::Type*> doubles{prototypeArgs.size(), llvm::Type::getDoubleTy(Context_)};
+    llvm::Function* EmitPrototype(std::string_view name, TSymbolId symbol,
+                                  const std::vector<std::string_view>& argNames,
+                                  std::span<const TSymbolId> argSymbols)
+    {
+        std::vector<llvm::Type*> doubles{argNames.size(), llvm::Type::getDoubleTy(*Context_)};
         llvm::FunctionType* functionType = llvm::FunctionType::get(
-            llvm::Type::getDoubleTy(Context_), doubles, /* isVarArg = */ false);
+            llvm::Type::getDoubleTy(*Context_), doubles, /* isVarArg = */ false);
 
-        Function_ = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, name, Module_);
+        llvm::Function* function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, name, *Module_);
 
         // set names for all arguments
         std::size_t idx = 0;
-        for (auto& arg : Function_->args()) {
-            arg.setName(prototypeArgs[idx++].AsStringView());
+        for (auto& arg : function->args()) {
+            arg.setName(argNames[idx++]);
+        }
+
+        // a repeated declaration gets a uniqued name, the first one stays reachable by the name
+        if (Symbols_ && function->getName() == llvm::StringRef{name}) {
+            symbol = Resolve(name, symbol);
+            SetSlot(Functions_, symbol, function);
+            // the body of a later definition refers to the args by these ids
+            if (symbol != INVALID_SYMBOL) {
+                if (symbol >= FunctionArgs_.size()) {
+                    FunctionArgs_.resize(symbol + 1);
+                }
+                FunctionArgs_[symbol].clear();
+                for (std::size_t i = 0; i < argNames.size(); ++i) {
+                    FunctionArgs_[symbol].push_back(Resolve(argNames[i], argSymbols[i]));
+                }
+            }
         }
+        return function;
     }
 
-    void Visit(const NAst::TFunction& function) {
-        const std::string_view funcName = function.GetPrototype().GetName().AsStringView();
-        llvm::Function* func = Module_.getFunction(funcName);
+    void EmitFunction(std::string_view funcName, TSymbolId symbol, auto&& emitPrototype, auto&& emitBody) {
+        llvm::Function* func = LookupFunction(funcName, symbol);
         if (!func) {
-            function.GetPrototype().Accept(Visitor_);
+            emitPrototype();
             func = Function_;
         }
         if (!func->empty()) {
             throw std::runtime_error("Can't redefine function \"" + std::string{funcName} + "\"");
         }
 
+        // memoized values are only valid inside the function
+        ClearMemo();
+        struct TMemoGuard {
+            TImpl* Impl;
+            ~TMemoGuard() { Impl->ClearMemo(); }
+        } memoGuard{this};
+
         // create BBs for body
-        llvm::BasicBlock* basicBlock = llvm::BasicBlock::Create(Context_, "entry", func);
-        Builder_.SetInsertPoint(basicBlock);
+        llvm::BasicBlock* basicBlock = llvm::BasicBlock::Create(*Context_, "entry", func);
+        Builder_->SetInsertPoint(basicBlock);
 
         // record function arguments' names
-        NamedValues_.clear();
-        for (auto& arg : func->args()) {
-            NamedValues_[arg.getName()] = &arg;
+        if (Symbols_) {
+            for (TSymbolId local : Locals_) {
+                LocalValues_[local] = nullptr;
+            }
+            Locals_.clear();
+            symbol = Resolve(funcName, symbol);
+            // the args of a function whose name isn't in the table are found by their names
+            const bool hasArgSymbols = symbol < FunctionArgs_.size() && FunctionArgs_[symbol].size() == func->arg_size();
+            for (auto& arg : func->args()) {
+                const TSymbolId local = hasArgSymbols ? FunctionArgs_[symbol][arg.getArgNo()]
+                                                      : Symbols_->Find(arg.getName());
+                // the first of the args with the same name wins, like with the names
+                if (local != INVALID_SYMBOL && !(local < LocalValues_.size() && LocalValues_[local])) {
+                    SetSlot(LocalValues_, local, &arg);
+                    Locals_.push_back(local);
+                }
+            }
+        } else {
+            NamedValues_.clear();
+            for (auto& arg : func->args()) {
+                NamedValues_[arg.getName()] = &arg;
+            }
         }
 
         // return expression value
-        function.GetBody().Accept(Visitor_);
-        Builder_.CreateRet(Value_);
+        Builder_->CreateRet(emitBody());
         llvm::verifyFunction(*func);
-        FunctionPassManager_.run(*func);
+        FunctionPassManager_->run(*func);
     }
 
-    const llvm::Value* GetValue() const { return Value_; }
-    const llvm::Function* GetFunction() const { return Function_; }
+    void ClearMemo() {
+        Memo_.clear();
+        MemoLog_.clear();
+    }
+
+    // nodes built without a symbol table still carry their names
+    TSymbolId Resolve(std::string_view name, TSymbolId symbol) const {
+        return symbol != INVALID_SYMBOL ? symbol : Symbols_->Find(name);
+    }
 
-    llvm::Module& GetModule() { return Module_; }
+    llvm::Function* LookupFunction(std::string_view name, TSymbolId symbol) {
+        if (!Symbols_) {
+            return Module_->getFunction(name);
+        }
+        symbol = Resolve(name, symbol);
+        if (symbol < Functions_.size() && Functions_[symbol]) {
+            return Functions_[symbol];
+        }
+        llvm::Function* function = Module_->getFunction(name);
+        if (function && symbol != INVALID_SYMBOL) {
+            SetSlot(Functions_, symbol, function);
+        }
+        return function;
+    }
+
+    template <typename T>
+    static void SetSlot(std::vector<T*>& slots, TSymbolId symbol, std::type_identity_t<T*> value) {
+        if (symbol == INVALID_SYMBOL) {
+            return;
+        }
+        if (symbol >= slots.size()) {
+            slots.resize(symbol + 1, nullptr);
+        }
+        slots[symbol] = value;
+    }
 
 private:
-    // base visitor
-    TCodegenVisitor& Visitor_;
-
-    // llvm classes
-    llvm::LLVMContext Context_;
-    llvm::IRBuilder<> Builder_;
-    llvm::Module Module_;
-    llvm::legacy::FunctionPassManager FunctionPassManager_;
+    // names are resolved by string if there is no symbol table
+    const TSymbolTable* Symbols_;
+
+    // llvm classes, the module and its context are handed over by ReleaseModule
+    EOptimizationLevel OptimizationLevel_;
+    std::unique_ptr<llvm::LLVMContext> Context_;
+    std::unique_ptr<llvm::IRBuilder<>> Builder_;
+    std::unique_ptr<llvm::Module> Module_;
+    std::unique_ptr<llvm::legacy::FunctionPassManager> FunctionPassManager_;
     std::map<std::string_view, llvm::Value*, std::less<>> NamedValues_;
 
+    // tables indexed by symbols, Locals_ are the symbols set in LocalValues_
+    std::vector<llvm::Value*> LocalValues_;
+    std::vector<TSymbolId> Locals_;
+    std::vector<llvm::Function*> Functions_;
+    // the ids of the args of Functions_
+    std::vector<std::vector<TSymbolId>> FunctionArgs_;
+
+    // values of the pure nodes emitted in the current function, MemoLog_ is
+    // in the order of emission
+    std::unordered_map<const NAst::TExpr*, llvm::Value*> Memo_;
+    std::vector<const NAst::TExpr*> MemoLog_;
+    bool EmittedCall_;
+
+    // the names of the functions made of top-level expressions in this module,
+    // the count goes on over the released modules to keep the names unique
+    bool WrapTopLevelExprs_;
+    std::vector<std::string> TopLevelFunctions_;
+    std::size_t TopLevelExprCount_ = 0;
+
     // visitor's values
-    llvm::Value* Value_;
-    llvm::Function* Function_;
+    llvm::Value* Value_ = nullptr;
+    llvm::Function* Function_ = nullptr;
 };
 
 // TCodegenVisitor
-TCodegenVisitor::TCodegenVisitor(EOptimizationLevel optimizationLevel)
-    : Impl_{std::make_unique<TImpl>(*this, optimizationLevel)}
+TCodegenVisitor::TCodegenVisitor(EOptimizationLevel optimizationLevel, const TSymbolTable* symbols)
+    : Impl_{std::make_unique<TImpl>(optimizationLevel, symbols)}
 {
 }
 
@@ -240,9 +695,31 @@ void TCodegenVisitor::Visit(const NAst::TCallExpr& callExpr) { Impl_->Visit(call
 void TCodegenVisitor::Visit(const NAst::TPrototype& prototype) { Impl_->Visit(prototype); }
 void TCodegenVisitor::Visit(const NAst::TFunction& function) { Impl_->Visit(function); }
 
+void TCodegenVisitor::Generate(const NAst::TNode& node) { Impl_->EmitTop(node); }
+
+void TCodegenVisitor::Generate(const NAst::TFlatAst& ast, NAst::TNodeIndex index) { Impl_->GenerateTop(ast, index); }
+
+void TCodegenVisitor::Generate(const NAst::TFlatAst& ast) {
+    for (NAst::TNodeIndex top : ast.GetTops()) {
+        Impl_->GenerateTop(ast, top);
+    }
+}
+
+void TCodegenVisitor::Generate(const NAst::TAstCache& cache, NAst::TNodeIndex index) { Impl_->GenerateTop(cache, index); }
+
+void TCodegenVisitor::Generate(const NAst::TAstCache& cache) {
+    for (NAst::TNodeIndex top : cache.GetTops()) {
+        Impl_->GenerateTop(cache, top);
+    }
+}
+
+void TCodegenVisitor::WrapTopLevelExprs() { Impl_->WrapTopLevelExprs(); }
+
 const llvm::Value* TCodegenVisitor::GetValue() const { return Impl_->GetValue(); }
 const llvm::Function* TCodegenVisitor::GetFunction() const { return Impl_->GetFunction(); }
 
 llvm::Module& TCodegenVisitor::GetModule() { return Impl_->GetModule(); }
 
+TGeneratedModule TCodegenVisitor::ReleaseModule() { return Impl_->ReleaseModule(); }
+
 } // namespace NKaleidoscope
@@ -1,8 +1,17 @@
 #pragma once
 
 #include "ast.h"
+#include "ast_cache.h"
+#include "flat_ast.h"
+#include "symbol.h"
 
 #include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace NKaleidoscope {
 
@@ -11,9 +20,20 @@ enum struct EOptimizationLevel {
     High,
 };
 
+// a module with the context it lives in, e.g. for a JIT
+struct TGeneratedModule {
+    std::unique_ptr<llvm::LLVMContext> Context;
+    std::unique_ptr<llvm::Module> Module;
+    // the functions of the wrapped top-level expressions in source order
+    std::vector<std::string> TopLevelFunctions;
+};
+
 class TCodegenVisitor : public NAst::IVisitor {
 public:
-    TCodegenVisitor(EOptimizationLevel optimizationLevel = EOptimizationLevel::High);
+    // with the symbol table that the AST was parsed with, names are resolved
+    // by their ids instead of strings
+    TCodegenVisitor(EOptimizationLevel optimizationLevel = EOptimizationLevel::High,
+                    const TSymbolTable* symbols = nullptr);
     ~TCodegenVisitor();
 
     void Visit(const NAst::TNumberExpr&) override;
@@ -24,11 +44,30 @@ public:
     void Visit(const NAst::TPrototype&) override;
     void Visit(const NAst::TFunction&) override;
 
+    // Generate wraps every top-level expression into a function
+    // "double __anon_expr<N>()" that returns its value, so it can be run
+    void WrapTopLevelExprs();
+
+    // the same as Accept, but the nodes are dispatched statically
+    void Generate(const NAst::TNode& node);
+
+    // the flat AST is generated exactly like the same pointer tree
+    void Generate(const NAst::TFlatAst& ast, NAst::TNodeIndex index);
+    void Generate(const NAst::TFlatAst& ast);
+
+    // the AST is read right from the cache file
+    void Generate(const NAst::TAstCache& cache, NAst::TNodeIndex index);
+    void Generate(const NAst::TAstCache& cache);
+
     const llvm::Value* GetValue() const;
     const llvm::Function* GetFunction() const;
 
     llvm::Module& GetModule();
 
+    // hands the module over and goes on with an empty one, which doesn't
+    // know the functions of the released module
+    TGeneratedModule ReleaseModule();
+
 private:
     class TImpl;
     std::unique_ptr<TImpl> Impl_;
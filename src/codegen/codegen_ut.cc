@@ -1,8 +1,16 @@
 #include <gtest/gtest.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include "bind_symbols.h"
 #include "codegen.h"
 #include "lexer.h"
 #include "parser.h"
 
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
 using namespace NKaleidoscope;
 using namespace NKaleidoscope::NAst;
 
@@ -15,6 +23,13 @@ std::string Print(auto* element) {
     return str;
 }
 
+std::string PrintModule(llvm::Module& module) {
+    std::string str;
+    llvm::raw_string_ostream rso{str};
+    module.print(rso, /* annotationWriter = */ nullptr);
+    return str;
+}
+
 } // namespace
 
 TEST(CodegenTest, NumberExpr) {
@@ -180,3 +195,335 @@ ifcont:                                           ; preds = %else, %then
 }
 )");
 }
+
+TEST(CodegenTest, FlatAst) {
+    constexpr std::string_view sourceStr = R"(
+extern foo(x);
+def bar(a b) if a < b then foo(a) else bar(b - 1, a) * 2;
+def baz(x) bar(x, 31337) + 1;
+)";
+    for (const auto level : {EOptimizationLevel::Zero, EOptimizationLevel::High}) {
+        auto source = TSource::FromString(std::string{sourceStr});
+
+        TCodegenVisitor treeCodegen{level};
+        TParser treeParser{source};
+        for (auto&& astNode : treeParser.ParseChunk()) {
+            astNode->Accept(treeCodegen);
+        }
+
+        TCodegenVisitor flatCodegen{level};
+        TParser flatParser{source};
+        flatCodegen.Generate(flatParser.ParseChunkFlat());
+
+        EXPECT_EQ(PrintModule(flatCodegen.GetModule()), PrintModule(treeCodegen.GetModule()));
+        EXPECT_EQ(Print(flatCodegen.GetFunction()), Print(treeCodegen.GetFunction()));
+    }
+}
+
+TEST(CodegenTest, Symbols) {
+    constexpr std::string_view sourceStr = R"(
+extern foo(x);
+extern foo(y);
+def bar(a b) if a < b then foo(a) else bar(b - 1, a) * 2;
+def baz(x) bar(x, 31337) + 1;
+def qux(a a) a * foo(a);
+extern quux(p);
+def quux(p) p * 2;
+)";
+    auto source = TSource::FromString(std::string{sourceStr});
+
+    TCodegenVisitor plainCodegen;
+    TParser plainParser{source};
+    auto plainNodes = plainParser.ParseChunk();
+    for (auto&& astNode : plainNodes) {
+        astNode->Accept(plainCodegen);
+    }
+
+    TSymbolTable symbols;
+    TCodegenVisitor treeCodegen{EOptimizationLevel::High, &symbols};
+    TParser treeParser{source, /* arena = */ nullptr, &symbols};
+    for (auto&& astNode : treeParser.ParseChunk()) {
+        astNode->Accept(treeCodegen);
+    }
+
+    TCodegenVisitor flatCodegen{EOptimizationLevel::High, &symbols};
+    TParser flatParser{source, /* arena = */ nullptr, &symbols};
+    flatCodegen.Generate(flatParser.ParseChunkFlat());
+
+    EXPECT_EQ(PrintModule(treeCodegen.GetModule()), PrintModule(plainCodegen.GetModule()));
+    EXPECT_EQ(PrintModule(flatCodegen.GetModule()), PrintModule(plainCodegen.GetModule()));
+
+    // the ids bound after parsing, the args included
+    TSymbolTable boundSymbols;
+    NAst::BindSymbols(plainNodes, boundSymbols);
+    TCodegenVisitor boundCodegen{EOptimizationLevel::High, &boundSymbols};
+    for (auto&& astNode : plainNodes) {
+        astNode->Accept(boundCodegen);
+    }
+    EXPECT_EQ(boundSymbols.Size(), symbols.Size());
+    EXPECT_EQ(PrintModule(boundCodegen.GetModule()), PrintModule(plainCodegen.GetModule()));
+
+    // a node without a symbol is resolved by its name
+    const TVariableExpr unknown{TSourceRange{.Source = &source, .Offset = 1, .Length = 6}};
+    EXPECT_THROW(unknown.Accept(treeCodegen), std::runtime_error);
+}
+
+TEST(CodegenTest, UserOperator) {
+    auto source = TSource::FromString(R"(
+def binary| 5 (a b) if a then 1 else if b then 1 else 0;
+def f(x y) (x | y) + (x | y);
+)");
+
+    TCodegenVisitor treeCodegen;
+    for (auto&& astNode : TParser{source}.ParseChunk()) {
+        astNode->Accept(treeCodegen);
+    }
+    EXPECT_EQ("\n" + Print(treeCodegen.GetFunction()), R"(
+define double @f(double %x, double %y) {
+entry:
+  %binop = call double @"binary|"(double %x, double %y)
+  %binop1 = call double @"binary|"(double %x, double %y)
+  %addtmp = fadd double %binop, %binop1
+  ret double %addtmp
+}
+)");
+
+    // a user operator is a call, so the hash-consed one is emitted twice too
+    TSymbolTable symbols;
+    TArena arena;
+    TCodegenVisitor consedCodegen{EOptimizationLevel::High, &symbols};
+    TParser consedParser{source, &arena, &symbols};
+    consedParser.EnableHashConsing();
+    for (auto&& astNode : consedParser.ParseChunk()) {
+        astNode->Accept(consedCodegen);
+    }
+    EXPECT_EQ(PrintModule(consedCodegen.GetModule()), PrintModule(treeCodegen.GetModule()));
+
+    TCodegenVisitor flatCodegen;
+    flatCodegen.Generate(TParser{source}.ParseChunkFlat());
+    EXPECT_EQ(PrintModule(flatCodegen.GetModule()), PrintModule(treeCodegen.GetModule()));
+}
+
+TEST(CodegenTest, DeepNesting) {
+    constexpr int depth = 100'000;
+    std::string buffer = "extern g(x); def f(x) ";
+    for (int i = 0; i < depth; ++i) {
+        buffer += i % 3 == 0 ? "(x + " : i % 3 == 1 ? "g(" : "if x then ";
+    }
+    buffer += "x";
+    for (int i = depth - 1; i >= 0; --i) {
+        buffer += i % 3 == 0 ? ")" : i % 3 == 1 ? ")" : " else 2";
+    }
+    auto source = TSource::FromString(std::move(buffer));
+
+    TArena arena;
+    TParser parser{source, &arena};
+    const auto nodes = parser.ParseChunk();
+
+    TCodegenVisitor treeCodegen{EOptimizationLevel::Zero};
+    for (const auto& node : nodes) {
+        treeCodegen.Generate(*node);
+    }
+    EXPECT_FALSE(llvm::verifyModule(treeCodegen.GetModule(), &llvm::errs()));
+    // an if adds 3 blocks
+    EXPECT_EQ(treeCodegen.GetFunction()->size(), 1 + depth / 3 * 3);
+
+    TCodegenVisitor flatCodegen{EOptimizationLevel::Zero};
+    flatCodegen.Generate(NAst::Flatten(nodes));
+    EXPECT_EQ(flatCodegen.GetFunction()->size(), treeCodegen.GetFunction()->size());
+}
+
+TEST(CodegenTest, HashConsing) {
+    auto source = TSource::FromString(R"(
+extern g(a);
+def f(x) x*x + x*x;
+def h(x) g(x) + g(x);
+def k(x) if x then x*x else x*x + 1;
+)");
+
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    TParser parser{source, &arena, &symbols};
+    parser.EnableHashConsing();
+
+    TCodegenVisitor codegen{EOptimizationLevel::Zero, &symbols};
+    for (auto&& astNode : parser.ParseChunk()) {
+        astNode->Accept(codegen);
+    }
+    EXPECT_FALSE(llvm::verifyModule(codegen.GetModule(), &llvm::errs()));
+
+    EXPECT_EQ("\n" + PrintModule(codegen.GetModule()), R"(
+; ModuleID = 'cool_module'
+source_filename = "cool_module"
+
+declare double @g(double)
+
+define double @f(double %x) {
+entry:
+  %multmp = fmul double %x, %x
+  %addtmp = fadd double %multmp, %multmp
+  ret double %addtmp
+}
+
+define double @h(double %x) {
+entry:
+  %calltmp = call double @g(double %x)
+  %calltmp1 = call double @g(double %x)
+  %addtmp = fadd double %calltmp, %calltmp1
+  ret double %addtmp
+}
+
+define double @k(double %x) {
+entry:
+  %ifcond = fcmp one double %x, 0.000000e+00
+  br i1 %ifcond, label %then, label %else
+
+then:                                             ; preds = %entry
+  %multmp = fmul double %x, %x
+  br label %ifcont
+
+else:                                             ; preds = %entry
+  %multmp1 = fmul double %x, %x
+  %addtmp = fadd double %multmp1, 1.000000e+00
+  br label %ifcont
+
+ifcont:                                           ; preds = %else, %then
+  %iftmp = phi double [ %multmp, %then ], [ %addtmp, %else ]
+  ret double %iftmp
+}
+)");
+}
+
+TEST(CodegenTest, AstCache) {
+    constexpr std::string_view sourceStr = R"(
+extern foo(x);
+def bar(a b) if a < b then foo(a) else bar(b - 1, a) * 2;
+def baz(x) bar(x, 31337) + 1;
+baz(2 * 3);
+)";
+    const std::string cacheFile = ::testing::TempDir() + "codegen_ut.kast";
+    auto source = TSource::FromString(std::string{sourceStr});
+
+    TSymbolTable treeSymbols;
+    TCodegenVisitor treeCodegen{EOptimizationLevel::High, &treeSymbols};
+    TParser parser{source, /* arena = */ nullptr, &treeSymbols};
+    const auto nodes = parser.ParseChunk();
+    for (auto&& astNode : nodes) {
+        astNode->Accept(treeCodegen);
+    }
+    WriteAstCache(Flatten(nodes), source, cacheFile);
+
+    TAstCache cache{cacheFile};
+    EXPECT_TRUE(cache.Matches(source));
+    EXPECT_FALSE(cache.Matches(TSource::FromString(std::string{sourceStr} + " ")));
+    EXPECT_EQ(cache.GetTops().size(), nodes.size());
+
+    // without symbols the names are resolved by strings
+    TCodegenVisitor plainCodegen;
+    plainCodegen.Generate(cache);
+    EXPECT_EQ(PrintModule(plainCodegen.GetModule()), PrintModule(treeCodegen.GetModule()));
+
+    TSymbolTable symbols;
+    cache.BindSymbols(symbols);
+    EXPECT_EQ(symbols.Size(), 6);
+    TCodegenVisitor codegen{EOptimizationLevel::High, &symbols};
+    codegen.Generate(cache);
+    EXPECT_EQ(PrintModule(codegen.GetModule()), PrintModule(treeCodegen.GetModule()));
+    EXPECT_EQ(Print(codegen.GetValue()), Print(treeCodegen.GetValue()));
+}
+
+TEST(CodegenTest, AstCacheMalformed) {
+    const std::string cacheFile = ::testing::TempDir() + "codegen_ut_malformed.kast";
+    auto source = TSource::FromString("def foo(x) x*x + foo(x - 1)");
+    TParser parser{source};
+    WriteAstCache(Flatten(parser.ParseChunk()), source, cacheFile);
+
+    std::string data;
+    {
+        std::ifstream input{cacheFile, std::ios::binary};
+        data.assign(std::istreambuf_iterator<char>{input}, {});
+    }
+    ASSERT_GT(data.size(), sizeof(TAstCacheHeader));
+    const auto write = [&](std::string_view content) {
+        std::ofstream output{cacheFile, std::ios::binary | std::ios::trunc};
+        output << content;
+    };
+
+    // truncated
+    write(std::string_view{data}.substr(0, data.size() - 8));
+    EXPECT_THROW(TAstCache{cacheFile}, std::runtime_error);
+
+    // another version
+    std::string corrupted = data;
+    corrupted[offsetof(TAstCacheHeader, Version)] ^= 1;
+    write(corrupted);
+    EXPECT_THROW(TAstCache{cacheFile}, std::runtime_error);
+
+    // a child refers to its parent
+    corrupted = data;
+    const std::size_t nodesOffset = reinterpret_cast<const TAstCacheHeader*>(data.data())->Nodes.Offset;
+    TFlatNode node;
+    std::memcpy(&node, corrupted.data() + nodesOffset + sizeof(TFlatNode) * 3, sizeof(node));
+    ASSERT_EQ(node.Kind, ENodeKind::Binary);
+    node.A = 3;
+    std::memcpy(corrupted.data() + nodesOffset + sizeof(TFlatNode) * 3, &node, sizeof(node));
+    write(corrupted);
+    EXPECT_THROW(TAstCache{cacheFile}, std::runtime_error);
+
+    // the padding of the nodes is written as zeros and should stay so
+    for (std::size_t i = 0; i < reinterpret_cast<const TAstCacheHeader*>(data.data())->Nodes.Count; ++i) {
+        std::memcpy(&node, data.data() + nodesOffset + sizeof(TFlatNode) * i, sizeof(node));
+        EXPECT_EQ(node.Reserved, 0);
+    }
+    corrupted = data;
+    corrupted[nodesOffset + offsetof(TFlatNode, Reserved)] = 1;
+    write(corrupted);
+    EXPECT_THROW(TAstCache{cacheFile}, std::runtime_error);
+
+    write(data);
+    EXPECT_NO_THROW(TAstCache{cacheFile});
+}
+
+TEST(CodegenTest, AstCacheWriteError) {
+    // a non-empty directory can't be replaced by the cache file
+    const std::filesystem::path directory = ::testing::TempDir() + "codegen_ut_write_error";
+    const std::filesystem::path cacheFile = directory / "test.kast";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(cacheFile / "child");
+
+    auto source = TSource::FromString("def foo(x) x*x");
+    TParser parser{source};
+    EXPECT_THROW(WriteAstCache(Flatten(parser.ParseChunk()), source, cacheFile.string()), std::exception);
+
+    // the temporary file is removed
+    const auto entries = std::distance(std::filesystem::directory_iterator{directory}, {});
+    EXPECT_EQ(entries, 1);
+    std::filesystem::remove_all(directory);
+}
+
+TEST(CodegenTest, WrapTopLevelExprs) {
+    TCodegenVisitor codegen{EOptimizationLevel::Zero};
+    codegen.WrapTopLevelExprs();
+
+    auto source = TSource::FromString("extern cos(x); cos(1) + 2;");
+    for (auto&& astNode : TParser{source}.ParseChunk()) {
+        codegen.Generate(*astNode);
+    }
+    EXPECT_EQ("\n" + Print(codegen.GetFunction()), R"(
+define double @__anon_expr0() {
+entry:
+  %calltmp = call double @cos(double 1.000000e+00)
+  %addtmp = fadd double %calltmp, 2.000000e+00
+  ret double %addtmp
+}
+)");
+
+    TGeneratedModule module = codegen.ReleaseModule();
+    EXPECT_EQ(module.TopLevelFunctions, std::vector<std::string>{"__anon_expr0"});
+    EXPECT_FALSE(llvm::verifyModule(*module.Module, &llvm::errs()));
+    ASSERT_NE(module.Module->getFunction("cos"), nullptr);
+
+    // the visitor goes on with an empty module
+    EXPECT_EQ(codegen.GetModule().getFunction("cos"), nullptr);
+    EXPECT_THROW(codegen.Generate(*TParser{source}.ParseChunk().back()), std::runtime_error);
+}
@@ -1,6 +1,8 @@
 #include "dump.h"
 
 #include <sstream>
+#include <type_traits>
+#include <vector>
 
 using namespace NKaleidoscope::NAst;
 
@@ -10,103 +12,213 @@ namespace {
 
 constexpr std::string_view DUMP_CHILD_INDENT = "  ";
 
-char BinaryExprOpToChar(TBinaryExpr::EOp op) {
+char BinaryExprOpToChar(TBinaryExpr::EOp op, char userOp) {
     using enum TBinaryExpr::EOp;
     switch (op) {
         case Less: return '<';
         case Plus: return '+';
         case Minus: return '-';
         case Multiply: return '*';
+        case User: return userOp;
         default: __builtin_unreachable();
     }
 }
 
-std::string Indent(std::string s) {
-    std::stringstream result;
-    result << DUMP_CHILD_INDENT;
-    for (std::size_t i = 0; i < s.size(); ++i) {
-        result << s[i];
-        if (s[i] == '\n' && i != s.size() - 1) {
-            result << DUMP_CHILD_INDENT;
+std::string FormatName(const TSourceRange& name, EDumpMode mode) {
+    std::string result = "\"" + std::string{name.AsStringView()} + "\"";
+    if (mode == EDumpMode::WithLocations) {
+        const TSourceLocation location = name.Locate();
+        result += " (" + std::to_string(location.Line) + ":" + std::to_string(location.Column) + ")";
+    }
+    return result;
+}
+
+// a node to dump, or a label line if the label is not empty
+template <class TNodeRef>
+struct TDumpItem {
+    TNodeRef Node;
+    std::size_t Depth;
+    std::string_view Label = {};
+};
+
+// Dumps the nodes in pre-order with an explicit stack, every line is indented
+// by the depth of its node. The writer prints the header line of a node and
+// appends its children and labels in order.
+template <class TNodeRef, class TWriter>
+std::string DumpIteratively(TNodeRef root, TWriter&& writeNode) {
+    std::stringstream ss;
+    std::vector<TDumpItem<TNodeRef>> stack = {{.Node = root, .Depth = 0}};
+    std::vector<TDumpItem<TNodeRef>> children;
+    while (!stack.empty()) {
+        const TDumpItem<TNodeRef> item = stack.back();
+        stack.pop_back();
+        for (std::size_t i = 0; i < item.Depth; ++i) {
+            ss << DUMP_CHILD_INDENT;
+        }
+        if (!item.Label.empty()) {
+            ss << item.Label << "\n";
+            continue;
         }
+
+        children.clear();
+        writeNode(ss, item.Node, item.Depth, children);
+        stack.insert(stack.end(), children.rbegin(), children.rend());
     }
-    return result.str();
+    return ss.str();
 }
 
 } // namespace
 
+TDumpVisitor::TDumpVisitor(EDumpMode mode)
+    : Mode_{mode}
+{}
+
 void TDumpVisitor::Visit(const TNumberExpr& numberExpr) {
-    std::stringstream ss;
-    ss << "NumberExpr: " << numberExpr.GetValue() << "\n";
-    Dump_ = ss.str();
+    Dump_ = Dump(numberExpr, Mode_);
 }
 
 void TDumpVisitor::Visit(const TVariableExpr& variableExpr) {
-    std::stringstream ss;
-    ss << "VariableExpr: \"" << variableExpr.GetName().AsStringView() << "\"\n";
-    Dump_ = ss.str();
+    Dump_ = Dump(variableExpr, Mode_);
 }
 
 void TDumpVisitor::Visit(const TBinaryExpr& binaryExpr) {
-    std::stringstream ss;
-    ss << "BinaryExpr: \"" << BinaryExprOpToChar(binaryExpr.GetOp()) << "\"\n";
-    ss << Indent(Dump(binaryExpr.GetLhs()));
-    ss << Indent(Dump(binaryExpr.GetRhs()));
-    Dump_ = ss.str();
+    Dump_ = Dump(binaryExpr, Mode_);
 }
 
 void TDumpVisitor::Visit(const NAst::TIfExpr& ifExpr) {
-    std::stringstream ss;
-    ss << "IfExpr:\n";
-    ss << "Cond:\n";
-    ss << Indent(Dump(ifExpr.GetCond()));
-    ss << "Then:\n";
-    ss << Indent(Dump(ifExpr.GetThen()));
-    ss << "Else:\n";
-    ss << Indent(Dump(ifExpr.GetElse()));
-    Dump_ = ss.str();
+    Dump_ = Dump(ifExpr, Mode_);
 }
 
 void TDumpVisitor::Visit(const TCallExpr& callExpr) {
-    std::stringstream ss;
-    ss << "CallExpr: \"" << callExpr.GetCallee().AsStringView() << "\"\n";
-    for (const auto& arg : callExpr.GetArgs()) {
-        ss << Indent(Dump(*arg));
-    }
-    Dump_ = ss.str();
+    Dump_ = Dump(callExpr, Mode_);
 }
 
 void TDumpVisitor::Visit(const TPrototype& prototype) {
-    std::stringstream ss;
-    ss << "Prototype: \"" << prototype.GetName().AsStringView() << "\", args: ";
-    const auto& args = prototype.GetArgs();
-    for (std::size_t i = 0; i < args.size(); ++i) {
-        ss << "\"" << args[i].AsStringView() << "\"";
-        if (i != args.size() - 1) {
-            ss << ", ";
-        } else {
-            ss << "\n";
-        }
-    }
-    Dump_ = ss.str();
+    Dump_ = Dump(prototype, Mode_);
 }
 
 void TDumpVisitor::Visit(const TFunction& function) {
-    std::stringstream ss;
-    ss << "Function definition: \n";
-    ss << Indent(Dump(function.GetPrototype()));
-    ss << Indent(Dump(function.GetBody()));
-    Dump_ = ss.str();
+    Dump_ = Dump(function, Mode_);
 }
 
 const std::string& TDumpVisitor::GetDump() const {
     return Dump_;
 }
 
-std::string Dump(const TNode& node) {
-    TDumpVisitor visitor;
-    node.Accept(visitor);
-    return visitor.GetDump();
+std::string Dump(const TNode& node, EDumpMode mode) {
+    using TItem = TDumpItem<const TNode*>;
+    return DumpIteratively(&node, [mode](std::ostream& ss, const TNode* node, std::size_t depth,
+                                         std::vector<TItem>& children)
+    {
+        const auto addChild = [&](const TNode& child) {
+            children.push_back(TItem{.Node = &child, .Depth = depth + 1});
+        };
+        const auto addLabel = [&](std::string_view label) {
+            children.push_back(TItem{.Node = nullptr, .Depth = depth, .Label = label});
+        };
+
+        Visit(*node, [&](const auto& concrete) {
+            using T = std::decay_t<decltype(concrete)>;
+            if constexpr (std::is_same_v<T, TNumberExpr>) {
+                ss << "NumberExpr: " << concrete.GetValue() << "\n";
+            } else if constexpr (std::is_same_v<T, TVariableExpr>) {
+                ss << "VariableExpr: " << FormatName(concrete.GetName(), mode) << "\n";
+            } else if constexpr (std::is_same_v<T, TBinaryExpr>) {
+                ss << "BinaryExpr: \"" << BinaryExprOpToChar(concrete.GetOp(), concrete.GetUserOp()) << "\"\n";
+                addChild(concrete.GetLhs());
+                addChild(concrete.GetRhs());
+            } else if constexpr (std::is_same_v<T, TIfExpr>) {
+                ss << "IfExpr:\n";
+                addLabel("Cond:");
+                addChild(concrete.GetCond());
+                addLabel("Then:");
+                addChild(concrete.GetThen());
+                addLabel("Else:");
+                addChild(concrete.GetElse());
+            } else if constexpr (std::is_same_v<T, TCallExpr>) {
+                ss << "CallExpr: " << FormatName(concrete.GetCallee(), mode) << "\n";
+                for (const auto& arg : concrete.GetArgs()) {
+                    addChild(*arg);
+                }
+            } else if constexpr (std::is_same_v<T, TPrototype>) {
+                ss << "Prototype: " << FormatName(concrete.GetName(), mode) << ", args: ";
+                const auto& args = concrete.GetArgs();
+                for (std::size_t i = 0; i < args.size(); ++i) {
+                    ss << FormatName(args[i], mode);
+                    if (i != args.size() - 1) {
+                        ss << ", ";
+                    } else {
+                        ss << "\n";
+                    }
+                }
+            } else if constexpr (std::is_same_v<T, TFunction>) {
+                ss << "Function definition: \n";
+                addChild(concrete.GetPrototype());
+                addChild(concrete.GetBody());
+            }
+        });
+    });
+}
+
+std::string Dump(const TFlatAst& ast, TNodeIndex index, EDumpMode mode) {
+    using TItem = TDumpItem<TNodeIndex>;
+    return DumpIteratively(index, [&ast, mode](std::ostream& ss, TNodeIndex index, std::size_t depth,
+                                               std::vector<TItem>& children)
+    {
+        const auto addChild = [&](TNodeIndex child) {
+            children.push_back(TItem{.Node = child, .Depth = depth + 1});
+        };
+        const auto addLabel = [&](std::string_view label) {
+            children.push_back(TItem{.Node = 0, .Depth = depth, .Label = label});
+        };
+
+        switch (ast.GetKind(index)) {
+        case ENodeKind::Number:
+            ss << "NumberExpr: " << ast.GetValue(index) << "\n";
+            break;
+        case ENodeKind::Variable:
+            ss << "VariableExpr: " << FormatName(ast.GetName(index), mode) << "\n";
+            break;
+        case ENodeKind::Binary:
+            ss << "BinaryExpr: \"" << BinaryExprOpToChar(ast.GetOp(index), ast.GetUserOp(index)) << "\"\n";
+            addChild(ast.GetLhs(index));
+            addChild(ast.GetRhs(index));
+            break;
+        case ENodeKind::If:
+            ss << "IfExpr:\n";
+            addLabel("Cond:");
+            addChild(ast.GetCond(index));
+            addLabel("Then:");
+            addChild(ast.GetThen(index));
+            addLabel("Else:");
+            addChild(ast.GetElse(index));
+            break;
+        case ENodeKind::Call:
+            ss << "CallExpr: " << FormatName(ast.GetName(index), mode) << "\n";
+            for (TNodeIndex arg : ast.GetArgs(index)) {
+                addChild(arg);
+            }
+            break;
+        case ENodeKind::Prototype: {
+            ss << "Prototype: " << FormatName(ast.GetName(index), mode) << ", args: ";
+            const std::size_t argCount = ast.GetArgNameCount(index);
+            for (std::size_t i = 0; i < argCount; ++i) {
+                ss << FormatName(ast.GetArgName(index, i), mode);
+                if (i != argCount - 1) {
+                    ss << ", ";
+                } else {
+                    ss << "\n";
+                }
+            }
+            break;
+        }
+        case ENodeKind::Function:
+            ss << "Function definition: \n";
+            addChild(ast.GetPrototype(index));
+            addChild(ast.GetBody(index));
+            break;
+        }
+    });
 }
 
 } // namespace NKaleidoscope
@@ -1,11 +1,20 @@
 #pragma once
 
 #include "ast.h"
+#include "flat_ast.h"
 
 namespace NKaleidoscope {
 
+enum struct EDumpMode {
+    Plain,
+    // print "line:column" after every name
+    WithLocations,
+};
+
 class TDumpVisitor : public NAst::IVisitor {
 public:
+    TDumpVisitor(EDumpMode mode = EDumpMode::Plain);
+
     void Visit(const NAst::TNumberExpr&) override;
     void Visit(const NAst::TVariableExpr&) override;
     void Visit(const NAst::TBinaryExpr&) override;
@@ -17,9 +26,14 @@ public:
     const std::string& GetDump() const;
 
 private:
+    EDumpMode Mode_;
     std::string Dump_;
 };
 
-std::string Dump(const NAst::TNode& node);
+// the nodes are dumped with an explicit stack, so any depth is fine
+std::string Dump(const NAst::TNode& node, EDumpMode mode = EDumpMode::Plain);
+
+// dumps a node of the flat AST exactly like the same node of the tree
+std::string Dump(const NAst::TFlatAst& ast, NAst::TNodeIndex index, EDumpMode mode = EDumpMode::Plain);
 
 } // namespace NKaleidoscope
@@ -0,0 +1,623 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include "thread_pool.h"
+
+namespace NKaleidoscope {
+
+namespace {
+
+// unwraps the result of an ORC call or throws its error
+template <class T>
+T Unwrap(llvm::Expected<T> expected, std::string_view what) {
+    if (!expected) {
+        throw std::runtime_error(std::string{what} + ": " + llvm::toString(expected.takeError()));
+    }
+    return std::forward<T>(*expected);
+}
+
+void Check(llvm::Error error, std::string_view what) {
+    if (error) {
+        throw std::runtime_error(std::string{what} + ": " + llvm::toString(std::move(error)));
+    }
+}
+
+std::unique_ptr<llvm::orc::LLJIT> CreateJit() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto jit = Unwrap(llvm::orc::LLJITBuilder{}.create(), "Can't create JIT");
+    auto hostSymbols = Unwrap(
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit->getDataLayout().getGlobalPrefix()),
+        "Can't load host symbols");
+    jit->getMainJITDylib().addGenerator(std::move(hostSymbols));
+    return jit;
+}
+
+// a compile layer of its own, which can be used from several threads at once
+std::unique_ptr<llvm::orc::IRCompileLayer> CreateCompileLayer(llvm::orc::LLJIT& jit, llvm::CodeGenOpt::Level level) {
+    auto machineBuilder = Unwrap(llvm::orc::JITTargetMachineBuilder::detectHost(), "Can't detect host");
+    machineBuilder.setCodeGenOptLevel(level);
+    return std::make_unique<llvm::orc::IRCompileLayer>(
+        jit.getExecutionSession(), jit.getObjLinkingLayer(),
+        std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(machineBuilder)));
+}
+
+// the implementations call each other through the stubs of the main dylib
+llvm::orc::JITDylib& CreateImplDylib(llvm::orc::LLJIT& jit, const std::string& name) {
+    llvm::orc::JITDylib& dylib = Unwrap(jit.createJITDylib(name), "Can't create JIT dylib");
+    dylib.setLinkOrder({{&jit.getMainJITDylib(), llvm::orc::JITDylibLookupFlags::MatchAllSymbols}},
+                       /* LinkAgainstThisJITDylibFirst = */ false);
+    return dylib;
+}
+
+void* ToPointer(llvm::JITTargetAddress address) {
+    return reinterpret_cast<void*>(static_cast<std::uintptr_t>(address));
+}
+
+// a stub jumps here if the item behind it can't be compiled, the error is already reported
+[[noreturn]] void OnLazyCompileError() {
+    llvm::report_fatal_error("Lazy compilation failed");
+}
+
+// calls `onCall(name, argCount)` for every call of the item, including the user operators
+template <class TOnCall>
+void ForEachCall(const NAst::TNode& item, TOnCall&& onCall) {
+    std::vector<const NAst::TNode*> stack = {&item};
+    while (!stack.empty()) {
+        const NAst::TNode* node = stack.back();
+        stack.pop_back();
+        if (const auto* call = NAst::NodeCast<NAst::TCallExpr>(node)) {
+            onCall(call->GetCallee().AsStringView(), call->GetArgs().size());
+        } else if (const auto* binary = NAst::NodeCast<NAst::TBinaryExpr>(node);
+                   binary && binary->GetOp() == NAst::TBinaryExpr::EOp::User) {
+            onCall(std::string{"binary"} + binary->GetUserOp(), 2);
+        }
+        for (std::size_t i = 0; i < NAst::GetChildCount(*node); ++i) {
+            stack.push_back(&NAst::GetChild(*node, i));
+        }
+    }
+}
+
+// The items added to a JIT that generates them one by one. The errors the
+// codegen would throw are reported when an item is added, and so are the
+// externs missing from the host process that an expression reaches. Generate
+// may run on several threads at once, and while items are added.
+class TItemRegistry {
+public:
+    TItemRegistry(const TSymbolTable* symbols, const llvm::DataLayout& dataLayout)
+        : Symbols_{symbols}
+        , DataLayout_{dataLayout}
+        , ExprCount_{0}
+        , GeneratedCount_{0}
+    {}
+
+    // the name of the function of an expression, or the name of the function or the extern
+    std::string Add(const NAst::TNode& item) {
+        std::lock_guard guard{Mutex_};
+        std::string name;
+        if (const auto* prototype = NAst::NodeCast<NAst::TPrototype>(&item)) {
+            // an extern is resolved against the host process or a later definition
+            name = prototype->GetName().AsStringView();
+            Prototypes_.try_emplace(name, prototype);
+            return name;
+        }
+        if (const auto* function = NAst::NodeCast<NAst::TFunction>(&item)) {
+            name = function->GetPrototype().GetName().AsStringView();
+            if (Definitions_.contains(name)) {
+                throw std::runtime_error("Can't redefine function \"" + name + "\"");
+            }
+            // the function may call itself, a failed one leaves the previous prototype, if any
+            auto [iter, inserted] = Prototypes_.try_emplace(name, nullptr);
+            const NAst::TPrototype* previous = iter->second;
+            iter->second = &function->GetPrototype();
+            try {
+                CheckItem(item);
+            } catch (...) {
+                if (inserted) {
+                    Prototypes_.erase(iter);
+                } else {
+                    iter->second = previous;
+                }
+                throw;
+            }
+        } else {
+            CheckItem(item);
+            // an expression runs right away, so the externs it reaches should be in the host process
+            CheckExterns(item);
+            name = "__anon_expr" + std::to_string(ExprCount_++);
+        }
+        Definitions_.emplace(name, &item);
+        return name;
+    }
+
+    // a module with the item and the declarations of its callees
+    TGeneratedModule Generate(const std::string& name, const NAst::TNode& item,
+                              EOptimizationLevel optimizationLevel) const {
+        std::vector<const NAst::TPrototype*> callees;
+        {
+            std::lock_guard guard{Mutex_};
+            std::unordered_set<std::string> declared;
+            ForEachCall(item, [&](std::string_view callee, std::size_t) {
+                if (auto [iter, inserted] = declared.emplace(callee); inserted) {
+                    callees.push_back(Prototypes_.at(*iter));
+                }
+            });
+        }
+
+        TCodegenVisitor codegen{optimizationLevel, Symbols_};
+        for (const NAst::TPrototype* callee : callees) {
+            codegen.Generate(*callee);
+        }
+        const bool isExpr = NAst::IsExprKind(item.GetKind());
+        if (isExpr) {
+            codegen.WrapTopLevelExprs();
+        }
+        codegen.Generate(item);
+        TGeneratedModule module = codegen.ReleaseModule();
+        if (isExpr) {
+            module.Module->getFunction(module.TopLevelFunctions.front())->setName(name);
+        }
+        module.Module->setDataLayout(DataLayout_);
+        ++GeneratedCount_;
+        return module;
+    }
+
+    std::size_t GetGeneratedCount() const { return GeneratedCount_; }
+
+private:
+    // the errors the codegen would throw for the item
+    void CheckItem(const NAst::TNode& item) const {
+        ForEachCall(item, [this](std::string_view callee, std::size_t argCount) {
+            const auto iter = Prototypes_.find(std::string{callee});
+            if (iter == Prototypes_.end()) {
+                throw std::runtime_error("Unknown function \"" + std::string{callee} + "\"");
+            }
+            if (iter->second->GetArgs().size() != argCount) {
+                throw std::runtime_error("Incorrect number of arguments");
+            }
+        });
+
+        std::vector<std::string_view> args;
+        if (const auto* function = NAst::NodeCast<NAst::TFunction>(&item)) {
+            for (const TSourceRange& arg : function->GetPrototype().GetArgs()) {
+                args.push_back(arg.AsStringView());
+            }
+        }
+        std::vector<const NAst::TNode*> stack = {&item};
+        while (!stack.empty()) {
+            const NAst::TNode* node = stack.back();
+            stack.pop_back();
+            if (const auto* variable = NAst::NodeCast<NAst::TVariableExpr>(node)) {
+                const std::string_view name = variable->GetName().AsStringView();
+                if (std::find(args.begin(), args.end(), name) == args.end()) {
+                    throw std::runtime_error("Expected known named value, found \"" + std::string{name} + "\"");
+                }
+            }
+            for (std::size_t i = 0; i < NAst::GetChildCount(*node); ++i) {
+                stack.push_back(&NAst::GetChild(*node, i));
+            }
+        }
+    }
+
+    // Throws for the callees the item reaches that have neither a definition nor
+    // a host symbol, since a stub that can't be compiled aborts the process.
+    // A later definition of an extern is fine until an expression calls it.
+    void CheckExterns(const NAst::TNode& item) {
+        std::unordered_set<std::string> visited;
+        std::vector<const NAst::TNode*> stack = {&item};
+        while (!stack.empty()) {
+            const NAst::TNode* node = stack.back();
+            stack.pop_back();
+            ForEachCall(*node, [&](std::string_view callee, std::size_t) {
+                const std::string name{callee};
+                if (Resolved_.contains(name) || !visited.insert(name).second) {
+                    return;
+                }
+                if (const auto iter = Definitions_.find(name); iter != Definitions_.end()) {
+                    stack.push_back(iter->second);
+                } else if (!llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(name)) {
+                    throw std::runtime_error("Can't find \"" + name + "\"");
+                }
+            });
+        }
+        Resolved_.merge(visited);
+    }
+
+private:
+    const TSymbolTable* Symbols_;
+    llvm::DataLayout DataLayout_;
+
+    mutable std::mutex Mutex_;
+    // the latest prototype of every name, for the declarations of the callees
+    std::unordered_map<std::string, const NAst::TPrototype*> Prototypes_;
+    std::unordered_map<std::string, const NAst::TNode*> Definitions_;
+    // the callees whose externs have been found, with all of their own callees
+    std::unordered_set<std::string> Resolved_;
+    std::size_t ExprCount_;
+    mutable std::atomic<std::size_t> GeneratedCount_;
+};
+
+// materializes an item by generating its IR and emitting it to a compile layer
+class TItemUnit final : public llvm::orc::MaterializationUnit {
+public:
+    TItemUnit(llvm::orc::IRLayer& layer, std::string name, llvm::orc::SymbolFlagsMap symbols,
+              std::function<TGeneratedModule()> generate)
+        : MaterializationUnit{Interface{std::move(symbols), /* InitSymbol = */ nullptr}}
+        , Layer_{layer}
+        , Name_{std::move(name)}
+        , Generate_{std::move(generate)}
+    {}
+
+    llvm::StringRef getName() const override { return Name_; }
+
+    void materialize(std::unique_ptr<llvm::orc::MaterializationResponsibility> responsibility) override {
+        TGeneratedModule module;
+        try {
+            module = Generate_();
+        } catch (const std::exception& e) {
+            Layer_.getExecutionSession().reportError(
+                llvm::make_error<llvm::StringError>(e.what(), llvm::inconvertibleErrorCode()));
+            responsibility->failMaterialization();
+            return;
+        }
+        Layer_.emit(std::move(responsibility),
+                    llvm::orc::ThreadSafeModule{std::move(module.Module), std::move(module.Context)});
+    }
+
+private:
+    void discard(const llvm::orc::JITDylib&, const llvm::orc::SymbolStringPtr&) override {}
+
+private:
+    llvm::orc::IRLayer& Layer_;
+    std::string Name_;
+    std::function<TGeneratedModule()> Generate_;
+};
+
+const llvm::JITSymbolFlags FUNCTION_FLAGS = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+
+} // namespace
+
+// TJit::TImpl
+class TJit::TImpl {
+public:
+    TImpl()
+        : Jit_{CreateJit()}
+    {}
+
+    void AddModule(TGeneratedModule module) {
+        Check(Jit_->addIRModule(llvm::orc::ThreadSafeModule{std::move(module.Module), std::move(module.Context)}),
+              "Can't add module");
+    }
+
+    void* Lookup(std::string_view name) {
+        const llvm::JITEvaluatedSymbol symbol = Unwrap(Jit_->lookup(llvm::StringRef{name}),
+                                                       "Can't find \"" + std::string{name} + "\"");
+        return ToPointer(symbol.getAddress());
+    }
+
+private:
+    std::unique_ptr<llvm::orc::LLJIT> Jit_;
+};
+
+// TJit
+TJit::TJit()
+    : Impl_{std::make_unique<TImpl>()}
+{
+}
+
+TJit::~TJit()
+{
+}
+
+void TJit::AddModule(TGeneratedModule module) { Impl_->AddModule(std::move(module)); }
+
+void* TJit::Lookup(std::string_view name) { return Impl_->Lookup(name); }
+
+double TJit::Run(std::string_view name) {
+    auto* function = reinterpret_cast<double (*)()>(Lookup(name));
+    return function();
+}
+
+// TLazyJit::TImpl
+class TLazyJit::TImpl {
+public:
+    TImpl(EOptimizationLevel optimizationLevel, const TSymbolTable* symbols)
+        : OptimizationLevel_{optimizationLevel}
+        , Jit_{CreateJit()}
+        , ImplDylib_{CreateImplDylib(*Jit_, "implementations")}
+        , CallThroughManager_{Unwrap(
+              llvm::orc::createLocalLazyCallThroughManager(Jit_->getTargetTriple(), Jit_->getExecutionSession(),
+                                                           llvm::pointerToJITTargetAddress(&OnLazyCompileError)),
+              "Can't create lazy call-through manager")}
+        , StubsManager_{llvm::orc::createLocalIndirectStubsManagerBuilder(Jit_->getTargetTriple())()}
+        , Items_{symbols, Jit_->getDataLayout()}
+    {
+    }
+
+    std::string Add(const NAst::TNode& item) {
+        std::string name = Items_.Add(item);
+        if (NAst::NodeCast<NAst::TPrototype>(&item)) {
+            return name;
+        }
+
+        // the item is generated on the first call through its stub
+        const llvm::orc::SymbolStringPtr symbol = Jit_->mangleAndIntern(name);
+        Check(ImplDylib_.define(std::make_unique<TItemUnit>(
+                  Jit_->getIRCompileLayer(), name, llvm::orc::SymbolFlagsMap{{symbol, FUNCTION_FLAGS}},
+                  [this, name, &item] { return Items_.Generate(name, item, OptimizationLevel_); })),
+              "Can't add \"" + name + "\"");
+        Check(Jit_->getMainJITDylib().define(llvm::orc::lazyReexports(
+                  *CallThroughManager_, *StubsManager_, ImplDylib_,
+                  llvm::orc::SymbolAliasMap{{symbol, {symbol, FUNCTION_FLAGS}}})),
+              "Can't add a stub of \"" + name + "\"");
+        return name;
+    }
+
+    void* Lookup(std::string_view name) {
+        const llvm::JITEvaluatedSymbol symbol = Unwrap(Jit_->lookup(llvm::StringRef{name}),
+                                                       "Can't find \"" + std::string{name} + "\"");
+        return ToPointer(symbol.getAddress());
+    }
+
+    std::size_t GetGeneratedCount() const { return Items_.GetGeneratedCount(); }
+
+private:
+    EOptimizationLevel OptimizationLevel_;
+
+    // the main dylib has the stubs and the host symbols, the other one has the items
+    std::unique_ptr<llvm::orc::LLJIT> Jit_;
+    llvm::orc::JITDylib& ImplDylib_;
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> CallThroughManager_;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> StubsManager_;
+
+    TItemRegistry Items_;
+};
+
+// TLazyJit
+TLazyJit::TLazyJit(EOptimizationLevel optimizationLevel, const TSymbolTable* symbols)
+    : Impl_{std::make_unique<TImpl>(optimizationLevel, symbols)}
+{
+}
+
+TLazyJit::~TLazyJit()
+{
+}
+
+std::string TLazyJit::Add(const NAst::TNode& item) { return Impl_->Add(item); }
+
+void* TLazyJit::Lookup(std::string_view name) { return Impl_->Lookup(name); }
+
+double TLazyJit::Run(std::string_view name) {
+    auto* function = reinterpret_cast<double (*)()>(Lookup(name));
+    return function();
+}
+
+std::size_t TLazyJit::GetGeneratedCount() const { return Impl_->GetGeneratedCount(); }
+
+// TTieredJit::TImpl
+class TTieredJit::TImpl {
+public:
+    TImpl(std::size_t hotCallCount, const TSymbolTable* symbols, std::size_t compileThreads)
+        : HotCallCount_{std::max<std::size_t>(hotCallCount, 1)}
+        , Jit_{CreateJit()}
+        , Tier0Dylib_{CreateImplDylib(*Jit_, "tier0")}
+        , Tier1Dylib_{CreateImplDylib(*Jit_, "tier1")}
+        , Tier0CompileLayer_{CreateCompileLayer(*Jit_, llvm::CodeGenOpt::None)}
+        , Tier1CompileLayer_{CreateCompileLayer(*Jit_, llvm::CodeGenOpt::Default)}
+        , CallThroughManager_{Unwrap(
+              llvm::orc::createLocalLazyCallThroughManager(Jit_->getTargetTriple(), Jit_->getExecutionSession(),
+                                                           llvm::pointerToJITTargetAddress(&OnLazyCompileError)),
+              "Can't create lazy call-through manager")}
+        , StubsManager_{llvm::orc::createLocalIndirectStubsManagerBuilder(Jit_->getTargetTriple())()}
+        , Items_{symbols, Jit_->getDataLayout()}
+        , PromotedCount_{0}
+        , ThreadPool_{std::max<std::size_t>(compileThreads, 1)}
+    {
+    }
+
+    std::string Add(const NAst::TNode& item) {
+        std::string name = Items_.Add(item);
+        if (NAst::NodeCast<NAst::TPrototype>(&item)) {
+            return name;
+        }
+        TFunctionState& function = Functions_.emplace_back(name, &item);
+        FunctionsByName_.emplace(name, &function);
+
+        const llvm::orc::SymbolStringPtr symbol = Jit_->mangleAndIntern(name);
+        Check(Tier0Dylib_.define(std::make_unique<TItemUnit>(
+                  *Tier0CompileLayer_, name, llvm::orc::SymbolFlagsMap{{symbol, FUNCTION_FLAGS}},
+                  [this, &function] {
+                      TGeneratedModule module = Items_.Generate(function.Name, *function.Item, EOptimizationLevel::Zero);
+                      CountCalls(module, function);
+                      return module;
+                  })),
+              "Can't add \"" + name + "\"");
+
+        // The stub of the main dylib points to a trampoline first, the first
+        // call compiles the tier 0 code and points the stub to it.
+        const llvm::JITTargetAddress trampoline = Unwrap(
+            CallThroughManager_->getCallThroughTrampoline(
+                Tier0Dylib_, symbol,
+                [this, name](llvm::JITTargetAddress address) { return StubsManager_->updatePointer(name, address); }),
+            "Can't add a stub of \"" + name + "\"");
+        Check(StubsManager_->createStub(name, trampoline, FUNCTION_FLAGS), "Can't add a stub of \"" + name + "\"");
+        const llvm::JITEvaluatedSymbol stub = StubsManager_->findStub(name, /* ExportedStubsOnly = */ true);
+        Check(Jit_->getMainJITDylib().define(llvm::orc::absoluteSymbols({{symbol, stub}})),
+              "Can't add a stub of \"" + name + "\"");
+        return name;
+    }
+
+    void* Lookup(std::string_view name) {
+        const llvm::JITEvaluatedSymbol symbol = Unwrap(Jit_->lookup(llvm::StringRef{name}),
+                                                       "Can't find \"" + std::string{name} + "\"");
+        return ToPointer(symbol.getAddress());
+    }
+
+    void WaitForPromotions() {
+        std::vector<std::future<void>> promotions;
+        {
+            std::lock_guard guard{PromotionsMutex_};
+            promotions.swap(Promotions_);
+        }
+        for (std::future<void>& promotion : promotions) {
+            promotion.wait();
+        }
+    }
+
+    std::size_t GetPromotedCount() const { return PromotedCount_; }
+
+    std::uint64_t GetCallCount(std::string_view name) const {
+        const auto iter = FunctionsByName_.find(std::string{name});
+        if (iter == FunctionsByName_.end()) {
+            throw std::runtime_error("Can't find \"" + std::string{name} + "\"");
+        }
+        return iter->second->CallCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct TFunctionState {
+        std::string Name;
+        const NAst::TNode* Item;
+        // counted by the tier 0 code only
+        std::atomic<std::uint64_t> CallCount{0};
+    };
+
+    // Prepends the function with an increment of its counter, the call that
+    // reaches the threshold calls OnHot. The addresses are baked into the IR as
+    // constants, the states live in a deque and never move.
+    void CountCalls(TGeneratedModule& module, TFunctionState& function) const {
+        llvm::Function* code = module.Module->getFunction(function.Name);
+        llvm::BasicBlock& entry = code->getEntryBlock();
+        llvm::BasicBlock* body = entry.splitBasicBlock(entry.begin(), "body");
+        entry.getTerminator()->eraseFromParent();
+
+        llvm::IRBuilder<> builder{&entry};
+        llvm::Type* int64 = builder.getInt64Ty();
+        const auto address = [&](const void* pointer, llvm::Type* type) {
+            return builder.CreateIntToPtr(builder.getInt64(reinterpret_cast<std::uintptr_t>(pointer)),
+                                          type->getPointerTo());
+        };
+        llvm::Value* count = builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, address(&function.CallCount, int64),
+                                                     builder.getInt64(1), llvm::MaybeAlign{8},
+                                                     llvm::AtomicOrdering::Monotonic);
+        llvm::BasicBlock* promote = llvm::BasicBlock::Create(*module.Context, "promote", code, body);
+        builder.CreateCondBr(builder.CreateICmpEQ(count, builder.getInt64(HotCallCount_ - 1)), promote, body);
+
+        builder.SetInsertPoint(promote);
+        llvm::FunctionType* onHotType = llvm::FunctionType::get(builder.getVoidTy(), {int64, int64}, false);
+        builder.CreateCall(onHotType, address(reinterpret_cast<const void*>(&OnHot), onHotType),
+                           {builder.getInt64(reinterpret_cast<std::uintptr_t>(this)),
+                            builder.getInt64(reinterpret_cast<std::uintptr_t>(&function))});
+        builder.CreateBr(body);
+    }
+
+    // Called by the tier 0 code once, on the thread that made the call. The
+    // state comes from the IR, the deque may grow on another thread meanwhile.
+    static void OnHot(std::uint64_t self, std::uint64_t function) noexcept {
+        reinterpret_cast<TImpl*>(self)->Promote(*reinterpret_cast<const TFunctionState*>(function));
+    }
+
+    // generates the function at the High level on the thread pool and points its stub to the new code
+    void Promote(const TFunctionState& function) noexcept {
+        try {
+            std::future<void> promotion = ThreadPool_.Submit([this, &function] {
+                try {
+                    TGeneratedModule module = Items_.Generate(function.Name, *function.Item, EOptimizationLevel::High);
+                    Check(Tier1CompileLayer_->add(
+                              Tier1Dylib_, llvm::orc::ThreadSafeModule{std::move(module.Module), std::move(module.Context)}),
+                          "Can't add \"" + function.Name + "\"");
+                    const llvm::JITEvaluatedSymbol symbol = Unwrap(
+                        Jit_->lookup(Tier1Dylib_, function.Name), "Can't compile \"" + function.Name + "\"");
+                    // the stub jumps through an aligned pointer, the callers
+                    // see either the old code or the new one
+                    Check(StubsManager_->updatePointer(function.Name, symbol.getAddress()),
+                          "Can't patch \"" + function.Name + "\"");
+                    ++PromotedCount_;
+                } catch (const std::exception& e) {
+                    // the function stays in tier 0
+                    Jit_->getExecutionSession().reportError(
+                        llvm::make_error<llvm::StringError>(e.what(), llvm::inconvertibleErrorCode()));
+                }
+            });
+            std::lock_guard guard{PromotionsMutex_};
+            Promotions_.push_back(std::move(promotion));
+        } catch (const std::exception&) {
+            // no promotion, the tier 0 code keeps working
+        }
+    }
+
+private:
+    std::size_t HotCallCount_;
+
+    // The main dylib has the stubs and the host symbols. The tier 0 dylib has
+    // the quick code: unoptimized IR compiled by the fast instruction selector.
+    // The tier 1 dylib has the code optimized at the High level.
+    std::unique_ptr<llvm::orc::LLJIT> Jit_;
+    llvm::orc::JITDylib& Tier0Dylib_;
+    llvm::orc::JITDylib& Tier1Dylib_;
+    std::unique_ptr<llvm::orc::IRCompileLayer> Tier0CompileLayer_;
+    std::unique_ptr<llvm::orc::IRCompileLayer> Tier1CompileLayer_;
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> CallThroughManager_;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> StubsManager_;
+
+    TItemRegistry Items_;
+    std::deque<TFunctionState> Functions_;
+    std::unordered_map<std::string, const TFunctionState*> FunctionsByName_;
+
+    std::atomic<std::size_t> PromotedCount_;
+    std::mutex PromotionsMutex_;
+    std::vector<std::future<void>> Promotions_;
+
+    // the last member, so that the promotions finish before the rest is destroyed
+    TThreadPool ThreadPool_;
+};
+
+// TTieredJit
+TTieredJit::TTieredJit(std::size_t hotCallCount, const TSymbolTable* symbols, std::size_t compileThreads)
+    : Impl_{std::make_unique<TImpl>(hotCallCount, symbols, compileThreads)}
+{
+}
+
+TTieredJit::~TTieredJit()
+{
+}
+
+std::string TTieredJit::Add(const NAst::TNode& item) { return Impl_->Add(item); }
+
+void* TTieredJit::Lookup(std::string_view name) { return Impl_->Lookup(name); }
+
+double TTieredJit::Run(std::string_view name) {
+    auto* function = reinterpret_cast<double (*)()>(Lookup(name));
+    return function();
+}
+
+void TTieredJit::WaitForPromotions() { Impl_->WaitForPromotions(); }
+
+std::size_t TTieredJit::GetPromotedCount() const { return Impl_->GetPromotedCount(); }
+
+std::uint64_t TTieredJit::GetCallCount(std::string_view name) const { return Impl_->GetCallCount(name); }
+
+} // namespace NKaleidoscope
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "ast.h"
+#include "codegen.h"
+#include "noncopyable.h"
+#include "symbol.h"
+
+namespace NKaleidoscope {
+
+// Compiles generated modules in-process with LLVM ORC LLJIT. The functions of
+// all added modules see each other, and externs are resolved against the
+// symbols of the host process, e.g. "sin" from libm.
+class TJit : private TNonCopyable {
+public:
+    TJit();
+    ~TJit();
+
+    // the module is compiled lazily, on the first lookup of its symbols
+    void AddModule(TGeneratedModule module);
+
+    // the address of a compiled function, throws if it can't be found or compiled
+    void* Lookup(std::string_view name);
+
+    // calls a compiled function "double name()", e.g. a wrapped top-level expression
+    double Run(std::string_view name);
+
+private:
+    class TImpl;
+    std::unique_ptr<TImpl> Impl_;
+};
+
+// Generates and compiles every function on its first call. An item gets a stub
+// when it is added, and the first call through the stub generates the IR of
+// the item alone, optimizes it and compiles it; the callees are reached
+// through their stubs too. The start time depends on the code that runs, not
+// on the size of the source.
+class TLazyJit : private TNonCopyable {
+public:
+    // the symbol table is the one the items were parsed with, if any
+    explicit TLazyJit(EOptimizationLevel optimizationLevel = EOptimizationLevel::High,
+                      const TSymbolTable* symbols = nullptr);
+    ~TLazyJit();
+
+    // Registers a top-level item, which should outlive the JIT. Returns the
+    // name of the function to run for an expression, or the name of the
+    // function or the extern. Unknown names are reported here like codegen
+    // does, not on the first call, and so is an expression that reaches an
+    // extern missing from the host process. A failed item isn't added.
+    std::string Add(const NAst::TNode& item);
+
+    void* Lookup(std::string_view name);
+    double Run(std::string_view name);
+
+    // the number of items generated so far
+    std::size_t GetGeneratedCount() const;
+
+private:
+    class TImpl;
+    std::unique_ptr<TImpl> Impl_;
+};
+
+// Runs every function in a cheap tier first and optimizes the hot ones. The
+// first call of a function compiles it quickly, without IR optimizations and
+// with the fast instruction selector, and this code counts its calls. The call
+// that reaches `hotCallCount` makes a thread pool generate the function again
+// at the High level, then the stub of the function is patched to the new code.
+// The calls that are in flight finish in the old code.
+class TTieredJit : private TNonCopyable {
+public:
+    static constexpr std::size_t DEFAULT_HOT_CALL_COUNT = 1000;
+
+    // the symbol table is the one the items were parsed with, if any
+    explicit TTieredJit(std::size_t hotCallCount = DEFAULT_HOT_CALL_COUNT,
+                        const TSymbolTable* symbols = nullptr,
+                        std::size_t compileThreads = 1);
+    ~TTieredJit();
+
+    // registers a top-level item like TLazyJit::Add, should be called from one thread
+    std::string Add(const NAst::TNode& item);
+
+    void* Lookup(std::string_view name);
+    double Run(std::string_view name);
+
+    // waits for the promotions to the optimized code that have started so far
+    void WaitForPromotions();
+
+    // the number of functions that run the optimized code
+    std::size_t GetPromotedCount() const;
+
+    // the calls of a function made to its unoptimized code
+    std::uint64_t GetCallCount(std::string_view name) const;
+
+private:
+    class TImpl;
+    std::unique_ptr<TImpl> Impl_;
+};
+
+} // namespace NKaleidoscope
@@ -0,0 +1,100 @@
+#include <benchmark/benchmark.h>
+#include "jit.h"
+#include "parser.h"
+
+using namespace NKaleidoscope;
+
+namespace {
+
+// a library of 2000 functions, the expression calls 5% of them
+const std::string& LibrarySource() {
+    static const std::string result = [] {
+        std::string text;
+        std::string main = "def main() 0";
+        for (int i = 0; i < 2000; ++i) {
+            const std::string id = std::to_string(i);
+            text += "def model" + id + "(x y)\n";
+            text += "    if x < " + id + " then x*x*3.25 + y*2.5 - (x + 1) * (y - 2) else model" + id + "(x - 1, y);\n";
+            if (i % 20 == 0) {
+                main += " + model" + id + "(" + id + ", 2)";
+            }
+        }
+        return text + main + ";\nmain();\n";
+    }();
+    return result;
+}
+
+// the engines to compare
+enum struct EEngine {
+    Eager,
+    Lazy,
+    Tiered,
+};
+
+template <class TEngine>
+double AddAndRun(TEngine& jit, const std::vector<NAst::TNodePtr<NAst::TNode>>& nodes) {
+    std::string expr;
+    for (const auto& node : nodes) {
+        expr = jit.Add(*node);
+    }
+    return jit.Run(expr);
+}
+
+// from the parsed source to the value of its expression
+void BM_TimeToFirstResult(benchmark::State& state) {
+    const auto engine = static_cast<EEngine>(state.range(0));
+    auto source = TSource::FromString(LibrarySource());
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    const auto nodes = TParser{source, &arena, &symbols}.ParseChunk();
+
+    for (auto _ : state) {
+        double result;
+        if (engine == EEngine::Lazy) {
+            TLazyJit jit{EOptimizationLevel::High, &symbols};
+            result = AddAndRun(jit, nodes);
+        } else if (engine == EEngine::Tiered) {
+            TTieredJit jit{TTieredJit::DEFAULT_HOT_CALL_COUNT, &symbols};
+            result = AddAndRun(jit, nodes);
+        } else {
+            TCodegenVisitor codegen{EOptimizationLevel::High, &symbols};
+            codegen.WrapTopLevelExprs();
+            for (const auto& node : nodes) {
+                codegen.Generate(*node);
+            }
+            TJit jit;
+            TGeneratedModule module = codegen.ReleaseModule();
+            const std::string expr = module.TopLevelFunctions.back();
+            jit.AddModule(std::move(module));
+            result = jit.Run(expr);
+        }
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_TimeToFirstResult)->ArgName("engine")->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+// a hot function after the warm-up, the lazy JIT at the Zero level stands for the eager engine here
+void BM_HotFunction(benchmark::State& state) {
+    const auto engine = static_cast<EEngine>(state.range(0));
+    auto source = TSource::FromString(
+        "def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2);\n"
+        "fib(25);\n");
+    const auto nodes = TParser{source}.ParseChunk();
+
+    TLazyJit lazy{engine == EEngine::Lazy ? EOptimizationLevel::High : EOptimizationLevel::Zero};
+    TTieredJit tiered;
+    std::string expr;
+    for (const auto& node : nodes) {
+        expr = engine == EEngine::Tiered ? tiered.Add(*node) : lazy.Add(*node);
+    }
+    auto* fib = reinterpret_cast<double (*)()>(engine == EEngine::Tiered ? tiered.Lookup(expr) : lazy.Lookup(expr));
+    fib();
+    tiered.WaitForPromotions();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fib());
+    }
+}
+BENCHMARK(BM_HotFunction)->ArgName("engine")->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+} // namespace
@@ -0,0 +1,260 @@
+#include <gtest/gtest.h>
+#include "jit.h"
+#include "parser.h"
+
+#include <cmath>
+
+using namespace NKaleidoscope;
+
+// a host function for the externs of the tests
+extern "C" double jittesttriple(double x) {
+    return 3 * x;
+}
+
+namespace {
+
+// compiles the source and runs its top-level expressions
+std::vector<double> Evaluate(const std::string& text, bool flat = false) {
+    auto source = TSource::FromString(text);
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    TParser parser{source, &arena, &symbols};
+    const auto nodes = parser.ParseChunk();
+
+    TCodegenVisitor codegen{EOptimizationLevel::High, &symbols};
+    codegen.WrapTopLevelExprs();
+    if (flat) {
+        codegen.Generate(NAst::Flatten(nodes));
+    } else {
+        for (const auto& node : nodes) {
+            codegen.Generate(*node);
+        }
+    }
+
+    TJit jit;
+    TGeneratedModule module = codegen.ReleaseModule();
+    const std::vector<std::string> functions = module.TopLevelFunctions;
+    jit.AddModule(std::move(module));
+
+    std::vector<double> results;
+    for (const std::string& function : functions) {
+        results.push_back(jit.Run(function));
+    }
+    return results;
+}
+
+} // namespace
+
+TEST(JitTest, TopLevelExprs) {
+    const std::string text =
+        "def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2);\n"
+        "4 + 5;\n"
+        "fib(20);\n"
+        "def twice(x) x * 2;\n"
+        "twice(fib(10)) - 1;\n";
+    const std::vector<double> expected = {9, 6765, 109};
+    EXPECT_EQ(Evaluate(text), expected);
+    EXPECT_EQ(Evaluate(text, /* flat = */ true), expected);
+}
+
+TEST(JitTest, HostExterns) {
+    const auto results = Evaluate("extern sin(x); extern jittesttriple(x); sin(1); jittesttriple(sin(1));");
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_DOUBLE_EQ(results[0], std::sin(1.0));
+    EXPECT_DOUBLE_EQ(results[1], 3 * std::sin(1.0));
+}
+
+TEST(JitTest, SeveralModules) {
+    TJit jit;
+    TCodegenVisitor codegen;
+    codegen.WrapTopLevelExprs();
+
+    auto source = TSource::FromString("def square(x) x * x; square(3);");
+    for (const auto& node : TParser{source}.ParseChunk()) {
+        codegen.Generate(*node);
+    }
+    jit.AddModule(codegen.ReleaseModule());
+    EXPECT_EQ(jit.Run("__anon_expr0"), 9);
+
+    // the next module declares the function of the previous one, the names of the expressions go on
+    auto nextSource = TSource::FromString("extern square(x); square(4) + 1;");
+    for (const auto& node : TParser{nextSource}.ParseChunk()) {
+        codegen.Generate(*node);
+    }
+    TGeneratedModule module = codegen.ReleaseModule();
+    EXPECT_EQ(module.TopLevelFunctions, std::vector<std::string>{"__anon_expr1"});
+    jit.AddModule(std::move(module));
+    EXPECT_EQ(jit.Run("__anon_expr1"), 17);
+}
+
+TEST(JitTest, Errors) {
+    TJit jit;
+    EXPECT_THROW(jit.Lookup("no_such_function"), std::runtime_error);
+
+    // an extern without a definition fails when the module is compiled
+    TCodegenVisitor codegen;
+    codegen.WrapTopLevelExprs();
+    auto source = TSource::FromString("extern jittestmissing(x); jittestmissing(1);");
+    for (const auto& node : TParser{source}.ParseChunk()) {
+        codegen.Generate(*node);
+    }
+    jit.AddModule(codegen.ReleaseModule());
+    EXPECT_THROW(jit.Run("__anon_expr0"), std::runtime_error);
+}
+
+TEST(JitTest, LazyCompilesCalledFunctions) {
+    std::string text;
+    for (int i = 0; i < 200; ++i) {
+        text += "def f" + std::to_string(i) + "(x) x + " + std::to_string(i) + ";\n";
+    }
+    text += "def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2);\n";
+    text += "def main() f3(1) * f7(2) + fib(10);\n";
+    text += "main();\n";
+    auto source = TSource::FromString(text);
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    const auto nodes = TParser{source, &arena, &symbols}.ParseChunk();
+
+    TLazyJit jit{EOptimizationLevel::High, &symbols};
+    std::string expr;
+    for (const auto& node : nodes) {
+        expr = jit.Add(*node);
+    }
+    EXPECT_EQ(expr, "__anon_expr0");
+    EXPECT_EQ(jit.GetGeneratedCount(), 0u);
+
+    EXPECT_EQ(jit.Run(expr), 4 * 9 + 55);
+    // the expression, main, f3, f7 and fib
+    EXPECT_EQ(jit.GetGeneratedCount(), 5u);
+
+    // the same results as the eager JIT
+    EXPECT_EQ(jit.Run("f150"), Evaluate(text + "f150(0);").back());
+    EXPECT_EQ(jit.GetGeneratedCount(), 6u);
+}
+
+TEST(JitTest, LazyHostExterns) {
+    auto source = TSource::FromString("extern sin(x); extern jittesttriple(x); def f(x) jittesttriple(sin(x)); f(1);");
+    const auto nodes = TParser{source}.ParseChunk();
+
+    TLazyJit jit;
+    std::string expr;
+    for (const auto& node : nodes) {
+        expr = jit.Add(*node);
+    }
+    EXPECT_DOUBLE_EQ(jit.Run(expr), 3 * std::sin(1.0));
+}
+
+TEST(JitTest, LazyErrors) {
+    auto source = TSource::FromString(
+        "def f(x) x;"
+        "def g(x) h(x);"
+        "def g(x) f(x, x);"
+        "def g(x) y;"
+        "def f(y) y;"
+        "f(1);"
+        "g(1);"
+        "extern jittestmissing(x);"
+        "def k(x) jittestmissing(x);"
+        "k(1);"
+        "extern later(x);"
+        "def early(x) later(x);"
+        "def later(x) x + 1;"
+        "early(1);");
+    const auto nodes = TParser{source}.ParseChunk();
+
+    TLazyJit jit;
+    jit.Add(*nodes[0]);
+    // the errors of the codegen are thrown when an item is added, not on its first call
+    const auto expectError = [&](std::size_t item, std::string_view message) {
+        try {
+            jit.Add(*nodes[item]);
+            ADD_FAILURE() << "No error for item " << item;
+        } catch (const std::runtime_error& e) {
+            EXPECT_EQ(e.what(), message);
+        }
+    };
+    expectError(1, "Unknown function \"h\"");
+    expectError(2, "Incorrect number of arguments");
+    expectError(3, "Expected known named value, found \"y\"");
+    expectError(4, "Can't redefine function \"f\"");
+    EXPECT_EQ(jit.Run(jit.Add(*nodes[5])), 1);
+    // the failed definitions of g leave nothing behind
+    expectError(6, "Unknown function \"g\"");
+
+    // an extern may be defined later, but not after an expression calls it
+    jit.Add(*nodes[7]);
+    jit.Add(*nodes[8]);
+    expectError(9, "Can't find \"jittestmissing\"");
+    for (std::size_t i = 10; i < 13; ++i) {
+        jit.Add(*nodes[i]);
+    }
+    EXPECT_EQ(jit.Run(jit.Add(*nodes[13])), 2);
+
+    TTieredJit tiered;
+    tiered.Add(*nodes[7]);
+    tiered.Add(*nodes[8]);
+    EXPECT_THROW(tiered.Add(*nodes[9]), std::runtime_error);
+}
+
+TEST(JitTest, TieredPromotesHotFunctions) {
+    auto source = TSource::FromString(
+        "def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2);"
+        "def cold(x) x + 1;"
+        "fib(15);"
+        "cold(1);");
+    const auto nodes = TParser{source}.ParseChunk();
+
+    TTieredJit jit{/* hotCallCount = */ 100};
+    std::vector<std::string> names;
+    for (const auto& node : nodes) {
+        names.push_back(jit.Add(*node));
+    }
+    EXPECT_EQ(jit.GetCallCount("fib"), 0u);
+    EXPECT_EQ(jit.Run(names[2]), 610);
+    EXPECT_EQ(jit.Run(names[3]), 2);
+    EXPECT_GE(jit.GetCallCount("fib"), 100u);
+    EXPECT_EQ(jit.GetCallCount("cold"), 1u);
+
+    jit.WaitForPromotions();
+    EXPECT_EQ(jit.GetPromotedCount(), 1u);
+
+    // the optimized code gives the same results and doesn't count the calls
+    const std::uint64_t callCount = jit.GetCallCount("fib");
+    auto* fib = reinterpret_cast<double (*)(double)>(jit.Lookup("fib"));
+    EXPECT_EQ(fib(20), 6765);
+    EXPECT_EQ(jit.GetCallCount("fib"), callCount);
+    EXPECT_THROW(jit.GetCallCount("sin"), std::runtime_error);
+}
+
+TEST(JitTest, TieredSameResults) {
+    const std::string text =
+        "extern sin(x);"
+        "def binary| 5 (a b) if a then 1 else if b then 1 else 0;"
+        "def g(x) if x < 1 then sin(x) else g(x - 1) * 0.5 + x;"
+        "def h(x y) if x < 1 | y < 0 then y else h(x - 1, y + g(x) * 0.01);"
+        "g(30);"
+        "h(40, 3);";
+    auto source = TSource::FromString(text);
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    const auto nodes = TParser{source, &arena, &symbols}.ParseChunk();
+
+    TTieredJit jit{/* hotCallCount = */ 10, &symbols, /* compileThreads = */ 2};
+    std::vector<std::string> exprs;
+    for (const auto& node : nodes) {
+        if (const std::string name = jit.Add(*node); name.starts_with("__anon_expr")) {
+            exprs.push_back(name);
+        }
+    }
+    const std::vector<double> expected = Evaluate(text);
+    ASSERT_EQ(exprs.size(), expected.size());
+    for (std::size_t run = 0; run < 3; ++run) {
+        for (std::size_t i = 0; i < exprs.size(); ++i) {
+            EXPECT_DOUBLE_EQ(jit.Run(exprs[i]), expected[i]) << "run " << run;
+        }
+        jit.WaitForPromotions();
+    }
+    // binary|, g and h
+    EXPECT_EQ(jit.GetPromotedCount(), 3u);
+    EXPECT_THROW(jit.Add(*TParser{source}.ParseChunk()[2]), std::runtime_error);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace NKaleidoscope::NCharClass {
+
+// classes of the characters in the "C" locale, non-ASCII bytes belong to none
+enum EClass : std::uint8_t {
+    Space = 1 << 0, // ' ', '\t', '\n', '\v', '\f', '\r'
+    Alpha = 1 << 1, // [a-zA-Z]
+    Digit = 1 << 2, // [0-9]
+    Dot = 1 << 3,   // '.'
+};
+
+constexpr std::array<std::uint8_t, 256> BuildTable() {
+    std::array<std::uint8_t, 256> table{};
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        table[static_cast<unsigned char>(c)] |= Space;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        table[c] |= Alpha;
+        table[c - 'a' + 'A'] |= Alpha;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        table[c] |= Digit;
+    }
+    table['.'] |= Dot;
+    return table;
+}
+
+constexpr std::array<std::uint8_t, 256> TABLE = BuildTable();
+
+constexpr bool Is(char c, std::uint8_t classes) {
+    return TABLE[static_cast<unsigned char>(c)] & classes;
+}
+
+constexpr bool IsSpace(char c) { return Is(c, Space); }
+constexpr bool IsAlpha(char c) { return Is(c, Alpha); }
+constexpr bool IsAlnum(char c) { return Is(c, Alpha | Digit); }
+constexpr bool IsDigitDot(char c) { return Is(c, Digit | Dot); }
+
+static_assert(IsSpace('\v') && !IsSpace('a'));
+static_assert(IsAlpha('Z') && !IsAlpha('0') && !IsAlpha('\xE9'));
+static_assert(IsAlnum('7') && !IsAlnum('_'));
+static_assert(IsDigitDot('.') && !IsDigitDot('e'));
+
+} // namespace NKaleidoscope::NCharClass
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "lexer.h"
+
+namespace NKaleidoscope::NKeywords {
+
+struct TKeyword {
+    std::string_view Spelling;
+    ETokenKind Kind;
+};
+
+// a new keyword should be added only here
+constexpr std::array KEYWORDS = {
+    TKeyword{"def", ETokenKind::Def},
+    TKeyword{"extern", ETokenKind::Extern},
+    TKeyword{"binary", ETokenKind::Binary},
+    TKeyword{"if", ETokenKind::If},
+    TKeyword{"then", ETokenKind::Then},
+    TKeyword{"else", ETokenKind::Else},
+};
+
+constexpr std::size_t MAX_KEYWORD_LENGTH = [] {
+    std::size_t result = 0;
+    for (const auto& keyword : KEYWORDS) {
+        result = std::max(result, keyword.Spelling.size());
+    }
+    return result;
+}();
+
+// the table has at least twice as many slots as there are keywords
+constexpr std::size_t TABLE_BITS = std::bit_width(KEYWORDS.size() * 2 - 1);
+constexpr std::size_t TABLE_SIZE = std::size_t{1} << TABLE_BITS;
+
+// multiplicative hash of the length and the first and the last characters
+constexpr std::size_t Hash(std::string_view id, std::uint32_t seed) {
+    const std::uint32_t key = (static_cast<unsigned char>(id.front()) << 16)
+                            | (static_cast<unsigned char>(id.back()) << 8)
+                            | static_cast<std::uint32_t>(id.size());
+    return (key * seed) >> (32 - TABLE_BITS);
+}
+
+// the first seed that gives no collisions between the keywords
+constexpr std::uint32_t SEED = [] {
+    for (std::uint32_t seed = 0x9E3779B1;; seed += 2) {
+        std::array<bool, TABLE_SIZE> used{};
+        bool collision = false;
+        for (const auto& keyword : KEYWORDS) {
+            collision |= std::exchange(used[Hash(keyword.Spelling, seed)], true);
+        }
+        if (!collision) {
+            return seed;
+        }
+    }
+}();
+
+constexpr std::array<TKeyword, TABLE_SIZE> TABLE = [] {
+    std::array<TKeyword, TABLE_SIZE> table{};
+    for (auto& slot : table) {
+        slot = TKeyword{"", ETokenKind::Identifier};
+    }
+    for (const auto& keyword : KEYWORDS) {
+        table[Hash(keyword.Spelling, SEED)] = keyword;
+    }
+    return table;
+}();
+
+// returns the keyword's token kind, or ETokenKind::Identifier for other identifiers
+constexpr ETokenKind Find(std::string_view id) {
+    if (id.empty() || id.size() > MAX_KEYWORD_LENGTH) {
+        return ETokenKind::Identifier;
+    }
+    const TKeyword& keyword = TABLE[Hash(id, SEED)];
+    if (keyword.Spelling.size() != id.size()) {
+        return ETokenKind::Identifier;
+    }
+    // keywords are short, a plain loop is cheaper than a memcmp call
+    for (std::size_t i = 0; i < id.size(); ++i) {
+        if (keyword.Spelling[i] != id[i]) {
+            return ETokenKind::Identifier;
+        }
+    }
+    return keyword.Kind;
+}
+
+static_assert(Find("def") == ETokenKind::Def);
+static_assert(Find("else") == ETokenKind::Else);
+static_assert(Find("elsa") == ETokenKind::Identifier);
+
+} // namespace NKaleidoscope::NKeywords
@@ -1,13 +1,18 @@
 #include "lexer.h"
 
+#include "char_class.h"
+#include "keywords.h"
+#include "scan.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
 namespace NKaleidoscope {
 
 namespace {
 
-bool IsDigitDot(auto c) {
-    return std::isdigit(c) || c == '.';
-}
-
 ETokenKind CharToToken(char c) {
     switch (c) {
     case '(':
@@ -33,43 +38,97 @@ ETokenKind CharToToken(char c) {
     }
 }
 
-TToken LexToken(const TSource& source, std::size_t& offset) {
-    std::string_view buffer = source.GetBuffer();
-    while (offset < buffer.length() && std::isspace(buffer[offset])) {
-        ++offset;
+// a window over the source buffer, a streaming source is refilled on demand
+class TLexWindow {
+public:
+    TLexWindow(const TSource& source, TSource* stream,
+               std::size_t endLimit = std::numeric_limits<std::size_t>::max())
+        : Source_{source}
+        , Stream_{stream}
+        , EndLimit_{endLimit}
+    {
+        Reload();
+    }
+
+    // checks that the byte at `offset` is available, the streaming source
+    // keeps all bytes starting from `keepFrom` while being refilled
+    bool Has(std::size_t offset, std::size_t keepFrom) {
+        while (offset >= End_) {
+            if (!Stream_ || !Stream_->ReadChunk(keepFrom)) {
+                return false;
+            }
+            Reload();
+        }
+        return true;
+    }
+
+    // moves `offset` past the run accepted by the kernel, a streaming source
+    // keeps everything starting from `keepFrom` (or from the current offset)
+    void SkipRun(std::size_t& offset, std::optional<std::size_t> keepFrom,
+                 const char* (*skip)(const char* begin, const char* end))
+    {
+        while (Has(offset, keepFrom.value_or(offset))) {
+            const char* begin = Data_ + (offset - Begin_);
+            offset += skip(begin, Data_ + (End_ - Begin_)) - begin;
+            if (offset < End_) {
+                break;
+            }
+        }
+    }
+
+    char operator[](std::size_t offset) const {
+        return Data_[offset - Begin_];
+    }
+
+    std::string_view Substr(std::size_t offset, std::size_t length) const {
+        return {Data_ + (offset - Begin_), length};
+    }
+
+private:
+    void Reload() {
+        const std::string_view buffer = Source_.GetBuffer();
+        Data_ = buffer.data();
+        Begin_ = Source_.GetBufferOffset();
+        End_ = std::min(Begin_ + buffer.length(), EndLimit_);
+    }
+
+private:
+    const TSource& Source_;
+    TSource* Stream_;
+    std::size_t EndLimit_;
+    const char* Data_;
+    std::size_t Begin_;
+    std::size_t End_;
+};
+
+TToken LexToken(const TSource& source, TLexWindow& window, std::size_t& offset) {
+    const TScanKernels& kernels = GetScanKernels();
+    window.SkipRun(offset, /* keepFrom = */ std::nullopt, kernels.SkipSpaces);
+
+    // comment: '#' and until end of line, a run of them is skipped in a loop
+    while (window.Has(offset, offset) && window[offset] == '#') {
+        window.SkipRun(++offset, /* keepFrom = */ std::nullopt, kernels.SkipLine);
+        window.SkipRun(offset, /* keepFrom = */ std::nullopt, kernels.SkipSpaces);
     }
 
     // check if we have reached EOF
-    if (offset >= buffer.length()) {
+    if (!window.Has(offset, offset)) {
         return TToken{
             .Kind = ETokenKind::Eof,
-            .SourceRange = TSourceRange{.Source = &source, .Offset = buffer.length(), .Length = 0},
+            .SourceRange = TSourceRange{.Source = &source, .Offset = offset, .Length = 0},
         };
     }
 
     const std::size_t beginOffset = offset;
 
     // identifier: [a-zA-Z][a-zA-Z0-9]*
-    if (std::isalpha(buffer[offset])) {
-        while (offset < buffer.length() && std::isalnum(buffer[offset])) {
-            ++offset;
-        }
+    if (NCharClass::IsAlpha(window[offset])) {
+        window.SkipRun(++offset, beginOffset, kernels.SkipAlnums);
         const std::size_t tokenLength = offset - beginOffset;
 
         // calculate token kind
-        const std::string_view identifierStr = buffer.substr(beginOffset, tokenLength);
-        ETokenKind kind = ETokenKind::Identifier;
-        if (identifierStr == "def") {
-            kind = ETokenKind::Def;
-        } else if (identifierStr == "extern") {
-            kind = ETokenKind::Extern;
-        } else if (identifierStr == "if") {
-            kind = ETokenKind::If;
-        } else if (identifierStr == "then") {
-            kind = ETokenKind::Then;
-        } else if (identifierStr == "else") {
-            kind = ETokenKind::Else;
-        }
+        const std::string_view identifierStr = window.Substr(beginOffset, tokenLength);
+        const ETokenKind kind = NKeywords::Find(identifierStr);
 
         // return token
         return TToken{
@@ -79,10 +138,8 @@ TToken LexToken(const TSource& source, std::size_t& offset) {
     }
 
     // number: [0-9.]+
-    if (IsDigitDot(buffer[offset])) {
-        while (offset < buffer.length() && IsDigitDot(buffer[offset])) {
-            ++offset;
-        }
+    if (NCharClass::IsDigitDot(window[offset])) {
+        window.SkipRun(offset, beginOffset, kernels.SkipDigitDots);
         const std::size_t tokenLength = offset - beginOffset;
 
         // return token
@@ -92,17 +149,8 @@ TToken LexToken(const TSource& source, std::size_t& offset) {
         };
     }
 
-    // comment: '#' and until end of line
-    if (buffer[offset] == '#') {
-        do {
-            ++offset;
-        } while (offset < buffer.length() && buffer[offset] != '\n' && buffer[offset] != '\n');
-
-        return LexToken(source, offset);
-    }
-
     // map the current character to the token
-    char ch = buffer[offset++];
+    char ch = window[offset++];
     return TToken{
         .Kind = CharToToken(ch),
         .SourceRange = TSourceRange{.Source = &source, .Offset = beginOffset, .Length = 1},
@@ -111,10 +159,102 @@ TToken LexToken(const TSource& source, std::size_t& offset) {
 
 } // namespace
 
+// TLexer
+TLexer::TLexer(const TSource& source)
+    : TLexer{source, 0, source.GetBuffer().size()}
+{
+}
+
+TLexer::TLexer(const TSource& source, std::size_t beginOffset, std::size_t endOffset)
+    : Source_{source}
+    , Offset_{beginOffset}
+    , EndOffset_{endOffset}
+{
+    if (source.IsStreaming()) {
+        throw std::runtime_error("Streaming source should be lexed with LexStream");
+    }
+}
+
+TToken TLexer::Next() {
+    TLexWindow window{Source_, /* stream = */ nullptr, EndOffset_};
+    return LexToken(Source_, window, Offset_);
+}
+
+// TTokenStream
+TTokenStream::TTokenStream(const TSource& source)
+    : Lexer_{std::in_place, source}
+    , Exhausted_{false}
+    , Head_{0}
+    , Size_{0}
+{
+    Fill();
+}
+
+TTokenStream::TTokenStream(TTokenList&& tokens)
+    : List_{std::move(tokens)}
+    , Exhausted_{false}
+    , Head_{0}
+    , Size_{0}
+{
+    Fill();
+}
+
+const TToken& TTokenStream::Current() const {
+    return Ring_[Head_];
+}
+
+bool TTokenStream::SkipToken() {
+    if (Size_ == 1 && !Fill()) {
+        return false;
+    }
+    Head_ = (Head_ + 1) % LOOKAHEAD;
+    --Size_;
+    return true;
+}
+
+const TToken& TTokenStream::Peek(std::size_t n) {
+    if (n >= LOOKAHEAD) {
+        throw std::runtime_error("Can't peek beyond the lookahead");
+    }
+    while (Size_ <= n && Fill()) {
+    }
+    return Ring_[(Head_ + std::min(n, Size_ - 1)) % LOOKAHEAD];
+}
+
+bool TTokenStream::Fill() {
+    if (Exhausted_ || Size_ == LOOKAHEAD) {
+        return false;
+    }
+
+    TToken& token = Ring_[(Head_ + Size_) % LOOKAHEAD];
+    if (Lexer_) {
+        token = Lexer_->Next();
+        Exhausted_ = token.Kind == ETokenKind::Eof;
+    } else {
+        token = List_->Current();
+        Exhausted_ = !List_->SkipToken();
+    }
+    ++Size_;
+    return true;
+}
+
 void LexTokens(const TSource& source, ITokenVisitor& visitor) {
+    TLexer lexer{source};
+    while (true) {
+        TToken token = lexer.Next();
+        bool isEof = token.Kind == ETokenKind::Eof;
+        visitor.Visit(std::move(token));
+        if (isEof) {
+            break;
+        }
+    }
+}
+
+void LexStream(TSource& source, ITokenVisitor& visitor) {
+    TLexWindow window{source, /* stream = */ &source};
     std::size_t offset = 0;
     while (true) {
-        TToken token = LexToken(source, offset);
+        TToken token = LexToken(source, window, offset);
         bool isEof = token.Kind == ETokenKind::Eof;
         visitor.Visit(std::move(token));
         if (isEof) {
@@ -125,26 +265,89 @@ void LexTokens(const TSource& source, ITokenVisitor& visitor) {
 
 // token parsers
 TTokenList::TTokenList()
-    : Index_{0}
+    : Source_{nullptr}
+    , Index_{0}
+    , Current_{}
 {
 }
 
 void TTokenList::AddToken(TToken token) {
-    Tokens_.emplace_back(std::move(token));
+    const TSourceRange& range = token.SourceRange;
+    if (Source_ && Source_ != range.Source) {
+        throw std::runtime_error("All tokens of a list should come from the same source");
+    }
+    if (range.Offset + range.Length > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("Source is too large for a token list");
+    }
+
+    Source_ = range.Source;
+    Kinds_.push_back(token.Kind);
+    Offsets_.push_back(static_cast<std::uint32_t>(range.Offset));
+    Lengths_.push_back(static_cast<std::uint32_t>(range.Length));
+    if (Kinds_.size() == 1) {
+        Current_ = GetToken(0);
+    }
 }
 
 const TToken& TTokenList::Current() const {
-    return Tokens_[Index_];
+    return Current_;
 }
 
 bool TTokenList::SkipToken() {
-    if (Index_ + 1 < Tokens_.size()) {
-        ++Index_;
+    if (Index_ + 1 < Kinds_.size()) {
+        Current_ = GetToken(++Index_);
         return true;
     }
     return false;
 }
 
+std::size_t TTokenList::Size() const {
+    return Kinds_.size();
+}
+
+ETokenKind TTokenList::GetKind(std::size_t index) const {
+    return Kinds_[index];
+}
+
+TSourceRange TTokenList::GetSourceRange(std::size_t index) const {
+    return TSourceRange{.Source = Source_, .Offset = Offsets_[index], .Length = Lengths_[index]};
+}
+
+TToken TTokenList::GetToken(std::size_t index) const {
+    return TToken{.Kind = Kinds_[index], .SourceRange = GetSourceRange(index)};
+}
+
+void TTokenList::Append(const TTokenList& tokens) {
+    if (tokens.Kinds_.empty()) {
+        return;
+    }
+    if (Source_ && Source_ != tokens.Source_) {
+        throw std::runtime_error("All tokens of a list should come from the same source");
+    }
+
+    const bool wasEmpty = Kinds_.empty();
+    Source_ = tokens.Source_;
+    Kinds_.insert(Kinds_.end(), tokens.Kinds_.begin(), tokens.Kinds_.end());
+    Offsets_.insert(Offsets_.end(), tokens.Offsets_.begin(), tokens.Offsets_.end());
+    Lengths_.insert(Lengths_.end(), tokens.Lengths_.begin(), tokens.Lengths_.end());
+    if (wasEmpty) {
+        Current_ = GetToken(0);
+    }
+}
+
+TTokenList TTokenList::Slice(std::size_t begin, std::size_t end) const {
+    TTokenList tokens;
+    if (begin == end) {
+        return tokens;
+    }
+    tokens.Source_ = Source_;
+    tokens.Kinds_.assign(Kinds_.begin() + begin, Kinds_.begin() + end);
+    tokens.Offsets_.assign(Offsets_.begin() + begin, Offsets_.begin() + end);
+    tokens.Lengths_.assign(Lengths_.begin() + begin, Lengths_.begin() + end);
+    tokens.Current_ = tokens.GetToken(0);
+    return tokens;
+}
+
 TTokenList LexTokens(const TSource& source) {
     TTokenList tokenList;
 
@@ -161,4 +364,56 @@ TTokenList LexTokens(const TSource& source) {
     return tokenList;
 }
 
+TTokenList LexTokensParallel(const TSource& source, TThreadPool& threadPool, std::size_t chunkSize) {
+    const std::string_view buffer = source.GetBuffer();
+    if (buffer.size() <= chunkSize || threadPool.GetThreadCount() == 1) {
+        return LexTokens(source);
+    }
+
+    // A chunk starts right after a '\n'. No token contains a newline and a
+    // comment ends at the newline, so every chunk starts in the initial state
+    // of the lexer and there is nothing to carry over between chunks.
+    std::vector<std::size_t> boundaries = {0};
+    while (boundaries.back() + chunkSize < buffer.size()) {
+        const std::size_t newline = buffer.find('\n', boundaries.back() + chunkSize);
+        if (newline == std::string_view::npos) {
+            break;
+        }
+        boundaries.push_back(newline + 1);
+    }
+    boundaries.push_back(buffer.size());
+
+    std::vector<std::future<TTokenList>> chunks;
+    for (std::size_t i = 0; i + 1 < boundaries.size(); ++i) {
+        const bool isLast = i + 2 == boundaries.size();
+        chunks.push_back(threadPool.Submit([&source, begin = boundaries[i], end = boundaries[i + 1], isLast] {
+            TTokenList tokenList;
+            TLexer lexer{source, begin, end};
+            while (true) {
+                TToken token = lexer.Next();
+                // only the last chunk ends with the real Eof
+                if (token.Kind == ETokenKind::Eof && !isLast) {
+                    break;
+                }
+                tokenList.AddToken(token);
+                if (token.Kind == ETokenKind::Eof) {
+                    break;
+                }
+            }
+            return tokenList;
+        }));
+    }
+
+    // the tasks reference the source, so all of them should finish before any error is thrown
+    for (auto& chunk : chunks) {
+        chunk.wait();
+    }
+
+    TTokenList tokenList;
+    for (auto& chunk : chunks) {
+        tokenList.Append(chunk.get());
+    }
+    return tokenList;
+}
+
 } // namespace NKaleidoscope
@@ -1,13 +1,17 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <optional>
 #include <vector>
 
 #include "source.h"
+#include "thread_pool.h"
 
 namespace NKaleidoscope {
 
 // the list of all possible tokens
-enum struct ETokenKind {
+enum struct ETokenKind : std::uint8_t {
     Invalid,
 
     // end-of-file
@@ -16,6 +20,7 @@ enum struct ETokenKind {
     // commands
     Def,
     Extern,
+    Binary,
     
     // primary
     Identifier,
@@ -38,6 +43,9 @@ enum struct ETokenKind {
     Semicolon,  // ;
 };
 
+// Semicolon should stay the last kind
+constexpr std::size_t TOKEN_KIND_COUNT = static_cast<std::size_t>(ETokenKind::Semicolon) + 1;
+
 // description of every token
 struct TToken {
     ETokenKind Kind;
@@ -45,19 +53,89 @@ struct TToken {
 };
 
 // token parsers
+// tokens are stored column-wise (kind, offset, length) with a single source
+// pointer, so a token takes 9 bytes instead of sizeof(TToken)
 class TTokenList {
 public:
     TTokenList();
 
+    // all tokens should come from the same source of at most 4 GiB
     void AddToken(TToken token);
     const TToken& Current() const;
     bool SkipToken();
 
+    // random access, the source ranges are rebuilt on demand
+    std::size_t Size() const;
+    ETokenKind GetKind(std::size_t index) const;
+    TSourceRange GetSourceRange(std::size_t index) const;
+    TToken GetToken(std::size_t index) const;
+
+    void Append(const TTokenList& tokens);
+
+    // copy of the tokens [begin, end)
+    TTokenList Slice(std::size_t begin, std::size_t end) const;
+
 private:
-    std::vector<TToken> Tokens_;
+    const TSource* Source_;
+    std::vector<ETokenKind> Kinds_;
+    std::vector<std::uint32_t> Offsets_;
+    std::vector<std::uint32_t> Lengths_;
+
     std::size_t Index_;
+    TToken Current_;
+};
+
+// pulls tokens out of a source one by one, returns Eof after the end
+class TLexer {
+public:
+    explicit TLexer(const TSource& source);
+
+    // lexes only [beginOffset, endOffset), both should be token boundaries;
+    // Eof is reported at endOffset
+    TLexer(const TSource& source, std::size_t beginOffset, std::size_t endOffset);
+
+    TToken Next();
+
+private:
+    const TSource& Source_;
+    std::size_t Offset_;
+    std::size_t EndOffset_;
+};
+
+// a token cursor with the same contract as TTokenList, tokens are lexed
+// on demand and only a small lookahead ring is kept in memory
+class TTokenStream {
+public:
+    static constexpr std::size_t LOOKAHEAD = 4;
+
+public:
+    explicit TTokenStream(const TSource& source);
+
+    // replays already lexed tokens
+    explicit TTokenStream(TTokenList&& tokens);
+
+    const TToken& Current() const;
+    bool SkipToken();
+
+    // the n-th token after the current one, n < LOOKAHEAD; the last token
+    // is repeated if there are not enough tokens
+    const TToken& Peek(std::size_t n);
+
+private:
+    bool Fill();
+
+private:
+    std::optional<TLexer> Lexer_;
+    std::optional<TTokenList> List_;
+    bool Exhausted_;
+
+    std::array<TToken, LOOKAHEAD> Ring_;
+    std::size_t Head_;
+    std::size_t Size_;
 };
 
+constexpr std::size_t DEFAULT_PARALLEL_CHUNK_SIZE = 1 << 20;
+
 struct ITokenVisitor {
     virtual void Visit(TToken token) = 0;
 };
@@ -65,4 +143,13 @@ struct ITokenVisitor {
 void LexTokens(const TSource& source, ITokenVisitor& visitor);
 TTokenList LexTokens(const TSource& source);
 
+// splits the source into chunks of about `chunkSize` bytes at line boundaries
+// and lexes them in parallel, the result is the same as of LexTokens
+TTokenList LexTokensParallel(const TSource& source, TThreadPool& threadPool,
+                             std::size_t chunkSize = DEFAULT_PARALLEL_CHUNK_SIZE);
+
+// lexes a streaming source chunk by chunk, a token's range is valid
+// only until the visitor returns
+void LexStream(TSource& source, ITokenVisitor& visitor);
+
 } // namespace NKaleidoscope
@@ -0,0 +1,146 @@
+#include <benchmark/benchmark.h>
+#include "keywords.h"
+#include "lexer.h"
+#include "scan.h"
+
+using namespace NKaleidoscope;
+
+namespace {
+
+// a few MB of generated definitions
+const std::string& GeneratedProgram() {
+    static const std::string program = [] {
+        std::string result;
+        for (int i = 0; i < 50000; ++i) {
+            const std::string id = std::to_string(i);
+            result += "# polynomial number " + id + "\n";
+            result += "def polynomial" + id + "(x y)\n";
+            result += "    if x < " + id + ".5 then\n";
+            result += "        x*x*3.14159265 + y*2.71828182 - coefficient" + id + "(x, y)\n";
+            result += "    else\n";
+            result += "        polynomial" + id + "(x - 1, y)\n\n";
+        }
+        return result;
+    }();
+    return program;
+}
+
+struct TCountingVisitor : ITokenVisitor {
+    void Visit(TToken) override {
+        ++Count;
+    }
+
+    std::size_t Count = 0;
+};
+
+void BM_LexTokens(benchmark::State& state) {
+    const TSource source = TSource::FromString(GeneratedProgram());
+    for (auto _ : state) {
+        TCountingVisitor visitor;
+        LexTokens(source, visitor);
+        benchmark::DoNotOptimize(visitor.Count);
+    }
+    state.SetBytesProcessed(state.iterations() * source.GetBuffer().size());
+}
+BENCHMARK(BM_LexTokens);
+
+void BM_LexTokensList(benchmark::State& state) {
+    const TSource source = TSource::FromString(GeneratedProgram());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(LexTokens(source).Size());
+    }
+    state.SetBytesProcessed(state.iterations() * source.GetBuffer().size());
+}
+BENCHMARK(BM_LexTokensList);
+
+void BM_LexTokensParallel(benchmark::State& state) {
+    const TSource source = TSource::FromString(GeneratedProgram());
+    TThreadPool threadPool{static_cast<std::size_t>(state.range(0))};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(LexTokensParallel(source, threadPool).Size());
+    }
+    state.SetBytesProcessed(state.iterations() * source.GetBuffer().size());
+}
+BENCHMARK(BM_LexTokensParallel)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// skip all runs of the program with a single kernel
+void BM_ScanKernels(benchmark::State& state) {
+    const auto backend = static_cast<EScanBackend>(state.range(0));
+    if (!IsScanBackendSupported(backend)) {
+        state.SkipWithError("backend is not supported");
+        return;
+    }
+    const TScanKernels& kernels = GetScanKernels(backend);
+    const std::string& program = GeneratedProgram();
+    for (auto _ : state) {
+        const char* begin = program.data();
+        const char* end = begin + program.size();
+        while (begin != end) {
+            const char* next = kernels.SkipAlnums(begin, end);
+            next = kernels.SkipSpaces(next, end);
+            begin = next == begin ? begin + 1 : next;
+        }
+        benchmark::DoNotOptimize(begin);
+    }
+    state.SetBytesProcessed(state.iterations() * program.size());
+}
+BENCHMARK(BM_ScanKernels)
+    ->Arg(static_cast<int>(EScanBackend::Scalar))
+    ->Arg(static_cast<int>(EScanBackend::Sse2))
+    ->Arg(static_cast<int>(EScanBackend::Avx2));
+
+// identifiers, half of them look like keywords (same first character or length)
+const std::vector<std::string>& IdentifierList() {
+    static const std::vector<std::string> ids = [] {
+        std::vector<std::string> result;
+        const std::vector<std::string> words = {
+            "x", "y", "def", "delta", "extern", "external", "if", "iff", "then", "thence",
+            "else", "elsewhere", "fib", "polynomial", "coefficient", "t", "e", "d",
+        };
+        std::uint32_t random = 1;
+        for (int i = 0; i < 10000; ++i) {
+            random = random * 1664525 + 1013904223;
+            result.push_back(words[(random >> 16) % words.size()]);
+        }
+        return result;
+    }();
+    return ids;
+}
+
+// the comparison chain LexToken used before the perfect hash
+ETokenKind FindKeywordByComparisons(std::string_view identifierStr) {
+    if (identifierStr == "def") {
+        return ETokenKind::Def;
+    } else if (identifierStr == "extern") {
+        return ETokenKind::Extern;
+    } else if (identifierStr == "if") {
+        return ETokenKind::If;
+    } else if (identifierStr == "then") {
+        return ETokenKind::Then;
+    } else if (identifierStr == "else") {
+        return ETokenKind::Else;
+    }
+    return ETokenKind::Identifier;
+}
+
+void BM_KeywordsComparisons(benchmark::State& state) {
+    for (auto _ : state) {
+        for (const auto& id : IdentifierList()) {
+            benchmark::DoNotOptimize(FindKeywordByComparisons(id));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * IdentifierList().size());
+}
+BENCHMARK(BM_KeywordsComparisons);
+
+void BM_KeywordsPerfectHash(benchmark::State& state) {
+    for (auto _ : state) {
+        for (const auto& id : IdentifierList()) {
+            benchmark::DoNotOptimize(NKeywords::Find(id));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * IdentifierList().size());
+}
+BENCHMARK(BM_KeywordsPerfectHash);
+
+} // namespace
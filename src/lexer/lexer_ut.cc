@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
+#include <unistd.h>
+#include "keywords.h"
 #include "lexer.h"
+#include "scan.h"
 
 using namespace NKaleidoscope;
 using enum ETokenKind;
@@ -14,6 +17,25 @@ struct TMockTokenVisitor : ITokenVisitor {
     std::vector<TToken> Tokens;
 };
 
+struct TTokenText {
+    ETokenKind Kind;
+    std::size_t Offset;
+    std::string Text;
+
+    bool operator==(const TTokenText&) const = default;
+};
+
+// copies the token text while it is still valid
+struct TTextTokenVisitor : ITokenVisitor {
+    void Visit(TToken token) override {
+        Tokens.emplace_back(token.Kind, token.SourceRange.Offset, std::string{token.SourceRange.AsStringView()});
+        MaxBufferSize = std::max(MaxBufferSize, token.SourceRange.Source->GetBuffer().size());
+    }
+
+    std::vector<TTokenText> Tokens;
+    std::size_t MaxBufferSize = 0;
+};
+
 const std::string SMOKE_PROGRAM = R"(
 # Compute the x'th fibonacci number.
 def fib(x)
@@ -89,3 +111,215 @@ TEST(LexerTest, TokenListSmoke) {
         }
     }
 }
+
+TEST(LexerTest, StreamChunks) {
+    const std::string program = SMOKE_PROGRAM + "# trailing comment without a newline";
+
+    const TSource source = TSource::FromString(program);
+    TTextTokenVisitor expectedVisitor;
+    LexTokens(source, expectedVisitor);
+
+    for (std::size_t chunkSize : {1, 2, 3, 5, 8, 64, 4096}) {
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        ASSERT_EQ(write(fds[1], program.data(), program.size()), static_cast<ssize_t>(program.size()));
+        close(fds[1]);
+
+        TSource stream = TSource::FromFileDescriptor(fds[0], chunkSize);
+        TTextTokenVisitor streamVisitor;
+        LexStream(stream, streamVisitor);
+        close(fds[0]);
+
+        EXPECT_EQ(streamVisitor.Tokens, expectedVisitor.Tokens) << "chunk size " << chunkSize;
+
+        // the window holds a chunk and the unfinished token at most
+        EXPECT_LE(streamVisitor.MaxBufferSize, chunkSize + std::string_view{"fibonacci"}.size());
+    }
+}
+
+TEST(LexerTest, StreamRequiresLexStream) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    close(fds[1]);
+
+    const TSource stream = TSource::FromFileDescriptor(fds[0]);
+    TMockTokenVisitor tokenVisitor;
+    EXPECT_THROW(LexTokens(stream, tokenVisitor), std::runtime_error);
+    close(fds[0]);
+}
+
+TEST(LexerTest, LongRuns) {
+    const std::string longId = "a" + std::string(40, 'Z') + "0123456789";
+    const std::string longNumber = std::string(37, '1') + "." + std::string(33, '2');
+    const std::string program =
+        std::string(50, ' ') + "\t\r\v\f\n" + longId + std::string(33, '\n') +
+        "# " + std::string(100, 'x') + "\n" + longNumber + " \xE9 " + longId + "#";
+
+    const TSource source = TSource::FromString(program);
+    TTextTokenVisitor tokenVisitor;
+    LexTokens(source, tokenVisitor);
+
+    const auto& tokens = tokenVisitor.Tokens;
+    ASSERT_EQ(tokens.size(), 5);
+    EXPECT_EQ(tokens[0].Kind, Identifier);
+    EXPECT_EQ(tokens[0].Text, longId);
+    EXPECT_EQ(tokens[1].Kind, Number);
+    EXPECT_EQ(tokens[1].Text, longNumber);
+    EXPECT_EQ(tokens[2].Kind, Invalid);
+    EXPECT_EQ(tokens[2].Text, "\xE9");
+    EXPECT_EQ(tokens[3].Kind, Identifier);
+    EXPECT_EQ(tokens[3].Text, longId);
+    EXPECT_EQ(tokens[4].Kind, Eof);
+    EXPECT_EQ(tokens[4].Offset, program.size());
+}
+
+TEST(LexerTest, ManyComments) {
+    // every comment used to take a stack frame
+    std::string program;
+    for (int i = 0; i < 1'000'000; ++i) {
+        program += "#c\n";
+    }
+    program += "x # the end";
+
+    const TSource source = TSource::FromString(program);
+    TTextTokenVisitor tokenVisitor;
+    LexTokens(source, tokenVisitor);
+
+    const auto& tokens = tokenVisitor.Tokens;
+    ASSERT_EQ(tokens.size(), 2);
+    EXPECT_EQ(tokens[0].Kind, Identifier);
+    EXPECT_EQ(tokens[1].Kind, Eof);
+}
+
+TEST(LexerTest, ScanBackendsAgree) {
+    // every byte value at every position of the SIMD blocks
+    std::string buffer;
+    for (int i = 0; i < 4; ++i) {
+        for (int c = 0; c < 256; ++c) {
+            buffer += std::string(i * 7 % 40, " a7.\n"[c % 5]);
+            buffer += static_cast<char>(c);
+        }
+    }
+
+    const TScanKernels& scalar = GetScanKernels(EScanBackend::Scalar);
+    for (auto backend : {EScanBackend::Sse2, EScanBackend::Avx2}) {
+        if (!IsScanBackendSupported(backend)) {
+            continue;
+        }
+        const TScanKernels& kernels = GetScanKernels(backend);
+        const char* end = buffer.data() + buffer.size();
+        for (const char* begin = buffer.data(); begin != end; ++begin) {
+            EXPECT_EQ(kernels.SkipSpaces(begin, end), scalar.SkipSpaces(begin, end));
+            EXPECT_EQ(kernels.SkipAlnums(begin, end), scalar.SkipAlnums(begin, end));
+            EXPECT_EQ(kernels.SkipDigitDots(begin, end), scalar.SkipDigitDots(begin, end));
+            EXPECT_EQ(kernels.SkipLine(begin, end), scalar.SkipLine(begin, end));
+        }
+    }
+}
+
+TEST(LexerTest, Keywords) {
+    for (const auto& keyword : NKeywords::KEYWORDS) {
+        EXPECT_EQ(NKeywords::Find(keyword.Spelling), keyword.Kind) << keyword.Spelling;
+    }
+    for (std::string_view id : {"d", "de", "deff", "dxf", "Def", "ef", "iff", "i", "f", "thenelse",
+                                "elif", "elsee", "externs", "extrn", "eeeeee", "x", "fib"}) {
+        EXPECT_EQ(NKeywords::Find(id), Identifier) << id;
+    }
+
+    const TSource source = TSource::FromString("def extern if then else define externa iff thenx els");
+    TTextTokenVisitor tokenVisitor;
+    LexTokens(source, tokenVisitor);
+
+    const std::vector<ETokenKind> expected = {
+        Def, Extern, If, Then, Else, Identifier, Identifier, Identifier, Identifier, Identifier, Eof,
+    };
+    ASSERT_EQ(tokenVisitor.Tokens.size(), expected.size());
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(tokenVisitor.Tokens[i].Kind, expected[i]);
+    }
+}
+
+TEST(LexerTest, TokenStreamSmoke) {
+    const TSource source = TSource::FromString(SMOKE_PROGRAM);
+    TTokenStream tokenStream{source};
+
+    for (std::size_t i = 0; i < TOKEN_KINDS.size(); ++i) {
+        EXPECT_EQ(tokenStream.Current().Kind, TOKEN_KINDS[i]);
+        for (std::size_t n = 0; n < TTokenStream::LOOKAHEAD; ++n) {
+            const std::size_t expected = std::min(i + n, TOKEN_KINDS.size() - 1);
+            EXPECT_EQ(tokenStream.Peek(n).Kind, TOKEN_KINDS[expected]);
+        }
+        if (i + 1 < TOKEN_KINDS.size()) {
+            EXPECT_TRUE(tokenStream.SkipToken());
+        } else {
+            EXPECT_FALSE(tokenStream.SkipToken());
+        }
+    }
+    EXPECT_EQ(tokenStream.Current().Kind, Eof);
+    EXPECT_THROW(tokenStream.Peek(TTokenStream::LOOKAHEAD), std::runtime_error);
+}
+
+TEST(LexerTest, TokenStreamFromList) {
+    const TSource source = TSource::FromString(SMOKE_PROGRAM);
+    TTokenStream tokenStream{LexTokens(source)};
+
+    for (std::size_t i = 0; i < TOKEN_KINDS.size(); ++i) {
+        EXPECT_EQ(tokenStream.Current().Kind, TOKEN_KINDS[i]);
+        EXPECT_EQ(tokenStream.SkipToken(), i + 1 < TOKEN_KINDS.size());
+    }
+}
+
+TEST(LexerTest, TokenListRandomAccess) {
+    const TSource source = TSource::FromString(SMOKE_PROGRAM);
+    TMockTokenVisitor tokenVisitor;
+    LexTokens(source, tokenVisitor);
+    const TTokenList tokenList = LexTokens(source);
+
+    ASSERT_EQ(tokenList.Size(), tokenVisitor.Tokens.size());
+    for (std::size_t i = 0; i < tokenList.Size(); ++i) {
+        const TToken& expected = tokenVisitor.Tokens[i];
+        EXPECT_EQ(tokenList.GetKind(i), expected.Kind);
+
+        const TSourceRange range = tokenList.GetSourceRange(i);
+        EXPECT_EQ(range.Source, &source);
+        EXPECT_EQ(range.Offset, expected.SourceRange.Offset);
+        EXPECT_EQ(range.Length, expected.SourceRange.Length);
+        EXPECT_EQ(tokenList.GetToken(i).SourceRange.AsStringView(), expected.SourceRange.AsStringView());
+    }
+}
+
+TEST(LexerTest, TokenListSingleSource) {
+    const TSource first = TSource::FromString("a");
+    const TSource second = TSource::FromString("b");
+
+    TTokenList tokenList;
+    tokenList.AddToken(TToken{.Kind = Identifier, .SourceRange = {.Source = &first, .Offset = 0, .Length = 1}});
+    EXPECT_THROW(
+        tokenList.AddToken(TToken{.Kind = Identifier, .SourceRange = {.Source = &second, .Offset = 0, .Length = 1}}),
+        std::runtime_error);
+}
+
+TEST(LexerTest, Parallel) {
+    std::string program;
+    for (int i = 0; i < 200; ++i) {
+        program += "# definition " + std::to_string(i) + " # with (tokens) in a comment\n";
+        program += "def f" + std::to_string(i) + "(x y) x*" + std::to_string(i) + ".5 + f(y, x) # tail\n\n";
+        program += std::string(i % 7, ' ') + "\t" + "extern g" + std::to_string(i) + "();\n";
+    }
+    program += "f0(1, 2) # no newline at the end";
+
+    const TSource source = TSource::FromString(program);
+    const TTokenList expected = LexTokens(source);
+
+    TThreadPool threadPool{4};
+    for (std::size_t chunkSize : {1, 7, 64, 1000, 1 << 20}) {
+        const TTokenList tokenList = LexTokensParallel(source, threadPool, chunkSize);
+        ASSERT_EQ(tokenList.Size(), expected.Size()) << "chunk size " << chunkSize;
+        for (std::size_t i = 0; i < expected.Size(); ++i) {
+            EXPECT_EQ(tokenList.GetKind(i), expected.GetKind(i));
+            EXPECT_EQ(tokenList.GetSourceRange(i).Offset, expected.GetSourceRange(i).Offset);
+            EXPECT_EQ(tokenList.GetSourceRange(i).Length, expected.GetSourceRange(i).Length);
+        }
+        EXPECT_EQ(tokenList.Current().Kind, Def);
+    }
+}
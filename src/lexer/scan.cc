@@ -0,0 +1,236 @@
+#include "scan.h"
+
+#include "char_class.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KALEIDOSCOPE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace NKaleidoscope {
+
+namespace {
+
+// scalar kernels, also used for the tails of the SIMD kernels
+template <std::uint8_t Classes>
+const char* SkipClassScalar(const char* begin, const char* end) {
+    while (begin != end && NCharClass::Is(*begin, Classes)) {
+        ++begin;
+    }
+    return begin;
+}
+
+const char* SkipLineScalar(const char* begin, const char* end) {
+    while (begin != end && *begin != '\n') {
+        ++begin;
+    }
+    return begin;
+}
+
+constexpr TScanKernels SCALAR_KERNELS = {
+    .SkipSpaces = SkipClassScalar<NCharClass::Space>,
+    .SkipAlnums = SkipClassScalar<NCharClass::Alpha | NCharClass::Digit>,
+    .SkipDigitDots = SkipClassScalar<NCharClass::Digit | NCharClass::Dot>,
+    .SkipLine = SkipLineScalar,
+};
+
+#ifdef KALEIDOSCOPE_SCAN_X86
+
+// most runs (identifiers, single spaces) are short, so the first bytes are
+// checked one by one before loading whole blocks
+constexpr std::ptrdiff_t SCALAR_PREFIX = 8;
+
+template <auto Scalar>
+bool SkipPrefix(const char*& begin, const char* end) {
+    const char* prefixEnd = begin + std::min(SCALAR_PREFIX, end - begin);
+    begin = Scalar(begin, prefixEnd);
+    return begin != prefixEnd;
+}
+
+// the block-wide predicates below are the same for SSE2 and AVX2 and are
+// written in terms of byte compares only: `x <= k` (unsigned) is `min(x, k) == x`
+
+// SSE2
+__m128i LessEqual(__m128i x, char k) {
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(k)), x);
+}
+
+__m128i InRange(__m128i x, char from, char to) {
+    return LessEqual(_mm_sub_epi8(x, _mm_set1_epi8(from)), to - from);
+}
+
+struct TSpacesSse2 {
+    static __m128i Match(__m128i x) {
+        return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), InRange(x, '\t', '\r'));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipSpaces;
+};
+
+struct TAlnumsSse2 {
+    static __m128i Match(__m128i x) {
+        const __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        return _mm_or_si128(InRange(x, '0', '9'), InRange(lower, 'a', 'z'));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipAlnums;
+};
+
+struct TDigitDotsSse2 {
+    static __m128i Match(__m128i x) {
+        return _mm_or_si128(InRange(x, '0', '9'), _mm_cmpeq_epi8(x, _mm_set1_epi8('.')));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipDigitDots;
+};
+
+struct TLineSse2 {
+    static __m128i Match(__m128i x) {
+        return _mm_xor_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), _mm_set1_epi8(-1));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipLine;
+};
+
+template <class TPredicate>
+const char* SkipSse2(const char* begin, const char* end) {
+    if (SkipPrefix<TPredicate::Scalar>(begin, end)) {
+        return begin;
+    }
+    while (end - begin >= 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const unsigned mismatch = ~_mm_movemask_epi8(TPredicate::Match(block)) & 0xFFFF;
+        if (mismatch) {
+            return begin + __builtin_ctz(mismatch);
+        }
+        begin += 16;
+    }
+    return TPredicate::Scalar(begin, end);
+}
+
+constexpr TScanKernels SSE2_KERNELS = {
+    .SkipSpaces = SkipSse2<TSpacesSse2>,
+    .SkipAlnums = SkipSse2<TAlnumsSse2>,
+    .SkipDigitDots = SkipSse2<TDigitDotsSse2>,
+    .SkipLine = SkipSse2<TLineSse2>,
+};
+
+// AVX2
+#define KALEIDOSCOPE_AVX2 __attribute__((target("avx2")))
+
+KALEIDOSCOPE_AVX2 __m256i LessEqual(__m256i x, char k) {
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(k)), x);
+}
+
+KALEIDOSCOPE_AVX2 __m256i InRange(__m256i x, char from, char to) {
+    return LessEqual(_mm256_sub_epi8(x, _mm256_set1_epi8(from)), to - from);
+}
+
+struct TSpacesAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256i Match(__m256i x) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), InRange(x, '\t', '\r'));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipSpaces;
+    static constexpr auto Sse2 = SSE2_KERNELS.SkipSpaces;
+};
+
+struct TAlnumsAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256i Match(__m256i x) {
+        const __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        return _mm256_or_si256(InRange(x, '0', '9'), InRange(lower, 'a', 'z'));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipAlnums;
+    static constexpr auto Sse2 = SSE2_KERNELS.SkipAlnums;
+};
+
+struct TDigitDotsAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256i Match(__m256i x) {
+        return _mm256_or_si256(InRange(x, '0', '9'), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('.')));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipDigitDots;
+    static constexpr auto Sse2 = SSE2_KERNELS.SkipDigitDots;
+};
+
+struct TLineAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256i Match(__m256i x) {
+        return _mm256_xor_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')), _mm256_set1_epi8(-1));
+    }
+    static constexpr auto Scalar = SCALAR_KERNELS.SkipLine;
+    static constexpr auto Sse2 = SSE2_KERNELS.SkipLine;
+};
+
+template <class TPredicate>
+KALEIDOSCOPE_AVX2 const char* SkipAvx2(const char* begin, const char* end) {
+    if (SkipPrefix<TPredicate::Scalar>(begin, end)) {
+        return begin;
+    }
+    while (end - begin >= 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const unsigned mismatch = ~static_cast<unsigned>(_mm256_movemask_epi8(TPredicate::Match(block)));
+        if (mismatch) {
+            return begin + __builtin_ctz(mismatch);
+        }
+        begin += 32;
+    }
+    return TPredicate::Sse2(begin, end);
+}
+
+constexpr TScanKernels AVX2_KERNELS = {
+    .SkipSpaces = SkipAvx2<TSpacesAvx2>,
+    .SkipAlnums = SkipAvx2<TAlnumsAvx2>,
+    .SkipDigitDots = SkipAvx2<TDigitDotsAvx2>,
+    .SkipLine = SkipAvx2<TLineAvx2>,
+};
+
+#undef KALEIDOSCOPE_AVX2
+
+#endif // KALEIDOSCOPE_SCAN_X86
+
+} // namespace
+
+EScanBackend DetectScanBackend() {
+    if (IsScanBackendSupported(EScanBackend::Avx2)) {
+        return EScanBackend::Avx2;
+    }
+    if (IsScanBackendSupported(EScanBackend::Sse2)) {
+        return EScanBackend::Sse2;
+    }
+    return EScanBackend::Scalar;
+}
+
+bool IsScanBackendSupported(EScanBackend backend) {
+    switch (backend) {
+    case EScanBackend::Scalar:
+        return true;
+#ifdef KALEIDOSCOPE_SCAN_X86
+    case EScanBackend::Sse2:
+        return __builtin_cpu_supports("sse2");
+    case EScanBackend::Avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const TScanKernels& GetScanKernels(EScanBackend backend) {
+    if (!IsScanBackendSupported(backend)) {
+        throw std::runtime_error("Scan backend is not supported by the CPU");
+    }
+    switch (backend) {
+#ifdef KALEIDOSCOPE_SCAN_X86
+    case EScanBackend::Sse2:
+        return SSE2_KERNELS;
+    case EScanBackend::Avx2:
+        return AVX2_KERNELS;
+#endif
+    default:
+        return SCALAR_KERNELS;
+    }
+}
+
+const TScanKernels& GetScanKernels() {
+    static const TScanKernels& kernels = GetScanKernels(DetectScanBackend());
+    return kernels;
+}
+
+} // namespace NKaleidoscope
@@ -0,0 +1,33 @@
+#pragma once
+
+namespace NKaleidoscope {
+
+// SIMD kernels of the lexer, every kernel returns the first position
+// in [begin, end) that doesn't belong to the run
+struct TScanKernels {
+    // ' ', '\t', '\n', '\v', '\f', '\r'
+    const char* (*SkipSpaces)(const char* begin, const char* end);
+    // [a-zA-Z0-9]
+    const char* (*SkipAlnums)(const char* begin, const char* end);
+    // [0-9.]
+    const char* (*SkipDigitDots)(const char* begin, const char* end);
+    // everything except '\n'
+    const char* (*SkipLine)(const char* begin, const char* end);
+};
+
+enum struct EScanBackend {
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+// the best backend supported by the CPU
+EScanBackend DetectScanBackend();
+
+bool IsScanBackendSupported(EScanBackend backend);
+const TScanKernels& GetScanKernels(EScanBackend backend);
+
+// kernels of the detected backend, selected once
+const TScanKernels& GetScanKernels();
+
+} // namespace NKaleidoscope
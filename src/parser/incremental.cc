@@ -0,0 +1,384 @@
+#include "incremental.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "parser.h"
+#include "shift_ranges.h"
+
+namespace NKaleidoscope {
+
+namespace {
+
+// the text of the source before an edit, for the ranges of the replaced nodes
+class TOldText {
+public:
+    TOldText(std::string_view buffer, const TEdit& edit)
+        : Offset_{edit.Offset}
+        , Removed_{buffer.substr(edit.Offset, edit.RemovedLength)}
+        , Delta_{static_cast<std::ptrdiff_t>(edit.Inserted.size()) - static_cast<std::ptrdiff_t>(edit.RemovedLength)}
+    {}
+
+    // the range points to the old text, the source holds the new one
+    std::string Get(const TSourceRange& range) const {
+        const std::string_view buffer = range.Source->GetBuffer();
+        const std::size_t end = range.Offset + range.Length;
+        std::string result;
+        if (range.Offset < Offset_) {
+            result += buffer.substr(range.Offset, std::min(end, Offset_) - range.Offset);
+        }
+        if (range.Offset < Offset_ + Removed_.size() && end > Offset_) {
+            const std::size_t begin = std::max(range.Offset, Offset_);
+            result += Removed_.substr(begin - Offset_, std::min(end, Offset_ + Removed_.size()) - begin);
+        }
+        if (end > Offset_ + Removed_.size()) {
+            const std::size_t begin = std::max(range.Offset, Offset_ + Removed_.size());
+            result += buffer.substr(begin + Delta_, end - begin);
+        }
+        return result;
+    }
+
+private:
+    std::size_t Offset_;
+    std::string Removed_;
+    std::ptrdiff_t Delta_;
+};
+
+// the name of a function or an extern, empty for top-level expressions
+const TSourceRange* FindItemName(const NAst::TNode& item) {
+    if (const auto* function = NAst::NodeCast<NAst::TFunction>(&item)) {
+        return &function->GetPrototype().GetName();
+    }
+    if (const auto* prototype = NAst::NodeCast<NAst::TPrototype>(&item)) {
+        return &prototype->GetName();
+    }
+    return nullptr;
+}
+
+// compares an old item with a new one, ignoring the locations
+bool IsSameItem(const NAst::TNode& oldRoot, const NAst::TNode& newRoot, const TOldText& oldText) {
+    const auto sameName = [&oldText](const TSourceRange& oldName, const TSourceRange& newName) {
+        return oldName.Length == newName.Length && oldText.Get(oldName) == newName.AsStringView();
+    };
+
+    std::vector<std::pair<const NAst::TNode*, const NAst::TNode*>> stack = {{&oldRoot, &newRoot}};
+    while (!stack.empty()) {
+        const auto [oldNode, newNode] = stack.back();
+        stack.pop_back();
+        if (oldNode->GetKind() != newNode->GetKind()) {
+            return false;
+        }
+
+        const bool same = NAst::Visit(*oldNode, [&](const auto& concrete) {
+            using T = std::decay_t<decltype(concrete)>;
+            const auto& other = static_cast<const T&>(*newNode);
+            if constexpr (std::is_same_v<T, NAst::TNumberExpr>) {
+                return concrete.GetValue() == other.GetValue();
+            } else if constexpr (std::is_same_v<T, NAst::TVariableExpr>) {
+                return sameName(concrete.GetName(), other.GetName());
+            } else if constexpr (std::is_same_v<T, NAst::TBinaryExpr>) {
+                return concrete.GetOp() == other.GetOp() && concrete.GetUserOp() == other.GetUserOp();
+            } else if constexpr (std::is_same_v<T, NAst::TCallExpr>) {
+                return sameName(concrete.GetCallee(), other.GetCallee());
+            } else if constexpr (std::is_same_v<T, NAst::TPrototype>) {
+                return sameName(concrete.GetName(), other.GetName())
+                    && std::equal(concrete.GetArgs().begin(), concrete.GetArgs().end(),
+                                  other.GetArgs().begin(), other.GetArgs().end(), sameName);
+            } else {
+                return true;
+            }
+        });
+        const std::size_t childCount = NAst::GetChildCount(*oldNode);
+        if (!same || childCount != NAst::GetChildCount(*newNode)) {
+            return false;
+        }
+        for (std::size_t i = 0; i < childCount; ++i) {
+            stack.emplace_back(&NAst::GetChild(*oldNode, i), &NAst::GetChild(*newNode, i));
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+struct TIncrementalParser::TSegment {
+    // [Begin, End) of the source, a segment begins with a 'def' or an 'extern'
+    // token, except for the first one that begins at 0
+    std::size_t Begin;
+    std::size_t End;
+    std::size_t FirstItem = 0;
+    // the ranges of the items are moved to Begin lazily, see ShiftRanges
+    std::ptrdiff_t PendingShift = 0;
+    // the items are destroyed before their arena
+    std::unique_ptr<NAst::TArena> Arena;
+    std::vector<NAst::TNodePtr<NAst::TNode>> Items;
+    std::string Error;
+    bool DefinesOperators = false;
+
+    void ShiftRanges() {
+        if (PendingShift != 0) {
+            for (auto& item : Items) {
+                NAst::ShiftSourceRanges(*item, PendingShift);
+            }
+            PendingShift = 0;
+        }
+    }
+};
+
+TIncrementalParser::TIncrementalParser(std::string text, TSymbolTable* symbols)
+    // a prvalue initializes the source in place, it can't be moved
+    : Source_{new TSource{TSource::FromString(std::move(text))}}
+    , Symbols_{symbols}
+    , Segments_{ParseAll()}
+{
+    std::size_t itemCount = 0;
+    for (TSegment& segment : Segments_) {
+        segment.FirstItem = itemCount;
+        itemCount += segment.Items.size();
+    }
+}
+
+TIncrementalParser::~TIncrementalParser() = default;
+
+TIncrementalUpdate TIncrementalParser::ApplyEdit(const TEdit& edit) {
+    const std::string_view buffer = Source_->GetBuffer();
+    if (edit.Offset > buffer.size() || edit.RemovedLength > buffer.size() - edit.Offset) {
+        throw std::runtime_error("Edit is out of the source");
+    }
+    const std::size_t editEnd = edit.Offset + edit.RemovedLength;
+    const std::ptrdiff_t delta =
+        static_cast<std::ptrdiff_t>(edit.Inserted.size()) - static_cast<std::ptrdiff_t>(edit.RemovedLength);
+    const TOldText oldText{buffer, edit};
+    Source_->Edit(edit.Offset, edit.RemovedLength, edit.Inserted);
+
+    // The first segment to parse contains the byte before the edit, since its
+    // last token may grow into the inserted text. The text before it is the
+    // same, so the lexer starts there in the same state.
+    const auto bySegmentBegin = [](std::size_t offset, const TSegment& segment) {
+        return offset < segment.Begin;
+    };
+    const std::size_t first = std::upper_bound(Segments_.begin(), Segments_.end(),
+                                               edit.Offset == 0 ? 0 : edit.Offset - 1, bySegmentBegin)
+                            - Segments_.begin() - 1;
+
+    // Lexing stops at a 'def' or an 'extern' at an old segment start after the
+    // edit: the text after it is the same, so the rest of the tokens are too.
+    std::size_t next = first + 1;
+    const auto isOldStart = [&](std::size_t offset) {
+        while (next < Segments_.size()
+               && (Segments_[next].Begin < editEnd || Segments_[next].Begin + delta < offset)) {
+            ++next;
+        }
+        return next < Segments_.size() && Segments_[next].Begin + delta == offset;
+    };
+
+    const auto definesOperators = [](const TSegment& segment) {
+        return segment.DefinesOperators;
+    };
+    std::size_t firstReplaced = first;
+    std::vector<TSegment> segments;
+    const bool wholeSource = std::any_of(Segments_.begin(), Segments_.end(), definesOperators);
+    if (!wholeSource) {
+        segments = ParseSegments(Segments_[first].Begin, isOldStart);
+    }
+    if (wholeSource || std::any_of(segments.begin(), segments.end(), definesOperators)) {
+        firstReplaced = 0;
+        segments = ParseAll();
+        next = Segments_.size();
+    } else if (segments.back().End == Source_->GetBuffer().size()) {
+        next = Segments_.size();
+    }
+
+    TIncrementalUpdate update;
+    update.FirstItem = Segments_[firstReplaced].FirstItem;
+
+    // an inserted item hasn't changed if the removed item of the same name, or
+    // the next removed top-level expression, is the same tree
+    std::unordered_map<std::string, std::vector<const NAst::TNode*>> removedItems;
+    std::vector<const NAst::TNode*> removedExprs;
+    for (std::size_t i = firstReplaced; i < next; ++i) {
+        // the old text is read at the offsets before the edit
+        Segments_[i].ShiftRanges();
+        for (const auto& item : Segments_[i].Items) {
+            ++update.RemovedCount;
+            if (const TSourceRange* name = FindItemName(*item)) {
+                removedItems[oldText.Get(*name)].push_back(item.get());
+            } else {
+                removedExprs.push_back(item.get());
+            }
+        }
+    }
+    std::reverse(removedExprs.begin(), removedExprs.end());
+    for (auto& [name, items] : removedItems) {
+        std::reverse(items.begin(), items.end());
+    }
+
+    for (TSegment& segment : segments) {
+        segment.FirstItem = update.FirstItem + update.InsertedCount;
+        for (const auto& item : segment.Items) {
+            const NAst::TNode* removed = nullptr;
+            const TSourceRange* name = FindItemName(*item);
+            std::vector<const NAst::TNode*>* candidates = &removedExprs;
+            if (name) {
+                const auto iter = removedItems.find(std::string{name->AsStringView()});
+                candidates = iter != removedItems.end() ? &iter->second : nullptr;
+            }
+            if (candidates && !candidates->empty()) {
+                removed = candidates->back();
+                candidates->pop_back();
+            }
+            if (!removed || !IsSameItem(*removed, *item, oldText)) {
+                update.ChangedItems.push_back(update.FirstItem + update.InsertedCount);
+            }
+            ++update.InsertedCount;
+        }
+    }
+
+    // the names that are declared again aren't removed
+    for (const TSegment& segment : segments) {
+        for (const auto& item : segment.Items) {
+            if (const TSourceRange* name = FindItemName(*item)) {
+                removedItems.erase(std::string{name->AsStringView()});
+            }
+        }
+    }
+    for (auto& [name, items] : removedItems) {
+        update.RemovedNames.push_back(name);
+    }
+    std::sort(update.RemovedNames.begin(), update.RemovedNames.end());
+
+    // The kept segments after the edit move with their text, the ranges of
+    // their items are shifted only when they are read. An error message has
+    // a line and a column in it, so a segment with an error is parsed again.
+    for (std::size_t i = next; i < Segments_.size(); ++i) {
+        TSegment& segment = Segments_[i];
+        segment.Begin += delta;
+        segment.End += delta;
+        segment.FirstItem += update.InsertedCount - update.RemovedCount;
+        if (!segment.Error.empty()) {
+            const std::size_t firstItem = segment.FirstItem;
+            segment = ParseSegment(segment.Begin, segment.End, LexSegmentTokens(segment.Begin, segment.End));
+            segment.FirstItem = firstItem;
+        } else {
+            segment.PendingShift += delta;
+        }
+    }
+
+    Segments_.erase(Segments_.begin() + firstReplaced, Segments_.begin() + next);
+    Segments_.insert(Segments_.begin() + firstReplaced,
+                     std::make_move_iterator(segments.begin()), std::make_move_iterator(segments.end()));
+    return update;
+}
+
+const TSource& TIncrementalParser::GetSource() const {
+    return *Source_;
+}
+
+std::size_t TIncrementalParser::GetItemCount() const {
+    return Segments_.back().FirstItem + Segments_.back().Items.size();
+}
+
+const NAst::TNode& TIncrementalParser::GetItem(std::size_t index) {
+    // the last segment that begins at or before the item, the empty ones before it begin there too
+    const auto bySegmentFirstItem = [](std::size_t index, const TSegment& segment) {
+        return index < segment.FirstItem;
+    };
+    TSegment& segment = *(std::upper_bound(Segments_.begin(), Segments_.end(), index, bySegmentFirstItem) - 1);
+    segment.ShiftRanges();
+    return *segment.Items.at(index - segment.FirstItem);
+}
+
+std::vector<const NAst::TNode*> TIncrementalParser::GetItems() {
+    std::vector<const NAst::TNode*> items;
+    for (TSegment& segment : Segments_) {
+        segment.ShiftRanges();
+        for (const auto& item : segment.Items) {
+            items.push_back(item.get());
+        }
+    }
+    return items;
+}
+
+std::vector<std::string> TIncrementalParser::GetErrors() const {
+    std::vector<std::string> errors;
+    for (const TSegment& segment : Segments_) {
+        if (!segment.Error.empty()) {
+            errors.push_back(segment.Error);
+        }
+    }
+    return errors;
+}
+
+std::vector<TIncrementalParser::TSegment> TIncrementalParser::ParseSegments(
+    std::size_t begin, const std::function<bool(std::size_t)>& isOldStart) const
+{
+    const std::size_t size = Source_->GetBuffer().size();
+    TLexer lexer{*Source_, begin, size};
+    std::vector<TSegment> segments;
+    TTokenList tokens;
+    while (true) {
+        TToken token = lexer.Next();
+        const bool startsSegment = token.Kind == ETokenKind::Def || token.Kind == ETokenKind::Extern;
+        if (token.Kind == ETokenKind::Eof || (startsSegment && tokens.Size() > 0)) {
+            const std::size_t end = token.Kind == ETokenKind::Eof ? size : token.SourceRange.Offset;
+            // an error at the end of the segment is reported at the next 'def' or 'extern'
+            tokens.AddToken(TToken{.Kind = ETokenKind::Eof, .SourceRange = token.SourceRange});
+            segments.push_back(ParseSegment(begin, end, std::move(tokens)));
+            tokens = TTokenList{};
+            begin = end;
+            if (token.Kind == ETokenKind::Eof || isOldStart(end)) {
+                break;
+            }
+        }
+        tokens.AddToken(token);
+    }
+    return segments;
+}
+
+std::vector<TIncrementalParser::TSegment> TIncrementalParser::ParseAll() const {
+    std::vector<TSegment> segments = ParseSegments(0, [](std::size_t) { return false; });
+    if (std::any_of(segments.begin(), segments.end(), [](const TSegment& segment) { return segment.DefinesOperators; })) {
+        // an operator is known only after its prototype
+        const std::size_t size = Source_->GetBuffer().size();
+        segments.clear();
+        segments.push_back(ParseSegment(0, size, LexSegmentTokens(0, size)));
+    }
+    return segments;
+}
+
+TTokenList TIncrementalParser::LexSegmentTokens(std::size_t begin, std::size_t end) const {
+    TLexer lexer{*Source_, begin, Source_->GetBuffer().size()};
+    TTokenList tokens;
+    while (true) {
+        const TToken token = lexer.Next();
+        if (token.Kind == ETokenKind::Eof || token.SourceRange.Offset >= end) {
+            tokens.AddToken(TToken{.Kind = ETokenKind::Eof, .SourceRange = token.SourceRange});
+            return tokens;
+        }
+        tokens.AddToken(token);
+    }
+}
+
+TIncrementalParser::TSegment TIncrementalParser::ParseSegment(std::size_t begin, std::size_t end,
+                                                              TTokenList&& tokens) const
+{
+    TSegment segment{
+        .Begin = begin,
+        .End = end,
+        .Arena = std::make_unique<NAst::TArena>(/* initialSize = */ 1024),
+    };
+    for (std::size_t i = 0; i < tokens.Size() && !segment.DefinesOperators; ++i) {
+        segment.DefinesOperators = tokens.GetKind(i) == ETokenKind::Binary;
+    }
+    try {
+        TParser parser{std::move(tokens), segment.Arena.get(), Symbols_};
+        segment.Items = parser.ParseChunk();
+    } catch (const std::runtime_error& e) {
+        segment.Items.clear();
+        segment.Error = e.what();
+    }
+    return segment;
+}
+
+} // namespace NKaleidoscope
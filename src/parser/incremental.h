@@ -0,0 +1,83 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "lexer.h"
+#include "noncopyable.h"
+#include "source.h"
+#include "symbol.h"
+
+namespace NKaleidoscope {
+
+// replaces `RemovedLength` bytes at `Offset` by `Inserted`
+struct TEdit {
+    std::size_t Offset = 0;
+    std::size_t RemovedLength = 0;
+    std::string Inserted;
+};
+
+// what an edit did to the top-level items
+struct TIncrementalUpdate {
+    // the items [FirstItem, FirstItem + InsertedCount) replaced
+    // RemovedCount items starting at FirstItem
+    std::size_t FirstItem = 0;
+    std::size_t RemovedCount = 0;
+    std::size_t InsertedCount = 0;
+
+    // indices of the inserted items that differ from all removed ones in more
+    // than their locations, downstream stages should redo only these
+    std::vector<std::size_t> ChangedItems;
+
+    // functions and externs that were removed and not declared again
+    std::vector<std::string> RemovedNames;
+};
+
+// Keeps the top-level items of a source up to date with its edits. The source
+// is split into segments before every top-level 'def' and 'extern', and every
+// segment is parsed on its own. An edit re-lexes the text from the segment
+// before it until the lexer meets an old segment start again, only these
+// segments are parsed, the nodes of the later ones are kept and their ranges
+// are shifted when they are read. A source with binary operators is parsed as
+// a whole, like with ParseChunkParallel.
+class TIncrementalParser : private TNonCopyable {
+public:
+    // identifiers are interned into the symbol table if it is given
+    explicit TIncrementalParser(std::string text, TSymbolTable* symbols = nullptr);
+    ~TIncrementalParser();
+
+    TIncrementalUpdate ApplyEdit(const TEdit& edit);
+
+    const TSource& GetSource() const;
+
+    // reading an item brings its ranges up to date, so it isn't const
+    std::size_t GetItemCount() const;
+    const NAst::TNode& GetItem(std::size_t index);
+    std::vector<const NAst::TNode*> GetItems();
+
+    // a segment with a parse error has no items, the errors are in source order
+    std::vector<std::string> GetErrors() const;
+
+private:
+    struct TSegment;
+
+    // lexes from `begin` and parses the segments, stops before a segment that
+    // starts at an offset accepted by `isOldStart`, or at the end of the source
+    std::vector<TSegment> ParseSegments(std::size_t begin,
+                                        const std::function<bool(std::size_t)>& isOldStart) const;
+    // the segments of the whole source, or a single one if it has binary operators
+    std::vector<TSegment> ParseAll() const;
+    TSegment ParseSegment(std::size_t begin, std::size_t end, TTokenList&& tokens) const;
+    // the tokens of [begin, end) and an Eof at the next token
+    TTokenList LexSegmentTokens(std::size_t begin, std::size_t end) const;
+
+private:
+    std::unique_ptr<TSource> Source_;
+    TSymbolTable* Symbols_;
+    std::vector<TSegment> Segments_;
+};
+
+} // namespace NKaleidoscope
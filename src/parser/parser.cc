@@ -1,62 +1,111 @@
 #include "parser.h"
 
-#include <unordered_map>
+#include "bind_symbols.h"
+
+#include <cctype>
+#include <cstring>
 
 namespace NKaleidoscope {
 
 namespace {
 
-const std::unordered_map<ETokenKind, int> BINOP_PRECEDENCE = {
-    {ETokenKind::Less, 10},
-    {ETokenKind::Plus, 20},
-    {ETokenKind::Minus, 20},
-    {ETokenKind::Multiply, 40},
-};
+// the built-in binary operators indexed by the token kind
+constexpr std::array<TParser::TBinop, TOKEN_KIND_COUNT> BINOPS = [] {
+    using enum NAst::TBinaryExpr::EOp;
+    // Filled explicitly: for a value-initialized `binops{}`, GCC 12.2 at -O1 and
+    // above emits the elements after the last assigned one as zeros instead of
+    // their member initializers, although the constant evaluation (and so the
+    // static_asserts below) sees -1. Greater and Semicolon would become operators.
+    std::array<TParser::TBinop, TOKEN_KIND_COUNT> binops;
+    binops.fill(TParser::TBinop{});
+    binops[static_cast<std::size_t>(ETokenKind::Less)] = {.Precedence = 10, .Op = Less};
+    binops[static_cast<std::size_t>(ETokenKind::Plus)] = {.Precedence = 20, .Op = Plus};
+    binops[static_cast<std::size_t>(ETokenKind::Minus)] = {.Precedence = 20, .Op = Minus};
+    binops[static_cast<std::size_t>(ETokenKind::Multiply)] = {.Precedence = 40, .Op = Multiply};
+    return binops;
+}();
+
+static_assert(BINOPS[static_cast<std::size_t>(ETokenKind::Plus)].Precedence == 20);
+static_assert(BINOPS[static_cast<std::size_t>(ETokenKind::Identifier)].Precedence < 0);
+
+// characters the lexer turns into Invalid or Greater tokens
+bool IsUserOperatorChar(char c) {
+    const auto uc = static_cast<unsigned char>(c);
+    return c != '\0' && !std::isalnum(uc) && !std::isspace(uc) && !std::strchr("(),;+-*<#.", c);
+}
 
-const std::unordered_map<ETokenKind, NAst::TBinaryExpr::EOp> TOKEN_KIND_TO_BINOP = {
-    {ETokenKind::Less, NAst::TBinaryExpr::EOp::Less},
-    {ETokenKind::Plus, NAst::TBinaryExpr::EOp::Plus},
-    {ETokenKind::Minus, NAst::TBinaryExpr::EOp::Minus},
-    {ETokenKind::Multiply, NAst::TBinaryExpr::EOp::Multiply},
-};
+bool IsUserOperatorToken(const TToken& token) {
+    return (token.Kind == ETokenKind::Invalid || token.Kind == ETokenKind::Greater)
+        && token.SourceRange.Length == 1;
+}
 
 } // namespace
 
-TParser::TParser(TTokenList&& tokens)
+TParser::TParser(TTokenList&& tokens, NAst::TArena* arena, TSymbolTable* symbols)
     : Tokens_{std::move(tokens)}
+    , Arena_{arena}
+    , Symbols_{symbols}
+    , UserPrecedence_{}
+    , HasUserOperators_{false}
 {}
 
-std::unique_ptr<NAst::TExpr> TParser::ParseNumberExpr() {
+TParser::TParser(const TSource& source, NAst::TArena* arena, TSymbolTable* symbols)
+    : Tokens_{source}
+    , Arena_{arena}
+    , Symbols_{symbols}
+    , UserPrecedence_{}
+    , HasUserOperators_{false}
+{}
+
+void TParser::EnableHashConsing() {
+    if (!Arena_) {
+        throw std::runtime_error("Hash-consing requires an arena");
+    }
+    HashCons_ = std::make_unique<NAst::THashConsTable>(*Arena_);
+}
+
+void TParser::AddBinaryOperator(char op, int precedence) {
+    if (!IsUserOperatorChar(op)) {
+        throw std::runtime_error("Invalid binary operator '" + std::string(1, op) + "'");
+    }
+    if (precedence < MIN_USER_PRECEDENCE || precedence > MAX_USER_PRECEDENCE) {
+        throw std::runtime_error("Invalid precedence of binary operator '" + std::string(1, op) + "'");
+    }
+    UserPrecedence_[static_cast<unsigned char>(op)] = precedence;
+    HasUserOperators_ = true;
+}
+
+NAst::TNodePtr<NAst::TExpr> TParser::ParseNumberExpr() {
     const double number = Tokens_.Current().SourceRange.AsDouble();
     Tokens_.SkipToken();
-    return std::make_unique<NAst::TNumberExpr>(number);
+    return MakeNumber(number);
 }
 
-std::unique_ptr<NAst::TExpr> TParser::ParseParenExpr() {
+NAst::TNodePtr<NAst::TExpr> TParser::ParseParenExpr() {
     Tokens_.SkipToken(); // eat '('
 
     auto expr = ParseExpr(); // parse expression inside brackets
 
     if (Tokens_.Current().Kind != ETokenKind::RBracket) {
-        throw std::runtime_error("Expected ')' symbol");
+        ThrowError("Expected ')' symbol");
     }
     Tokens_.SkipToken(); // eat ')'
 
     return expr;
 }
 
-std::unique_ptr<NAst::TExpr> TParser::ParseIdentifierExpr() {
+NAst::TNodePtr<NAst::TExpr> TParser::ParseIdentifierExpr() {
     const TSourceRange idSourceRange = Tokens_.Current().SourceRange;
     Tokens_.SkipToken(); // eat identifier
 
     if (Tokens_.Current().Kind != ETokenKind::LBracket) {
         // simple variable reference
-        return std::make_unique<NAst::TVariableExpr>(idSourceRange);
+        return MakeVariable(idSourceRange);
     }
 
     // function call
     Tokens_.SkipToken(); // eat '('
-    std::vector<std::unique_ptr<NAst::TExpr>> args;
+    std::pmr::vector<NAst::TNodePtr<NAst::TExpr>> args{NAst::GetResource(Arena_)};
     if (Tokens_.Current().Kind != ETokenKind::RBracket) {
         // there is a non-empty list of arguments
         while (true) {
@@ -70,36 +119,36 @@ std::unique_ptr<NAst::TExpr> TParser::ParseIdentifierExpr() {
 
             // there should be a ','
             if (kind != ETokenKind::Comma) {
-                throw std::runtime_error("Expected ',' symbol");
+                ThrowError("Expected ',' symbol");
             }
             Tokens_.SkipToken(); // eat ','
         }
     }
     Tokens_.SkipToken(); // eat ')'
 
-    return std::make_unique<NAst::TCallExpr>(idSourceRange, std::move(args));
+    return MakeCall(idSourceRange, std::move(args));
 }
 
-std::unique_ptr<NAst::TExpr> TParser::ParseIfExpr() {
+NAst::TNodePtr<NAst::TExpr> TParser::ParseIfExpr() {
     Tokens_.SkipToken(); // eat 'if'
     auto condExpr = ParseExpr();
 
     if (Tokens_.Current().Kind != ETokenKind::Then) {
-        throw std::runtime_error("Expected 'then'");
+        ThrowError("Expected 'then'");
     }
     Tokens_.SkipToken(); // eat 'then'
     auto thenExpr = ParseExpr();
 
     if (Tokens_.Current().Kind != ETokenKind::Else) {
-        throw std::runtime_error("Expected 'else'");
+        ThrowError("Expected 'else'");
     }
     Tokens_.SkipToken(); // eat 'else'
     auto elseExpr = ParseExpr();
 
-    return std::make_unique<NAst::TIfExpr>(std::move(condExpr), std::move(thenExpr), std::move(elseExpr));
+    return MakeIf(std::move(condExpr), std::move(thenExpr), std::move(elseExpr));
 }
 
-std::unique_ptr<NAst::TExpr> TParser::ParsePrimaryExpr() {
+NAst::TNodePtr<NAst::TExpr> TParser::ParsePrimaryExpr() {
     switch (Tokens_.Current().Kind) {
     case ETokenKind::Identifier:
         return ParseIdentifierExpr();
@@ -110,88 +159,98 @@ std::unique_ptr<NAst::TExpr> TParser::ParsePrimaryExpr() {
     case ETokenKind::If:
         return ParseIfExpr();
     default:
-        throw std::runtime_error("unknown token when expecting an expression");
+        ThrowError("unknown token when expecting an expression");
     }
 }
 
-std::unique_ptr<NAst::TExpr> TParser::ParseExpr() {
-    auto lhs = ParsePrimaryExpr();
-    return ParseBinopRhs(0, std::move(lhs));
+NAst::TNodePtr<NAst::TExpr> TParser::ParseExpr() {
+    return ParseExprIteratively(/* minPrecedence = */ 0, /* lhs = */ nullptr);
 }
 
-std::unique_ptr<NAst::TExpr> TParser::ParseBinopRhs(int exprPrec, std::unique_ptr<NAst::TExpr> lhs) {
-    while (true) {
-        // find the binop's precedence
-        int tokPrec = GetTokenPrecedence();
+NAst::TNodePtr<NAst::TExpr> TParser::ParseBinopRhs(int exprPrec, NAst::TNodePtr<NAst::TExpr> lhs) {
+    return ParseExprIteratively(exprPrec, std::move(lhs));
+}
 
-        // if this is a binop that is at least as harder as the current binop,
-        // consume it, otherwise we are done
-        if (tokPrec < exprPrec) {
-            return lhs;
+NAst::TNodePtr<NAst::TPrototype> TParser::ParsePrototype() {
+    TSourceRange nameSourceRange = Tokens_.Current().SourceRange;
+    char userOp = 0;
+    int precedence = DEFAULT_USER_PRECEDENCE;
+    switch (Tokens_.Current().Kind) {
+    case ETokenKind::Identifier:
+        Tokens_.SkipToken(); // eat the identifier
+        break;
+    case ETokenKind::Binary: {
+        Tokens_.SkipToken(); // eat 'binary'
+
+        // the name is "binary" immediately followed by the operator
+        const TToken& opToken = Tokens_.Current();
+        if (!IsUserOperatorToken(opToken)
+            || opToken.SourceRange.Offset != nameSourceRange.Offset + nameSourceRange.Length)
+        {
+            ThrowError("Expected an operator character right after 'binary'");
         }
-
-        const ETokenKind binopTokenKind = Tokens_.Current().Kind;
-        Tokens_.SkipToken(); // eat binop
-
-        // parse primary expr after the binop
-        auto rhs = ParsePrimaryExpr();
-
-        // if this is a binop that is harder than the current binop,
-        // read its group as a whole
-        int nextPrec = GetTokenPrecedence();
-        if (tokPrec < nextPrec) {
-            rhs = ParseBinopRhs(tokPrec + 1, std::move(rhs));
+        userOp = opToken.SourceRange.AsStringView().front();
+        ++nameSourceRange.Length;
+        Tokens_.SkipToken(); // eat the operator
+
+        if (Tokens_.Current().Kind == ETokenKind::Number) {
+            const double value = Tokens_.Current().SourceRange.AsDouble();
+            if (!(value >= MIN_USER_PRECEDENCE && value <= MAX_USER_PRECEDENCE)
+                || value != static_cast<int>(value))
+            {
+                ThrowError("Invalid precedence: must be an integer in [1, 100]");
+            }
+            precedence = static_cast<int>(value);
+            Tokens_.SkipToken(); // eat the precedence
         }
-
-        // merge lhs/rhs
-        lhs = std::make_unique<NAst::TBinaryExpr>(
-            TOKEN_KIND_TO_BINOP.at(binopTokenKind),
-            std::move(lhs),
-            std::move(rhs)
-        );
+        break;
     }
-}
-
-std::unique_ptr<NAst::TPrototype> TParser::ParsePrototype() {
-    if (Tokens_.Current().Kind != ETokenKind::Identifier) {
-        throw std::runtime_error("Expected function name in prototype");
+    default:
+        ThrowError("Expected function name in prototype");
     }
 
-    const TSourceRange nameSourceRange = Tokens_.Current().SourceRange;
-    Tokens_.SkipToken(); // eat the identifier
-
     if (Tokens_.Current().Kind != ETokenKind::LBracket) {
-        throw std::runtime_error("Expected '(' in prototype");
+        ThrowError("Expected '(' in prototype");
     }
     Tokens_.SkipToken(); // eat '('
 
-    std::vector<TSourceRange> args;
+    // the name is interned before the args, in the order of the source
+    const TSymbolId symbol = Intern(nameSourceRange);
+    std::pmr::vector<TSourceRange> args{NAst::GetResource(Arena_)};
+    std::pmr::vector<TSymbolId> argSymbols{NAst::GetResource(Arena_)};
     while (Tokens_.Current().Kind == ETokenKind::Identifier) {
         args.emplace_back(Tokens_.Current().SourceRange);
+        argSymbols.push_back(Intern(args.back()));
         Tokens_.SkipToken(); // eat the identifier
     }
 
     if (Tokens_.Current().Kind != ETokenKind::RBracket) {
-        throw std::runtime_error("Expected ')' in prototype");
+        ThrowError("Expected ')' in prototype");
+    }
+    if (userOp && args.size() != 2) {
+        ThrowError("Expected two operands of a binary operator");
     }
     Tokens_.SkipToken(); // eat ')'
 
-    return std::make_unique<NAst::TPrototype>(nameSourceRange, std::move(args));
+    if (userOp) {
+        AddBinaryOperator(userOp, precedence);
+    }
+    return NAst::MakeNode<NAst::TPrototype>(Arena_, nameSourceRange, std::move(args), symbol, std::move(argSymbols));
 }
 
-std::unique_ptr<NAst::TFunction> TParser::ParseDefinition() {
+NAst::TNodePtr<NAst::TFunction> TParser::ParseDefinition() {
     Tokens_.SkipToken(); // eat 'def'
     auto prototype = ParsePrototype();
     auto expr = ParseExpr();
-    return std::make_unique<NAst::TFunction>(std::move(prototype), std::move(expr));
+    return NAst::MakeNode<NAst::TFunction>(Arena_, std::move(prototype), std::move(expr));
 }
 
-std::unique_ptr<NAst::TPrototype> TParser::ParseExtern() {
+NAst::TNodePtr<NAst::TPrototype> TParser::ParseExtern() {
     Tokens_.SkipToken(); // eat 'extern'
     return ParsePrototype();
 }
 
-std::unique_ptr<NAst::TNode> TParser::ParseTop() {
+NAst::TNodePtr<NAst::TNode> TParser::ParseTop() {
     while (Tokens_.Current().Kind == ETokenKind::Semicolon) {
         Tokens_.SkipToken(); // eat ';'
     }
@@ -208,8 +267,8 @@ std::unique_ptr<NAst::TNode> TParser::ParseTop() {
     }
 }
 
-std::vector<std::unique_ptr<NAst::TNode>> TParser::ParseChunk() {
-    std::vector<std::unique_ptr<NAst::TNode>> nodes;
+std::vector<NAst::TNodePtr<NAst::TNode>> TParser::ParseChunk() {
+    std::vector<NAst::TNodePtr<NAst::TNode>> nodes;
     while (true) {
         auto top = ParseTop();
         if (!top) {
@@ -220,12 +279,308 @@ std::vector<std::unique_ptr<NAst::TNode>> TParser::ParseChunk() {
     return nodes;
 }
 
-int TParser::GetTokenPrecedence() const {
-    const auto kind = Tokens_.Current().Kind;
-    if (auto iter = BINOP_PRECEDENCE.find(kind); iter != BINOP_PRECEDENCE.end()) {
-        return iter->second;
+NAst::TFlatAst TParser::ParseChunkFlat() {
+    NAst::TFlatAst ast;
+    NAst::TArena* arena = Arena_;
+    // the flat AST is a tree anyway, and the shared nodes would outlive their arenas
+    std::unique_ptr<NAst::THashConsTable> hashCons = std::move(HashCons_);
+    while (true) {
+        // the item's tree is released right after it has been flattened
+        NAst::TArena itemArena{/* initialSize = */ 4096};
+        Arena_ = &itemArena;
+        NAst::TNodePtr<NAst::TNode> top;
+        try {
+            top = ParseTop();
+        } catch (...) {
+            Arena_ = arena;
+            HashCons_ = std::move(hashCons);
+            throw;
+        }
+        Arena_ = arena;
+
+        if (!top) {
+            break;
+        }
+        ast.AddTop(ast.Add(*top));
+    }
+    HashCons_ = std::move(hashCons);
+    return ast;
+}
+
+// A shunting-yard parser: the operands and the pending binops are kept on
+// explicit stacks, and every open parenthesis, 'if' and call gets a frame.
+// A primary expression is expected after a binop and at the start of a frame,
+// a binop or the end of the innermost frame is expected after an operand.
+NAst::TNodePtr<NAst::TExpr> TParser::ParseExprIteratively(int minPrecedence, NAst::TNodePtr<NAst::TExpr> lhs) {
+    using EKind = TExprFrame::EKind;
+    Operands_.clear();
+    Operators_.clear();
+    Frames_.clear();
+    Frames_.push_back(TExprFrame{.Kind = EKind::Root, .OperandBase = 0, .OperatorBase = 0, .MinPrecedence = minPrecedence});
+    const auto openFrame = [this](EKind kind, TSourceRange callee = {}) {
+        Frames_.push_back(TExprFrame{
+            .Kind = kind,
+            .OperandBase = Operands_.size(),
+            .OperatorBase = Operators_.size(),
+            .Callee = callee,
+        });
+    };
+    const auto popOperand = [this] {
+        NAst::TNodePtr<NAst::TExpr> operand = std::move(Operands_.back());
+        Operands_.pop_back();
+        return operand;
+    };
+
+    bool expectOperand = !lhs;
+    if (lhs) {
+        Operands_.push_back(std::move(lhs));
+    }
+    while (true) {
+        if (expectOperand) {
+            const TToken& token = Tokens_.Current();
+            switch (token.Kind) {
+            case ETokenKind::Number:
+                Operands_.push_back(ParseNumberExpr());
+                break;
+            case ETokenKind::Identifier: {
+                const TSourceRange idSourceRange = token.SourceRange;
+                Tokens_.SkipToken(); // eat identifier
+                if (Tokens_.Current().Kind != ETokenKind::LBracket) {
+                    Operands_.push_back(MakeVariable(idSourceRange));
+                    break;
+                }
+                Tokens_.SkipToken(); // eat '('
+                if (Tokens_.Current().Kind == ETokenKind::RBracket) {
+                    Tokens_.SkipToken(); // eat ')'
+                    Operands_.push_back(MakeCall(idSourceRange, std::pmr::vector<NAst::TNodePtr<NAst::TExpr>>{
+                        NAst::GetResource(Arena_)}));
+                    break;
+                }
+                openFrame(EKind::CallArgs, idSourceRange);
+                continue;
+            }
+            case ETokenKind::LBracket:
+                Tokens_.SkipToken(); // eat '('
+                openFrame(EKind::Paren);
+                continue;
+            case ETokenKind::If:
+                Tokens_.SkipToken(); // eat 'if'
+                openFrame(EKind::IfCond);
+                continue;
+            default:
+                ThrowError("unknown token when expecting an expression");
+            }
+            expectOperand = false;
+        }
+
+        // a binop continues the innermost frame
+        TExprFrame& frame = Frames_.back();
+        const TBinop binop = GetBinop();
+        if (binop.Precedence >= 0 && binop.Precedence >= frame.MinPrecedence) {
+            // the pending binops of at least the same precedence are left operands
+            std::size_t operatorBase = Operators_.size();
+            while (operatorBase > frame.OperatorBase && Operators_[operatorBase - 1].Precedence >= binop.Precedence) {
+                --operatorBase;
+            }
+            ReduceOperators(operatorBase);
+            Operators_.push_back(binop);
+            Tokens_.SkipToken(); // eat binop
+            expectOperand = true;
+            continue;
+        }
+
+        // otherwise the frame ends
+        ReduceOperators(frame.OperatorBase);
+        switch (frame.Kind) {
+        case EKind::Root:
+            return popOperand();
+        case EKind::Paren:
+            if (Tokens_.Current().Kind != ETokenKind::RBracket) {
+                ThrowError("Expected ')' symbol");
+            }
+            Tokens_.SkipToken(); // eat ')'
+            Frames_.pop_back();
+            break;
+        case EKind::IfCond:
+            if (Tokens_.Current().Kind != ETokenKind::Then) {
+                ThrowError("Expected 'then'");
+            }
+            Tokens_.SkipToken(); // eat 'then'
+            frame.Kind = EKind::IfThen;
+            expectOperand = true;
+            break;
+        case EKind::IfThen:
+            if (Tokens_.Current().Kind != ETokenKind::Else) {
+                ThrowError("Expected 'else'");
+            }
+            Tokens_.SkipToken(); // eat 'else'
+            frame.Kind = EKind::IfElse;
+            expectOperand = true;
+            break;
+        case EKind::IfElse: {
+            auto elseExpr = popOperand();
+            auto thenExpr = popOperand();
+            auto condExpr = popOperand();
+            Frames_.pop_back();
+            Operands_.push_back(MakeIf(std::move(condExpr), std::move(thenExpr), std::move(elseExpr)));
+            break;
+        }
+        case EKind::CallArgs: {
+            const auto kind = Tokens_.Current().Kind;
+            if (kind == ETokenKind::Comma) {
+                Tokens_.SkipToken(); // eat ','
+                expectOperand = true;
+                break;
+            }
+            if (kind != ETokenKind::RBracket) {
+                ThrowError("Expected ',' symbol");
+            }
+            Tokens_.SkipToken(); // eat ')'
+
+            std::pmr::vector<NAst::TNodePtr<NAst::TExpr>> args{NAst::GetResource(Arena_)};
+            args.reserve(Operands_.size() - frame.OperandBase);
+            for (std::size_t i = frame.OperandBase; i < Operands_.size(); ++i) {
+                args.push_back(std::move(Operands_[i]));
+            }
+            Operands_.resize(frame.OperandBase);
+            const TSourceRange callee = frame.Callee;
+            Frames_.pop_back();
+            Operands_.push_back(MakeCall(callee, std::move(args)));
+            break;
+        }
+        }
+    }
+}
+
+void TParser::ReduceOperators(std::size_t operatorBase) {
+    while (Operators_.size() > operatorBase) {
+        auto rhs = std::move(Operands_.back());
+        Operands_.pop_back();
+        auto lhs = std::move(Operands_.back());
+        Operands_.pop_back();
+        Operands_.push_back(MakeBinary(Operators_.back(), std::move(lhs), std::move(rhs)));
+        Operators_.pop_back();
     }
-    return -1;
+}
+
+void TParser::ThrowError(const std::string& message) const {
+    const TSourceRange& sourceRange = Tokens_.Current().SourceRange;
+    throw std::runtime_error(sourceRange.FormatLocation() + ": " + message);
+}
+
+TParallelChunk ParseChunkParallel(const TTokenList& tokens, TThreadPool& threadPool,
+                                  TSymbolTable* symbols, std::size_t taskTokens)
+{
+    // 'def' and 'extern' can't be a part of an expression or a prototype, so
+    // every one of them starts a new top-level item, and a slice is parsed
+    // exactly like the same part of the whole list
+    std::vector<std::size_t> boundaries = {0};
+    for (std::size_t i = 0; i < tokens.Size(); ++i) {
+        const ETokenKind kind = tokens.GetKind(i);
+        if (kind == ETokenKind::Binary) {
+            // an operator is known only after its prototype
+            boundaries = {0};
+            break;
+        }
+        if ((kind == ETokenKind::Def || kind == ETokenKind::Extern) && i - boundaries.back() >= taskTokens) {
+            boundaries.push_back(i);
+        }
+    }
+    boundaries.push_back(tokens.Size());
+
+    TParallelChunk chunk;
+    std::vector<std::future<std::vector<NAst::TNodePtr<NAst::TNode>>>> slices;
+    for (std::size_t i = 0; i + 1 < boundaries.size(); ++i) {
+        NAst::TArena* arena = chunk.Arenas.emplace_back(std::make_unique<NAst::TArena>()).get();
+        slices.push_back(threadPool.Submit([&tokens, arena, begin = boundaries[i], end = boundaries[i + 1]] {
+            TTokenList slice = tokens.Slice(begin, end);
+            if (end < tokens.Size()) {
+                // an error at the end of the slice is reported at the next 'def' or 'extern'
+                slice.AddToken(TToken{.Kind = ETokenKind::Eof, .SourceRange = tokens.GetSourceRange(end)});
+            }
+            TParser parser{std::move(slice), arena};
+            return parser.ParseChunk();
+        }));
+    }
+
+    // the tasks reference the tokens, so all of them should finish before any error is thrown
+    for (auto& slice : slices) {
+        slice.wait();
+    }
+
+    for (auto& slice : slices) {
+        for (auto& node : slice.get()) {
+            chunk.Nodes.push_back(std::move(node));
+        }
+    }
+    if (symbols) {
+        NAst::BindSymbols(chunk.Nodes, *symbols);
+    }
+    return chunk;
+}
+
+TParser::TBinop TParser::GetBinop() const {
+    const TToken& token = Tokens_.Current();
+    const TBinop& binop = BINOPS[static_cast<std::size_t>(token.Kind)];
+    if (binop.Precedence >= 0 || !HasUserOperators_) [[likely]] {
+        return binop;
+    }
+    if (!IsUserOperatorToken(token)) {
+        return binop;
+    }
+
+    const char op = token.SourceRange.AsStringView().front();
+    const int precedence = UserPrecedence_[static_cast<unsigned char>(op)];
+    if (precedence == 0) {
+        return binop;
+    }
+    return TBinop{.Precedence = precedence, .Op = NAst::TBinaryExpr::EOp::User, .UserOp = op};
+}
+
+NAst::TNodePtr<NAst::TExpr> TParser::MakeNumber(double value) {
+    if (HashCons_) {
+        return HashCons_->MakeNumber(value);
+    }
+    return NAst::MakeNode<NAst::TNumberExpr>(Arena_, value);
+}
+
+NAst::TNodePtr<NAst::TExpr> TParser::MakeVariable(const TSourceRange& name) {
+    if (HashCons_) {
+        return HashCons_->MakeVariable(name, Intern(name));
+    }
+    return NAst::MakeNode<NAst::TVariableExpr>(Arena_, name, Intern(name));
+}
+
+NAst::TNodePtr<NAst::TExpr> TParser::MakeBinary(const TBinop& binop, NAst::TNodePtr<NAst::TExpr> lhs,
+                                                NAst::TNodePtr<NAst::TExpr> rhs)
+{
+    if (HashCons_) {
+        return HashCons_->MakeBinary(binop.Op, std::move(lhs), std::move(rhs), binop.UserOp);
+    }
+    return NAst::MakeNode<NAst::TBinaryExpr>(Arena_, binop.Op, std::move(lhs), std::move(rhs), binop.UserOp);
+}
+
+NAst::TNodePtr<NAst::TExpr> TParser::MakeIf(NAst::TNodePtr<NAst::TExpr> condExpr, NAst::TNodePtr<NAst::TExpr> thenExpr,
+                                            NAst::TNodePtr<NAst::TExpr> elseExpr)
+{
+    if (HashCons_) {
+        return HashCons_->MakeIf(std::move(condExpr), std::move(thenExpr), std::move(elseExpr));
+    }
+    return NAst::MakeNode<NAst::TIfExpr>(Arena_, std::move(condExpr), std::move(thenExpr), std::move(elseExpr));
+}
+
+NAst::TNodePtr<NAst::TExpr> TParser::MakeCall(const TSourceRange& callee,
+                                              std::pmr::vector<NAst::TNodePtr<NAst::TExpr>> args)
+{
+    // the callee is interned after the arguments
+    if (HashCons_) {
+        return HashCons_->MakeCall(callee, std::move(args), Intern(callee));
+    }
+    return NAst::MakeNode<NAst::TCallExpr>(Arena_, callee, std::move(args), Intern(callee));
+}
+
+TSymbolId TParser::Intern(const TSourceRange& name) const {
+    return Symbols_ ? Symbols_->Intern(name.AsStringView()) : INVALID_SYMBOL;
 }
 
 } // namespace NKaleidoscope
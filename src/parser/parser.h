@@ -1,65 +1,173 @@
 #pragma once
 
+#include <array>
 #include <memory>
+#include <vector>
 
 #include "ast.h"
+#include "flat_ast.h"
+#include "hash_cons.h"
 #include "lexer.h"
+#include "symbol.h"
+#include "thread_pool.h"
 
 namespace NKaleidoscope {
 
 class TParser {
 public:
-    TParser(TTokenList&& tokens);
+    // the nodes are allocated in the arena if it is given, otherwise on the heap;
+    // identifiers are interned into the symbol table if it is given
+    TParser(TTokenList&& tokens, NAst::TArena* arena = nullptr, TSymbolTable* symbols = nullptr);
+
+    // lexes the source on demand while parsing
+    TParser(const TSource& source, NAst::TArena* arena = nullptr, TSymbolTable* symbols = nullptr);
+
+    // Shares structurally identical expressions, so the parsed AST becomes a DAG;
+    // requires an arena, and variables and callees are only shared with a symbol table
+    void EnableHashConsing();
+
+    // Registers a binary operator that calls the function "binary<op>", it binds
+    // tighter than the operators of a lower precedence; '<' is 10, '+' and '-' are 20,
+    // '*' is 40. The character should not have a meaning of its own like '(' or '+'.
+    // Prototypes of the form 'binary' char register their operators too.
+    void AddBinaryOperator(char op, int precedence);
 
     // numberexpr ::= number
-    std::unique_ptr<NAst::TExpr> ParseNumberExpr();
+    NAst::TNodePtr<NAst::TExpr> ParseNumberExpr();
 
     // parenexpr ::= '(' expression ')'
-    std::unique_ptr<NAst::TExpr> ParseParenExpr();
+    NAst::TNodePtr<NAst::TExpr> ParseParenExpr();
 
     // identifierexpr
     //   ::= identifier
     //   ::= identifier '(' expression* ')'
-    std::unique_ptr<NAst::TExpr> ParseIdentifierExpr();
+    NAst::TNodePtr<NAst::TExpr> ParseIdentifierExpr();
 
     // ifexpr ::= 'if' expr 'then' expr 'else' expr
-    std::unique_ptr<NAst::TExpr> ParseIfExpr();
+    NAst::TNodePtr<NAst::TExpr> ParseIfExpr();
 
     // primary
     //   ::= identifierexpr
     //   ::= numberexpr
     //   ::= parenexpr
     //   ::= ifexpr
-    std::unique_ptr<NAst::TExpr> ParsePrimaryExpr();
+    NAst::TNodePtr<NAst::TExpr> ParsePrimaryExpr();
 
     // expr ::= primary binoprhs
-    std::unique_ptr<NAst::TExpr> ParseExpr();
+    // the expression is parsed with explicit stacks, so the native stack
+    // doesn't grow with the nesting depth
+    NAst::TNodePtr<NAst::TExpr> ParseExpr();
 
-    // binop ::= '<'|'+'|'-'|'*'
+    // binop ::= '<'|'+'|'-'|'*'|user operator
     // binoprhs ::= (binop primary)*
-    std::unique_ptr<NAst::TExpr> ParseBinopRhs(int exprPrec, std::unique_ptr<NAst::TExpr> lhs);
+    // consumes only the binops of at least exprPrec precedence
+    NAst::TNodePtr<NAst::TExpr> ParseBinopRhs(int exprPrec, NAst::TNodePtr<NAst::TExpr> lhs);
 
-    // prototype ::= id '(' id* ')'
-    std::unique_ptr<NAst::TPrototype> ParsePrototype();
+    // prototype
+    //   ::= id '(' id* ')'
+    //   ::= 'binary' char number? '(' id id ')'
+    NAst::TNodePtr<NAst::TPrototype> ParsePrototype();
 
     // definition ::= 'def' prototype expression
-    std::unique_ptr<NAst::TFunction> ParseDefinition();
+    NAst::TNodePtr<NAst::TFunction> ParseDefinition();
 
     // external ::= 'extern' prototype
-    std::unique_ptr<NAst::TPrototype> ParseExtern();
+    NAst::TNodePtr<NAst::TPrototype> ParseExtern();
 
     // top ::= definition | external | expression | ';'
-    std::unique_ptr<NAst::TNode> ParseTop();
+    NAst::TNodePtr<NAst::TNode> ParseTop();
 
     // chunk ::= top*
-    std::vector<std::unique_ptr<NAst::TNode>> ParseChunk();
+    std::vector<NAst::TNodePtr<NAst::TNode>> ParseChunk();
+
+    // the same as ParseChunk, but the result is a flat AST; only one
+    // top-level item at a time exists as a pointer tree
+    NAst::TFlatAst ParseChunkFlat();
+
+public:
+    static constexpr int MIN_USER_PRECEDENCE = 1;
+    static constexpr int MAX_USER_PRECEDENCE = 100;
+    static constexpr int DEFAULT_USER_PRECEDENCE = 30;
+
+    // a binary operator the current token stands for
+    struct TBinop {
+        int Precedence = -1;
+        NAst::TBinaryExpr::EOp Op = {};
+        char UserOp = 0;
+    };
+
+private:
+    // a construct of the expression being parsed that is not closed yet
+    struct TExprFrame {
+        enum class EKind {
+            Root,
+            Paren,
+            IfCond,
+            IfThen,
+            IfElse,
+            CallArgs,
+        };
+
+        EKind Kind;
+        // the operands and the operators of the frame are above these sizes
+        std::size_t OperandBase;
+        std::size_t OperatorBase;
+        // binops of a lower precedence end the root expression
+        int MinPrecedence = 0;
+        TSourceRange Callee = {};
+    };
 
 private:
     // helper methods
-    int GetTokenPrecedence() const;
+    NAst::TNodePtr<NAst::TExpr> ParseExprIteratively(int minPrecedence, NAst::TNodePtr<NAst::TExpr> lhs);
+    void ReduceOperators(std::size_t operatorBase);
+    TBinop GetBinop() const;
+    NAst::TNodePtr<NAst::TExpr> MakeNumber(double value);
+    NAst::TNodePtr<NAst::TExpr> MakeVariable(const TSourceRange& name);
+    NAst::TNodePtr<NAst::TExpr> MakeBinary(const TBinop& binop, NAst::TNodePtr<NAst::TExpr> lhs,
+                                           NAst::TNodePtr<NAst::TExpr> rhs);
+    NAst::TNodePtr<NAst::TExpr> MakeIf(NAst::TNodePtr<NAst::TExpr> condExpr, NAst::TNodePtr<NAst::TExpr> thenExpr,
+                                       NAst::TNodePtr<NAst::TExpr> elseExpr);
+    NAst::TNodePtr<NAst::TExpr> MakeCall(const TSourceRange& callee,
+                                         std::pmr::vector<NAst::TNodePtr<NAst::TExpr>> args);
+    TSymbolId Intern(const TSourceRange& name) const;
+
+    // reports an error at the current token
+    [[noreturn]] void ThrowError(const std::string& message) const;
 
 private:
-    TTokenList Tokens_;
+    TTokenStream Tokens_;
+    NAst::TArena* Arena_;
+    TSymbolTable* Symbols_;
+    std::unique_ptr<NAst::THashConsTable> HashCons_;
+
+    // precedences of the user operators by character, 0 if there is no operator
+    std::array<std::uint8_t, 256> UserPrecedence_;
+    bool HasUserOperators_;
+
+    // stacks of ParseExpr, kept between the calls to reuse their memory
+    std::vector<NAst::TNodePtr<NAst::TExpr>> Operands_;
+    std::vector<TBinop> Operators_;
+    std::vector<TExprFrame> Frames_;
 };
 
+// top-level items of a parallel parse, every task allocates its nodes in its own arena
+struct TParallelChunk {
+    std::vector<std::unique_ptr<NAst::TArena>> Arenas;
+    std::vector<NAst::TNodePtr<NAst::TNode>> Nodes;
+};
+
+constexpr std::size_t DEFAULT_PARALLEL_TASK_TOKENS = 1 << 14;
+
+// The same as ParseChunk, but the tokens are split before every top-level 'def'
+// and 'extern', and the slices of about `taskTokens` tokens are parsed on the
+// thread pool. The first error in source order is thrown with the same message
+// as the sequential parser's one. The names are interned in the source order
+// after parsing, so the symbols are the same as the sequential parser's ones too.
+// A source that defines binary operators is parsed as a whole, since an
+// operator changes how the rest of the source is parsed.
+TParallelChunk ParseChunkParallel(const TTokenList& tokens, TThreadPool& threadPool,
+                                  TSymbolTable* symbols = nullptr,
+                                  std::size_t taskTokens = DEFAULT_PARALLEL_TASK_TOKENS);
+
 } // namespace NKaleidoscope
@@ -0,0 +1,166 @@
+#include <benchmark/benchmark.h>
+#include "ast_cache.h"
+#include "incremental.h"
+#include "parser.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace NKaleidoscope;
+
+// count all heap allocations of the benchmark
+namespace {
+std::atomic<std::size_t> AllocationCount = 0;
+} // namespace
+
+void* operator new(std::size_t size) {
+    ++AllocationCount;
+    if (void* memory = std::malloc(size)) {
+        return memory;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+const TSource& GeneratedSource() {
+    static const TSource source = [] {
+        std::string result;
+        for (int i = 0; i < 20000; ++i) {
+            const std::string id = std::to_string(i);
+            result += "extern coefficient" + id + "(x y);\n";
+            result += "def polynomial" + id + "(x y)\n";
+            result += "    if x < " + id + " then\n";
+            result += "        x*x*3.25 + y*2.5 - coefficient" + id + "(x, y) * (x + 1) * (y - 2)\n";
+            result += "    else\n";
+            result += "        polynomial" + id + "(x - 1, y)\n\n";
+        }
+        return TSource::FromString(result);
+    }();
+    return source;
+}
+
+// parse and free the whole AST, nodes are allocated on the heap or in an arena
+void BM_ParseAndFree(benchmark::State& state) {
+    const bool useArena = state.range(0);
+    const TSource& source = GeneratedSource();
+    const TTokenList tokens = LexTokens(source);
+
+    std::size_t allocations = 0;
+    for (auto _ : state) {
+        const std::size_t before = AllocationCount;
+        {
+            std::optional<NAst::TArena> arena;
+            if (useArena) {
+                arena.emplace();
+            }
+            TParser parser{TTokenList{tokens}, arena ? &*arena : nullptr};
+            auto nodes = parser.ParseChunk();
+            benchmark::DoNotOptimize(nodes.data());
+        }
+        allocations = AllocationCount - before;
+    }
+    state.counters["allocations"] = allocations;
+}
+BENCHMARK(BM_ParseAndFree)->ArgName("arena")->Arg(0)->Arg(1);
+
+// the way to get the AST without a cache
+void BM_LexAndParse(benchmark::State& state) {
+    const TSource& source = GeneratedSource();
+    for (auto _ : state) {
+        NAst::TArena arena;
+        TParser parser{LexTokens(source), &arena};
+        auto nodes = parser.ParseChunk();
+        benchmark::DoNotOptimize(nodes.data());
+    }
+    state.SetBytesProcessed(state.iterations() * source.GetBuffer().size());
+}
+BENCHMARK(BM_LexAndParse)->Unit(benchmark::kMillisecond);
+
+// a keystroke in the middle of the source and its undo, compare with BM_LexAndParse
+void BM_IncrementalEdit(benchmark::State& state) {
+    TIncrementalParser parser{std::string{GeneratedSource().GetBuffer()}};
+    const std::size_t offset = parser.GetSource().GetBuffer().find("x*x*3.25", parser.GetSource().GetBuffer().size() / 2);
+    for (auto _ : state) {
+        parser.ApplyEdit({.Offset = offset + 4, .RemovedLength = 0, .Inserted = "1"});
+        auto update = parser.ApplyEdit({.Offset = offset + 4, .RemovedLength = 1, .Inserted = ""});
+        benchmark::DoNotOptimize(update.ChangedItems.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_IncrementalEdit)->Unit(benchmark::kMicrosecond);
+
+// long chains of binary operators, most of the time goes to finding the precedences
+void BM_ParseBinops(benchmark::State& state) {
+    static const TSource source = [] {
+        std::string result;
+        for (int i = 0; i < 2000; ++i) {
+            result += "def chain" + std::to_string(i) + "(a b c) ";
+            for (int j = 0; j < 50; ++j) {
+                result += "a * b + c - a < b * 2 + ";
+            }
+            result += "c;\n";
+        }
+        return TSource::FromString(result);
+    }();
+    const TTokenList tokens = LexTokens(source);
+    for (auto _ : state) {
+        NAst::TArena arena;
+        TParser parser{TTokenList{tokens}, &arena};
+        auto nodes = parser.ParseChunk();
+        benchmark::DoNotOptimize(nodes.data());
+    }
+    state.SetItemsProcessed(state.iterations() * tokens.Size());
+}
+BENCHMARK(BM_ParseBinops)->Unit(benchmark::kMillisecond);
+
+void BM_ParseChunkParallel(benchmark::State& state) {
+    const TSource& source = GeneratedSource();
+    const TTokenList tokens = LexTokens(source);
+    TThreadPool threadPool{static_cast<std::size_t>(state.range(0))};
+    for (auto _ : state) {
+        auto chunk = ParseChunkParallel(tokens, threadPool);
+        benchmark::DoNotOptimize(chunk.Nodes.data());
+    }
+    state.SetBytesProcessed(state.iterations() * source.GetBuffer().size());
+}
+BENCHMARK(BM_ParseChunkParallel)->ArgName("threads")->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// open a cache that is warm in the page cache, check the hash and the
+// structure, and visit every node
+void BM_LoadAstCache(benchmark::State& state) {
+    const TSource& source = GeneratedSource();
+    const std::string cacheFile = "parser_bench.kast";
+    {
+        TParser parser{source};
+        NAst::WriteAstCache(parser.ParseChunkFlat(), source, cacheFile);
+    }
+
+    for (auto _ : state) {
+        NAst::TAstCache cache{cacheFile};
+        if (!cache.Matches(source)) {
+            state.SkipWithError("Cache doesn't match the source");
+            break;
+        }
+        std::size_t kindSum = 0;
+        for (NAst::TNodeIndex index = 0; index < cache.GetNodeCount(); ++index) {
+            kindSum += static_cast<std::size_t>(cache.GetKind(index));
+        }
+        benchmark::DoNotOptimize(kindSum);
+    }
+    state.SetBytesProcessed(state.iterations() * source.GetBuffer().size());
+    std::remove(cacheFile.c_str());
+}
+BENCHMARK(BM_LoadAstCache)->Unit(benchmark::kMillisecond);
+
+} // namespace
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 #include "parser.h"
+#include "simplify.h"
 #include "dump.h"
+#include "bind_symbols.h"
+#include "incremental.h"
+
+#include <random>
 
 using namespace NKaleidoscope;
 
@@ -49,3 +54,612 @@ Prototype: "sin", args: "a"
 )";
     EXPECT_EQ("\n" + Dump(*definition), expectedDump);
 }
+
+TEST(ParserTest, ErrorLocation) {
+    std::string buffer = "def foo(x y)\n  x+foo(y 4.0);";
+    auto source = TSource::FromString(std::move(buffer));
+
+    TParser parser{LexTokens(source)};
+    try {
+        parser.ParseDefinition();
+        FAIL() << "expected an error";
+    } catch (const std::runtime_error& e) {
+        EXPECT_STREQ(e.what(), "2:11: Expected ',' symbol");
+    }
+}
+
+TEST(ParserTest, DumpWithLocations) {
+    std::string buffer = "def foo(x y)\n  x+foo(y, 4.0);";
+    auto source = TSource::FromString(std::move(buffer));
+
+    TParser parser{LexTokens(source)};
+    auto definition = parser.ParseDefinition();
+    constexpr std::string_view expectedDump = R"(
+Function definition: 
+  Prototype: "foo" (1:5), args: "x" (1:9), "y" (1:11)
+  BinaryExpr: "+"
+    VariableExpr: "x" (2:3)
+    CallExpr: "foo" (2:5)
+      VariableExpr: "y" (2:9)
+      NumberExpr: 4
+)";
+    EXPECT_EQ("\n" + Dump(*definition, EDumpMode::WithLocations), expectedDump);
+}
+
+TEST(ParserTest, LazyTokens) {
+    auto source = TSource::FromString("extern sin(a); def foo(x y) x+sin(y); foo(1, 2)");
+
+    TParser listParser{LexTokens(source)};
+    TParser lazyParser{source};
+    const auto listNodes = listParser.ParseChunk();
+    const auto lazyNodes = lazyParser.ParseChunk();
+
+    ASSERT_EQ(lazyNodes.size(), 3);
+    ASSERT_EQ(listNodes.size(), lazyNodes.size());
+    for (std::size_t i = 0; i < lazyNodes.size(); ++i) {
+        EXPECT_EQ(Dump(*lazyNodes[i]), Dump(*listNodes[i]));
+    }
+}
+
+TEST(ParserTest, Arena) {
+    auto source = TSource::FromString("extern sin(a); def foo(x y) if x < y then sin(x) else foo(y, 4.0) * 2; foo(1, 2)");
+
+    TParser heapParser{source};
+    const auto heapNodes = heapParser.ParseChunk();
+
+    NAst::TArena arena;
+    TParser arenaParser{source, &arena};
+    const auto arenaNodes = arenaParser.ParseChunk();
+
+    ASSERT_EQ(arenaNodes.size(), heapNodes.size());
+    for (std::size_t i = 0; i < arenaNodes.size(); ++i) {
+        EXPECT_EQ(Dump(*arenaNodes[i]), Dump(*heapNodes[i]));
+        EXPECT_FALSE(arenaNodes[i].get_deleter().Owning);
+        EXPECT_TRUE(heapNodes[i].get_deleter().Owning);
+    }
+
+    // prototype + (prototype, if, less, 2 variables, call, variable, multiply, call, 2 numbers) + (call, 2 numbers)
+    EXPECT_EQ(arena.GetNodeCount(), 17);
+}
+
+TEST(ParserTest, FlatAst) {
+    auto source = TSource::FromString("extern sin(a); def foo(x y) if x < y then sin(x) else foo(y, 4.0) * 2; foo(1, 2)");
+
+    TParser treeParser{source};
+    const auto nodes = treeParser.ParseChunk();
+
+    TParser flatParser{source};
+    const NAst::TFlatAst parsedAst = flatParser.ParseChunkFlat();
+    const NAst::TFlatAst convertedAst = NAst::Flatten(nodes);
+
+    for (const NAst::TFlatAst* ast : {&parsedAst, &convertedAst}) {
+        ASSERT_EQ(ast->GetTops().size(), nodes.size());
+        EXPECT_EQ(ast->GetNodeCount(), 17);
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            EXPECT_EQ(Dump(*ast, ast->GetTops()[i], EDumpMode::WithLocations),
+                      Dump(*nodes[i], EDumpMode::WithLocations));
+        }
+    }
+}
+
+TEST(ParserTest, Symbols) {
+    auto source = TSource::FromString("extern sin(a); def foo(x y) sin(x) + foo(y, x)");
+
+    TSymbolTable symbols;
+    TParser parser{source, /* arena = */ nullptr, &symbols};
+    const auto nodes = parser.ParseChunk();
+    ASSERT_EQ(nodes.size(), 2);
+
+    const auto& sin = dynamic_cast<const NAst::TPrototype&>(*nodes[0]);
+    EXPECT_EQ(sin.GetSymbol(), symbols.Find("sin"));
+
+    const auto& foo = dynamic_cast<const NAst::TFunction&>(*nodes[1]);
+    EXPECT_EQ(foo.GetPrototype().GetSymbol(), symbols.Find("foo"));
+
+    const auto& body = dynamic_cast<const NAst::TBinaryExpr&>(foo.GetBody());
+    const auto& sinCall = dynamic_cast<const NAst::TCallExpr&>(body.GetLhs());
+    const auto& fooCall = dynamic_cast<const NAst::TCallExpr&>(body.GetRhs());
+    EXPECT_EQ(sinCall.GetCalleeSymbol(), sin.GetSymbol());
+    EXPECT_EQ(fooCall.GetCalleeSymbol(), foo.GetPrototype().GetSymbol());
+
+    const auto& x = dynamic_cast<const NAst::TVariableExpr&>(*sinCall.GetArgs()[0]);
+    const auto& y = dynamic_cast<const NAst::TVariableExpr&>(*fooCall.GetArgs()[0]);
+    EXPECT_EQ(symbols.GetName(x.GetSymbol()), "x");
+    EXPECT_EQ(symbols.GetName(y.GetSymbol()), "y");
+
+    // the args of prototypes are interned after the names
+    EXPECT_EQ(sin.GetArgSymbols(), (std::pmr::vector<TSymbolId>{symbols.Find("a")}));
+    EXPECT_EQ(foo.GetPrototype().GetArgSymbols(), (std::pmr::vector<TSymbolId>{x.GetSymbol(), y.GetSymbol()}));
+    EXPECT_EQ(symbols.Find("a"), sin.GetSymbol() + 1);
+    EXPECT_EQ(symbols.Size(), 5);
+
+    // the flat AST keeps the symbols
+    const NAst::TFlatAst ast = NAst::Flatten(nodes);
+    EXPECT_EQ(ast.GetSymbol(ast.GetTops()[0]), sin.GetSymbol());
+    EXPECT_EQ(ast.GetArgSymbol(ast.GetTops()[0], 0), symbols.Find("a"));
+
+    TParser plainParser{source};
+    const auto plainNodes = plainParser.ParseChunk();
+    EXPECT_EQ(dynamic_cast<const NAst::TPrototype&>(*plainNodes[0]).GetSymbol(), INVALID_SYMBOL);
+}
+
+TEST(ParserTest, HashConsing) {
+    auto source = TSource::FromString("def f(x) x*x + x*x; def g(x y) if x*x < y then g(y, x) else g(y, x)");
+
+    TParser treeParser{source};
+    const auto treeNodes = treeParser.ParseChunk();
+
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    TParser parser{source, &arena, &symbols};
+    parser.EnableHashConsing();
+    const auto nodes = parser.ParseChunk();
+
+    ASSERT_EQ(nodes.size(), treeNodes.size());
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        EXPECT_EQ(Dump(*nodes[i]), Dump(*treeNodes[i]));
+    }
+
+    const auto& f = dynamic_cast<const NAst::TFunction&>(*nodes[0]);
+    const auto& fBody = dynamic_cast<const NAst::TBinaryExpr&>(f.GetBody());
+    EXPECT_EQ(&fBody.GetLhs(), &fBody.GetRhs());
+
+    const auto& g = dynamic_cast<const NAst::TFunction&>(*nodes[1]);
+    const auto& gBody = dynamic_cast<const NAst::TIfExpr&>(g.GetBody());
+    const auto& gCond = dynamic_cast<const NAst::TBinaryExpr&>(gBody.GetCond());
+    EXPECT_EQ(&gBody.GetThen(), &gBody.GetElse());
+    EXPECT_EQ(&gCond.GetLhs(), &fBody.GetLhs());
+
+    // f: prototype, x, x*x, +, function; g: prototype, y, <, call, if, function
+    EXPECT_EQ(arena.GetNodeCount(), 11);
+
+    TParser heapParser{source};
+    EXPECT_THROW(heapParser.EnableHashConsing(), std::runtime_error);
+}
+
+TEST(ParserTest, Simplify) {
+    auto source = TSource::FromString(
+        "def f(x) x*1 + (2*3 - 0) * (if 1 < 2 then x else foo(x));"
+        "1 + 2*3;"
+        "def g(x) (x + 0) * (if 2 < 1 then 1 else x);"
+        "def h(x) x + 0*(0 - 1)");
+    auto expectedSource = TSource::FromString("def f(x) x + 6*x; 7; def g(x) (x + 0) * x; def h(x) x");
+
+    TParser parser{source};
+    auto nodes = parser.ParseChunk();
+    EXPECT_EQ(NAst::Simplify(nodes), 12 + 4 + 5 + 6);
+
+    TParser expectedParser{expectedSource};
+    const auto expectedNodes = expectedParser.ParseChunk();
+    ASSERT_EQ(nodes.size(), expectedNodes.size());
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        EXPECT_EQ(Dump(*nodes[i]), Dump(*expectedNodes[i]));
+    }
+}
+
+TEST(ParserTest, SimplifyNaN) {
+    // inf - inf is NaN, the folding should agree with fcmp ult and fcmp one in any build
+    const std::string inf = "1" + std::string(400, '0');
+    auto source = TSource::FromString(
+        "(" + inf + " - " + inf + ") < 1;"
+        "if " + inf + " - " + inf + " then 2 else 3;"
+        "if 0 * (0 - 1) then 2 else 3");
+
+    TParser parser{source};
+    auto nodes = parser.ParseChunk();
+    NAst::Simplify(nodes);
+
+    const double expected[] = {1, 3, 3};
+    ASSERT_EQ(nodes.size(), std::size(expected));
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        EXPECT_EQ(dynamic_cast<const NAst::TNumberExpr&>(*nodes[i]).GetValue(), expected[i]) << i;
+    }
+}
+
+TEST(ParserTest, SimplifyHashConsed) {
+    auto source = TSource::FromString("def f(x) (x*1) * (x*1) + (2 - 1)");
+
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    TParser parser{source, &arena, &symbols};
+    parser.EnableHashConsing();
+    auto nodes = parser.ParseChunk();
+
+    // the shared x*1 is simplified once
+    EXPECT_EQ(NAst::Simplify(nodes, &arena), 2 + 2);
+
+    const auto& f = dynamic_cast<const NAst::TFunction&>(*nodes[0]);
+    const auto& sum = dynamic_cast<const NAst::TBinaryExpr&>(f.GetBody());
+    const auto& product = dynamic_cast<const NAst::TBinaryExpr&>(sum.GetLhs());
+    EXPECT_EQ(&product.GetLhs(), &product.GetRhs());
+    EXPECT_TRUE(dynamic_cast<const NAst::TVariableExpr*>(&product.GetLhs()));
+    EXPECT_EQ(dynamic_cast<const NAst::TNumberExpr&>(sum.GetRhs()).GetValue(), 1.0);
+}
+
+TEST(ParserTest, SimplifyHashConsedDropped) {
+    auto source = TSource::FromString(
+        "def f(x) x*x + (if 0 then x*x else 1);"
+        "def g(y) if 0 then (y + 2)*(y + 2) else 1");
+
+    NAst::TArena arena;
+    TSymbolTable symbols;
+    TParser parser{source, &arena, &symbols};
+    parser.EnableHashConsing();
+    auto nodes = parser.ParseChunk();
+
+    // the dropped x*x is still the lhs of f, and the shared y + 2 is counted once
+    EXPECT_EQ(NAst::Simplify(nodes, &arena), 2 + (2 + 4));
+}
+
+TEST(ParserTest, Parallel) {
+    std::string sourceStr;
+    for (int i = 0; i < 50; ++i) {
+        const std::string id = std::to_string(i);
+        sourceStr += "extern coef" + id + "(x);\n";
+        sourceStr += "def poly" + id + "(x y) if x < " + id + " then x*x + coef" + id + "(y) else poly" + id + "(x - 1, y);\n";
+        sourceStr += "poly" + id + "(1, 2); 3 + 4;\n";
+    }
+    auto source = TSource::FromString(sourceStr);
+    const TTokenList tokens = LexTokens(source);
+
+    TSymbolTable sequentialSymbols;
+    TParser parser{TTokenList{tokens}, /* arena = */ nullptr, &sequentialSymbols};
+    const auto nodes = parser.ParseChunk();
+
+    TThreadPool threadPool{4};
+    for (std::size_t taskTokens : {std::size_t{1}, std::size_t{100}, DEFAULT_PARALLEL_TASK_TOKENS}) {
+        TSymbolTable symbols;
+        const TParallelChunk chunk = ParseChunkParallel(tokens, threadPool, &symbols, taskTokens);
+        ASSERT_EQ(chunk.Nodes.size(), nodes.size());
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            EXPECT_EQ(Dump(*chunk.Nodes[i], EDumpMode::WithLocations), Dump(*nodes[i], EDumpMode::WithLocations));
+        }
+
+        // the same ids as the sequential parser
+        ASSERT_EQ(symbols.Size(), sequentialSymbols.Size());
+        for (TSymbolId symbol = 0; symbol < symbols.Size(); ++symbol) {
+            EXPECT_EQ(symbols.GetName(symbol), sequentialSymbols.GetName(symbol));
+        }
+    }
+}
+
+TEST(ParserTest, ParallelErrors) {
+    const auto sequentialError = [](const TSource& source) {
+        try {
+            TParser{source}.ParseChunk();
+        } catch (const std::runtime_error& e) {
+            return std::string{e.what()};
+        }
+        return std::string{};
+    };
+
+    TThreadPool threadPool{4};
+    for (const char* sourceStr : {
+        "def f(x) x + def g(y) y",
+        "def f(x) x; extern g(a def h(y) y",
+        "def f(x) x; def g(y) (y; def h(z) z +",
+        "def f(x) x; def g(y) y; def h(z) )",
+    }) {
+        auto source = TSource::FromString(sourceStr);
+        const std::string expected = sequentialError(source);
+        ASSERT_FALSE(expected.empty());
+        try {
+            ParseChunkParallel(LexTokens(source), threadPool, /* symbols = */ nullptr, /* taskTokens = */ 1);
+            ADD_FAILURE() << "No error for " << sourceStr;
+        } catch (const std::runtime_error& e) {
+            EXPECT_EQ(e.what(), expected);
+        }
+    }
+}
+
+TEST(ParserTest, Precedence) {
+    auto source = TSource::FromString("a - b - c * d < e + f * g");
+    TParser parser{source};
+    constexpr std::string_view expectedDump = R"(
+BinaryExpr: "<"
+  BinaryExpr: "-"
+    BinaryExpr: "-"
+      VariableExpr: "a"
+      VariableExpr: "b"
+    BinaryExpr: "*"
+      VariableExpr: "c"
+      VariableExpr: "d"
+  BinaryExpr: "+"
+    VariableExpr: "e"
+    BinaryExpr: "*"
+      VariableExpr: "f"
+      VariableExpr: "g"
+)";
+    EXPECT_EQ("\n" + Dump(*parser.ParseExpr()), expectedDump);
+}
+
+TEST(ParserTest, UserOperators) {
+    auto source = TSource::FromString("def binary| 5 (a b) a + b; def binary& (a b) a * b; x | y & z + w < v | u");
+    TParser parser{source};
+    const auto nodes = parser.ParseChunk();
+    ASSERT_EQ(nodes.size(), 3);
+    EXPECT_EQ(Dump(NAst::NodeCast<NAst::TFunction>(nodes[0].get())->GetPrototype()),
+              "Prototype: \"binary|\", args: \"a\", \"b\"\n");
+
+    // '|' is 5 and '&' is 30 by default
+    constexpr std::string_view expectedDump = R"(
+BinaryExpr: "|"
+  BinaryExpr: "|"
+    VariableExpr: "x"
+    BinaryExpr: "<"
+      BinaryExpr: "+"
+        BinaryExpr: "&"
+          VariableExpr: "y"
+          VariableExpr: "z"
+        VariableExpr: "w"
+      VariableExpr: "v"
+  VariableExpr: "u"
+)";
+    EXPECT_EQ("\n" + Dump(*nodes[2]), expectedDump);
+
+    // registered at runtime, '>' is not a built-in operator
+    TParser registered{TSource::FromString("x > y * z")};
+    registered.AddBinaryOperator('>', 50);
+    EXPECT_EQ(Dump(*registered.ParseExpr()), R"(BinaryExpr: "*"
+  BinaryExpr: ">"
+    VariableExpr: "x"
+    VariableExpr: "y"
+  VariableExpr: "z"
+)");
+
+    EXPECT_THROW(registered.AddBinaryOperator('+', 50), std::runtime_error);
+    EXPECT_THROW(registered.AddBinaryOperator('a', 50), std::runtime_error);
+    EXPECT_THROW(registered.AddBinaryOperator('|', 0), std::runtime_error);
+    EXPECT_THROW(registered.AddBinaryOperator('|', 101), std::runtime_error);
+
+    // an unknown operator is not a binop, nor are the last token kinds of the built-in table
+    EXPECT_THROW(TParser{TSource::FromString("x | y")}.ParseChunk(), std::runtime_error);
+    EXPECT_THROW(TParser{TSource::FromString("x > y")}.ParseChunk(), std::runtime_error);
+    EXPECT_EQ(TParser{TSource::FromString("x; y")}.ParseChunk().size(), 2);
+
+    for (const char* sourceStr : {
+        "def binary | (a b) a",
+        "def binary+ (a b) a",
+        "def binary| 0 (a b) a",
+        "def binary| 1.5 (a b) a",
+        "def binary| (a) a",
+    }) {
+        EXPECT_THROW(TParser{TSource::FromString(sourceStr)}.ParseChunk(), std::runtime_error) << sourceStr;
+    }
+}
+
+TEST(ParserTest, ParallelUserOperators) {
+    auto source = TSource::FromString("def f(x) x; def binary| 5 (a b) a; def g(y) y | y; def h(z) z | z");
+    const auto sequentialNodes = TParser{source}.ParseChunk();
+
+    TThreadPool threadPool{4};
+    const TParallelChunk chunk = ParseChunkParallel(LexTokens(source), threadPool, nullptr, /* taskTokens = */ 1);
+    ASSERT_EQ(chunk.Nodes.size(), sequentialNodes.size());
+    for (std::size_t i = 0; i < sequentialNodes.size(); ++i) {
+        EXPECT_EQ(Dump(*chunk.Nodes[i]), Dump(*sequentialNodes[i]));
+    }
+}
+
+TEST(ParserTest, DeepNesting) {
+    // an expression nested far deeper than the native stack would allow for a recursive parser
+    constexpr int depth = 200'000;
+    std::string buffer = "def f(x) ";
+    for (int i = 0; i < depth; ++i) {
+        buffer += i % 4 == 0 ? "(x + " : i % 4 == 1 ? "f(" : i % 4 == 2 ? "if x then " : "1 * (";
+    }
+    buffer += "x";
+    for (int i = depth - 1; i >= 0; --i) {
+        buffer += i % 4 == 0 ? ")" : i % 4 == 1 ? ")" : i % 4 == 2 ? " else 2" : ")";
+    }
+    auto source = TSource::FromString(std::move(buffer));
+
+    TSymbolTable symbols;
+    NAst::TArena arena;
+    TParser parser{source, &arena, &symbols};
+    auto nodes = parser.ParseChunk();
+    ASSERT_EQ(nodes.size(), 1);
+
+    // prototype, function, x, and per 4 levels: +, x, call, if, x, 2, *, 1
+    EXPECT_EQ(arena.GetNodeCount(), 3 + depth / 4 * 8);
+
+    const NAst::TFlatAst flatAst = NAst::Flatten(nodes);
+    EXPECT_EQ(flatAst.GetNodeCount(), arena.GetNodeCount());
+
+    TSymbolTable boundSymbols;
+    NAst::BindSymbols(nodes, boundSymbols);
+    EXPECT_EQ(boundSymbols.Size(), symbols.Size());
+
+    // every 1 * (...) is removed
+    EXPECT_EQ(NAst::Simplify(nodes, &arena), depth / 4 * 2);
+}
+
+TEST(ParserTest, DeepDump) {
+    std::string buffer;
+    for (int i = 0; i < 100; ++i) {
+        buffer += "if x then g(1, (y * ";
+    }
+    buffer += "z";
+    for (int i = 0; i < 100; ++i) {
+        buffer += ")) else 3";
+    }
+    auto source = TSource::FromString(std::move(buffer));
+
+    TParser parser{source};
+    const auto expr = parser.ParseExpr();
+    NAst::TFlatAst flatAst;
+    const NAst::TNodeIndex root = flatAst.Add(*expr);
+    const std::string dump = Dump(*expr, EDumpMode::WithLocations);
+    EXPECT_EQ(Dump(flatAst, root, EDumpMode::WithLocations), dump);
+    EXPECT_TRUE(dump.starts_with("IfExpr:\nCond:\n  VariableExpr: \"x\" (1:4)\nThen:\n  CallExpr: \"g\" (1:11)\n"));
+}
+
+namespace {
+
+// checks the incremental parser against a parse of its whole source
+void ExpectSameAsFullParse(TIncrementalParser& incremental) {
+    auto source = TSource::FromString(std::string{incremental.GetSource().GetBuffer()});
+    std::vector<NAst::TNodePtr<NAst::TNode>> nodes;
+    std::string error;
+    try {
+        nodes = TParser{source}.ParseChunk();
+    } catch (const std::runtime_error& e) {
+        error = e.what();
+    }
+
+    const std::vector<std::string> errors = incremental.GetErrors();
+    if (!error.empty()) {
+        ASSERT_FALSE(errors.empty()) << source.GetBuffer();
+        EXPECT_EQ(errors.front(), error) << source.GetBuffer();
+        return;
+    }
+    EXPECT_TRUE(errors.empty()) << source.GetBuffer();
+    const auto items = incremental.GetItems();
+    ASSERT_EQ(items.size(), nodes.size()) << source.GetBuffer();
+    ASSERT_EQ(incremental.GetItemCount(), nodes.size());
+    for (std::size_t i = 0; i < items.size(); ++i) {
+        EXPECT_EQ(Dump(*items[i], EDumpMode::WithLocations), Dump(*nodes[i], EDumpMode::WithLocations));
+    }
+}
+
+} // namespace
+
+TEST(ParserTest, IncrementalEdits) {
+    const std::string text =
+        "extern sin(x);\n"
+        "def f(x) x + 1;\n"
+        "f(2);\n"
+        "def g(y) # comment\n"
+        "  y * 2;\n"
+        "def h(z) g(z) - f(z);\n";
+    TIncrementalParser parser{text};
+    ExpectSameAsFullParse(parser);
+    ASSERT_EQ(parser.GetItems().size(), 5u);
+
+    const auto apply = [&parser](std::string_view removed, std::string inserted, std::size_t from = 0) {
+        const std::size_t offset = parser.GetSource().GetBuffer().find(removed, from);
+        TIncrementalUpdate update = parser.ApplyEdit({offset, removed.size(), std::move(inserted)});
+        ExpectSameAsFullParse(parser);
+        return update;
+    };
+
+    // only the body of g changes, h is shifted
+    TIncrementalUpdate update = apply("y * 2", "y * 20");
+    EXPECT_EQ(update.FirstItem, 3u);
+    EXPECT_EQ(update.RemovedCount, 1u);
+    EXPECT_EQ(update.InsertedCount, 1u);
+    EXPECT_EQ(update.ChangedItems, std::vector<std::size_t>{3});
+    EXPECT_TRUE(update.RemovedNames.empty());
+
+    // whitespace changes nothing but the locations
+    update = apply("x + 1", "x   +   1");
+    EXPECT_TRUE(update.ChangedItems.empty());
+
+    // a new definition in the middle of f's segment
+    update = apply("f(2);", "f(2); def k() 3;");
+    EXPECT_EQ(update.InsertedCount, 3u);
+    EXPECT_EQ(update.ChangedItems, std::vector<std::size_t>{3});
+
+    // renaming removes the old name
+    update = apply("def k", "def m");
+    EXPECT_EQ(update.ChangedItems, std::vector<std::size_t>{3});
+    EXPECT_EQ(update.RemovedNames, std::vector<std::string>{"k"});
+
+    // gluing a token to the next 'def' merges two segments
+    update = apply("3;\ndef g", "3 \ndefg");
+    EXPECT_EQ(update.RemovedNames, std::vector<std::string>{"g"});
+    update = apply("defg", "def g");
+    EXPECT_TRUE(update.RemovedNames.empty());
+
+    // a comment hides the rest of its line
+    update = apply("def h", "# def h");
+    EXPECT_EQ(update.RemovedNames, std::vector<std::string>{"h"});
+
+    // errors are kept per segment and follow the edits
+    update = apply("def f(x)", "def f(x");
+    ASSERT_EQ(parser.GetErrors().size(), 1u);
+    apply("sin", "\n\nsin");
+    apply("def f(x", "def f(x)");
+    EXPECT_TRUE(parser.GetErrors().empty());
+
+    // a single item is shifted on its own
+    parser.ApplyEdit({0, 0, "\n"});
+    auto source = TSource::FromString(std::string{parser.GetSource().GetBuffer()});
+    const auto nodes = TParser{source}.ParseChunk();
+    ASSERT_EQ(parser.GetItemCount(), nodes.size());
+    EXPECT_EQ(Dump(parser.GetItem(3), EDumpMode::WithLocations), Dump(*nodes[3], EDumpMode::WithLocations));
+
+    EXPECT_THROW(parser.ApplyEdit({parser.GetSource().GetBuffer().size(), 1, ""}), std::runtime_error);
+}
+
+TEST(ParserTest, IncrementalUserOperators) {
+    TIncrementalParser parser{"def f(x) x | x; def g(y) y;"};
+    EXPECT_EQ(parser.GetErrors().size(), 1u);
+
+    // the operator changes how an earlier item is parsed, so the whole source is parsed again
+    TIncrementalUpdate update = parser.ApplyEdit({0, 0, "def binary| 5 (a b) a; "});
+    ExpectSameAsFullParse(parser);
+    EXPECT_TRUE(parser.GetErrors().empty());
+    EXPECT_EQ(update.FirstItem, 0u);
+    EXPECT_EQ(update.InsertedCount, 3u);
+
+    update = parser.ApplyEdit({parser.GetSource().GetBuffer().size(), 0, " g(1) | 2;"});
+    ExpectSameAsFullParse(parser);
+    EXPECT_EQ(update.ChangedItems, std::vector<std::size_t>{3});
+}
+
+TEST(ParserTest, IncrementalRandomEdits) {
+    const std::vector<std::string> snippets = {
+        "def ", "extern ", "f", "g", "x", "(", ")", "(x)", "(x y)", ",", "+", "*", "<",
+        "1", "2.5", " ", "\n", "# note\n", ";", "if ", " then ", " else ", "f(x)", "def f(x) x;",
+    };
+    std::mt19937 random{42};
+    const auto pick = [&random](std::size_t size) {
+        return std::uniform_int_distribution<std::size_t>{0, size - 1}(random);
+    };
+
+    std::string text;
+    for (int i = 0; i < 20; ++i) {
+        text += "def f" + std::to_string(i) + "(x y) if x < y then f(x, 1) else x * 2.5;\n";
+    }
+    TSymbolTable symbols;
+    TIncrementalParser parser{text, &symbols};
+    for (int i = 0; i < 500; ++i) {
+        const std::string_view buffer = parser.GetSource().GetBuffer();
+        if (i % 2 == 0) {
+            // a random edit that likely breaks the source, and its undo
+            const std::size_t offset = pick(buffer.size() + 1);
+            const std::size_t removed = std::min(pick(8), buffer.size() - offset);
+            std::string removedText{buffer.substr(offset, removed)};
+            const std::string& inserted = snippets[pick(snippets.size())];
+            parser.ApplyEdit({offset, removed, inserted});
+            if (i % 4 == 0) {
+                ExpectSameAsFullParse(parser);
+            }
+            parser.ApplyEdit({offset, inserted.size(), std::move(removedText)});
+        } else {
+            // a lasting edit of a whole line that keeps the source valid
+            std::vector<std::size_t> lineBegins = {0};
+            for (std::size_t j = 0; j + 1 < buffer.size(); ++j) {
+                if (buffer[j] == '\n') {
+                    lineBegins.push_back(j + 1);
+                }
+            }
+            const std::size_t offset = lineBegins[pick(lineBegins.size())];
+            if (pick(2) == 0 && buffer.size() > offset) {
+                parser.ApplyEdit({offset, buffer.find('\n', offset) + 1 - offset, ""});
+            } else {
+                const std::string id = std::to_string(i);
+                parser.ApplyEdit({offset, 0, pick(2) ? "def k" + id + "(x) x + " + id + ";\n" : "f(" + id + ");\n"});
+            }
+        }
+        // the ranges of the items are shifted over several edits before they are read
+        EXPECT_TRUE(parser.GetErrors().empty());
+        if (i % 3 == 0) {
+            ExpectSameAsFullParse(parser);
+        }
+        if (HasFailure()) {
+            break;
+        }
+    }
+    ExpectSameAsFullParse(parser);
+}
@@ -1,9 +1,66 @@
 #include "source.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <limits>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace NKaleidoscope {
 
+namespace {
+
+[[noreturn]] void ThrowFileError(std::string_view what, const std::string& fileName) {
+    throw std::runtime_error(std::string{what} + " \"" + fileName + "\": " + std::strerror(errno));
+}
+
+void FindLineBeginnings(std::string_view buffer, std::vector<std::size_t>& lineOffsets) {
+    const char* data = buffer.data();
+    std::size_t offset = 0;
+
+#ifdef __SSE2__
+    // compare 16 bytes at once and walk the bits of the newline mask
+    const __m128i newlines = _mm_set1_epi8('\n');
+    for (; offset + 16 <= buffer.size(); offset += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+        while (mask) {
+            lineOffsets.push_back(offset + __builtin_ctz(mask) + 1);
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; offset < buffer.size(); ++offset) {
+        if (data[offset] == '\n') {
+            lineOffsets.push_back(offset + 1);
+        }
+    }
+}
+
+} // namespace
+
 // TSource
+TSource::~TSource() {
+    if (MappedData_) {
+        ::munmap(const_cast<char*>(MappedData_), MappedSize_);
+    }
+}
+
 std::string_view TSource::GetBuffer() const {
+    if (MappedData_) {
+        return {MappedData_, MappedSize_};
+    }
     return Buffer_;
 }
 
@@ -11,25 +68,177 @@ const std::string* TSource::GetFileName() const {
     return FileName_ ? &FileName_.value() : nullptr;
 }
 
+std::size_t TSource::GetBufferOffset() const {
+    return BufferOffset_;
+}
+
+bool TSource::IsStreaming() const {
+    return Fd_ >= 0;
+}
+
+bool TSource::ReadChunk(std::size_t keepFrom) {
+    if (!IsStreaming()) {
+        return false;
+    }
+
+    // keep only the tail that is still in use
+    const std::size_t dropSize = std::min(keepFrom - BufferOffset_, Buffer_.size());
+    Buffer_.erase(0, dropSize);
+    BufferOffset_ += dropSize;
+
+    const std::size_t oldSize = Buffer_.size();
+    Buffer_.resize(oldSize + ChunkSize_);
+    ssize_t readSize;
+    do {
+        readSize = ::read(Fd_, Buffer_.data() + oldSize, ChunkSize_);
+    } while (readSize < 0 && errno == EINTR);
+
+    if (readSize < 0) {
+        Buffer_.resize(oldSize);
+        throw std::runtime_error(std::string{"Can't read source: "} + std::strerror(errno));
+    }
+    Buffer_.resize(oldSize + readSize);
+    return readSize > 0;
+}
+
+void TSource::Edit(std::size_t offset, std::size_t removedLength, std::string_view inserted) {
+    if (IsStreaming() || MappedData_ || FileName_) {
+        throw std::runtime_error("Only a source made from a string can be edited");
+    }
+    if (offset > Buffer_.size() || removedLength > Buffer_.size() - offset) {
+        throw std::runtime_error("Edit is out of the source");
+    }
+    Buffer_.replace(offset, removedLength, inserted);
+    LineIndexFlag_.emplace();
+    LineOffsets_.clear();
+}
+
+TSourceLocation TSource::Locate(std::size_t offset) const {
+    if (IsStreaming()) {
+        throw std::runtime_error("Can't locate an offset in a streaming source");
+    }
+    std::call_once(*LineIndexFlag_, [this] { BuildLineIndex(); });
+
+    // the last line that begins at or before the offset
+    const auto iter = std::upper_bound(LineOffsets_.begin(), LineOffsets_.end(), offset);
+    const std::size_t line = iter - LineOffsets_.begin();
+    return TSourceLocation{.Line = line, .Column = offset - LineOffsets_[line - 1] + 1};
+}
+
+void TSource::BuildLineIndex() const {
+    LineOffsets_.push_back(0);
+    FindLineBeginnings(GetBuffer(), LineOffsets_);
+}
+
 TSource::TSource(std::optional<std::string> fileName, std::string buffer)
     : FileName_{std::move(fileName)}
     , Buffer_{std::move(buffer)}
+    , MappedData_{nullptr}
+    , MappedSize_{0}
+    , Fd_{-1}
+    , ChunkSize_{0}
+    , BufferOffset_{0}
+{}
+
+TSource::TSource(std::string fileName, const char* mappedData, std::size_t mappedSize)
+    : FileName_{std::move(fileName)}
+    , MappedData_{mappedData}
+    , MappedSize_{mappedSize}
+    , Fd_{-1}
+    , ChunkSize_{0}
+    , BufferOffset_{0}
 {}
 
+TSource::TSource(int fd, std::size_t chunkSize)
+    : MappedData_{nullptr}
+    , MappedSize_{0}
+    , Fd_{fd}
+    , ChunkSize_{chunkSize}
+    , BufferOffset_{0}
+{
+    Buffer_.reserve(chunkSize);
+}
+
 TSource TSource::FromString(std::string buffer) {
     return TSource{/* fileName = */ std::nullopt, std::move(buffer)};
 }
 
-// TSourceLocation
+TSource TSource::FromFile(std::string fileName) {
+    const int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ThrowFileError("Can't open file", fileName);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        ThrowFileError("Can't stat file", fileName);
+    }
+
+    // an empty mapping is not allowed
+    const std::size_t size = st.st_size;
+    if (size == 0) {
+        ::close(fd);
+        return TSource{std::move(fileName), /* buffer = */ std::string{}};
+    }
+
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file referenced
+    if (data == MAP_FAILED) {
+        ThrowFileError("Can't map file", fileName);
+    }
+
+    // the lexer reads the buffer once from the beginning to the end
+    ::madvise(data, size, MADV_SEQUENTIAL);
+    ::madvise(data, size, MADV_WILLNEED);
+
+    return TSource{std::move(fileName), static_cast<const char*>(data), size};
+}
+
+TSource TSource::FromFileDescriptor(int fd, std::size_t chunkSize) {
+    if (fd < 0 || chunkSize == 0) {
+        throw std::runtime_error("Streaming source needs a valid descriptor and a non-zero chunk size");
+    }
+    return TSource{fd, chunkSize};
+}
+
+// TSourceRange
 std::string_view TSourceRange::AsStringView() const {
     const auto* data = Source->GetBuffer().data();
-    return {data + Offset, Length};
+    return {data + (Offset - Source->GetBufferOffset()), Length};
+}
+
+TSourceLocation TSourceRange::Locate() const {
+    return Source->Locate(Offset);
+}
+
+std::string TSourceRange::FormatLocation() const {
+    const TSourceLocation location = Locate();
+    std::string result;
+    if (const std::string* fileName = Source->GetFileName()) {
+        result = *fileName + ":";
+    }
+    return result + std::to_string(location.Line) + ":" + std::to_string(location.Column);
 }
 
 double TSourceRange::AsDouble() const {
+    // from_chars doesn't depend on the locale and never reads past the range
     const std::string_view sv = AsStringView();
-    char* strEnd = const_cast<char*>(sv.data()) + Length;
-    return std::strtod(sv.data(), &strEnd);
+    double value;
+    const auto [end, error] = std::from_chars(sv.data(), sv.data() + sv.size(), value, std::chars_format::fixed);
+    if (error == std::errc::result_out_of_range && end == sv.data() + sv.size()) {
+        // a well-formed literal out of range is inf or 0, like with strtod
+        const bool isLarge = sv.substr(0, sv.find('.')).find_first_not_of('0') != std::string_view::npos;
+        return isLarge ? std::numeric_limits<double>::infinity() : 0.0;
+    }
+    if (error != std::errc{} || end != sv.data() + sv.size()) {
+        std::string message = "Malformed number literal \"" + std::string{sv} + "\"";
+        if (!Source->IsStreaming()) {
+            message = FormatLocation() + ": " + message;
+        }
+        throw std::runtime_error(message);
+    }
+    return value;
 }
 
 } // namespace NKaleidoscope
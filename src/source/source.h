@@ -1,26 +1,82 @@
 #pragma once
 
+#include <mutex>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "noncopyable.h"
 
 namespace NKaleidoscope {
 
+// 1-based line and column of a byte in the source
+struct TSourceLocation {
+    std::size_t Line;
+    std::size_t Column;
+};
+
 class TSource : private TNonCopyable {
 public:
+    ~TSource();
+
     std::string_view GetBuffer() const;
     const std::string* GetFileName() const;
 
+    // offset of the first byte of GetBuffer() from the start of the source,
+    // non-zero only for streaming sources
+    std::size_t GetBufferOffset() const;
+
+    // a streaming source holds only a window of the input in its buffer
+    bool IsStreaming() const;
+
+    // streaming only: drops the bytes before `keepFrom` and appends the next
+    // chunk to the buffer, returns false if the input is exhausted
+    bool ReadChunk(std::size_t keepFrom);
+
+    // replaces `removedLength` bytes at `offset` by `inserted`, only for sources
+    // made by FromString; ranges after the offset keep their old offsets, and the
+    // line index is rebuilt on the next Locate
+    void Edit(std::size_t offset, std::size_t removedLength, std::string_view inserted);
+
+    // finds the line and the column of the byte at `offset` in O(log(lines)),
+    // the line index is built on the first call; not available for streaming sources
+    TSourceLocation Locate(std::size_t offset) const;
+
     static TSource FromString(std::string buffer);
-    // TODO: add FromFile
+
+    // maps the file into memory, the buffer is a view over the mapped pages
+    static TSource FromFile(std::string fileName);
+
+    // reads the descriptor (e.g. stdin or a pipe) in chunks of `chunkSize` bytes,
+    // the descriptor is not closed by the source; ranges pointing to the dropped
+    // bytes become invalid after ReadChunk
+    static TSource FromFileDescriptor(int fd, std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    static constexpr std::size_t DEFAULT_CHUNK_SIZE = 1 << 16;
 
 private:
     TSource(std::optional<std::string> fileName, std::string buffer);
+    TSource(std::string fileName, const char* mappedData, std::size_t mappedSize);
+    TSource(int fd, std::size_t chunkSize);
+
+    void BuildLineIndex() const;
 
 private:
     std::optional<std::string> FileName_;
     std::string Buffer_;
+
+    // non-null only for memory-mapped files
+    const char* MappedData_;
+    std::size_t MappedSize_;
+
+    // -1 for non-streaming sources
+    int Fd_;
+    std::size_t ChunkSize_;
+    std::size_t BufferOffset_;
+
+    // offsets of the beginnings of the lines, Edit resets the flag
+    mutable std::optional<std::once_flag> LineIndexFlag_{std::in_place};
+    mutable std::vector<std::size_t> LineOffsets_;
 };
 
 // Points to a contigious range of a source
@@ -30,7 +86,14 @@ struct TSourceRange {
     std::size_t Length;
 
     std::string_view AsStringView() const;
+
+    // the whole range should be a number literal like "1", "1.5" or ".5"
     double AsDouble() const;
+
+    TSourceLocation Locate() const;
+
+    // "file:line:column", or "line:column" for sources without a file
+    std::string FormatLocation() const;
 };
 
 } // namespace NKaleidoscope
@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+#include "source.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace NKaleidoscope;
+
+namespace {
+
+// a coefficient table: numbers separated by commas
+struct TNumberTable {
+    TSource Source = TSource::FromString(Generate());
+    std::vector<TSourceRange> Ranges;
+
+    TNumberTable() {
+        const std::string_view buffer = Source.GetBuffer();
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i <= buffer.size(); ++i) {
+            if (i == buffer.size() || buffer[i] == ',') {
+                Ranges.push_back(TSourceRange{.Source = &Source, .Offset = begin, .Length = i - begin});
+                begin = i + 1;
+            }
+        }
+    }
+
+    static std::string Generate() {
+        std::string result;
+        std::uint32_t random = 1;
+        for (int i = 0; i < 100000; ++i) {
+            random = random * 1664525 + 1013904223;
+            if (i) {
+                result += ",";
+            }
+            result += std::to_string(random % 1000) + "." + std::to_string(random >> 8);
+        }
+        return result;
+    }
+};
+
+const TNumberTable& NumberTable() {
+    static const TNumberTable table;
+    return table;
+}
+
+// what AsDouble did before: a null-terminated copy and strtod
+void BM_AsDoubleStrtod(benchmark::State& state) {
+    for (auto _ : state) {
+        for (const auto& range : NumberTable().Ranges) {
+            const std::string str{range.AsStringView()};
+            benchmark::DoNotOptimize(std::strtod(str.c_str(), nullptr));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * NumberTable().Ranges.size());
+}
+BENCHMARK(BM_AsDoubleStrtod);
+
+void BM_AsDouble(benchmark::State& state) {
+    for (auto _ : state) {
+        for (const auto& range : NumberTable().Ranges) {
+            benchmark::DoNotOptimize(range.AsDouble());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * NumberTable().Ranges.size());
+}
+BENCHMARK(BM_AsDouble);
+
+} // namespace
@@ -1,4 +1,7 @@
 #include <gtest/gtest.h>
+#include <fstream>
+#include <limits>
+#include <unistd.h>
 #include "source.h"
 
 using namespace NKaleidoscope;
@@ -14,3 +17,155 @@ TEST(SourceTest, SourceRange) {
     TSourceRange sr{.Source = &s, .Offset = 2, .Length = 4};
     EXPECT_TRUE(sr.AsStringView() == "f sa");
 }
+
+TEST(SourceTest, FromFile) {
+    const std::string fileName = ::testing::TempDir() + "source_test.ka";
+    {
+        std::ofstream ostr{fileName};
+        ostr << "def sample";
+    }
+
+    auto s = TSource::FromFile(fileName);
+    EXPECT_TRUE(s.GetBuffer() == "def sample");
+    ASSERT_TRUE(s.GetFileName() != nullptr);
+    EXPECT_EQ(*s.GetFileName(), fileName);
+
+    TSourceRange sr{.Source = &s, .Offset = 4, .Length = 6};
+    EXPECT_TRUE(sr.AsStringView() == "sample");
+}
+
+TEST(SourceTest, FromEmptyFile) {
+    const std::string fileName = ::testing::TempDir() + "source_test_empty.ka";
+    std::ofstream{fileName};
+
+    auto s = TSource::FromFile(fileName);
+    EXPECT_TRUE(s.GetBuffer().empty());
+}
+
+TEST(SourceTest, FromMissingFile) {
+    EXPECT_THROW(TSource::FromFile(::testing::TempDir() + "no_such_file.ka"), std::runtime_error);
+}
+
+TEST(SourceTest, FromFileDescriptor) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], "def sample", 10), 10);
+    close(fds[1]);
+
+    auto s = TSource::FromFileDescriptor(fds[0], /* chunkSize = */ 4);
+    EXPECT_TRUE(s.IsStreaming());
+    EXPECT_TRUE(s.GetBuffer().empty());
+
+    EXPECT_TRUE(s.ReadChunk(/* keepFrom = */ 0));
+    EXPECT_TRUE(s.GetBuffer() == "def ");
+
+    EXPECT_TRUE(s.ReadChunk(/* keepFrom = */ 2));
+    EXPECT_EQ(s.GetBufferOffset(), 2);
+    EXPECT_TRUE(s.GetBuffer() == "f samp");
+
+    TSourceRange sr{.Source = &s, .Offset = 4, .Length = 3};
+    EXPECT_TRUE(sr.AsStringView() == "sam");
+
+    EXPECT_TRUE(s.ReadChunk(/* keepFrom = */ 7));
+    EXPECT_TRUE(s.GetBuffer() == "ple");
+    EXPECT_FALSE(s.ReadChunk(/* keepFrom = */ 10));
+    EXPECT_TRUE(s.GetBuffer().empty());
+    close(fds[0]);
+}
+
+TEST(SourceTest, Locate) {
+    // lines longer than a SIMD block
+    auto s = TSource::FromString("def foo(x)\n  x + 1234567890123456789\n\n# comment\nfoo(2)");
+    const auto check = [&](std::size_t offset, std::size_t line, std::size_t column) {
+        const TSourceLocation location = s.Locate(offset);
+        EXPECT_EQ(location.Line, line) << "offset " << offset;
+        EXPECT_EQ(location.Column, column) << "offset " << offset;
+    };
+    check(0, 1, 1);
+    check(4, 1, 5);
+    check(10, 1, 11); // '\n' belongs to its line
+    check(11, 2, 1);
+    check(17, 2, 7);
+    check(36, 2, 26);
+    check(37, 3, 1);
+    check(38, 4, 1);
+    check(48, 5, 1);
+    check(54, 5, 7); // end of buffer
+
+    TSourceRange sr{.Source = &s, .Offset = 48, .Length = 3};
+    EXPECT_EQ(sr.FormatLocation(), "5:1");
+}
+
+TEST(SourceTest, Edit) {
+    auto s = TSource::FromString("def foo(x)\nfoo(2)");
+    EXPECT_EQ(s.Locate(11).Line, 2u);
+
+    s.Edit(/* offset = */ 4, /* removedLength = */ 3, "bar\n");
+    EXPECT_TRUE(s.GetBuffer() == "def bar\n(x)\nfoo(2)");
+    // the line index follows the edit
+    EXPECT_EQ(s.Locate(12).Line, 3u);
+
+    s.Edit(s.GetBuffer().size(), 0, ";");
+    EXPECT_TRUE(s.GetBuffer() == "def bar\n(x)\nfoo(2);");
+
+    EXPECT_THROW(s.Edit(10, 100, ""), std::runtime_error);
+
+    const std::string fileName = ::testing::TempDir() + "source_test_edit.ka";
+    std::ofstream{fileName};
+    auto file = TSource::FromFile(fileName);
+    EXPECT_THROW(file.Edit(0, 0, "def"), std::runtime_error);
+}
+
+TEST(SourceTest, FormatLocationWithFileName) {
+    const std::string fileName = ::testing::TempDir() + "source_test_location.ka";
+    {
+        std::ofstream ostr{fileName};
+        ostr << "extern sin(a);\nsin(1)";
+    }
+
+    auto s = TSource::FromFile(fileName);
+    TSourceRange sr{.Source = &s, .Offset = 19, .Length = 1};
+    EXPECT_EQ(sr.FormatLocation(), fileName + ":2:5");
+}
+
+TEST(SourceTest, AsDouble) {
+    auto s = TSource::FromString("3 1.5 .25 7. 0.1 123456789.125");
+    const auto number = [&](std::size_t offset, std::size_t length) {
+        return TSourceRange{.Source = &s, .Offset = offset, .Length = length}.AsDouble();
+    };
+    EXPECT_EQ(number(0, 1), 3.0);
+    EXPECT_EQ(number(2, 3), 1.5);
+    EXPECT_EQ(number(6, 3), 0.25);
+    EXPECT_EQ(number(10, 2), 7.0);
+    EXPECT_EQ(number(13, 3), 0.1);
+    EXPECT_EQ(number(17, 13), 123456789.125);
+
+    // the range ends before the rest of the digits
+    EXPECT_EQ(number(17, 3), 123.0);
+}
+
+TEST(SourceTest, AsDoubleOutOfRange) {
+    auto s = TSource::FromString("1" + std::string(400, '0') + " 0." + std::string(400, '0') + "1 0.5");
+    const auto number = [&](std::size_t offset, std::size_t length) {
+        return TSourceRange{.Source = &s, .Offset = offset, .Length = length}.AsDouble();
+    };
+    // inf, compared so that it holds in the -Ofast build as well
+    EXPECT_GT(number(0, 401), std::numeric_limits<double>::max());
+    EXPECT_EQ(number(402, 403), 0.0);
+    EXPECT_EQ(number(806, 3), 0.5);
+}
+
+TEST(SourceTest, AsDoubleMalformed) {
+    auto s = TSource::FromString("x\n1.2.3 . 1..");
+    const auto number = [&](std::size_t offset, std::size_t length) {
+        return TSourceRange{.Source = &s, .Offset = offset, .Length = length}.AsDouble();
+    };
+    try {
+        number(2, 5);
+        FAIL() << "expected an error";
+    } catch (const std::runtime_error& e) {
+        EXPECT_STREQ(e.what(), "2:1: Malformed number literal \"1.2.3\"");
+    }
+    EXPECT_THROW(number(8, 1), std::runtime_error);
+    EXPECT_THROW(number(10, 3), std::runtime_error);
+}
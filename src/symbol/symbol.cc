@@ -0,0 +1,36 @@
+#include "symbol.h"
+
+#include <stdexcept>
+
+namespace NKaleidoscope {
+
+TSymbolId TSymbolTable::Intern(std::string_view name) {
+    if (auto iter = Symbols_.find(name); iter != Symbols_.end()) {
+        return iter->second;
+    }
+    if (Names_.size() == INVALID_SYMBOL) {
+        throw std::runtime_error("Too many symbols");
+    }
+
+    const TSymbolId symbol = Names_.size();
+    const std::string& storedName = Names_.emplace_back(name);
+    Symbols_.emplace(storedName, symbol);
+    return symbol;
+}
+
+TSymbolId TSymbolTable::Find(std::string_view name) const {
+    if (auto iter = Symbols_.find(name); iter != Symbols_.end()) {
+        return iter->second;
+    }
+    return INVALID_SYMBOL;
+}
+
+std::string_view TSymbolTable::GetName(TSymbolId symbol) const {
+    return Names_[symbol];
+}
+
+std::size_t TSymbolTable::Size() const {
+    return Names_.size();
+}
+
+} // namespace NKaleidoscope
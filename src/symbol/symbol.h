@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "noncopyable.h"
+
+namespace NKaleidoscope {
+
+// dense id of an interned name
+using TSymbolId = std::uint32_t;
+
+constexpr TSymbolId INVALID_SYMBOL = std::numeric_limits<TSymbolId>::max();
+
+// Per-compilation string interner: equal names get equal ids, the ids are
+// 0, 1, 2, ... in the order of the first occurrence, so they can index vectors
+class TSymbolTable : private TNonCopyable {
+public:
+    TSymbolId Intern(std::string_view name);
+
+    // returns INVALID_SYMBOL for names that were never interned
+    TSymbolId Find(std::string_view name) const;
+
+    std::string_view GetName(TSymbolId symbol) const;
+    std::size_t Size() const;
+
+private:
+    // deque never moves the strings, so the keys stay valid
+    std::deque<std::string> Names_;
+    std::unordered_map<std::string_view, TSymbolId> Symbols_;
+};
+
+} // namespace NKaleidoscope
@@ -0,0 +1,27 @@
+#include <gtest/gtest.h>
+#include "symbol.h"
+
+using namespace NKaleidoscope;
+
+TEST(SymbolTest, Intern) {
+    TSymbolTable symbols;
+    EXPECT_EQ(symbols.Intern("foo"), 0);
+    EXPECT_EQ(symbols.Intern("bar"), 1);
+    EXPECT_EQ(symbols.Intern(std::string{"foo"}), 0);
+    EXPECT_EQ(symbols.Intern("x"), 2);
+    EXPECT_EQ(symbols.Size(), 3);
+
+    EXPECT_EQ(symbols.GetName(1), "bar");
+    EXPECT_EQ(symbols.Find("x"), 2);
+    EXPECT_EQ(symbols.Find("y"), INVALID_SYMBOL);
+}
+
+TEST(SymbolTest, StableNames) {
+    TSymbolTable symbols;
+    const std::string_view first = symbols.GetName(symbols.Intern("a"));
+    for (int i = 0; i < 10000; ++i) {
+        symbols.Intern("name" + std::to_string(i));
+    }
+    EXPECT_EQ(first, "a");
+    EXPECT_EQ(symbols.Find("name9999"), 10000);
+}
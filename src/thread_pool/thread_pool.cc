@@ -0,0 +1,56 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace NKaleidoscope {
+
+TThreadPool::TThreadPool(std::size_t threadCount)
+    : Stopping_{false}
+{
+    threadCount = std::max<std::size_t>(threadCount, 1);
+    Threads_.reserve(threadCount);
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        Threads_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+TThreadPool::~TThreadPool() {
+    {
+        std::lock_guard guard{Mutex_};
+        Stopping_ = true;
+    }
+    HasTasks_.notify_all();
+    for (auto& thread : Threads_) {
+        thread.join();
+    }
+}
+
+std::size_t TThreadPool::GetThreadCount() const {
+    return Threads_.size();
+}
+
+void TThreadPool::Enqueue(std::function<void()> task) {
+    {
+        std::lock_guard guard{Mutex_};
+        Tasks_.push_back(std::move(task));
+    }
+    HasTasks_.notify_one();
+}
+
+void TThreadPool::WorkerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock{Mutex_};
+            HasTasks_.wait(lock, [this] { return Stopping_ || !Tasks_.empty(); });
+            if (Tasks_.empty()) {
+                return; // stopping and nothing left to do
+            }
+            task = std::move(Tasks_.front());
+            Tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace NKaleidoscope
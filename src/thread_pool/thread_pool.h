@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace NKaleidoscope {
+
+// a fixed set of workers executing tasks in the order of submission
+class TThreadPool : private TNonCopyable {
+public:
+    explicit TThreadPool(std::size_t threadCount = std::thread::hardware_concurrency());
+
+    // finishes all submitted tasks
+    ~TThreadPool();
+
+    std::size_t GetThreadCount() const;
+
+    template <class TFunc>
+    auto Submit(TFunc&& func) -> std::future<std::invoke_result_t<TFunc>> {
+        using TResult = std::invoke_result_t<TFunc>;
+        auto task = std::make_shared<std::packaged_task<TResult()>>(std::forward<TFunc>(func));
+        auto future = task->get_future();
+        Enqueue([task] { (*task)(); });
+        return future;
+    }
+
+private:
+    void Enqueue(std::function<void()> task);
+    void WorkerLoop();
+
+private:
+    std::mutex Mutex_;
+    std::condition_variable HasTasks_;
+    std::deque<std::function<void()>> Tasks_;
+    bool Stopping_;
+    std::vector<std::thread> Threads_;
+};
+
+} // namespace NKaleidoscope
@@ -0,0 +1,36 @@
+#include <gtest/gtest.h>
+#include "thread_pool.h"
+
+#include <atomic>
+
+using namespace NKaleidoscope;
+
+TEST(ThreadPoolTest, Results) {
+    TThreadPool threadPool{4};
+    EXPECT_EQ(threadPool.GetThreadCount(), 4);
+
+    std::vector<std::future<int>> futures;
+    for (int i = 0; i < 100; ++i) {
+        futures.push_back(threadPool.Submit([i] { return i * i; }));
+    }
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(futures[i].get(), i * i);
+    }
+}
+
+TEST(ThreadPoolTest, Exception) {
+    TThreadPool threadPool{2};
+    auto future = threadPool.Submit([]() -> int { throw std::runtime_error("task failed"); });
+    EXPECT_THROW(future.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, FinishesTasksOnDestruction) {
+    std::atomic<int> counter = 0;
+    {
+        TThreadPool threadPool{3};
+        for (int i = 0; i < 50; ++i) {
+            threadPool.Submit([&counter] { ++counter; });
+        }
+    }
+    EXPECT_EQ(counter, 50);
+}
@@ -1,17 +1,20 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/Host.h>
 #include <llvm/MC/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 
-#include <fstream>
-
+#include "ast_cache.h"
 #include "codegen.h"
+#include "jit.h"
 #include "lexer.h"
 #include "parser.h"
+#include "simplify.h"
+#include "symbol.h"
 
 using namespace llvm;
 
@@ -24,9 +27,8 @@ std::string Print(auto* element) {
     return str;
 }
 
-std::string CalculateOutputFile(std::string_view sourceFile) {
+std::string CalculateOutputFile(std::string_view sourceFile, std::string_view outputExt = ".o") {
     constexpr std::string_view sourceExt = ".ka";
-    constexpr std::string_view outputExt = ".o";
 
     std::string outputFile{sourceFile};
     std::size_t pos = outputFile.find(sourceExt);
@@ -34,6 +36,24 @@ std::string CalculateOutputFile(std::string_view sourceFile) {
     return outputFile;
 }
 
+// the cache is used only if it was written for exactly this source
+std::unique_ptr<NKaleidoscope::NAst::TAstCache> LoadAstCache(const std::string& cacheFile,
+                                                            const NKaleidoscope::TSource& source)
+{
+    if (!sys::fs::exists(cacheFile)) {
+        return nullptr;
+    }
+    try {
+        auto cache = std::make_unique<NKaleidoscope::NAst::TAstCache>(cacheFile);
+        if (cache->Matches(source)) {
+            return cache;
+        }
+    } catch (const std::exception& e) {
+        errs() << "Ignoring AST cache: " << e.what() << "\n";
+    }
+    return nullptr;
+}
+
 } // namespace
 
 int main(int argc, char** argv) {
@@ -64,27 +84,101 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    // parse code from file
-    if (argc < 2) {
+    // parse code from file, "--jit" runs the top-level expressions instead of writing an object file,
+    // "--lazy-jit" does the same and compiles only the functions that are called,
+    // "--tiered-jit" compiles them quickly first and optimizes the hot ones
+    const bool jitMode = argc > 1 && std::string_view{argv[1]} == "--jit";
+    const bool lazyJitMode = argc > 1 && std::string_view{argv[1]} == "--lazy-jit";
+    const bool tieredJitMode = argc > 1 && std::string_view{argv[1]} == "--tiered-jit";
+    const int sourceArg = 1 + (jitMode || lazyJitMode || tieredJitMode);
+    if (argc <= sourceArg) {
         errs() << "Please write the name of the source file";
         return 1;
     }
 
-    const std::string sourceFile{argv[1]};
-    std::ifstream istr{sourceFile};
-    std::stringstream buffer;
-    buffer << istr.rdbuf();
-    const std::string sourceStr = buffer.str();
-
-    NKaleidoscope::TCodegenVisitor codegen{NKaleidoscope::EOptimizationLevel::High};
-    auto source = NKaleidoscope::TSource::FromString(sourceStr);
-    auto tokens = NKaleidoscope::LexTokens(source);
-    auto parser = NKaleidoscope::TParser{std::move(tokens)};
-    for (auto&& astNode : parser.ParseChunk()) {
-        astNode->Accept(codegen);
+    const std::string sourceFile{argv[sourceArg]};
+
+    NKaleidoscope::TSymbolTable symbols;
+    if (lazyJitMode || tieredJitMode) {
+        // the JIT generates the items from the AST on their first calls
+        auto source = NKaleidoscope::TSource::FromFile(sourceFile);
+        NKaleidoscope::NAst::TArena arena;
+        try {
+            auto astNodes = NKaleidoscope::TParser{source, &arena, &symbols}.ParseChunk();
+            NKaleidoscope::NAst::Simplify(astNodes, &arena);
+
+            const auto run = [&](auto& jit) {
+                std::vector<std::string> functions;
+                for (auto&& astNode : astNodes) {
+                    std::string name = jit.Add(*astNode);
+                    if (NKaleidoscope::NAst::IsExprKind(astNode->GetKind())) {
+                        functions.push_back(std::move(name));
+                    }
+                }
+                for (const std::string& function : functions) {
+                    outs() << format("%g\n", jit.Run(function));
+                }
+            };
+            if (tieredJitMode) {
+                NKaleidoscope::TTieredJit jit{NKaleidoscope::TTieredJit::DEFAULT_HOT_CALL_COUNT, &symbols};
+                run(jit);
+            } else {
+                NKaleidoscope::TLazyJit jit{NKaleidoscope::EOptimizationLevel::High, &symbols};
+                run(jit);
+            }
+        } catch (const std::exception& e) {
+            errs() << "JIT failed: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
     }
 
-    errs() << Print(codegen.GetFunction());
+    NKaleidoscope::TCodegenVisitor codegen{NKaleidoscope::EOptimizationLevel::High, &symbols};
+    if (jitMode) {
+        codegen.WrapTopLevelExprs();
+    }
+    auto source = NKaleidoscope::TSource::FromFile(sourceFile);
+    const std::string cacheFile = CalculateOutputFile(sourceFile, ".kast");
+    if (auto cache = LoadAstCache(cacheFile, source)) {
+        errs() << "Loaded AST cache \"" << cacheFile << "\"\n";
+        cache->BindSymbols(symbols);
+        codegen.Generate(*cache);
+    } else {
+        NKaleidoscope::NAst::TArena arena;
+        auto parser = NKaleidoscope::TParser{source, &arena, &symbols};
+        auto astNodes = parser.ParseChunk();
+        const std::size_t eliminated = NKaleidoscope::NAst::Simplify(astNodes, &arena);
+        errs() << "Simplified away " << eliminated << " AST nodes\n";
+        for (auto&& astNode : astNodes) {
+            codegen.Generate(*astNode);
+        }
+
+        try {
+            NKaleidoscope::NAst::WriteAstCache(NKaleidoscope::NAst::Flatten(astNodes), source, cacheFile);
+        } catch (const std::exception& e) {
+            errs() << "Could not write AST cache: " << e.what() << "\n";
+        }
+    }
+
+    if (const llvm::Function* function = codegen.GetFunction()) {
+        errs() << Print(function);
+    }
+
+    if (jitMode) {
+        try {
+            NKaleidoscope::TJit jit;
+            NKaleidoscope::TGeneratedModule module = codegen.ReleaseModule();
+            const std::vector<std::string> functions = std::move(module.TopLevelFunctions);
+            jit.AddModule(std::move(module));
+            for (const std::string& function : functions) {
+                outs() << format("%g\n", jit.Run(function));
+            }
+        } catch (const std::exception& e) {
+            errs() << "JIT failed: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
 
     const std::string filename = CalculateOutputFile(sourceFile);
     std::error_code errorCode;
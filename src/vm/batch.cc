@@ -0,0 +1,467 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "batch_kernels.h"
+#include "bytecode.h"
+
+namespace NKaleidoscope {
+
+namespace {
+
+using TColumn = std::vector<double>;
+
+// the function called by a call or a user operator, empty for the other nodes
+std::string GetCallee(const NAst::TExpr& expr) {
+    if (const auto* call = NAst::NodeCast<NAst::TCallExpr>(&expr)) {
+        return std::string{call->GetCallee().AsStringView()};
+    }
+    if (const auto* binary = NAst::NodeCast<NAst::TBinaryExpr>(&expr);
+        binary && binary->GetOp() == NAst::TBinaryExpr::EOp::User) {
+        return std::string{"binary"} + binary->GetUserOp();
+    }
+    return {};
+}
+
+// the arguments of a call or the operands of a user operator
+std::size_t GetArgCount(const NAst::TExpr& expr) {
+    if (const auto* call = NAst::NodeCast<NAst::TCallExpr>(&expr)) {
+        return call->GetArgs().size();
+    }
+    return 2;
+}
+
+const NAst::TExpr& GetArg(const NAst::TExpr& expr, std::size_t index) {
+    if (const auto* call = NAst::NodeCast<NAst::TCallExpr>(&expr)) {
+        return *call->GetArgs()[index];
+    }
+    const auto& binary = static_cast<const NAst::TBinaryExpr&>(expr);
+    return index == 0 ? binary.GetLhs() : binary.GetRhs();
+}
+
+// the rows where the condition is true (ordered and not 0, like the codegen) and the other ones
+void SplitRows(const TColumn& condition, std::vector<std::uint32_t>& thenRows, std::vector<std::uint32_t>& elseRows) {
+    thenRows.resize(condition.size());
+    elseRows.resize(condition.size());
+    std::size_t thenCount = 0;
+    std::size_t elseCount = 0;
+    for (std::size_t row = 0; row < condition.size(); ++row) {
+        const bool isTrue = condition[row] < 0.0 || condition[row] > 0.0;
+        thenRows[thenCount] = row;
+        elseRows[elseCount] = row;
+        thenCount += isTrue;
+        elseCount += !isTrue;
+    }
+    thenRows.resize(thenCount);
+    elseRows.resize(elseCount);
+}
+
+} // namespace
+
+// TBatchEvaluator::TImpl
+class TBatchEvaluator::TImpl {
+public:
+    explicit TImpl(const TNativeTable& natives)
+        : Natives_{natives}
+        , Kernels_{GetBatchKernels()}
+    {}
+
+    void Add(const NAst::TNode& item) {
+        if (NAst::IsExprKind(item.GetKind())) {
+            throw std::runtime_error("Expected a function or an extern");
+        }
+        // the compiler keeps nothing of a failed item, and the rest isn't touched before it succeeds
+        Compiler_.Generate(item);
+        Vm_.reset();
+
+        if (const auto* function = NAst::NodeCast<NAst::TFunction>(&item)) {
+            const NAst::TPrototype& prototype = function->GetPrototype();
+            TFunctionInfo& info = Functions_[std::string{prototype.GetName().AsStringView()}];
+            info.ArgCount = prototype.GetArgs().size();
+            for (const TSourceRange& arg : prototype.GetArgs()) {
+                info.Args.push_back(arg.AsStringView());
+            }
+            info.Body = &function->GetBody();
+        } else {
+            const auto& prototype = static_cast<const NAst::TPrototype&>(item);
+            Functions_.try_emplace(std::string{prototype.GetName().AsStringView()},
+                                   TFunctionInfo{.ArgCount = prototype.GetArgs().size()});
+        }
+    }
+
+    void Evaluate(std::string_view name, std::span<const std::span<const double>> args, std::span<double> results) {
+        Prepare();
+        const auto iter = Functions_.find(std::string{name});
+        if (iter == Functions_.end()) {
+            throw std::runtime_error("Unknown function \"" + std::string{name} + "\"");
+        }
+        const TFunctionInfo& function = iter->second;
+        if (args.size() != function.ArgCount) {
+            throw std::runtime_error("Incorrect number of arguments");
+        }
+        for (const std::span<const double> column : args) {
+            if (column.size() != results.size()) {
+                throw std::runtime_error("The columns have different sizes");
+            }
+        }
+
+        // a failed evaluation may leave its state behind
+        Scopes_.clear();
+        Values_.clear();
+        for (std::size_t begin = 0; begin < results.size(); begin += BATCH_SIZE) {
+            const std::size_t size = std::min(BATCH_SIZE, results.size() - begin);
+            TScope scope{.Function = &function, .Size = size};
+            for (const std::span<const double> column : args) {
+                scope.Args.push_back(column.data() + begin);
+            }
+            if (!function.Body || function.Recursive) {
+                EvaluateRows(function, scope.Args, size, results.data() + begin);
+                continue;
+            }
+
+            Scopes_.push_back(std::move(scope));
+            TColumn column = EvaluateExpr(*function.Body);
+            std::copy(column.begin(), column.end(), results.begin() + begin);
+            Release(std::move(column));
+            PopScope();
+        }
+    }
+
+private:
+    struct TFunctionInfo {
+        std::size_t ArgCount = 0;
+        std::vector<std::string_view> Args;
+        // nullptr for an extern
+        const NAst::TExpr* Body = nullptr;
+
+        // set by Prepare
+        std::vector<const TFunctionInfo*> Callees;
+        bool Recursive = false;
+        const TNativeFunction* Native = nullptr;
+        std::size_t VmFunction = 0;
+    };
+
+    // a function evaluated over Size rows, the arguments are columns
+    struct TScope {
+        const TFunctionInfo* Function = nullptr;
+        std::vector<const double*> Args;
+        // the gathered arguments
+        std::vector<TColumn> Owned;
+        std::size_t Size = 0;
+    };
+
+    // binds the externs and finds the recursive functions after the items are added
+    void Prepare() {
+        if (Vm_) {
+            return;
+        }
+        Vm_ = std::make_unique<TVm>(Compiler_.GetModule(), Natives_);
+        for (auto& [name, function] : Functions_) {
+            function.VmFunction = Vm_->FindFunction(name);
+            function.Native = function.Body ? nullptr : Natives_.Find(name);
+            function.Callees.clear();
+            if (!function.Body) {
+                continue;
+            }
+            std::vector<const NAst::TNode*> stack = {function.Body};
+            while (!stack.empty()) {
+                const auto& node = static_cast<const NAst::TExpr&>(*stack.back());
+                stack.pop_back();
+                if (const std::string callee = GetCallee(node); !callee.empty()) {
+                    function.Callees.push_back(&Functions_.at(callee));
+                }
+                for (std::size_t i = 0; i < NAst::GetChildCount(node); ++i) {
+                    stack.push_back(&NAst::GetChild(node, i));
+                }
+            }
+        }
+
+        // a function is recursive if it is reachable from its callees
+        for (auto& [name, function] : Functions_) {
+            std::vector<const TFunctionInfo*> stack = function.Callees;
+            std::unordered_set<const TFunctionInfo*> visited;
+            function.Recursive = false;
+            while (!stack.empty() && !function.Recursive) {
+                const TFunctionInfo* callee = stack.back();
+                stack.pop_back();
+                function.Recursive = callee == &function;
+                if (visited.insert(callee).second) {
+                    stack.insert(stack.end(), callee->Callees.begin(), callee->Callees.end());
+                }
+            }
+        }
+    }
+
+    // the fallback, one call per row
+    void EvaluateRows(const TFunctionInfo& function, const std::vector<const double*>& args, std::size_t size,
+                      double* results) {
+        RowArgs_.resize(args.size());
+        for (std::size_t row = 0; row < size; ++row) {
+            for (std::size_t i = 0; i < args.size(); ++i) {
+                RowArgs_[i] = args[i][row];
+            }
+            if (function.Native) {
+                results[row] = function.Native->Invoke(function.Native->Function, RowArgs_.data());
+            } else {
+                results[row] = Vm_->Call(function.VmFunction, RowArgs_);
+            }
+        }
+    }
+
+    // Evaluates the expression over the rows of the last scope. The AST is
+    // walked with an explicit stack like in the codegen, the values of the
+    // finished nodes are columns on the value stack.
+    TColumn EvaluateExpr(const NAst::TExpr& root) {
+        struct TFrame {
+            const NAst::TExpr* Expr;
+            std::size_t Scope;
+            std::size_t Stage = 0;
+            // the rows of the branches of an if and its value
+            std::vector<std::uint32_t> ThenRows = {};
+            std::vector<std::uint32_t> ElseRows = {};
+            TColumn Result = {};
+            const TFunctionInfo* Callee = nullptr;
+        };
+
+        std::vector<TFrame> frames = {TFrame{.Expr = &root, .Scope = Scopes_.size() - 1}};
+        while (!frames.empty()) {
+            TFrame& frame = frames.back();
+            const NAst::TExpr& expr = *frame.Expr;
+            const std::size_t size = Scopes_[frame.Scope].Size;
+            using enum NAst::ENodeKind;
+            switch (expr.GetKind()) {
+            case Number: {
+                TColumn column = Acquire(size);
+                std::fill(column.begin(), column.end(), static_cast<const NAst::TNumberExpr&>(expr).GetValue());
+                Values_.push_back(std::move(column));
+                frames.pop_back();
+                break;
+            }
+            case Variable: {
+                const TScope& scope = Scopes_[frame.Scope];
+                const std::string_view name = static_cast<const NAst::TVariableExpr&>(expr).GetName().AsStringView();
+                const auto& names = scope.Function->Args;
+                const std::size_t index = std::find(names.begin(), names.end(), name) - names.begin();
+                TColumn column = Acquire(size);
+                std::copy(scope.Args[index], scope.Args[index] + size, column.begin());
+                Values_.push_back(std::move(column));
+                frames.pop_back();
+                break;
+            }
+            case Binary: {
+                const auto& binary = static_cast<const NAst::TBinaryExpr&>(expr);
+                if (binary.GetOp() == NAst::TBinaryExpr::EOp::User) {
+                    EvaluateCall(frames);
+                } else if (frame.Stage == 0) {
+                    frame.Stage = 1;
+                    frames.push_back(TFrame{.Expr = &binary.GetLhs(), .Scope = frame.Scope});
+                } else if (frame.Stage == 1) {
+                    frame.Stage = 2;
+                    frames.push_back(TFrame{.Expr = &binary.GetRhs(), .Scope = frame.Scope});
+                } else {
+                    TColumn rhs = Pop();
+                    TColumn& lhs = Values_.back();
+                    GetKernel(binary.GetOp())(lhs.data(), rhs.data(), lhs.data(), size);
+                    Release(std::move(rhs));
+                    frames.pop_back();
+                }
+                break;
+            }
+            case If: {
+                const auto& ifExpr = static_cast<const NAst::TIfExpr&>(expr);
+                if (frame.Stage == 0) {
+                    frame.Stage = 1;
+                    frames.push_back(TFrame{.Expr = &ifExpr.GetCond(), .Scope = frame.Scope});
+                } else if (frame.Stage == 1) {
+                    TColumn condition = Pop();
+                    SplitRows(condition, frame.ThenRows, frame.ElseRows);
+                    Release(std::move(condition));
+                    if (frame.ThenRows.empty() || frame.ElseRows.empty()) {
+                        // all rows take one branch, its value is the value of the if
+                        const NAst::TExpr& branch = frame.ElseRows.empty() ? ifExpr.GetThen() : ifExpr.GetElse();
+                        frame.Stage = 4;
+                        frames.push_back(TFrame{.Expr = &branch, .Scope = frame.Scope});
+                    } else {
+                        frame.Result = Acquire(size);
+                        frame.Stage = 2;
+                        const std::size_t scope = PushGatheredScope(frame.Scope, frame.ThenRows);
+                        frames.push_back(TFrame{.Expr = &ifExpr.GetThen(), .Scope = scope});
+                    }
+                } else if (frame.Stage == 2) {
+                    Scatter(frame.ThenRows, frame.Result);
+                    frame.Stage = 3;
+                    const std::size_t scope = PushGatheredScope(frame.Scope, frame.ElseRows);
+                    frames.push_back(TFrame{.Expr = &ifExpr.GetElse(), .Scope = scope});
+                } else if (frame.Stage == 3) {
+                    Scatter(frame.ElseRows, frame.Result);
+                    Values_.push_back(std::move(frame.Result));
+                    frames.pop_back();
+                } else {
+                    frames.pop_back();
+                }
+                break;
+            }
+            case Call:
+                EvaluateCall(frames);
+                break;
+            case Prototype:
+            case Function:
+                throw std::runtime_error("Expected an expression");
+            }
+        }
+        return Pop();
+    }
+
+    // a call or a user operator: the arguments, then the body of the callee
+    // over the batch or the fallback per row
+    template <class TFrames>
+    void EvaluateCall(TFrames& frames) {
+        auto& frame = frames.back();
+        const NAst::TExpr& expr = *frame.Expr;
+        const std::size_t argCount = GetArgCount(expr);
+        if (frame.Stage == 0) {
+            frame.Callee = &Functions_.at(GetCallee(expr));
+        }
+        if (frame.Stage < argCount) {
+            const NAst::TExpr& arg = GetArg(expr, frame.Stage++);
+            frames.push_back({.Expr = &arg, .Scope = frame.Scope});
+            return;
+        }
+        if (frame.Stage > argCount) {
+            // the value of the body is the value of the call
+            PopScope();
+            frames.pop_back();
+            return;
+        }
+
+        const TFunctionInfo& callee = *frame.Callee;
+        TScope scope{.Function = &callee, .Size = Scopes_[frame.Scope].Size};
+        for (std::size_t i = Values_.size() - argCount; i < Values_.size(); ++i) {
+            scope.Args.push_back(Values_[i].data());
+            scope.Owned.push_back(std::move(Values_[i]));
+        }
+        Values_.resize(Values_.size() - argCount);
+
+        if (!callee.Body || callee.Recursive) {
+            TColumn result = Acquire(scope.Size);
+            EvaluateRows(callee, scope.Args, scope.Size, result.data());
+            for (TColumn& column : scope.Owned) {
+                Release(std::move(column));
+            }
+            Values_.push_back(std::move(result));
+            frames.pop_back();
+            return;
+        }
+        Scopes_.push_back(std::move(scope));
+        frame.Stage = argCount + 1;
+        frames.push_back({.Expr = callee.Body, .Scope = Scopes_.size() - 1});
+    }
+
+    // a scope with the arguments of another one at the given rows, for a branch of an if
+    std::size_t PushGatheredScope(std::size_t parent, const std::vector<std::uint32_t>& rows) {
+        TScope scope{.Function = Scopes_[parent].Function, .Size = rows.size()};
+        for (const double* arg : Scopes_[parent].Args) {
+            TColumn column = Acquire(rows.size());
+            for (std::size_t i = 0; i < rows.size(); ++i) {
+                column[i] = arg[rows[i]];
+            }
+            scope.Args.push_back(column.data());
+            scope.Owned.push_back(std::move(column));
+        }
+        Scopes_.push_back(std::move(scope));
+        return Scopes_.size() - 1;
+    }
+
+    // moves the value of a branch to its rows of the result and drops the scope of the branch
+    void Scatter(const std::vector<std::uint32_t>& rows, TColumn& result) {
+        TColumn value = Pop();
+        for (std::size_t i = 0; i < rows.size(); ++i) {
+            result[rows[i]] = value[i];
+        }
+        Release(std::move(value));
+        PopScope();
+    }
+
+    void PopScope() {
+        for (TColumn& column : Scopes_.back().Owned) {
+            Release(std::move(column));
+        }
+        Scopes_.pop_back();
+    }
+
+    decltype(TBatchKernels::Add) GetKernel(NAst::TBinaryExpr::EOp op) const {
+        using enum NAst::TBinaryExpr::EOp;
+        switch (op) {
+        case Less:
+            return Kernels_.Less;
+        case Plus:
+            return Kernels_.Add;
+        case Minus:
+            return Kernels_.Subtract;
+        case Multiply:
+        case User:
+            break;
+        }
+        return Kernels_.Multiply;
+    }
+
+    // the columns are reused, so a batch doesn't allocate after the first ones
+    TColumn Acquire(std::size_t size) {
+        TColumn column;
+        if (!FreeColumns_.empty()) {
+            column = std::move(FreeColumns_.back());
+            FreeColumns_.pop_back();
+        }
+        column.resize(size);
+        return column;
+    }
+
+    void Release(TColumn column) {
+        FreeColumns_.push_back(std::move(column));
+    }
+
+    TColumn Pop() {
+        TColumn column = std::move(Values_.back());
+        Values_.pop_back();
+        return column;
+    }
+
+private:
+    TNativeTable Natives_;
+    const TBatchKernels& Kernels_;
+
+    // the bytecode of the items for the fallback
+    TBytecodeCompiler Compiler_;
+    std::unique_ptr<TVm> Vm_;
+    std::unordered_map<std::string, TFunctionInfo> Functions_;
+
+    std::vector<TScope> Scopes_;
+    std::vector<TColumn> Values_;
+    std::vector<TColumn> FreeColumns_;
+    std::vector<double> RowArgs_;
+};
+
+// TBatchEvaluator
+TBatchEvaluator::TBatchEvaluator(const TNativeTable& natives)
+    : Impl_{std::make_unique<TImpl>(natives)}
+{
+}
+
+TBatchEvaluator::~TBatchEvaluator()
+{
+}
+
+void TBatchEvaluator::Add(const NAst::TNode& item) { Impl_->Add(item); }
+
+void TBatchEvaluator::Evaluate(std::string_view function, std::span<const std::span<const double>> args,
+                               std::span<double> results) {
+    Impl_->Evaluate(function, args, results);
+}
+
+} // namespace NKaleidoscope
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string_view>
+
+#include "ast.h"
+#include "noncopyable.h"
+#include "vm.h"
+
+namespace NKaleidoscope {
+
+// Evaluates a function over columns of rows, the way the expression engine of
+// a database does. The rows are split into batches, and the AST of the
+// function is walked once per batch: a binary operator runs a SIMD kernel over
+// whole columns, an if splits the rows by its condition and evaluates each
+// branch only for its rows. The calls of functions that aren't recursive are
+// evaluated over the batch too. The calls of the recursive functions and of
+// the externs fall back to one evaluation per row, on the bytecode VM or the
+// native function.
+class TBatchEvaluator : private TNonCopyable {
+public:
+    static constexpr std::size_t BATCH_SIZE = 2048;
+
+    explicit TBatchEvaluator(const TNativeTable& natives = TNativeTable::Math());
+    ~TBatchEvaluator();
+
+    // Registers a function or an extern, which should outlive the evaluator.
+    // Throws the errors of the codegen, a failed item isn't added.
+    void Add(const NAst::TNode& item);
+
+    // results[row] = function(args[0][row], args[1][row], ...)
+    void Evaluate(std::string_view function, std::span<const std::span<const double>> args,
+                  std::span<double> results);
+
+private:
+    class TImpl;
+    std::unique_ptr<TImpl> Impl_;
+};
+
+} // namespace NKaleidoscope
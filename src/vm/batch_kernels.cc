@@ -0,0 +1,180 @@
+#include "batch_kernels.h"
+
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KALEIDOSCOPE_BATCH_X86
+#include <immintrin.h>
+#endif
+
+namespace NKaleidoscope {
+
+namespace {
+
+// scalar kernels, also used for the tails of the SIMD kernels
+struct TAddScalar {
+    static double Apply(double lhs, double rhs) { return lhs + rhs; }
+};
+
+struct TSubtractScalar {
+    static double Apply(double lhs, double rhs) { return lhs - rhs; }
+};
+
+struct TMultiplyScalar {
+    static double Apply(double lhs, double rhs) { return lhs * rhs; }
+};
+
+struct TLessScalar {
+    static double Apply(double lhs, double rhs) { return !(lhs >= rhs) ? 1.0 : 0.0; }
+};
+
+template <class TOp>
+void ApplyScalar(const double* lhs, const double* rhs, double* result, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        result[i] = TOp::Apply(lhs[i], rhs[i]);
+    }
+}
+
+constexpr TBatchKernels SCALAR_KERNELS = {
+    .Add = ApplyScalar<TAddScalar>,
+    .Subtract = ApplyScalar<TSubtractScalar>,
+    .Multiply = ApplyScalar<TMultiplyScalar>,
+    .Less = ApplyScalar<TLessScalar>,
+};
+
+#ifdef KALEIDOSCOPE_BATCH_X86
+
+// SSE2
+struct TAddSse2 {
+    static __m128d Apply(__m128d lhs, __m128d rhs) { return _mm_add_pd(lhs, rhs); }
+    using TScalar = TAddScalar;
+};
+
+struct TSubtractSse2 {
+    static __m128d Apply(__m128d lhs, __m128d rhs) { return _mm_sub_pd(lhs, rhs); }
+    using TScalar = TSubtractScalar;
+};
+
+struct TMultiplySse2 {
+    static __m128d Apply(__m128d lhs, __m128d rhs) { return _mm_mul_pd(lhs, rhs); }
+    using TScalar = TMultiplyScalar;
+};
+
+struct TLessSse2 {
+    // "not greater or equal" is true for the unordered operands
+    static __m128d Apply(__m128d lhs, __m128d rhs) {
+        return _mm_and_pd(_mm_cmpnge_pd(lhs, rhs), _mm_set1_pd(1.0));
+    }
+    using TScalar = TLessScalar;
+};
+
+template <class TOp>
+void ApplySse2(const double* lhs, const double* rhs, double* result, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(result + i, TOp::Apply(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+    }
+    ApplyScalar<typename TOp::TScalar>(lhs + i, rhs + i, result + i, count - i);
+}
+
+constexpr TBatchKernels SSE2_KERNELS = {
+    .Add = ApplySse2<TAddSse2>,
+    .Subtract = ApplySse2<TSubtractSse2>,
+    .Multiply = ApplySse2<TMultiplySse2>,
+    .Less = ApplySse2<TLessSse2>,
+};
+
+// AVX2
+#define KALEIDOSCOPE_AVX2 __attribute__((target("avx2")))
+
+struct TAddAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256d Apply(__m256d lhs, __m256d rhs) { return _mm256_add_pd(lhs, rhs); }
+    using TScalar = TAddScalar;
+};
+
+struct TSubtractAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256d Apply(__m256d lhs, __m256d rhs) { return _mm256_sub_pd(lhs, rhs); }
+    using TScalar = TSubtractScalar;
+};
+
+struct TMultiplyAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256d Apply(__m256d lhs, __m256d rhs) { return _mm256_mul_pd(lhs, rhs); }
+    using TScalar = TMultiplyScalar;
+};
+
+struct TLessAvx2 {
+    KALEIDOSCOPE_AVX2 static __m256d Apply(__m256d lhs, __m256d rhs) {
+        return _mm256_and_pd(_mm256_cmp_pd(lhs, rhs, _CMP_NGE_UQ), _mm256_set1_pd(1.0));
+    }
+    using TScalar = TLessScalar;
+};
+
+template <class TOp>
+KALEIDOSCOPE_AVX2 void ApplyAvx2(const double* lhs, const double* rhs, double* result, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(result + i, TOp::Apply(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+    }
+    ApplyScalar<typename TOp::TScalar>(lhs + i, rhs + i, result + i, count - i);
+}
+
+constexpr TBatchKernels AVX2_KERNELS = {
+    .Add = ApplyAvx2<TAddAvx2>,
+    .Subtract = ApplyAvx2<TSubtractAvx2>,
+    .Multiply = ApplyAvx2<TMultiplyAvx2>,
+    .Less = ApplyAvx2<TLessAvx2>,
+};
+
+#undef KALEIDOSCOPE_AVX2
+
+#endif // KALEIDOSCOPE_BATCH_X86
+
+} // namespace
+
+EBatchBackend DetectBatchBackend() {
+    if (IsBatchBackendSupported(EBatchBackend::Avx2)) {
+        return EBatchBackend::Avx2;
+    }
+    if (IsBatchBackendSupported(EBatchBackend::Sse2)) {
+        return EBatchBackend::Sse2;
+    }
+    return EBatchBackend::Scalar;
+}
+
+bool IsBatchBackendSupported(EBatchBackend backend) {
+    switch (backend) {
+    case EBatchBackend::Scalar:
+        return true;
+#ifdef KALEIDOSCOPE_BATCH_X86
+    case EBatchBackend::Sse2:
+        return __builtin_cpu_supports("sse2");
+    case EBatchBackend::Avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const TBatchKernels& GetBatchKernels(EBatchBackend backend) {
+    if (!IsBatchBackendSupported(backend)) {
+        throw std::runtime_error("Batch backend is not supported by the CPU");
+    }
+    switch (backend) {
+#ifdef KALEIDOSCOPE_BATCH_X86
+    case EBatchBackend::Sse2:
+        return SSE2_KERNELS;
+    case EBatchBackend::Avx2:
+        return AVX2_KERNELS;
+#endif
+    default:
+        return SCALAR_KERNELS;
+    }
+}
+
+const TBatchKernels& GetBatchKernels() {
+    static const TBatchKernels& kernels = GetBatchKernels(DetectBatchBackend());
+    return kernels;
+}
+
+} // namespace NKaleidoscope
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+namespace NKaleidoscope {
+
+// SIMD kernels of the batch evaluator, result[i] = lhs[i] op rhs[i] for i < count,
+// the result may be one of the operands
+struct TBatchKernels {
+    void (*Add)(const double* lhs, const double* rhs, double* result, std::size_t count);
+    void (*Subtract)(const double* lhs, const double* rhs, double* result, std::size_t count);
+    void (*Multiply)(const double* lhs, const double* rhs, double* result, std::size_t count);
+    // 1 if lhs < rhs or they are unordered, else 0, like the codegen
+    void (*Less)(const double* lhs, const double* rhs, double* result, std::size_t count);
+};
+
+enum struct EBatchBackend {
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+// the best backend supported by the CPU
+EBatchBackend DetectBatchBackend();
+
+bool IsBatchBackendSupported(EBatchBackend backend);
+const TBatchKernels& GetBatchKernels(EBatchBackend backend);
+
+// kernels of the detected backend, selected once
+const TBatchKernels& GetBatchKernels();
+
+} // namespace NKaleidoscope
@@ -0,0 +1,326 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace NKaleidoscope {
+
+namespace {
+
+constexpr std::size_t MAX_OPERAND = std::numeric_limits<std::uint16_t>::max();
+
+std::uint16_t ToOperand(std::size_t value, const char* what) {
+    if (value > MAX_OPERAND) {
+        throw std::runtime_error(std::string{"Too many "} + what + " for the bytecode");
+    }
+    return static_cast<std::uint16_t>(value);
+}
+
+} // namespace
+
+void TBytecodeCompiler::Visit(const NAst::TNumberExpr& numberExpr) { CompileTopLevelExpr(numberExpr); }
+void TBytecodeCompiler::Visit(const NAst::TVariableExpr& variableExpr) { CompileTopLevelExpr(variableExpr); }
+void TBytecodeCompiler::Visit(const NAst::TBinaryExpr& binaryExpr) { CompileTopLevelExpr(binaryExpr); }
+void TBytecodeCompiler::Visit(const NAst::TIfExpr& ifExpr) { CompileTopLevelExpr(ifExpr); }
+void TBytecodeCompiler::Visit(const NAst::TCallExpr& callExpr) { CompileTopLevelExpr(callExpr); }
+
+void TBytecodeCompiler::Visit(const NAst::TPrototype& prototype) {
+    Declare(prototype.GetName().AsStringView(), prototype.GetArgs().size());
+}
+
+void TBytecodeCompiler::Visit(const NAst::TFunction& function) {
+    const NAst::TPrototype& prototype = function.GetPrototype();
+    const std::string_view name = prototype.GetName().AsStringView();
+    const bool isDeclared = FunctionIndices_.contains(std::string{name});
+    const std::size_t index = Declare(name, prototype.GetArgs().size());
+    if (!Module_.Functions[index].Code.empty()) {
+        throw std::runtime_error("Can't redefine function \"" + std::string{name} + "\"");
+    }
+    if (Module_.Functions[index].ArgCount != prototype.GetArgs().size()) {
+        throw std::runtime_error("Incorrect number of arguments");
+    }
+    std::vector<std::string_view> args;
+    for (const TSourceRange& arg : prototype.GetArgs()) {
+        args.push_back(arg.AsStringView());
+    }
+    try {
+        CompileFunction(index, std::move(args), function.GetBody());
+    } catch (...) {
+        // a function without an earlier extern leaves no declaration behind,
+        // the VM would look for it among the natives otherwise
+        if (!isDeclared) {
+            Module_.Functions.pop_back();
+            FunctionIndices_.erase(std::string{name});
+        }
+        throw;
+    }
+}
+
+void TBytecodeCompiler::Generate(const NAst::TNode& node) {
+    NAst::Visit(node, [this](const auto& concrete) { Visit(concrete); });
+}
+
+const TBytecodeModule& TBytecodeCompiler::GetModule() const { return Module_; }
+
+TBytecodeModule TBytecodeCompiler::ReleaseModule() {
+    FunctionIndices_.clear();
+    return std::exchange(Module_, {});
+}
+
+void TBytecodeCompiler::CompileTopLevelExpr(const NAst::TExpr& expr) {
+    const std::string name = "__anon_expr" + std::to_string(TopLevelExprCount_++);
+    const std::size_t index = Declare(name, 0);
+    try {
+        CompileFunction(index, {}, expr);
+    } catch (...) {
+        // the failed expression leaves no function behind
+        Module_.Functions.pop_back();
+        FunctionIndices_.erase(name);
+        throw;
+    }
+    Module_.TopLevelFunctions.push_back(name);
+}
+
+std::size_t TBytecodeCompiler::Declare(std::string_view name, std::size_t argCount) {
+    auto [iter, inserted] = FunctionIndices_.try_emplace(std::string{name}, Module_.Functions.size());
+    if (inserted) {
+        ToOperand(Module_.Functions.size(), "functions");
+        Module_.Functions.push_back(TBytecodeFunction{
+            .Name = iter->first,
+            .ArgCount = ToOperand(argCount, "arguments"),
+        });
+    }
+    return iter->second;
+}
+
+void TBytecodeCompiler::CompileFunction(std::size_t index, std::vector<std::string_view> args,
+                                        const NAst::TExpr& body) {
+    // the function is changed only if its body compiles
+    TBytecodeFunction function{.Name = Module_.Functions[index].Name};
+    function.ArgCount = ToOperand(args.size(), "arguments");
+    function.RegisterCount = function.ArgCount;
+    Function_ = &function;
+    Args_ = std::move(args);
+    ConstantIndices_.clear();
+    Top_ = function.ArgCount;
+
+    const std::uint16_t result = CompileExpr(body);
+    function.Code.push_back(TInstruction{.Op = EOpCode::Return, .A = result});
+    Function_ = nullptr;
+    Module_.Functions[index] = std::move(function);
+}
+
+// The expression is compiled in post-order with an explicit stack, like the
+// codegen does. An expression puts its value into the first free register,
+// the Base of its frame, and the registers after it are free again; only
+// the arguments are read from their own registers. So the arguments of a
+// call end up in consecutive registers.
+std::uint16_t TBytecodeCompiler::CompileExpr(const NAst::TExpr& root) {
+    struct TFrame {
+        const NAst::TExpr* Expr;
+        std::size_t Stage = 0;
+        std::uint16_t Base = 0;
+        std::uint16_t Lhs = 0;
+        // the jump to patch when the current branch of an if ends
+        std::size_t Jump = 0;
+        std::size_t Callee = 0;
+    };
+
+    std::vector<TFrame> frames = {TFrame{.Expr = &root, .Base = Top_}};
+    std::vector<TInstruction>& code = Function_->Code;
+    // the register of the last finished expression
+    std::uint16_t result = 0;
+    const auto push = [&](const NAst::TExpr& expr) {
+        frames.push_back(TFrame{.Expr = &expr, .Base = Top_});
+    };
+    const auto finish = [&](std::uint16_t value) {
+        result = value;
+        Top_ = std::max<std::uint16_t>(frames.back().Base, value + 1);
+        frames.pop_back();
+    };
+    // moves the last value to an argument of a call
+    const auto placeArg = [&](std::size_t target) {
+        EmitMove(ToOperand(target, "registers"), result);
+        Top_ = ToOperand(target + 1, "registers");
+    };
+    // the arguments are placed already
+    const auto emitCall = [&](const TFrame& frame) {
+        Top_ = frame.Base;
+        const std::uint16_t target = AllocateRegister();
+        code.push_back(TInstruction{
+            .Op = EOpCode::Call,
+            .A = target,
+            .B = static_cast<std::uint16_t>(frame.Callee),
+            .C = frame.Base,
+        });
+        finish(target);
+    };
+
+    while (!frames.empty()) {
+        TFrame& frame = frames.back();
+        const NAst::TExpr& expr = *frame.Expr;
+        using enum NAst::ENodeKind;
+        switch (expr.GetKind()) {
+        case Number: {
+            const std::uint16_t target = AllocateRegister();
+            const double value = static_cast<const NAst::TNumberExpr&>(expr).GetValue();
+            code.push_back(TInstruction{.Op = EOpCode::Constant, .A = target, .B = AddConstant(value)});
+            finish(target);
+            break;
+        }
+        case Variable: {
+            const std::string_view name = static_cast<const NAst::TVariableExpr&>(expr).GetName().AsStringView();
+            const auto iter = std::find(Args_.begin(), Args_.end(), name);
+            if (iter == Args_.end()) {
+                throw std::runtime_error("Expected known named value, found \"" + std::string{name} + "\"");
+            }
+            finish(static_cast<std::uint16_t>(iter - Args_.begin()));
+            break;
+        }
+        case Binary: {
+            const auto& binary = static_cast<const NAst::TBinaryExpr&>(expr);
+            const bool isUser = binary.GetOp() == NAst::TBinaryExpr::EOp::User;
+            if (frame.Stage == 0) {
+                if (isUser) {
+                    frame.Callee = LookupCallee(std::string{"binary"} + binary.GetUserOp(), 2);
+                }
+                frame.Stage = 1;
+                push(binary.GetLhs());
+            } else if (frame.Stage == 1) {
+                // a user operator is a call, its operands are the arguments
+                if (isUser) {
+                    placeArg(frame.Base);
+                }
+                frame.Lhs = result;
+                frame.Stage = 2;
+                push(binary.GetRhs());
+            } else if (isUser) {
+                placeArg(frame.Base + 1);
+                emitCall(frame);
+            } else {
+                const std::uint16_t rhs = result;
+                Top_ = frame.Base;
+                const std::uint16_t target = AllocateRegister();
+                using enum NAst::TBinaryExpr::EOp;
+                EOpCode op = EOpCode::Add;
+                switch (binary.GetOp()) {
+                case Less:
+                    op = EOpCode::Less;
+                    break;
+                case Plus:
+                    op = EOpCode::Add;
+                    break;
+                case Minus:
+                    op = EOpCode::Subtract;
+                    break;
+                case Multiply:
+                    op = EOpCode::Multiply;
+                    break;
+                case User:
+                    break;
+                }
+                code.push_back(TInstruction{.Op = op, .A = target, .B = frame.Lhs, .C = rhs});
+                finish(target);
+            }
+            break;
+        }
+        case If: {
+            // both branches put their values into the Base register
+            const auto& ifExpr = static_cast<const NAst::TIfExpr&>(expr);
+            if (frame.Stage == 0) {
+                frame.Stage = 1;
+                push(ifExpr.GetCond());
+            } else if (frame.Stage == 1) {
+                frame.Jump = code.size();
+                code.push_back(TInstruction{.Op = EOpCode::JumpIfFalse, .A = result});
+                Top_ = frame.Base;
+                frame.Stage = 2;
+                push(ifExpr.GetThen());
+            } else if (frame.Stage == 2) {
+                EmitMove(frame.Base, result);
+                const std::size_t jumpOverElse = code.size();
+                code.push_back(TInstruction{.Op = EOpCode::Jump});
+                PatchJump(frame.Jump);
+                frame.Jump = jumpOverElse;
+                Top_ = frame.Base;
+                frame.Stage = 3;
+                push(ifExpr.GetElse());
+            } else {
+                EmitMove(frame.Base, result);
+                PatchJump(frame.Jump);
+                finish(frame.Base);
+            }
+            break;
+        }
+        case Call: {
+            const auto& call = static_cast<const NAst::TCallExpr&>(expr);
+            const std::size_t argCount = call.GetArgs().size();
+            if (frame.Stage == 0) {
+                frame.Callee = LookupCallee(call.GetCallee().AsStringView(), argCount);
+            } else {
+                placeArg(frame.Base + frame.Stage - 1);
+            }
+            if (frame.Stage < argCount) {
+                const NAst::TExpr& arg = *call.GetArgs()[frame.Stage++];
+                push(arg);
+                break;
+            }
+            emitCall(frame);
+            break;
+        }
+        case Prototype:
+        case Function:
+            throw std::runtime_error("Expected an expression");
+        }
+    }
+    return result;
+}
+
+std::size_t TBytecodeCompiler::LookupCallee(std::string_view name, std::size_t argCount) const {
+    const auto iter = FunctionIndices_.find(std::string{name});
+    if (iter == FunctionIndices_.end()) {
+        throw std::runtime_error("Unknown function \"" + std::string{name} + "\"");
+    }
+    if (Module_.Functions[iter->second].ArgCount != argCount) {
+        throw std::runtime_error("Incorrect number of arguments");
+    }
+    return iter->second;
+}
+
+std::uint16_t TBytecodeCompiler::AllocateRegister() {
+    const std::uint16_t result = Top_;
+    Top_ = ToOperand(std::size_t{Top_} + 1, "registers");
+    Function_->RegisterCount = std::max(Function_->RegisterCount, Top_);
+    return result;
+}
+
+std::uint16_t TBytecodeCompiler::AddConstant(double value) {
+    auto [iter, inserted] = ConstantIndices_.try_emplace(std::bit_cast<std::uint64_t>(value),
+                                                         ToOperand(Function_->Constants.size(), "constants"));
+    if (inserted) {
+        Function_->Constants.push_back(value);
+    }
+    return iter->second;
+}
+
+void TBytecodeCompiler::EmitMove(std::uint16_t target, std::uint16_t source) {
+    Function_->RegisterCount = std::max<std::uint16_t>(Function_->RegisterCount,
+                                                       ToOperand(std::size_t{target} + 1, "registers"));
+    if (target != source) {
+        Function_->Code.push_back(TInstruction{.Op = EOpCode::Move, .A = target, .B = source});
+    }
+}
+
+void TBytecodeCompiler::PatchJump(std::size_t from) {
+    const std::size_t distance = Function_->Code.size() - from;
+    if (distance > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("Too many instructions in a branch for the bytecode");
+    }
+    Function_->Code[from].B = static_cast<std::uint16_t>(distance);
+    Function_->Code[from].C = static_cast<std::uint16_t>(distance >> 16);
+}
+
+} // namespace NKaleidoscope
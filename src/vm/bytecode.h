@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "noncopyable.h"
+
+namespace NKaleidoscope {
+
+// Instructions of the bytecode work on the registers of the current call, the
+// arguments are the first registers of a function. A, B and C are the operands.
+enum struct EOpCode : std::uint8_t {
+    // A = Constants[B]
+    Constant,
+    // A = B
+    Move,
+    // A = B op C
+    Add,
+    Subtract,
+    Multiply,
+    // A = 1 if B < C or they are unordered, else 0
+    Less,
+    // skips B + (C << 16) instructions forward
+    Jump,
+    // skips B + (C << 16) instructions forward if A is 0 or NaN
+    JumpIfFalse,
+    // A = Functions[B](C, C + 1, ...), the arguments are in consecutive registers
+    Call,
+    // A = Natives[B](C, C + 1, ...), made of Call by the VM for the externs
+    CallNative,
+    // returns A
+    Return,
+};
+
+inline constexpr std::size_t OP_CODE_COUNT = static_cast<std::size_t>(EOpCode::Return) + 1;
+
+struct TInstruction {
+    EOpCode Op;
+    std::uint16_t A = 0;
+    std::uint16_t B = 0;
+    std::uint16_t C = 0;
+};
+
+static_assert(sizeof(TInstruction) == 8);
+
+inline std::uint32_t GetJumpDistance(const TInstruction& instruction) {
+    return instruction.B | std::uint32_t{instruction.C} << 16;
+}
+
+// a function without code is an extern
+struct TBytecodeFunction {
+    std::string Name;
+    std::uint16_t ArgCount = 0;
+    std::uint16_t RegisterCount = 0;
+    std::vector<TInstruction> Code;
+    std::vector<double> Constants;
+};
+
+struct TBytecodeModule {
+    // the calls refer to the functions by their indices
+    std::vector<TBytecodeFunction> Functions;
+    // the functions of the top-level expressions in source order
+    std::vector<std::string> TopLevelFunctions;
+};
+
+// Lowers the AST to the register bytecode. Every top-level expression becomes
+// a function "__anon_exprN" without arguments, like with
+// TCodegenVisitor::WrapTopLevelExprs. The errors are the ones of the codegen.
+class TBytecodeCompiler : public NAst::IVisitor, private TNonCopyable {
+public:
+    // any expression is compiled as a top-level one
+    void Visit(const NAst::TNumberExpr&) override;
+    void Visit(const NAst::TVariableExpr&) override;
+    void Visit(const NAst::TBinaryExpr&) override;
+    void Visit(const NAst::TIfExpr&) override;
+    void Visit(const NAst::TCallExpr&) override;
+    void Visit(const NAst::TPrototype&) override;
+    void Visit(const NAst::TFunction&) override;
+
+    void Generate(const NAst::TNode& node);
+
+    const TBytecodeModule& GetModule() const;
+    TBytecodeModule ReleaseModule();
+
+private:
+    void CompileTopLevelExpr(const NAst::TExpr& expr);
+    std::size_t Declare(std::string_view name, std::size_t argCount);
+    void CompileFunction(std::size_t index, std::vector<std::string_view> args, const NAst::TExpr& body);
+
+    // the register with the value of the expression
+    std::uint16_t CompileExpr(const NAst::TExpr& root);
+    std::size_t LookupCallee(std::string_view name, std::size_t argCount) const;
+    std::uint16_t AllocateRegister();
+    std::uint16_t AddConstant(double value);
+    void EmitMove(std::uint16_t target, std::uint16_t source);
+    // points the jump at `from` to the next instruction
+    void PatchJump(std::size_t from);
+
+private:
+    TBytecodeModule Module_;
+    std::unordered_map<std::string, std::size_t> FunctionIndices_;
+    std::size_t TopLevelExprCount_ = 0;
+
+    // the function being compiled
+    TBytecodeFunction* Function_ = nullptr;
+    std::vector<std::string_view> Args_;
+    std::unordered_map<std::uint64_t, std::uint16_t> ConstantIndices_;
+    // the registers from Top_ on are free
+    std::uint16_t Top_ = 0;
+};
+
+} // namespace NKaleidoscope
@@ -0,0 +1,217 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace NKaleidoscope {
+
+// TNativeTable
+const TNativeFunction* TNativeTable::Find(std::string_view name) const {
+    const auto iter = Functions_.find(std::string{name});
+    return iter != Functions_.end() ? &iter->second : nullptr;
+}
+
+TNativeTable TNativeTable::Math() {
+    TNativeTable table;
+    table.Add("sin", static_cast<double (*)(double)>(&std::sin));
+    table.Add("cos", static_cast<double (*)(double)>(&std::cos));
+    table.Add("tan", static_cast<double (*)(double)>(&std::tan));
+    table.Add("atan2", static_cast<double (*)(double, double)>(&std::atan2));
+    table.Add("exp", static_cast<double (*)(double)>(&std::exp));
+    table.Add("log", static_cast<double (*)(double)>(&std::log));
+    table.Add("pow", static_cast<double (*)(double, double)>(&std::pow));
+    table.Add("sqrt", static_cast<double (*)(double)>(&std::sqrt));
+    table.Add("fabs", static_cast<double (*)(double)>(&std::fabs));
+    table.Add("floor", static_cast<double (*)(double)>(&std::floor));
+    table.Add("ceil", static_cast<double (*)(double)>(&std::ceil));
+    table.Add("fmod", static_cast<double (*)(double, double)>(&std::fmod));
+    return table;
+}
+
+// TVm
+TVm::TVm(const TBytecodeModule& module, const TNativeTable& natives) {
+    // the code of all functions goes into one array
+    for (const TBytecodeFunction& function : module.Functions) {
+        TFunction& linked = Functions_.emplace_back(TFunction{
+            .ArgCount = function.ArgCount,
+            .RegisterCount = function.RegisterCount,
+            .CodeOffset = Code_.size(),
+            .ConstantsOffset = Constants_.size(),
+        });
+        FunctionIndices_.emplace(function.Name, Functions_.size() - 1);
+        if (!function.Code.empty()) {
+            Code_.insert(Code_.end(), function.Code.begin(), function.Code.end());
+            Constants_.insert(Constants_.end(), function.Constants.begin(), function.Constants.end());
+            continue;
+        }
+
+        const TNativeFunction* native = natives.Find(function.Name);
+        if (!native) {
+            throw std::runtime_error("Unknown function \"" + function.Name + "\"");
+        }
+        if (native->ArgCount != function.ArgCount) {
+            throw std::runtime_error("Incorrect number of arguments");
+        }
+        linked.Native = Natives_.size();
+        Natives_.push_back(*native);
+    }
+
+    for (TInstruction& instruction : Code_) {
+        if (instruction.Op == EOpCode::Call) {
+            if (const auto native = Functions_[instruction.B].Native) {
+                instruction.Op = EOpCode::CallNative;
+                instruction.B = static_cast<std::uint16_t>(*native);
+            }
+        }
+    }
+}
+
+double TVm::Call(std::string_view name, std::span<const double> args) {
+    return Call(FindFunction(name), args);
+}
+
+double TVm::Call(std::size_t index, std::span<const double> args) {
+    const TFunction& function = Functions_.at(index);
+    if (function.ArgCount != args.size()) {
+        throw std::runtime_error("Incorrect number of arguments");
+    }
+    if (function.Native) {
+        const TNativeFunction& native = Natives_[*function.Native];
+        return native.Invoke(native.Function, args.data());
+    }
+
+    Frames_.clear();
+    if (Registers_.size() < function.RegisterCount) {
+        Registers_.resize(function.RegisterCount);
+    }
+    std::copy(args.begin(), args.end(), Registers_.begin());
+    return Execute(function);
+}
+
+std::size_t TVm::FindFunction(std::string_view name) const {
+    const auto iter = FunctionIndices_.find(std::string{name});
+    if (iter == FunctionIndices_.end()) {
+        throw std::runtime_error("Unknown function \"" + std::string{name} + "\"");
+    }
+    return iter->second;
+}
+
+double TVm::Run(std::string_view name) {
+    return Call(name);
+}
+
+double TVm::Execute(const TFunction& function) {
+    // the handlers in the order of EOpCode
+    static void* const HANDLERS[] = {
+        &&Constant,
+        &&Move,
+        &&Add,
+        &&Subtract,
+        &&Multiply,
+        &&Less,
+        &&Jump,
+        &&JumpIfFalse,
+        &&Call,
+        &&CallNative,
+        &&Return,
+    };
+    static_assert(sizeof(HANDLERS) / sizeof(HANDLERS[0]) == OP_CODE_COUNT);
+
+    const TInstruction* ip = Code_.data() + function.CodeOffset;
+    const double* constants = Constants_.data() + function.ConstantsOffset;
+    std::size_t base = 0;
+    double* registers = Registers_.data();
+
+#define KALEIDOSCOPE_VM_DISPATCH() goto* HANDLERS[static_cast<std::size_t>(ip->Op)]
+
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Constant:
+    registers[ip->A] = constants[ip->B];
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Move:
+    registers[ip->A] = registers[ip->B];
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Add:
+    registers[ip->A] = registers[ip->B] + registers[ip->C];
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Subtract:
+    registers[ip->A] = registers[ip->B] - registers[ip->C];
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Multiply:
+    registers[ip->A] = registers[ip->B] * registers[ip->C];
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Less:
+    // unordered or less, like the codegen
+    registers[ip->A] = !(registers[ip->B] >= registers[ip->C]) ? 1.0 : 0.0;
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Jump:
+    ip += GetJumpDistance(*ip);
+    KALEIDOSCOPE_VM_DISPATCH();
+
+JumpIfFalse:
+    // true is ordered and not equal to 0, like the codegen
+    if (registers[ip->A] < 0.0 || registers[ip->A] > 0.0) {
+        ++ip;
+    } else {
+        ip += GetJumpDistance(*ip);
+    }
+    KALEIDOSCOPE_VM_DISPATCH();
+
+Call: {
+    // the arguments are the first registers of the callee
+    const TFunction& callee = Functions_[ip->B];
+    if (Frames_.size() == MAX_CALL_DEPTH) {
+        throw std::runtime_error("Calls nest too deep");
+    }
+    Frames_.push_back(TFrame{.ReturnTo = ip, .Constants = constants, .Base = base});
+    base += ip->C;
+    if (base + callee.RegisterCount > Registers_.size()) {
+        Registers_.resize(std::max(2 * Registers_.size(), base + callee.RegisterCount));
+    }
+    registers = Registers_.data() + base;
+    ip = Code_.data() + callee.CodeOffset;
+    constants = Constants_.data() + callee.ConstantsOffset;
+    KALEIDOSCOPE_VM_DISPATCH();
+}
+
+CallNative: {
+    const TNativeFunction& native = Natives_[ip->B];
+    registers[ip->A] = native.Invoke(native.Function, registers + ip->C);
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+}
+
+Return: {
+    const double result = registers[ip->A];
+    if (Frames_.empty()) {
+        return result;
+    }
+    const TFrame& frame = Frames_.back();
+    ip = frame.ReturnTo;
+    constants = frame.Constants;
+    base = frame.Base;
+    Frames_.pop_back();
+    registers = Registers_.data() + base;
+    registers[ip->A] = result;
+    ++ip;
+    KALEIDOSCOPE_VM_DISPATCH();
+}
+
+#undef KALEIDOSCOPE_VM_DISPATCH
+}
+
+} // namespace NKaleidoscope
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+#include "noncopyable.h"
+
+namespace NKaleidoscope {
+
+// a host function of doubles, called with the arguments in consecutive registers
+struct TNativeFunction {
+    std::size_t ArgCount = 0;
+    void (*Function)() = nullptr;
+    double (*Invoke)(void (*function)(), const double* args) = nullptr;
+};
+
+// the host functions the externs of a module are bound to
+class TNativeTable {
+public:
+    template <class... TArgs>
+        requires (std::is_same_v<TArgs, double> && ...)
+    void Add(std::string name, double (*function)(TArgs...)) {
+        Functions_[std::move(name)] = TNativeFunction{
+            .ArgCount = sizeof...(TArgs),
+            .Function = reinterpret_cast<void (*)()>(function),
+            .Invoke = &Invoke<sizeof...(TArgs)>,
+        };
+    }
+
+    // nullptr if there is no such function
+    const TNativeFunction* Find(std::string_view name) const;
+
+    // the functions of libm: sin, cos, tan, atan2, exp, log, pow, sqrt, fabs, floor, ceil and fmod
+    static TNativeTable Math();
+
+private:
+    template <std::size_t>
+    using TDouble = double;
+
+    template <std::size_t ArgCount>
+    static double Invoke(void (*function)(), const double* args) {
+        return [&]<std::size_t... I>(std::index_sequence<I...>) {
+            using TFunction = double (*)(TDouble<I>...);
+            return reinterpret_cast<TFunction>(function)(args[I]...);
+        }(std::make_index_sequence<ArgCount>{});
+    }
+
+private:
+    std::unordered_map<std::string, TNativeFunction> Functions_;
+};
+
+// Runs a bytecode module with a threaded-code interpreter: every instruction
+// jumps straight to the handler of the next one through a table of label
+// addresses. The externs are bound to the native table when the module is
+// loaded, their calls become CallNative. Not thread-safe, a thread should
+// have a VM of its own.
+class TVm : private TNonCopyable {
+public:
+    static constexpr std::size_t MAX_CALL_DEPTH = 1 << 20;
+
+    // throws if an extern isn't in the native table or takes other arguments
+    TVm(const TBytecodeModule& module, const TNativeTable& natives = TNativeTable::Math());
+
+    // throws if there is no such function or the calls nest deeper than MAX_CALL_DEPTH
+    double Call(std::string_view name, std::span<const double> args = {});
+    double Call(std::size_t function, std::span<const double> args);
+
+    // the index of a function for Call, throws if there is no such function
+    std::size_t FindFunction(std::string_view name) const;
+
+    // calls a function "double name()", e.g. a top-level expression
+    double Run(std::string_view name);
+
+private:
+    // a bytecode function or a native one
+    struct TFunction {
+        std::size_t ArgCount = 0;
+        std::size_t RegisterCount = 0;
+        std::size_t CodeOffset = 0;
+        std::size_t ConstantsOffset = 0;
+        std::optional<std::size_t> Native;
+    };
+
+    // where a call returns to
+    struct TFrame {
+        const TInstruction* ReturnTo;
+        const double* Constants;
+        std::size_t Base;
+    };
+
+    double Execute(const TFunction& function);
+
+private:
+    std::vector<TInstruction> Code_;
+    std::vector<double> Constants_;
+    std::vector<TFunction> Functions_;
+    // the natives are copied, the table may go away
+    std::vector<TNativeFunction> Natives_;
+    std::unordered_map<std::string, std::size_t> FunctionIndices_;
+
+    std::vector<double> Registers_;
+    std::vector<TFrame> Frames_;
+};
+
+} // namespace NKaleidoscope
@@ -0,0 +1,144 @@
+#include <benchmark/benchmark.h>
+#include "batch.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "parser.h"
+#include "vm.h"
+
+using namespace NKaleidoscope;
+
+namespace {
+
+const std::string FIB_FILE = EXAMPLE_DIR "/fib.ka";
+
+// the engines to compare
+enum struct EEngine {
+    Vm,
+    Jit,
+    Batch,
+};
+
+// an engine with example/fib.ka loaded, ready to call fib
+class TFib {
+public:
+    explicit TFib(EEngine engine)
+        : Source_{TSource::FromFile(FIB_FILE)}
+        , Nodes_{TParser{Source_}.ParseChunk()}
+    {
+        if (engine == EEngine::Vm) {
+            TBytecodeCompiler compiler;
+            for (const auto& node : Nodes_) {
+                compiler.Generate(*node);
+            }
+            Vm_ = std::make_unique<TVm>(compiler.GetModule());
+        } else {
+            TCodegenVisitor codegen;
+            for (const auto& node : Nodes_) {
+                codegen.Generate(*node);
+            }
+            Jit_ = std::make_unique<TJit>();
+            Jit_->AddModule(codegen.ReleaseModule());
+            JitFib_ = reinterpret_cast<double (*)(double)>(Jit_->Lookup("fib"));
+        }
+    }
+
+    double operator()(double x) {
+        const double args[] = {x};
+        return Vm_ ? Vm_->Call("fib", args) : JitFib_(x);
+    }
+
+private:
+    TSource Source_;
+    std::vector<NAst::TNodePtr<NAst::TNode>> Nodes_;
+    std::unique_ptr<TVm> Vm_;
+    std::unique_ptr<TJit> Jit_;
+    double (*JitFib_)(double) = nullptr;
+};
+
+// from the source file to the first result
+void BM_FibStartup(benchmark::State& state) {
+    const auto engine = static_cast<EEngine>(state.range(0));
+    for (auto _ : state) {
+        TFib fib{engine};
+        benchmark::DoNotOptimize(fib(15));
+    }
+}
+BENCHMARK(BM_FibStartup)->ArgName("engine")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// the run of a loaded function
+void BM_FibRun(benchmark::State& state) {
+    const auto engine = static_cast<EEngine>(state.range(0));
+    TFib fib{engine};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fib(25));
+    }
+    // fib(25) makes 150049 calls
+    state.SetItemsProcessed(state.iterations() * 150049);
+}
+BENCHMARK(BM_FibRun)->ArgName("engine")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// a function of two columns without recursion, like a computed column of a query
+const char* const MODEL_SOURCE =
+    "def clamp(x lo hi) if x < lo then lo else if hi < x then hi else x;"
+    "def model(x y) if x < y then clamp(x * y - 3, 0, 50) else y * y + x * 0.5 - 1;";
+
+constexpr std::size_t MODEL_ROW_COUNT = 1 << 20;
+
+// the model over a million rows: evaluated per row by the VM and the JIT or over batches
+void BM_ModelRows(benchmark::State& state) {
+    const auto engine = static_cast<EEngine>(state.range(0));
+    auto source = TSource::FromString(MODEL_SOURCE);
+    const auto nodes = TParser{source}.ParseChunk();
+
+    std::vector<double> xs(MODEL_ROW_COUNT);
+    std::vector<double> ys(MODEL_ROW_COUNT);
+    for (std::size_t row = 0; row < MODEL_ROW_COUNT; ++row) {
+        xs[row] = static_cast<double>(row % 101) * 0.1;
+        ys[row] = static_cast<double>(row % 97) * 0.1;
+    }
+    const std::span<const double> columns[] = {xs, ys};
+    std::vector<double> results(MODEL_ROW_COUNT);
+
+    if (engine == EEngine::Batch) {
+        TBatchEvaluator evaluator;
+        for (const auto& node : nodes) {
+            evaluator.Add(*node);
+        }
+        for (auto _ : state) {
+            evaluator.Evaluate("model", columns, results);
+            benchmark::DoNotOptimize(results.data());
+        }
+    } else if (engine == EEngine::Vm) {
+        TBytecodeCompiler compiler;
+        for (const auto& node : nodes) {
+            compiler.Generate(*node);
+        }
+        TVm vm{compiler.GetModule()};
+        const std::size_t model = vm.FindFunction("model");
+        for (auto _ : state) {
+            for (std::size_t row = 0; row < MODEL_ROW_COUNT; ++row) {
+                const double args[] = {xs[row], ys[row]};
+                results[row] = vm.Call(model, args);
+            }
+            benchmark::DoNotOptimize(results.data());
+        }
+    } else {
+        TCodegenVisitor codegen;
+        for (const auto& node : nodes) {
+            codegen.Generate(*node);
+        }
+        TJit jit;
+        jit.AddModule(codegen.ReleaseModule());
+        const auto model = reinterpret_cast<double (*)(double, double)>(jit.Lookup("model"));
+        for (auto _ : state) {
+            for (std::size_t row = 0; row < MODEL_ROW_COUNT; ++row) {
+                results[row] = model(xs[row], ys[row]);
+            }
+            benchmark::DoNotOptimize(results.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * MODEL_ROW_COUNT);
+}
+BENCHMARK(BM_ModelRows)->ArgName("engine")->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+} // namespace
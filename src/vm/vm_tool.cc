@@ -0,0 +1,36 @@
+#include <cstdio>
+#include <exception>
+
+#include "bytecode.h"
+#include "parser.h"
+#include "simplify.h"
+#include "vm.h"
+
+// runs the top-level expressions of a source file on the bytecode VM and
+// prints their values, the externs are bound to libm
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Please write the name of the source file\n");
+        return 1;
+    }
+
+    try {
+        auto source = NKaleidoscope::TSource::FromFile(argv[1]);
+        NKaleidoscope::NAst::TArena arena;
+        auto astNodes = NKaleidoscope::TParser{source, &arena}.ParseChunk();
+        NKaleidoscope::NAst::Simplify(astNodes, &arena);
+
+        NKaleidoscope::TBytecodeCompiler compiler;
+        for (auto&& astNode : astNodes) {
+            compiler.Generate(*astNode);
+        }
+        NKaleidoscope::TVm vm{compiler.GetModule()};
+        for (const std::string& function : compiler.GetModule().TopLevelFunctions) {
+            std::printf("%g\n", vm.Run(function));
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "VM failed: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,266 @@
+#include <gtest/gtest.h>
+#include "batch.h"
+#include "batch_kernels.h"
+#include "bytecode.h"
+#include "parser.h"
+#include "vm.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace NKaleidoscope;
+
+namespace {
+
+double Triple(double x) {
+    return 3 * x;
+}
+
+TBytecodeModule Compile(const std::string& text) {
+    auto source = TSource::FromString(text);
+    NAst::TArena arena;
+    TBytecodeCompiler compiler;
+    for (const auto& node : TParser{source, &arena}.ParseChunk()) {
+        compiler.Generate(*node);
+    }
+    return compiler.ReleaseModule();
+}
+
+// the values of the top-level expressions
+std::vector<double> Evaluate(const std::string& text, const TNativeTable& natives = TNativeTable::Math()) {
+    const TBytecodeModule module = Compile(text);
+    TVm vm{module, natives};
+    std::vector<double> results;
+    for (const std::string& function : module.TopLevelFunctions) {
+        results.push_back(vm.Run(function));
+    }
+    return results;
+}
+
+} // namespace
+
+TEST(VmTest, Bytecode) {
+    const TBytecodeModule module = Compile("def f(x y) x * y + 1; f(2, 3);");
+    ASSERT_EQ(module.Functions.size(), 2u);
+    const TBytecodeFunction& f = module.Functions[0];
+    EXPECT_EQ(f.Name, "f");
+    EXPECT_EQ(f.ArgCount, 2);
+    EXPECT_EQ(f.RegisterCount, 4);
+    const std::vector<EOpCode> ops = {EOpCode::Multiply, EOpCode::Constant, EOpCode::Add, EOpCode::Return};
+    ASSERT_EQ(f.Code.size(), ops.size());
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        EXPECT_EQ(f.Code[i].Op, ops[i]) << i;
+    }
+    EXPECT_EQ(f.Constants, std::vector<double>{1});
+    EXPECT_EQ(module.TopLevelFunctions, std::vector<std::string>{"__anon_expr0"});
+}
+
+TEST(VmTest, Evaluate) {
+    const auto results = Evaluate(
+        "def fib(x) if x < 3 then 1 else fib(x - 1) + fib(x - 2);"
+        "def max(a b) if b < a then a else b;"
+        "def binary| 5 (a b) if a then 1 else if b then 1 else 0;"
+        "def nested(x) max(x, fib(max(x - 10, 2))) * (x - 1) - 2;"
+        "fib(20);"
+        "max(3, 7) + max(7, 3);"
+        "0 < 1 | 2 < 1;"
+        "(1 < 0) | (2 < 1);"
+        "nested(15);"
+        "if 0.5 then 2 else 3;"
+        "7;");
+    EXPECT_EQ(results, (std::vector<double>{6765, 14, 1, 0, 15 * 14 - 2, 2, 7}));
+}
+
+TEST(VmTest, NaN) {
+    // inf - inf is NaN: it is less than anything and it is false, like in the generated code
+    const std::string inf = "1" + std::string(400, '0');
+    const auto results = Evaluate(
+        "def g(x) x < 1;"
+        "def nan() " + inf + " - " + inf + ";"
+        "g(nan());"
+        "1 < nan();"
+        "if nan() then 2 else 3;"
+        "if 0 * (0 - 1) then 2 else 3;");
+    EXPECT_EQ(results, (std::vector<double>{1, 1, 3, 3}));
+}
+
+TEST(VmTest, Natives) {
+    TNativeTable natives = TNativeTable::Math();
+    natives.Add("triple", &Triple);
+    const auto results = Evaluate(
+        "extern sin(x); extern pow(x y); extern triple(x);"
+        "def f(x) triple(sin(x)) + pow(x, 2);"
+        "f(1);",
+        natives);
+    EXPECT_EQ(results, std::vector<double>{3 * std::sin(1.0) + 1});
+
+    // a module is checked against the natives when it is loaded
+    const TBytecodeModule module = Compile("extern triple(x); extern sin(x y);");
+    EXPECT_THROW((TVm{module}), std::runtime_error);
+    const TBytecodeModule tooManyArgs = Compile("extern sin(x y);");
+    EXPECT_THROW((TVm{tooManyArgs}), std::runtime_error);
+}
+
+TEST(VmTest, Call) {
+    const TBytecodeModule module = Compile("extern sqrt(x); def hypot(a b) sqrt(a * a + b * b);");
+    TVm vm{module};
+    EXPECT_EQ(vm.Call("hypot", std::vector<double>{3, 4}), 5);
+    EXPECT_EQ(vm.Call("sqrt", std::vector<double>{9}), 3);
+    EXPECT_THROW(vm.Call("hypot", std::vector<double>{3}), std::runtime_error);
+    EXPECT_THROW(vm.Run("missing"), std::runtime_error);
+}
+
+TEST(VmTest, DeepCode) {
+    // neither the compiler nor the calls use the native stack
+    constexpr int depth = 100'000;
+    std::string text = "extern fabs(x); def f(x) ";
+    for (int i = 0; i < depth; ++i) {
+        text += i % 3 == 0 ? "(x + " : i % 3 == 1 ? "fabs(" : "if x then ";
+    }
+    text += "x";
+    for (int i = depth - 1; i >= 0; --i) {
+        text += i % 3 == 0 ? ")" : i % 3 == 1 ? ")" : " else 2";
+    }
+    EXPECT_EQ(Evaluate(text + "; f(1);"), std::vector<double>{1 + (depth + 2) / 3});
+
+    const std::string count = "def count(x) if x < 1 then 0 else 1 + count(x - 1);";
+    EXPECT_EQ(Evaluate(count + "count(500000);"), std::vector<double>{500000});
+    EXPECT_THROW(Evaluate(count + "count(2000000);"), std::runtime_error);
+}
+
+TEST(VmTest, Errors) {
+    const auto expectError = [](const std::string& text, std::string_view message) {
+        try {
+            Compile(text);
+            ADD_FAILURE() << "No error for " << text;
+        } catch (const std::runtime_error& e) {
+            EXPECT_EQ(e.what(), message);
+        }
+    };
+    expectError("def g(x) h(x);", "Unknown function \"h\"");
+    expectError("def f(x) x; def g(x) f(x, x);", "Incorrect number of arguments");
+    expectError("def g(x) y;", "Expected known named value, found \"y\"");
+    expectError("def f(x) x; def f(y) y;", "Can't redefine function \"f\"");
+
+    // a failed expression or function leaves nothing behind
+    auto source = TSource::FromString("def f(x) x; f(y); f(2); def g(x) y; def h(x) x + 1; h(3);");
+    const auto nodes = TParser{source}.ParseChunk();
+    TBytecodeCompiler compiler;
+    compiler.Generate(*nodes[0]);
+    EXPECT_THROW(compiler.Generate(*nodes[1]), std::runtime_error);
+    compiler.Generate(*nodes[2]);
+    EXPECT_THROW(compiler.Generate(*nodes[3]), std::runtime_error);
+    compiler.Generate(*nodes[4]);
+    compiler.Generate(*nodes[5]);
+    for (const TBytecodeFunction& function : compiler.GetModule().Functions) {
+        EXPECT_NE(function.Name, "g");
+    }
+    TVm vm{compiler.GetModule()};
+    EXPECT_EQ(compiler.GetModule().TopLevelFunctions, (std::vector<std::string>{"__anon_expr1", "__anon_expr2"}));
+    EXPECT_EQ(vm.Run("__anon_expr1"), 2);
+    EXPECT_EQ(vm.Run("__anon_expr2"), 4);
+}
+
+TEST(VmTest, BatchBackendsAgree) {
+    // every pair of special values at every position of the SIMD blocks
+    const std::vector<double> special = {0.0, -0.0, 1.0, -2.5, 1e300, NAN, INFINITY, -INFINITY};
+    std::vector<double> lhs;
+    std::vector<double> rhs;
+    for (double a : special) {
+        for (double b : special) {
+            lhs.push_back(a);
+            rhs.push_back(b);
+        }
+    }
+
+    const auto same = [](const std::vector<double>& x, const std::vector<double>& y) {
+        return std::memcmp(x.data(), y.data(), x.size() * sizeof(double)) == 0;
+    };
+    const TBatchKernels& scalar = GetBatchKernels(EBatchBackend::Scalar);
+    for (auto backend : {EBatchBackend::Sse2, EBatchBackend::Avx2}) {
+        if (!IsBatchBackendSupported(backend)) {
+            continue;
+        }
+        const TBatchKernels& kernels = GetBatchKernels(backend);
+        for (auto kernel : {&TBatchKernels::Add, &TBatchKernels::Subtract, &TBatchKernels::Multiply,
+                            &TBatchKernels::Less}) {
+            for (std::size_t offset = 0; offset < 4; ++offset) {
+                const std::size_t count = lhs.size() - offset;
+                std::vector<double> expected(count);
+                std::vector<double> result(count);
+                (scalar.*kernel)(lhs.data() + offset, rhs.data() + offset, expected.data(), count);
+                (kernels.*kernel)(lhs.data() + offset, rhs.data() + offset, result.data(), count);
+                EXPECT_TRUE(same(result, expected)) << "offset " << offset;
+            }
+        }
+    }
+}
+
+TEST(VmTest, BatchEvaluate) {
+    auto source = TSource::FromString(
+        "extern sin(x);"
+        "def binary| 5 (a b) if a then 1 else if b then 1 else 0;"
+        "def fib(x) if x < 3 then 1 else fib(x - 1) + fib(x - 2);"
+        "def clamp(x lo hi) if x < lo then lo else if hi < x then hi else x;"
+        "def model(x y) if x < 0 | y < 0 then sin(x) * y else clamp(x * y - 3, 0, 50) + fib(clamp(x, 1, 15));"
+        "def ten(x) 10;");
+    NAst::TArena arena;
+    const auto nodes = TParser{source, &arena}.ParseChunk();
+
+    TBatchEvaluator evaluator;
+    TBytecodeCompiler compiler;
+    for (const auto& node : nodes) {
+        evaluator.Add(*node);
+        compiler.Generate(*node);
+    }
+    TVm vm{compiler.GetModule()};
+
+    // more rows than a batch, the last batch isn't full
+    const std::size_t rowCount = TBatchEvaluator::BATCH_SIZE * 2 + 123;
+    std::vector<double> xs;
+    std::vector<double> ys;
+    for (std::size_t row = 0; row < rowCount; ++row) {
+        xs.push_back(static_cast<double>(row % 23) - 5.5);
+        ys.push_back(row % 5 == 0 ? NAN : static_cast<double>(row % 11) - 2);
+    }
+    const std::span<const double> columns[] = {xs, ys};
+
+    const auto check = [&](std::string_view function, std::size_t argCount) {
+        std::vector<double> results(rowCount);
+        evaluator.Evaluate(function, std::span{columns, argCount}, results);
+        for (std::size_t row = 0; row < rowCount; ++row) {
+            const double args[] = {xs[row], ys[row]};
+            const double expected = vm.Call(function, std::span{args, argCount});
+            if (std::isnan(expected)) {
+                EXPECT_TRUE(std::isnan(results[row])) << function << " row " << row;
+            } else {
+                EXPECT_DOUBLE_EQ(results[row], expected) << function << " row " << row;
+            }
+        }
+    };
+    check("model", 2);
+    check("binary|", 2);
+    check("fib", 1);
+    check("sin", 1);
+    check("ten", 1);
+
+    std::vector<double> results(rowCount);
+    EXPECT_THROW(evaluator.Evaluate("model", std::span{columns, 1}, results), std::runtime_error);
+    EXPECT_THROW(evaluator.Evaluate("missing", {}, results), std::runtime_error);
+    results.pop_back();
+    EXPECT_THROW(evaluator.Evaluate("model", columns, results), std::runtime_error);
+    EXPECT_THROW(evaluator.Add(*TParser{source, &arena}.ParseChunk()[2]), std::runtime_error);
+
+    // a failed item leaves nothing behind, the next ones can be evaluated
+    auto nextSource = TSource::FromString("def f(x) y; def g(x) x + 1; g(1);");
+    const auto next = TParser{nextSource, &arena}.ParseChunk();
+    EXPECT_THROW(evaluator.Add(*next[0]), std::runtime_error);
+    EXPECT_THROW(evaluator.Add(*next[2]), std::runtime_error);
+    evaluator.Add(*next[1]);
+    results.resize(rowCount);
+    evaluator.Evaluate("g", std::span{columns, 1}, results);
+    for (std::size_t row = 0; row < rowCount; ++row) {
+        EXPECT_EQ(results[row], xs[row] + 1) << "row " << row;
+    }
+    EXPECT_THROW(evaluator.Evaluate("f", std::span{columns, 1}, results), std::runtime_error);
+}